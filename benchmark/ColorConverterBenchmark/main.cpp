@@ -0,0 +1,253 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include "ColorConverter.h"
+
+extern "C"
+{
+    #include <libswscale/swscale.h>
+}
+
+
+
+/// Conversion to check and benchmark.
+struct Conversion
+{
+    /// Name.
+    const char* name;
+    /// Source format.
+    cr::video::Fourcc src;
+    /// Destination format.
+    cr::video::Fourcc dst;
+    /// Source libav format.
+    AVPixelFormat avSrc;
+    /// Destination libav format.
+    AVPixelFormat avDst;
+};
+
+
+
+/// Frame size for given format.
+int frameSize(cr::video::Fourcc fourcc, int width, int height)
+{
+    switch (fourcc)
+    {
+    case cr::video::Fourcc::BGR24: [[fallthrough]];
+    case cr::video::Fourcc::RGB24: return width * height * 3;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY: return width * height * 2;
+    default: return width * height * 3 / 2;
+    }
+}
+
+
+
+/// Fill libav plane pointers of tightly packed frame.
+void planes(cr::video::Frame& frame, uint8_t* data[4], int linesize[4])
+{
+    int width = frame.width;
+    int ySize = width * frame.height;
+    for (int i = 0; i < 4; ++i)
+    {
+        data[i] = nullptr;
+        linesize[i] = 0;
+    }
+    data[0] = frame.data;
+    switch (frame.fourcc)
+    {
+    case cr::video::Fourcc::BGR24: [[fallthrough]];
+    case cr::video::Fourcc::RGB24:
+        linesize[0] = width * 3;
+        break;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY:
+        linesize[0] = width * 2;
+        break;
+    case cr::video::Fourcc::YU12:
+        linesize[0] = width;
+        data[1] = frame.data + ySize;
+        data[2] = frame.data + ySize + ySize / 4;
+        linesize[1] = linesize[2] = width / 2;
+        break;
+    default:
+        linesize[0] = width;
+        data[1] = frame.data + ySize;
+        linesize[1] = width;
+        break;
+    }
+}
+
+
+
+/// Average time of one call in milliseconds.
+template <typename F>
+double measure(int iterations, F function)
+{
+    function();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        function();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    int width = 1920;
+    int height = 1080;
+    int iterations = 100;
+    if (argc > 2)
+    {
+        width = std::atoi(argv[1]);
+        height = std::atoi(argv[2]);
+    }
+    if (argc > 3)
+    {
+        iterations = std::atoi(argv[3]);
+    }
+
+    std::cout << "Color converter benchmark " << width << "x" << height
+              << ", " << iterations << " iterations" << std::endl;
+
+    const Conversion conversions[] =
+    {
+        {"YU12 -> BGR24", cr::video::Fourcc::YU12, cr::video::Fourcc::BGR24, AV_PIX_FMT_YUV420P, AV_PIX_FMT_BGR24},
+        {"NV12 -> BGR24", cr::video::Fourcc::NV12, cr::video::Fourcc::BGR24, AV_PIX_FMT_NV12, AV_PIX_FMT_BGR24},
+        {"NV21 -> RGB24", cr::video::Fourcc::NV21, cr::video::Fourcc::RGB24, AV_PIX_FMT_NV21, AV_PIX_FMT_RGB24},
+        {"BGR24 -> YU12", cr::video::Fourcc::BGR24, cr::video::Fourcc::YU12, AV_PIX_FMT_BGR24, AV_PIX_FMT_YUV420P},
+        {"RGB24 -> NV12", cr::video::Fourcc::RGB24, cr::video::Fourcc::NV12, AV_PIX_FMT_RGB24, AV_PIX_FMT_NV12},
+        {"BGR24 -> NV21", cr::video::Fourcc::BGR24, cr::video::Fourcc::NV21, AV_PIX_FMT_BGR24, AV_PIX_FMT_NV21},
+        {"BGR24 -> RGB24", cr::video::Fourcc::BGR24, cr::video::Fourcc::RGB24, AV_PIX_FMT_BGR24, AV_PIX_FMT_RGB24},
+        {"NV12 -> YU12", cr::video::Fourcc::NV12, cr::video::Fourcc::YU12, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P},
+        {"YUYV -> YU12", cr::video::Fourcc::YUYV, cr::video::Fourcc::YU12, AV_PIX_FMT_YUYV422, AV_PIX_FMT_YUV420P},
+        {"UYVY -> YU12", cr::video::Fourcc::UYVY, cr::video::Fourcc::YU12, AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUV420P},
+    };
+
+    const ColorConverterIsa isas[] =
+    {
+        ColorConverterIsa::SCALAR, ColorConverterIsa::SSE41,
+        ColorConverterIsa::AVX2, ColorConverterIsa::NEON
+    };
+
+    // Bit-exactness of kernels is checked by ColorConverterTest.
+    std::mt19937 random(12345);
+
+    for (const Conversion &conversion : conversions)
+    {
+        std::cout << std::endl << conversion.name << std::endl;
+
+        cr::video::Frame src(width, height, conversion.src, frameSize(conversion.src, width, height));
+        for (int i = 0; i < src.size; ++i)
+        {
+            src.data[i] = static_cast<uint8_t>(random());
+        }
+        cr::video::Frame dst(width, height, conversion.dst, frameSize(conversion.dst, width, height));
+
+        for (ColorConverterIsa isa : isas)
+        {
+            ColorConverter converter;
+            if (!converter.setIsa(isa))
+            {
+                continue;
+            }
+            double time = measure(iterations, [&]{ converter.convert(src, dst); });
+            std::cout << std::setw(16) << ColorConverter::getIsaName(isa) << ": "
+                      << std::fixed << std::setprecision(3) << time << " ms" << std::endl;
+        }
+
+        // Reference libav software scaler with same size (as used by decoder before).
+        const int flags[] = {SWS_BILINEAR, SWS_BICUBIC};
+        const char* flagNames[] = {"swscale bilinear", "swscale bicubic"};
+        for (int i = 0; i < 2; ++i)
+        {
+            SwsContext *ctx = sws_getContext(width, height, conversion.avSrc,
+                                             width, height, conversion.avDst, flags[i], NULL, NULL, NULL);
+            if (!ctx)
+            {
+                continue;
+            }
+            uint8_t *srcData[4], *dstData[4];
+            int srcLinesize[4], dstLinesize[4];
+            planes(src, srcData, srcLinesize);
+            planes(dst, dstData, dstLinesize);
+            double time = measure(iterations, [&]{
+                sws_scale(ctx, srcData, srcLinesize, 0, height, dstData, dstLinesize); });
+            std::cout << std::setw(16) << flagNames[i] << ": "
+                      << std::fixed << std::setprecision(3) << time << " ms" << std::endl;
+            sws_freeContext(ctx);
+        }
+    }
+
+    // Downscaling of YU12 frame to ladder of 2/3, 1/3 and 1/4 sizes in one
+    // pass compared with libswscale (bilinear) per rendition.
+    std::cout << std::endl << "YU12 -> YU12 ladder (2/3, 1/3, 1/4)" << std::endl;
+    {
+        int w = width;
+        int h = height;
+        cr::video::Frame src(w, h, cr::video::Fourcc::YU12, frameSize(cr::video::Fourcc::YU12, w, h));
+        for (int i = 0; i < src.size; ++i)
+        {
+            src.data[i] = static_cast<uint8_t>(random());
+        }
+
+        const int ladder[][2] = {{w * 2 / 3 / 2 * 2, h * 2 / 3 / 2 * 2}, {w / 3 / 2 * 2, h / 3 / 2 * 2},
+                                 {w / 4 / 2 * 2, h / 4 / 2 * 2}};
+        std::vector<cr::video::Frame> result;
+        for (const auto &rendition : ladder)
+        {
+            int size = frameSize(cr::video::Fourcc::YU12, rendition[0], rendition[1]);
+            result.emplace_back(rendition[0], rendition[1], cr::video::Fourcc::YU12, size);
+        }
+        cr::video::Frame* resultFrames[3] = {&result[0], &result[1], &result[2]};
+
+        for (ColorConverterIsa isa : isas)
+        {
+            ColorConverter converter;
+            if (!converter.setIsa(isa))
+            {
+                continue;
+            }
+            double time = measure(iterations, [&]{ converter.downscale(src, resultFrames, 3); });
+            std::cout << std::setw(16) << ColorConverter::getIsaName(isa) << ": "
+                      << std::fixed << std::setprecision(3) << time << " ms" << std::endl;
+        }
+
+        std::vector<SwsContext*> contexts;
+        for (const auto &rendition : ladder)
+        {
+            contexts.push_back(sws_getContext(w, h, AV_PIX_FMT_YUV420P, rendition[0], rendition[1],
+                                              AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL));
+        }
+        uint8_t *srcData[4];
+        int srcLinesize[4];
+        planes(src, srcData, srcLinesize);
+        double time = measure(iterations, [&]
+        {
+            for (size_t i = 0; i < contexts.size(); ++i)
+            {
+                uint8_t *dstData[4];
+                int dstLinesize[4];
+                planes(result[i], dstData, dstLinesize);
+                if (contexts[i])
+                {
+                    sws_scale(contexts[i], srcData, srcLinesize, 0, h, dstData, dstLinesize);
+                }
+            }
+        });
+        std::cout << std::setw(16) << "swscale bilinear" << ": "
+                  << std::fixed << std::setprecision(3) << time << " ms" << std::endl;
+        for (SwsContext *ctx : contexts)
+        {
+            sws_freeContext(ctx);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,423 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include "VideoCodec.h"
+
+
+
+/// Synthetic content type.
+enum class Content
+{
+    /// Diagonal gradient moving by 4 pixels per frame.
+    GRADIENT = 0,
+    /// Moving gradient with random noise (worst case for encoder).
+    NOISE,
+    /// The same picture in every frame.
+    STATIC
+};
+
+
+
+/// Codec configuration to benchmark.
+struct Config
+{
+    /// Name.
+    const char* name;
+    /// Codec type.
+    cr::video::Fourcc fourcc;
+    /// Threading enabled.
+    bool threads;
+};
+
+
+
+/// Results of one benchmark case.
+struct Result
+{
+    /// Configuration.
+    Config config;
+    /// Content type.
+    Content content;
+    /// Frame width.
+    int width{0};
+    /// Frame height.
+    int height{0};
+    /// Encoding times of frames, ms.
+    std::vector<double> encodeTimes;
+    /// Decoding times of frames, ms.
+    std::vector<double> decodeTimes;
+    /// Total size of encoded frames, bytes.
+    long long totalBytes{0};
+    /// Sum of PSNR of decoded frames, dB.
+    double totalPsnr{0.0};
+    /// Number of decoded frames compared with source.
+    int decodedFrames{0};
+    /// Number of failed encode / decode calls.
+    int errors{0};
+};
+
+
+
+/// Content type name.
+const char* contentName(Content content)
+{
+    switch (content)
+    {
+    case Content::GRADIENT: return "gradient";
+    case Content::NOISE: return "noise";
+    default: return "static";
+    }
+}
+
+
+
+/// Codec type name.
+const char* fourccName(cr::video::Fourcc fourcc)
+{
+    switch (fourcc)
+    {
+    case cr::video::Fourcc::H264: return "H264";
+    case cr::video::Fourcc::HEVC: return "HEVC";
+    default: return "JPEG";
+    }
+}
+
+
+
+/// Generate deterministic YU12 frame of synthetic content.
+void generateFrame(cr::video::Frame& frame, Content content, int index)
+{
+    int width = frame.width;
+    int height = frame.height;
+    int shift = content == Content::STATIC ? 0 : index * 4;
+    uint8_t *y = frame.data;
+    uint8_t *u = y + width * height;
+    uint8_t *v = u + width * height / 4;
+
+    // Xorshift generator seeded by frame index, so runs are repeatable.
+    uint32_t state = 2463534242u + static_cast<uint32_t>(index) * 2654435761u;
+    for (int row = 0; row < height; ++row)
+    {
+        for (int col = 0; col < width; ++col)
+        {
+            int value = ((col + shift) * 255 / width + row * 255 / height) / 2;
+            // Static scene has sharp details of 16x16 checker board.
+            if (content == Content::STATIC && ((col / 16 + row / 16) & 1))
+            {
+                value = 255 - value;
+            }
+            if (content == Content::NOISE)
+            {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                value += static_cast<int>(state % 33) - 16;
+            }
+            y[row * width + col] = static_cast<uint8_t>(std::min(235, std::max(16, value)));
+        }
+    }
+    for (int row = 0; row < height / 2; ++row)
+    {
+        for (int col = 0; col < width / 2; ++col)
+        {
+            u[row * width / 2 + col] = static_cast<uint8_t>(64 + ((col * 2 + shift) % width) * 128 / width);
+            v[row * width / 2 + col] = static_cast<uint8_t>(64 + row * 2 * 128 / height);
+        }
+    }
+}
+
+
+
+/// PSNR of two YU12 frames, dB. Identical frames give 100 dB.
+double psnr(const cr::video::Frame& a, const cr::video::Frame& b)
+{
+    int size = a.width * a.height * 3 / 2;
+    double sum = 0.0;
+    for (int i = 0; i < size; ++i)
+    {
+        int diff = static_cast<int>(a.data[i]) - static_cast<int>(b.data[i]);
+        sum += diff * diff;
+    }
+    if (sum == 0.0)
+    {
+        return 100.0;
+    }
+    return 10.0 * std::log10(255.0 * 255.0 * size / sum);
+}
+
+
+
+/// Percentile of values (nearest rank).
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+
+
+/// Time of call in milliseconds.
+template <typename F>
+double measure(F function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+
+/// Compare decoded frame with source frame.
+void compare(Result& result, std::vector<cr::video::Frame>& sources, cr::video::Frame& decoded)
+{
+    if (result.decodedFrames < static_cast<int>(sources.size()))
+    {
+        result.totalPsnr += psnr(sources[result.decodedFrames], decoded);
+    }
+    ++result.decodedFrames;
+}
+
+
+
+/// Encode and decode frames with given configuration.
+Result run(const Config& config, Content content, int width, int height, int numFrames)
+{
+    Result result;
+    result.config = config;
+    result.content = content;
+    result.width = width;
+    result.height = height;
+
+    VideoCodec encoder;
+    VideoCodec decoder;
+    if (config.fourcc == cr::video::Fourcc::JPEG)
+    {
+        encoder.setParam(VideoCodecParam::JPEG_QUALITY, 80);
+        encoder.setParam(VideoCodecParam::JPEG_THREADS, config.threads ? 0 : 1);
+    }
+    else
+    {
+        encoder.setParam(VideoCodecParam::THREAD_MODE, static_cast<float>(
+                         config.threads ? VideoCodecThreadMode::SLICE : VideoCodecThreadMode::SINGLE));
+        encoder.setParam(VideoCodecParam::NUM_THREADS, 0);
+    }
+    decoder.setParam(VideoCodecParam::DECODER_THREADS, config.threads ? 0 : 1);
+    if (config.threads)
+    {
+        // Frame and slice threads: best throughput, output is delayed.
+        decoder.setParam(VideoCodecParam::DECODER_THREAD_TYPE, 3);
+    }
+
+    // Frames are generated before measurement.
+    std::vector<cr::video::Frame> sources;
+    sources.reserve(numFrames);
+    for (int i = 0; i < numFrames; ++i)
+    {
+        sources.emplace_back(width, height, cr::video::Fourcc::YU12);
+        generateFrame(sources.back(), content, i);
+    }
+
+    cr::video::Frame packet(width, height, config.fourcc);
+    cr::video::Frame decoded(width, height, cr::video::Fourcc::YU12);
+    for (int i = 0; i < numFrames; ++i)
+    {
+        bool encoded = false;
+        result.encodeTimes.push_back(measure([&]{ encoded = encoder.encode(sources[i], packet); }));
+        if (!encoded)
+        {
+            ++result.errors;
+            continue;
+        }
+        result.totalBytes += packet.size;
+
+        // Frame threads of decoder return frames with delay.
+        bool ready = false;
+        result.decodeTimes.push_back(measure([&]{ ready = decoder.decode(packet, decoded); }));
+        if (ready)
+        {
+            compare(result, sources, decoded);
+        }
+        while (decoder.receiveFrame(decoded))
+        {
+            compare(result, sources, decoded);
+        }
+    }
+    decoder.flushDecoder();
+    while (decoder.receiveFrame(decoded))
+    {
+        compare(result, sources, decoded);
+    }
+    // Each encoded frame must be decoded.
+    int encodedFrames = static_cast<int>(result.decodeTimes.size());
+    if (result.decodedFrames != encodedFrames)
+    {
+        result.errors += std::abs(encodedFrames - result.decodedFrames);
+    }
+
+    return result;
+}
+
+
+
+/// Throughput in frames per second.
+double fps(const std::vector<double>& times)
+{
+    double total = 0.0;
+    for (double time : times)
+    {
+        total += time;
+    }
+    return total > 0.0 ? times.size() * 1000.0 / total : 0.0;
+}
+
+
+
+/// Write timing statistics as JSON object.
+void writeTimes(std::ostream& out, const std::vector<double>& times)
+{
+    out << "{\"fps\": " << fps(times)
+        << ", \"p50_ms\": " << percentile(times, 0.5)
+        << ", \"p99_ms\": " << percentile(times, 0.99)
+        << ", \"p999_ms\": " << percentile(times, 0.999) << "}";
+}
+
+
+
+/// Write all results as JSON.
+void writeJson(std::ostream& out, const std::vector<Result>& results, int numFrames)
+{
+    out << std::fixed << std::setprecision(3);
+    out << "{" << std::endl;
+    out << "  \"version\": \"" << VideoCodec::getVersion() << "\"," << std::endl;
+    out << "  \"frames\": " << numFrames << "," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &result = results[i];
+        int encodedFrames = static_cast<int>(result.decodeTimes.size());
+        out << "    {\"codec\": \"" << fourccName(result.config.fourcc) << "\""
+            << ", \"threads\": " << (result.config.threads ? "true" : "false")
+            << ", \"content\": \"" << contentName(result.content) << "\""
+            << ", \"width\": " << result.width
+            << ", \"height\": " << result.height
+            << ", \"encode\": ";
+        writeTimes(out, result.encodeTimes);
+        out << ", \"decode\": ";
+        writeTimes(out, result.decodeTimes);
+        out << ", \"bytes_per_frame\": " << (encodedFrames > 0 ? static_cast<double>(result.totalBytes) / encodedFrames : 0.0)
+            << ", \"psnr_db\": " << (result.decodedFrames > 0 ? result.totalPsnr / result.decodedFrames : 0.0)
+            << ", \"errors\": " << result.errors << "}"
+            << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    int numFrames = 120;
+    std::string outputFile = "VideoCodecBenchmark.json";
+    std::vector<std::pair<int, int>> sizes = {{640, 360}, {1280, 720}, {1920, 1080}};
+    if (argc > 1)
+    {
+        numFrames = std::max(1, std::atoi(argv[1]));
+    }
+    if (argc > 2)
+    {
+        outputFile = argv[2];
+    }
+    if (argc > 3)
+    {
+        sizes.clear();
+        for (int i = 3; i < argc; ++i)
+        {
+            int width = 0;
+            int height = 0;
+            char separator = 0;
+            std::istringstream size(argv[i]);
+            if (!(size >> width >> separator >> height) || separator != 'x' || width < 2 || height < 2)
+            {
+                std::cout << "Invalid frame size " << argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+                return 1;
+            }
+            sizes.push_back({width & ~1, height & ~1});
+        }
+    }
+
+    std::cout << "VideoCodec benchmark v" << VideoCodec::getVersion() << ", "
+              << numFrames << " frames per case" << std::endl;
+
+    const Config configs[] =
+    {
+        {"H264", cr::video::Fourcc::H264, false},
+        {"H264 threads", cr::video::Fourcc::H264, true},
+        {"HEVC", cr::video::Fourcc::HEVC, false},
+        {"HEVC threads", cr::video::Fourcc::HEVC, true},
+        {"JPEG", cr::video::Fourcc::JPEG, false},
+        {"JPEG threads", cr::video::Fourcc::JPEG, true},
+    };
+    const Content contents[] = {Content::GRADIENT, Content::NOISE, Content::STATIC};
+
+    std::vector<Result> results;
+    int numErrors = 0;
+    for (const auto &size : sizes)
+    {
+        std::cout << std::endl << size.first << "x" << size.second << std::endl;
+        std::cout << std::setw(14) << "codec" << std::setw(10) << "content"
+                  << std::setw(10) << "enc fps" << std::setw(10) << "enc p99"
+                  << std::setw(10) << "dec fps" << std::setw(10) << "dec p99"
+                  << std::setw(12) << "bytes" << std::setw(8) << "PSNR" << std::endl;
+        for (const Config &config : configs)
+        {
+            for (Content content : contents)
+            {
+                Result result = run(config, content, size.first, size.second, numFrames);
+                int encodedFrames = static_cast<int>(result.decodeTimes.size());
+                std::cout << std::fixed << std::setprecision(2)
+                          << std::setw(14) << config.name << std::setw(10) << contentName(content)
+                          << std::setw(10) << fps(result.encodeTimes)
+                          << std::setw(10) << percentile(result.encodeTimes, 0.99)
+                          << std::setw(10) << fps(result.decodeTimes)
+                          << std::setw(10) << percentile(result.decodeTimes, 0.99)
+                          << std::setw(12) << std::setprecision(0)
+                          << (encodedFrames > 0 ? static_cast<double>(result.totalBytes) / encodedFrames : 0.0)
+                          << std::setw(8) << std::setprecision(2)
+                          << (result.decodedFrames > 0 ? result.totalPsnr / result.decodedFrames : 0.0);
+                if (result.errors > 0)
+                {
+                    std::cout << "  ERRORS: " << result.errors;
+                }
+                std::cout << std::endl;
+                numErrors += result.errors;
+                results.push_back(std::move(result));
+            }
+        }
+    }
+
+    std::ofstream file(outputFile);
+    if (!file.is_open())
+    {
+        std::cout << "Can't open output file " << outputFile << std::endl;
+        return 1;
+    }
+    writeJson(file, results, numFrames);
+    std::cout << std::endl << "Results are written to " << outputFile << std::endl;
+
+    return numErrors == 0 ? 0 : 1;
+}
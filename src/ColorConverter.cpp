@@ -0,0 +1,1429 @@
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include "ColorConverter.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define COLOR_CONVERTER_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define COLOR_CONVERTER_TARGET(isa)
+    #else
+        #define COLOR_CONVERTER_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define COLOR_CONVERTER_NEON
+    #include <arm_neon.h>
+#endif
+
+
+
+/*
+ * BT.601 limited range, 6 bit (YUV to RGB) and 8 bit (RGB to YUV) fixed point
+ * coefficients. Intermediate values of YUV to RGB fit int16, only blue channel
+ * may saturate and in this case result is clamped to 255 anyway. This keeps
+ * SIMD kernels bit-exact with scalar code.
+ */
+
+
+
+static inline uint8_t clampByte(int value)
+{
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+
+
+static void yuvToBgrRowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                              int uvStep, uint8_t* dst, int width, bool rgb)
+{
+    int bIndex = rgb ? 2 : 0;
+    int rIndex = rgb ? 0 : 2;
+    for (int x = 0; x < width; ++x)
+    {
+        int y1 = (y[x] - 16) * 74;
+        int cu = u[(x >> 1) * uvStep] - 128;
+        int cv = v[(x >> 1) * uvStep] - 128;
+        dst[bIndex] = clampByte((y1 + 129 * cu + 32) >> 6);
+        dst[1] = clampByte((y1 - 25 * cu - 52 * cv + 32) >> 6);
+        dst[rIndex] = clampByte((y1 + 102 * cv + 32) >> 6);
+        dst += 3;
+    }
+}
+
+
+
+static void bgrToYuvRowScalar(const uint8_t* src0, const uint8_t* src1,
+                              uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                              int uvStep, int width, bool rgb)
+{
+    int bIndex = rgb ? 2 : 0;
+    int rIndex = rgb ? 0 : 2;
+    for (int x = 0; x < width; x += 2)
+    {
+        const uint8_t* p[4] = {src0, src0 + 3, src1, src1 + 3};
+        uint8_t* py[4] = {y0 + x, y0 + x + 1, y1 + x, y1 + x + 1};
+        int sumB = 0, sumG = 0, sumR = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            int b = p[i][bIndex];
+            int g = p[i][1];
+            int r = p[i][rIndex];
+            *py[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            sumB += b;
+            sumG += g;
+            sumR += r;
+        }
+
+        // Chroma of averaged 2x2 block
+        int b = (sumB + 2) >> 2;
+        int g = (sumG + 2) >> 2;
+        int r = (sumR + 2) >> 2;
+        u[(x >> 1) * uvStep] = clampByte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[(x >> 1) * uvStep] = clampByte(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+
+        src0 += 6;
+        src1 += 6;
+    }
+}
+
+
+
+static void yuyvToYuvRowScalar(const uint8_t* src0, const uint8_t* src1,
+                               uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                               int width, bool uyvy)
+{
+    int yOffset = uyvy ? 1 : 0;
+    int uOffset = uyvy ? 0 : 1;
+    int vOffset = uyvy ? 2 : 3;
+    for (int x = 0; x < width; x += 2)
+    {
+        y0[x] = src0[yOffset];
+        y0[x + 1] = src0[yOffset + 2];
+        y1[x] = src1[yOffset];
+        y1[x + 1] = src1[yOffset + 2];
+        u[x >> 1] = static_cast<uint8_t>((src0[uOffset] + src1[uOffset] + 1) >> 1);
+        v[x >> 1] = static_cast<uint8_t>((src0[vOffset] + src1[vOffset] + 1) >> 1);
+        src0 += 4;
+        src1 += 4;
+    }
+}
+
+
+
+static void swapRbRowScalar(const uint8_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        uint8_t b = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = b;
+        src += 3;
+        dst += 3;
+    }
+}
+
+
+
+static void splitUvRowScalar(const uint8_t* uv, uint8_t* u, uint8_t* v, int count)
+{
+    for (int x = 0; x < count; ++x)
+    {
+        u[x] = uv[2 * x];
+        v[x] = uv[2 * x + 1];
+    }
+}
+
+
+
+static void halveRowScalar(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        dst[x] = static_cast<uint8_t>((src0[2 * x] + src0[2 * x + 1] + src1[2 * x] + src1[2 * x + 1] + 2) >> 2);
+    }
+}
+
+
+
+static void blendRowScalar(const uint8_t* src0, const uint8_t* src1, uint8_t* dst,
+                           int width, int weight)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        dst[x] = static_cast<uint8_t>((src0[x] * (256 - weight) + src1[x] * weight + 128) >> 8);
+    }
+}
+
+
+
+/**
+ * @brief Horizontal bilinear interpolation of row by table of source
+ * positions and weights (0..256, position + 1 is always inside row). Gather
+ * of source pixels doesn't fit SIMD kernels.
+ */
+static void resampleRow(const uint8_t* src, uint8_t* dst, const int* table, int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        int pos = table[2 * x];
+        int weight = table[2 * x + 1];
+        dst[x] = static_cast<uint8_t>((src[pos] * (256 - weight) + src[pos + 1] * weight + 128) >> 8);
+    }
+}
+
+
+
+#ifdef COLOR_CONVERTER_X86
+
+/**
+ * @brief Shuffle masks for packing 3 planes of 16 bytes into 48 bytes of
+ * packed pixels and for unpacking in opposite direction.
+ */
+struct ShuffleMasks
+{
+    /// pack[j][c] - mask of channel c for output vector j.
+    alignas(16) uint8_t pack[3][3][16];
+    /// unpack[c][j] - mask of input vector j for channel c.
+    alignas(16) uint8_t unpack[3][3][16];
+
+    ShuffleMasks()
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int i = 0; i < 16; ++i)
+                {
+                    // Packed byte k belongs to pixel k / 3 and channel k % 3.
+                    int k = 16 * j + i;
+                    pack[j][c][i] = k % 3 == c ? static_cast<uint8_t>(k / 3) : 0x80;
+                    // Pixel i of channel c is packed byte 3 * i + c.
+                    int s = 3 * i + c;
+                    unpack[c][j][i] = s / 16 == j ? static_cast<uint8_t>(s % 16) : 0x80;
+                }
+            }
+        }
+    }
+};
+
+static const ShuffleMasks g_masks;
+
+
+
+static inline __m128i mask(const uint8_t* data)
+{
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline void storeBgr48(uint8_t* dst, __m128i b, __m128i g, __m128i r)
+{
+    for (int j = 0; j < 3; ++j)
+    {
+        __m128i out = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(b, mask(g_masks.pack[j][0])),
+                         _mm_shuffle_epi8(g, mask(g_masks.pack[j][1]))),
+            _mm_shuffle_epi8(r, mask(g_masks.pack[j][2])));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16 * j), out);
+    }
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline void loadBgr48(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r)
+{
+    __m128i in[3];
+    for (int j = 0; j < 3; ++j)
+    {
+        in[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * j));
+    }
+    __m128i* out[3] = {&b, &g, &r};
+    for (int c = 0; c < 3; ++c)
+    {
+        *out[c] = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(in[0], mask(g_masks.unpack[c][0])),
+                         _mm_shuffle_epi8(in[1], mask(g_masks.unpack[c][1]))),
+            _mm_shuffle_epi8(in[2], mask(g_masks.unpack[c][2])));
+    }
+}
+
+
+
+/**
+ * @brief Load 8 U and 8 V samples (for 16 pixels) to low halves of vectors.
+ */
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline void loadChroma8(const uint8_t* u, const uint8_t* v, int uvStep,
+                               __m128i& u8, __m128i& v8)
+{
+    if (uvStep == 1)
+    {
+        u8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u));
+        v8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v));
+        return;
+    }
+
+    // Interleaved chroma: U first for NV12, V first for NV21.
+    const uint8_t* base = u < v ? u : v;
+    __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base));
+    __m128i even = _mm_shuffle_epi8(uv, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1));
+    __m128i odd = _mm_shuffle_epi8(uv, _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1));
+    u8 = u < v ? even : odd;
+    v8 = u < v ? odd : even;
+}
+
+
+
+/**
+ * @brief Store 8 U and 8 V samples from low halves of vectors.
+ */
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline void storeChroma8(uint8_t* u, uint8_t* v, int uvStep, __m128i u8, __m128i v8)
+{
+    if (uvStep == 1)
+    {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u), u8);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v), v8);
+        return;
+    }
+
+    uint8_t* base = u < v ? u : v;
+    __m128i uv = u < v ? _mm_unpacklo_epi8(u8, v8) : _mm_unpacklo_epi8(v8, u8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(base), uv);
+}
+
+
+
+/**
+ * @brief YUV to BGR of 8 pixels in 16 bit lanes. Returns B, G, R in 16 bit.
+ */
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline void yuvToBgr8(__m128i y16, __m128i u16, __m128i v16,
+                             __m128i& b, __m128i& g, __m128i& r)
+{
+    const __m128i round = _mm_set1_epi16(32);
+    __m128i y1 = _mm_mullo_epi16(_mm_sub_epi16(y16, _mm_set1_epi16(16)), _mm_set1_epi16(74));
+    __m128i cu = _mm_sub_epi16(u16, _mm_set1_epi16(128));
+    __m128i cv = _mm_sub_epi16(v16, _mm_set1_epi16(128));
+    b = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(y1, _mm_mullo_epi16(cu, _mm_set1_epi16(129))), round), 6);
+    g = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_sub_epi16(y1, _mm_mullo_epi16(cu, _mm_set1_epi16(25))),
+                                                   _mm_mullo_epi16(cv, _mm_set1_epi16(52))), round), 6);
+    r = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y1, _mm_mullo_epi16(cv, _mm_set1_epi16(102))), round), 6);
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void yuvToBgrRowSse41(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                             int uvStep, uint8_t* dst, int width, bool rgb)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i u8, v8;
+        loadChroma8(u + (x >> 1) * uvStep, v + (x >> 1) * uvStep, uvStep, u8, v8);
+
+        // Each chroma sample covers two pixels.
+        u8 = _mm_unpacklo_epi8(u8, u8);
+        v8 = _mm_unpacklo_epi8(v8, v8);
+
+        __m128i bLo, gLo, rLo, bHi, gHi, rHi;
+        yuvToBgr8(_mm_cvtepu8_epi16(y8), _mm_cvtepu8_epi16(u8), _mm_cvtepu8_epi16(v8), bLo, gLo, rLo);
+        yuvToBgr8(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(u8, zero),
+                  _mm_unpackhi_epi8(v8, zero), bHi, gHi, rHi);
+
+        __m128i b = _mm_packus_epi16(bLo, bHi);
+        __m128i g = _mm_packus_epi16(gLo, gHi);
+        __m128i r = _mm_packus_epi16(rLo, rHi);
+        if (rgb)
+        {
+            storeBgr48(dst + 3 * x, r, g, b);
+        }
+        else
+        {
+            storeBgr48(dst + 3 * x, b, g, r);
+        }
+    }
+
+    yuvToBgrRowScalar(y + x, u + (x >> 1) * uvStep, v + (x >> 1) * uvStep,
+                      uvStep, dst + 3 * x, width - x, rgb);
+}
+
+
+
+COLOR_CONVERTER_TARGET("avx2")
+static inline void yuvToBgr16Avx2(__m256i y16, __m256i u16, __m256i v16,
+                                  __m256i& b, __m256i& g, __m256i& r)
+{
+    const __m256i round = _mm256_set1_epi16(32);
+    __m256i y1 = _mm256_mullo_epi16(_mm256_sub_epi16(y16, _mm256_set1_epi16(16)), _mm256_set1_epi16(74));
+    __m256i cu = _mm256_sub_epi16(u16, _mm256_set1_epi16(128));
+    __m256i cv = _mm256_sub_epi16(v16, _mm256_set1_epi16(128));
+    b = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(y1, _mm256_mullo_epi16(cu, _mm256_set1_epi16(129))), round), 6);
+    g = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(_mm256_sub_epi16(y1, _mm256_mullo_epi16(cu, _mm256_set1_epi16(25))),
+                                                            _mm256_mullo_epi16(cv, _mm256_set1_epi16(52))), round), 6);
+    r = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(y1, _mm256_mullo_epi16(cv, _mm256_set1_epi16(102))), round), 6);
+}
+
+
+
+COLOR_CONVERTER_TARGET("avx2")
+static inline __m128i packus256(__m256i value)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+}
+
+
+
+COLOR_CONVERTER_TARGET("avx2")
+static void yuvToBgrRowAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                            int uvStep, uint8_t* dst, int width, bool rgb)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        // Arithmetic in 256 bit lanes, packing in 128 bit lanes.
+        for (int half = 0; half < 32; half += 16)
+        {
+            __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x + half));
+            __m128i u8, v8;
+            loadChroma8(u + ((x + half) >> 1) * uvStep, v + ((x + half) >> 1) * uvStep, uvStep, u8, v8);
+            u8 = _mm_unpacklo_epi8(u8, u8);
+            v8 = _mm_unpacklo_epi8(v8, v8);
+
+            __m256i b, g, r;
+            yuvToBgr16Avx2(_mm256_cvtepu8_epi16(y8), _mm256_cvtepu8_epi16(u8), _mm256_cvtepu8_epi16(v8), b, g, r);
+            if (rgb)
+            {
+                storeBgr48(dst + 3 * (x + half), packus256(r), packus256(g), packus256(b));
+            }
+            else
+            {
+                storeBgr48(dst + 3 * (x + half), packus256(b), packus256(g), packus256(r));
+            }
+        }
+    }
+
+    yuvToBgrRowSse41(y + x, u + (x >> 1) * uvStep, v + (x >> 1) * uvStep,
+                     uvStep, dst + 3 * x, width - x, rgb);
+}
+
+
+
+/**
+ * @brief Luma of 8 pixels in 16 bit lanes.
+ */
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline __m128i bgrToY8(__m128i b, __m128i g, __m128i r)
+{
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                              _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                                _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    // Unsigned 16 bit: max value 220 * 255 + 128 fits.
+    return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline __m128i bgrToY16(__m128i b, __m128i g, __m128i r)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = bgrToY8(_mm_cvtepu8_epi16(b), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(r));
+    __m128i hi = bgrToY8(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static inline __m128i average2x2(__m128i row0, __m128i row1)
+{
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i sum = _mm_add_epi16(_mm_maddubs_epi16(row0, ones), _mm_maddubs_epi16(row1, ones));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void bgrToYuvRowSse41(const uint8_t* src0, const uint8_t* src1,
+                             uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                             int uvStep, int width, bool rgb)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i b0, g0, r0, b1, g1, r1;
+        loadBgr48(src0 + 3 * x, b0, g0, r0);
+        loadBgr48(src1 + 3 * x, b1, g1, r1);
+        if (rgb)
+        {
+            std::swap(b0, r0);
+            std::swap(b1, r1);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), bgrToY16(b0, g0, r0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), bgrToY16(b1, g1, r1));
+
+        __m128i b = average2x2(b0, b1);
+        __m128i g = average2x2(g0, g1);
+        __m128i r = average2x2(r0, r1);
+        __m128i cu = _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)),
+                                   _mm_sub_epi16(_mm_set1_epi16(128),
+                                                 _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(38)),
+                                                               _mm_mullo_epi16(g, _mm_set1_epi16(74)))));
+        __m128i cv = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)),
+                                   _mm_sub_epi16(_mm_set1_epi16(128),
+                                                 _mm_add_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(94)),
+                                                               _mm_mullo_epi16(b, _mm_set1_epi16(18)))));
+        cu = _mm_add_epi16(_mm_srai_epi16(cu, 8), _mm_set1_epi16(128));
+        cv = _mm_add_epi16(_mm_srai_epi16(cv, 8), _mm_set1_epi16(128));
+
+        storeChroma8(u + (x >> 1) * uvStep, v + (x >> 1) * uvStep, uvStep,
+                     _mm_packus_epi16(cu, cu), _mm_packus_epi16(cv, cv));
+    }
+
+    bgrToYuvRowScalar(src0 + 3 * x, src1 + 3 * x, y0 + x, y1 + x,
+                      u + (x >> 1) * uvStep, v + (x >> 1) * uvStep, uvStep, width - x, rgb);
+}
+
+
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void yuyvToYuvRowSse41(const uint8_t* src0, const uint8_t* src1,
+                              uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                              int width, bool uyvy)
+{
+    // Byte order: YUYV - Y0 U Y1 V, UYVY - U Y0 V Y1.
+    const __m128i yLo = uyvy ? _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1) :
+                               _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i yHi = _mm_alignr_epi8(yLo, _mm_set1_epi8(-1), 8);
+    const __m128i uLo = uyvy ? _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1) :
+                               _mm_setr_epi8(1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i vLo = _mm_add_epi8(uLo, _mm_setr_epi8(2, 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m128i uHi = _mm_alignr_epi8(uLo, _mm_set1_epi8(-1), 12);
+    const __m128i vHi = _mm_alignr_epi8(vLo, _mm_set1_epi8(-1), 12);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x + 16));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x + 16));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x),
+                         _mm_or_si128(_mm_shuffle_epi8(a0, yLo), _mm_shuffle_epi8(b0, yHi)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x),
+                         _mm_or_si128(_mm_shuffle_epi8(a1, yLo), _mm_shuffle_epi8(b1, yHi)));
+
+        // Luma bytes are averaged too but not used.
+        __m128i a = _mm_avg_epu8(a0, a1);
+        __m128i b = _mm_avg_epu8(b0, b1);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + (x >> 1)),
+                         _mm_or_si128(_mm_shuffle_epi8(a, uLo), _mm_shuffle_epi8(b, uHi)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + (x >> 1)),
+                         _mm_or_si128(_mm_shuffle_epi8(a, vLo), _mm_shuffle_epi8(b, vHi)));
+    }
+
+    yuyvToYuvRowScalar(src0 + 2 * x, src1 + 2 * x, y0 + x, y1 + x,
+                       u + (x >> 1), v + (x >> 1), width - x, uyvy);
+}
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void swapRbRowSse41(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i b, g, r;
+        loadBgr48(src + 3 * x, b, g, r);
+        storeBgr48(dst + 3 * x, r, g, b);
+    }
+
+    swapRbRowScalar(src + 3 * x, dst + 3 * x, width - x);
+}
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void splitUvRowSse41(const uint8_t* uv, uint8_t* u, uint8_t* v, int count)
+{
+    const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x)), split);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x + 16)), split);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), _mm_unpackhi_epi64(a, b));
+    }
+
+    splitUvRowScalar(uv + 2 * x, u + x, v + x, count - x);
+}
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void halveRowSse41(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i lo = average2x2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x)));
+        __m128i hi = average2x2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * x + 16)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * x + 16)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+    }
+
+    halveRowScalar(src0 + 2 * x, src1 + 2 * x, dst + x, width - x);
+}
+
+COLOR_CONVERTER_TARGET("sse4.1")
+static void blendRowSse41(const uint8_t* src0, const uint8_t* src1, uint8_t* dst,
+                          int width, int weight)
+{
+    // Weighted sum of 8 bit values with weights sum 256 fits unsigned 16 bit.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_set1_epi16(static_cast<short>(256 - weight));
+    const __m128i w1 = _mm_set1_epi16(static_cast<short>(weight));
+    const __m128i round = _mm_set1_epi16(128);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+    }
+
+    blendRowScalar(src0 + x, src1 + x, dst + x, width - x, weight);
+}
+
+#endif // COLOR_CONVERTER_X86
+
+
+
+#ifdef COLOR_CONVERTER_NEON
+
+static inline void yuvToBgr8Neon(uint8x8_t y8, uint8x8_t u8, uint8x8_t v8,
+                                 uint8x8_t& b, uint8x8_t& g, uint8x8_t& r)
+{
+    int16x8_t y1 = vmulq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16)), 74);
+    int16x8_t cu = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128));
+    int16x8_t cv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128));
+    // Rounding narrow shift adds 32 before shift without overflow.
+    b = vqrshrun_n_s16(vqaddq_s16(y1, vmulq_n_s16(cu, 129)), 6);
+    g = vqrshrun_n_s16(vsubq_s16(vsubq_s16(y1, vmulq_n_s16(cu, 25)), vmulq_n_s16(cv, 52)), 6);
+    r = vqrshrun_n_s16(vaddq_s16(y1, vmulq_n_s16(cv, 102)), 6);
+}
+
+
+
+static void yuvToBgrRowNeon(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                            int uvStep, uint8_t* dst, int width, bool rgb)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t y8 = vld1q_u8(y + x);
+        uint8x8_t u8, v8;
+        if (uvStep == 1)
+        {
+            u8 = vld1_u8(u + (x >> 1));
+            v8 = vld1_u8(v + (x >> 1));
+        }
+        else
+        {
+            const uint8_t* base = u < v ? u : v;
+            uint8x8x2_t uv = vld2_u8(base + x);
+            u8 = u < v ? uv.val[0] : uv.val[1];
+            v8 = u < v ? uv.val[1] : uv.val[0];
+        }
+        uint8x8x2_t uu = vzip_u8(u8, u8);
+        uint8x8x2_t vv = vzip_u8(v8, v8);
+
+        uint8x8_t bLo, gLo, rLo, bHi, gHi, rHi;
+        yuvToBgr8Neon(vget_low_u8(y8), uu.val[0], vv.val[0], bLo, gLo, rLo);
+        yuvToBgr8Neon(vget_high_u8(y8), uu.val[1], vv.val[1], bHi, gHi, rHi);
+
+        uint8x16x3_t out;
+        out.val[0] = rgb ? vcombine_u8(rLo, rHi) : vcombine_u8(bLo, bHi);
+        out.val[1] = vcombine_u8(gLo, gHi);
+        out.val[2] = rgb ? vcombine_u8(bLo, bHi) : vcombine_u8(rLo, rHi);
+        vst3q_u8(dst + 3 * x, out);
+    }
+
+    yuvToBgrRowScalar(y + x, u + (x >> 1) * uvStep, v + (x >> 1) * uvStep,
+                      uvStep, dst + 3 * x, width - x, rgb);
+}
+
+
+
+static inline uint8x16_t bgrToY16Neon(uint8x16_t b, uint8x16_t g, uint8x16_t r)
+{
+    uint16x8_t lo = vmull_u8(vget_low_u8(r), vdup_n_u8(66));
+    lo = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(129));
+    lo = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(25));
+    uint16x8_t hi = vmull_u8(vget_high_u8(r), vdup_n_u8(66));
+    hi = vmlal_u8(hi, vget_high_u8(g), vdup_n_u8(129));
+    hi = vmlal_u8(hi, vget_high_u8(b), vdup_n_u8(25));
+    uint8x16_t y = vcombine_u8(vshrn_n_u16(vaddq_u16(lo, vdupq_n_u16(128)), 8),
+                               vshrn_n_u16(vaddq_u16(hi, vdupq_n_u16(128)), 8));
+    return vaddq_u8(y, vdupq_n_u8(16));
+}
+
+
+
+static inline int16x8_t average2x2Neon(uint8x16_t row0, uint8x16_t row1)
+{
+    uint16x8_t sum = vaddq_u16(vpaddlq_u8(row0), vpaddlq_u8(row1));
+    return vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(sum, vdupq_n_u16(2)), 2));
+}
+
+
+
+static void bgrToYuvRowNeon(const uint8_t* src0, const uint8_t* src1,
+                            uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                            int uvStep, int width, bool rgb)
+{
+    int bIndex = rgb ? 2 : 0;
+    int rIndex = rgb ? 0 : 2;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x3_t p0 = vld3q_u8(src0 + 3 * x);
+        uint8x16x3_t p1 = vld3q_u8(src1 + 3 * x);
+        vst1q_u8(y0 + x, bgrToY16Neon(p0.val[bIndex], p0.val[1], p0.val[rIndex]));
+        vst1q_u8(y1 + x, bgrToY16Neon(p1.val[bIndex], p1.val[1], p1.val[rIndex]));
+
+        int16x8_t b = average2x2Neon(p0.val[bIndex], p1.val[bIndex]);
+        int16x8_t g = average2x2Neon(p0.val[1], p1.val[1]);
+        int16x8_t r = average2x2Neon(p0.val[rIndex], p1.val[rIndex]);
+        int16x8_t cu = vmlaq_n_s16(vmlaq_n_s16(vmlaq_n_s16(vdupq_n_s16(128), r, -38), g, -74), b, 112);
+        int16x8_t cv = vmlaq_n_s16(vmlaq_n_s16(vmlaq_n_s16(vdupq_n_s16(128), r, 112), g, -94), b, -18);
+        uint8x8_t u8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(cu, 8), vdupq_n_s16(128)));
+        uint8x8_t v8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(cv, 8), vdupq_n_s16(128)));
+
+        if (uvStep == 1)
+        {
+            vst1_u8(u + (x >> 1), u8);
+            vst1_u8(v + (x >> 1), v8);
+        }
+        else
+        {
+            uint8x8x2_t uv;
+            uv.val[0] = u < v ? u8 : v8;
+            uv.val[1] = u < v ? v8 : u8;
+            vst2_u8((u < v ? u : v) + x, uv);
+        }
+    }
+
+    bgrToYuvRowScalar(src0 + 3 * x, src1 + 3 * x, y0 + x, y1 + x,
+                      u + (x >> 1) * uvStep, v + (x >> 1) * uvStep, uvStep, width - x, rgb);
+}
+
+
+
+static void yuyvToYuvRowNeon(const uint8_t* src0, const uint8_t* src1,
+                             uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                             int width, bool uyvy)
+{
+    // YUYV: Y0 U Y1 V, UYVY: U Y0 V Y1.
+    int yIndex = uyvy ? 1 : 0;
+    int uIndex = uyvy ? 0 : 1;
+    int vIndex = uyvy ? 2 : 3;
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x8x4_t p0 = vld4_u8(src0 + 2 * x);
+        uint8x8x4_t p1 = vld4_u8(src1 + 2 * x);
+        uint8x8x2_t l0 = {{p0.val[yIndex], p0.val[yIndex + 2]}};
+        uint8x8x2_t l1 = {{p1.val[yIndex], p1.val[yIndex + 2]}};
+        vst2_u8(y0 + x, l0);
+        vst2_u8(y1 + x, l1);
+        vst1_u8(u + (x >> 1), vrhadd_u8(p0.val[uIndex], p1.val[uIndex]));
+        vst1_u8(v + (x >> 1), vrhadd_u8(p0.val[vIndex], p1.val[vIndex]));
+    }
+
+    yuyvToYuvRowScalar(src0 + 2 * x, src1 + 2 * x, y0 + x, y1 + x,
+                       u + (x >> 1), v + (x >> 1), width - x, uyvy);
+}
+
+static void swapRbRowNeon(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x3_t p = vld3q_u8(src + 3 * x);
+        uint8x16_t b = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = b;
+        vst3q_u8(dst + 3 * x, p);
+    }
+
+    swapRbRowScalar(src + 3 * x, dst + 3 * x, width - x);
+}
+
+static void splitUvRowNeon(const uint8_t* uv, uint8_t* u, uint8_t* v, int count)
+{
+    int x = 0;
+    for (; x + 16 <= count; x += 16)
+    {
+        uint8x16x2_t p = vld2q_u8(uv + 2 * x);
+        vst1q_u8(u + x, p.val[0]);
+        vst1q_u8(v + x, p.val[1]);
+    }
+
+    splitUvRowScalar(uv + 2 * x, u + x, v + x, count - x);
+}
+
+static void halveRowNeon(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        int16x8_t lo = average2x2Neon(vld1q_u8(src0 + 2 * x), vld1q_u8(src1 + 2 * x));
+        int16x8_t hi = average2x2Neon(vld1q_u8(src0 + 2 * x + 16), vld1q_u8(src1 + 2 * x + 16));
+        vst1q_u8(dst + x, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+    }
+
+    halveRowScalar(src0 + 2 * x, src1 + 2 * x, dst + x, width - x);
+}
+
+static void blendRowNeon(const uint8_t* src0, const uint8_t* src1, uint8_t* dst,
+                         int width, int weight)
+{
+    const uint8x8_t w0 = vdup_n_u8(static_cast<uint8_t>(256 - weight));
+    const uint8x8_t w1 = vdup_n_u8(static_cast<uint8_t>(weight));
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t a = vld1q_u8(src0 + x);
+        uint8x16_t b = vld1q_u8(src1 + x);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1);
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+
+    blendRowScalar(src0 + x, src1 + x, dst + x, width - x, weight);
+}
+
+#endif // COLOR_CONVERTER_NEON
+
+
+
+ColorConverter::ColorConverter()
+{
+    setIsa(getBestIsa());
+}
+
+
+
+ColorConverterIsa ColorConverter::getBestIsa()
+{
+    if (isSupported(ColorConverterIsa::AVX2))
+    {
+        return ColorConverterIsa::AVX2;
+    }
+    if (isSupported(ColorConverterIsa::SSE41))
+    {
+        return ColorConverterIsa::SSE41;
+    }
+    if (isSupported(ColorConverterIsa::NEON))
+    {
+        return ColorConverterIsa::NEON;
+    }
+    return ColorConverterIsa::SCALAR;
+}
+
+
+
+bool ColorConverter::isSupported(ColorConverterIsa isa)
+{
+    switch (isa)
+    {
+    case ColorConverterIsa::SCALAR:
+        return true;
+#ifdef COLOR_CONVERTER_X86
+#if defined(_MSC_VER)
+    case ColorConverterIsa::SSE41:
+    {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 19)) != 0;
+    }
+    case ColorConverterIsa::AVX2:
+    {
+        int info[4];
+        __cpuid(info, 1);
+        // OSXSAVE and AVX state enabled by OS.
+        if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+#else
+    case ColorConverterIsa::SSE41:
+        return __builtin_cpu_supports("sse4.1") != 0;
+    case ColorConverterIsa::AVX2:
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+#endif
+#ifdef COLOR_CONVERTER_NEON
+    case ColorConverterIsa::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+
+
+const char* ColorConverter::getIsaName(ColorConverterIsa isa)
+{
+    switch (isa)
+    {
+    case ColorConverterIsa::SCALAR: return "scalar";
+    case ColorConverterIsa::SSE41: return "sse4.1";
+    case ColorConverterIsa::AVX2: return "avx2";
+    case ColorConverterIsa::NEON: return "neon";
+    default: return "unknown";
+    }
+}
+
+
+
+bool ColorConverter::setIsa(ColorConverterIsa isa)
+{
+    if (!isSupported(isa))
+    {
+        return false;
+    }
+
+    m_isa = isa;
+    m_yuvToBgrRow = yuvToBgrRowScalar;
+    m_bgrToYuvRow = bgrToYuvRowScalar;
+    m_yuyvToYuvRow = yuyvToYuvRowScalar;
+    m_swapRbRow = swapRbRowScalar;
+    m_splitUvRow = splitUvRowScalar;
+    m_halveRow = halveRowScalar;
+    m_blendRow = blendRowScalar;
+
+    switch (isa)
+    {
+#ifdef COLOR_CONVERTER_X86
+    case ColorConverterIsa::SSE41:
+        m_yuvToBgrRow = yuvToBgrRowSse41;
+        m_bgrToYuvRow = bgrToYuvRowSse41;
+        m_yuyvToYuvRow = yuyvToYuvRowSse41;
+        m_swapRbRow = swapRbRowSse41;
+        m_splitUvRow = splitUvRowSse41;
+        m_halveRow = halveRowSse41;
+        m_blendRow = blendRowSse41;
+        break;
+    case ColorConverterIsa::AVX2:
+        // Packing kernels are limited by shuffles and scaling kernels by
+        // memory bandwidth, SSE4.1 versions are used.
+        m_yuvToBgrRow = yuvToBgrRowAvx2;
+        m_bgrToYuvRow = bgrToYuvRowSse41;
+        m_yuyvToYuvRow = yuyvToYuvRowSse41;
+        m_swapRbRow = swapRbRowSse41;
+        m_splitUvRow = splitUvRowSse41;
+        m_halveRow = halveRowSse41;
+        m_blendRow = blendRowSse41;
+        break;
+#endif
+#ifdef COLOR_CONVERTER_NEON
+    case ColorConverterIsa::NEON:
+        m_yuvToBgrRow = yuvToBgrRowNeon;
+        m_bgrToYuvRow = bgrToYuvRowNeon;
+        m_yuyvToYuvRow = yuyvToYuvRowNeon;
+        m_swapRbRow = swapRbRowNeon;
+        m_splitUvRow = splitUvRowNeon;
+        m_halveRow = halveRowNeon;
+        m_blendRow = blendRowNeon;
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return true;
+}
+
+
+
+ColorConverterIsa ColorConverter::getIsa()
+{
+    return m_isa;
+}
+
+
+
+void ColorConverter::i420ToBgr(const uint8_t* y, int yStride, const uint8_t* u, int uStride,
+                               const uint8_t* v, int vStride, uint8_t* dst, int dstStride,
+                               int width, int height, bool rgb)
+{
+    for (int row = 0; row < height; ++row)
+    {
+        m_yuvToBgrRow(y + row * yStride, u + (row >> 1) * uStride, v + (row >> 1) * vStride,
+                      1, dst + row * dstStride, width, rgb);
+    }
+}
+
+
+
+void ColorConverter::nv12ToBgr(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                               uint8_t* dst, int dstStride, int width, int height,
+                               bool rgb, bool nv21)
+{
+    for (int row = 0; row < height; ++row)
+    {
+        const uint8_t* uvRow = uv + (row >> 1) * uvStride;
+        m_yuvToBgrRow(y + row * yStride, nv21 ? uvRow + 1 : uvRow, nv21 ? uvRow : uvRow + 1,
+                      2, dst + row * dstStride, width, rgb);
+    }
+}
+
+
+
+void ColorConverter::bgrToI420(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                               uint8_t* u, int uStride, uint8_t* v, int vStride,
+                               int width, int height, bool rgb)
+{
+    for (int row = 0; row + 1 < height; row += 2)
+    {
+        m_bgrToYuvRow(src + row * srcStride, src + (row + 1) * srcStride,
+                      y + row * yStride, y + (row + 1) * yStride,
+                      u + (row >> 1) * uStride, v + (row >> 1) * vStride, 1, width, rgb);
+    }
+}
+
+
+
+void ColorConverter::bgrToNv12(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                               uint8_t* uv, int uvStride, int width, int height,
+                               bool rgb, bool nv21)
+{
+    for (int row = 0; row + 1 < height; row += 2)
+    {
+        uint8_t* uvRow = uv + (row >> 1) * uvStride;
+        m_bgrToYuvRow(src + row * srcStride, src + (row + 1) * srcStride,
+                      y + row * yStride, y + (row + 1) * yStride,
+                      nv21 ? uvRow + 1 : uvRow, nv21 ? uvRow : uvRow + 1, 2, width, rgb);
+    }
+}
+
+
+
+void ColorConverter::nv12ToI420(const uint8_t* srcY, int srcYStride, const uint8_t* uv, int uvStride,
+                                uint8_t* y, int yStride, uint8_t* u, int uStride, uint8_t* v, int vStride,
+                                int width, int height, bool nv21)
+{
+    for (int row = 0; row < height; ++row)
+    {
+        memcpy(y + row * yStride, srcY + row * srcYStride, width);
+    }
+    for (int row = 0; row < height / 2; ++row)
+    {
+        if (nv21)
+        {
+            m_splitUvRow(uv + row * uvStride, v + row * vStride, u + row * uStride, width / 2);
+        }
+        else
+        {
+            m_splitUvRow(uv + row * uvStride, u + row * uStride, v + row * vStride, width / 2);
+        }
+    }
+}
+
+
+
+void ColorConverter::bgrToRgb(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                              int width, int height)
+{
+    for (int row = 0; row < height; ++row)
+    {
+        m_swapRbRow(src + row * srcStride, dst + row * dstStride, width);
+    }
+}
+
+
+
+void ColorConverter::yuyvToI420(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                                uint8_t* u, int uStride, uint8_t* v, int vStride,
+                                int width, int height, bool uyvy)
+{
+    for (int row = 0; row + 1 < height; row += 2)
+    {
+        m_yuyvToYuvRow(src + row * srcStride, src + (row + 1) * srcStride,
+                       y + row * yStride, y + (row + 1) * yStride,
+                       u + (row >> 1) * uStride, v + (row >> 1) * vStride, width, uyvy);
+    }
+}
+
+
+
+bool ColorConverter::convert(cr::video::Frame& src, cr::video::Frame& dst)
+{
+    using cr::video::Fourcc;
+
+    int width = src.width;
+    int height = src.height;
+
+    bool srcYuv420 = src.fourcc == Fourcc::YU12 || src.fourcc == Fourcc::NV12 || src.fourcc == Fourcc::NV21;
+    bool srcBgr = src.fourcc == Fourcc::BGR24 || src.fourcc == Fourcc::RGB24;
+    bool srcYuyv = src.fourcc == Fourcc::YUYV || src.fourcc == Fourcc::UYVY;
+    bool dstYuv420 = dst.fourcc == Fourcc::YU12 || dst.fourcc == Fourcc::NV12 || dst.fourcc == Fourcc::NV21;
+    bool dstBgr = dst.fourcc == Fourcc::BGR24 || dst.fourcc == Fourcc::RGB24;
+    bool swapRb = srcBgr && dstBgr && src.fourcc != dst.fourcc;
+    bool splitUv = (src.fourcc == Fourcc::NV12 || src.fourcc == Fourcc::NV21) && dst.fourcc == Fourcc::YU12;
+    if (!(srcYuv420 && dstBgr) && !(srcBgr && dstYuv420) && !swapRb && !splitUv &&
+        !(srcYuyv && dst.fourcc == Fourcc::YU12))
+    {
+        std::cout << "Unsupported conversion" << std::endl;
+        return false;
+    }
+
+    // 4:2:0 and 4:2:2 formats require even size
+    if (src.data == nullptr || width <= 0 || height <= 0 ||
+        (!swapRb && (width % 2 != 0 || height % 2 != 0)))
+    {
+        std::cout << "Invalid frame size" << std::endl;
+        return false;
+    }
+
+    // Check if destination frame has enough memory
+    if (dst.width != width || dst.height != height)
+    {
+        Fourcc fourcc = dst.fourcc;
+        dst.release();
+        dst = cr::video::Frame(width, height, fourcc);
+    }
+
+    int ySize = width * height;
+    int uvWidth = width / 2;
+    int uvSize = uvWidth * (height / 2);
+
+    if (swapRb)
+    {
+        bgrToRgb(src.data, width * 3, dst.data, width * 3, width, height);
+        dst.size = ySize * 3;
+    }
+    else if (dstBgr)
+    {
+        bool rgb = dst.fourcc == Fourcc::RGB24;
+        if (src.fourcc == Fourcc::YU12)
+        {
+            i420ToBgr(src.data, width, src.data + ySize, uvWidth, src.data + ySize + uvSize, uvWidth,
+                      dst.data, width * 3, width, height, rgb);
+        }
+        else
+        {
+            nv12ToBgr(src.data, width, src.data + ySize, width, dst.data, width * 3,
+                      width, height, rgb, src.fourcc == Fourcc::NV21);
+        }
+        dst.size = ySize * 3;
+    }
+    else if (srcBgr)
+    {
+        bool rgb = src.fourcc == Fourcc::RGB24;
+        if (dst.fourcc == Fourcc::YU12)
+        {
+            bgrToI420(src.data, width * 3, dst.data, width, dst.data + ySize, uvWidth,
+                      dst.data + ySize + uvSize, uvWidth, width, height, rgb);
+        }
+        else
+        {
+            bgrToNv12(src.data, width * 3, dst.data, width, dst.data + ySize, width,
+                      width, height, rgb, dst.fourcc == Fourcc::NV21);
+        }
+        dst.size = ySize + 2 * uvSize;
+    }
+    else if (splitUv)
+    {
+        nv12ToI420(src.data, width, src.data + ySize, width, dst.data, width, dst.data + ySize, uvWidth,
+                   dst.data + ySize + uvSize, uvWidth, width, height, src.fourcc == Fourcc::NV21);
+        dst.size = ySize + 2 * uvSize;
+    }
+    else
+    {
+        yuyvToI420(src.data, width * 2, dst.data, width, dst.data + ySize, uvWidth,
+                   dst.data + ySize + uvSize, uvWidth, width, height, src.fourcc == Fourcc::UYVY);
+        dst.size = ySize + 2 * uvSize;
+    }
+
+    dst.frameId = src.frameId;
+    dst.sourceId = src.sourceId;
+
+    return true;
+}
+
+
+
+/// Max number of destinations of downscaling.
+static const int g_maxDownscaleOutputs = 16;
+/// Max number of pyramid levels, level 0 is source.
+static const int g_maxPyramidLevels = 32;
+/// Number of source rows processed at once by downscaling.
+static const int g_downscaleBandRows = 16;
+
+
+
+/**
+ * @brief Source position of destination pixel (centers of pixels are aligned)
+ * in 16.16 fixed point, returned as integer position and 8 bit weight of next
+ * source pixel.
+ */
+static inline void scalePosition(int index, int srcSize, int dstSize, int& pos, int& weight)
+{
+    int64_t value = (static_cast<int64_t>(2 * index + 1) * srcSize * 65536) / (2 * static_cast<int64_t>(dstSize)) - 32768;
+    if (value < 0)
+    {
+        value = 0;
+    }
+    pos = static_cast<int>(value >> 16);
+    weight = static_cast<int>((value >> 8) & 255);
+    if (pos >= srcSize - 1)
+    {
+        pos = srcSize - 1;
+        weight = 0;
+    }
+}
+
+
+
+bool ColorConverter::downscale(const uint8_t* src, int srcStride, int width, int height,
+                               const ColorConverterPlane* dst, int count)
+{
+    if (src == nullptr || width <= 0 || height <= 0 || count < 0 || count > g_maxDownscaleOutputs)
+    {
+        std::cout << "Invalid downscaling parameters" << std::endl;
+        return false;
+    }
+
+    // Pyramid level of each destination: smallest level not smaller than
+    // destination, so interpolation never skips source pixels.
+    int levels[g_maxDownscaleOutputs];
+    int numLevels = 1;
+    size_t tableSize = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (dst[i].data == nullptr || dst[i].width <= 0 || dst[i].height <= 0 ||
+            dst[i].width > width || dst[i].height > height)
+        {
+            std::cout << "Invalid downscaling size" << std::endl;
+            return false;
+        }
+        int level = 0;
+        while (level + 1 < g_maxPyramidLevels &&
+               (width >> (level + 1)) >= dst[i].width && (height >> (level + 1)) >= dst[i].height)
+        {
+            ++level;
+        }
+        levels[i] = level;
+        numLevels = std::max(numLevels, level + 1);
+        tableSize += 2 * static_cast<size_t>(dst[i].width);
+    }
+
+    // Levels are stored one after another, then interpolated row.
+    const uint8_t* levelData[g_maxPyramidLevels];
+    int levelWidth[g_maxPyramidLevels];
+    int levelHeight[g_maxPyramidLevels];
+    int levelStride[g_maxPyramidLevels];
+    size_t levelOffset[g_maxPyramidLevels];
+    size_t bufferSize = 0;
+    for (int l = 0; l < numLevels; ++l)
+    {
+        levelWidth[l] = width >> l;
+        levelHeight[l] = height >> l;
+        levelStride[l] = l == 0 ? srcStride : levelWidth[l];
+        levelOffset[l] = bufferSize;
+        if (l > 0)
+        {
+            bufferSize += static_cast<size_t>(levelWidth[l]) * levelHeight[l];
+        }
+    }
+    size_t rowOffset = bufferSize;
+    bufferSize += static_cast<size_t>(width);
+    if (m_scaleBuffer.size() < bufferSize)
+    {
+        m_scaleBuffer.resize(bufferSize);
+    }
+    levelData[0] = src;
+    for (int l = 1; l < numLevels; ++l)
+    {
+        levelData[l] = m_scaleBuffer.data() + levelOffset[l];
+    }
+    uint8_t* row = m_scaleBuffer.data() + rowOffset;
+
+    // Horizontal interpolation tables.
+    if (m_scaleTables.size() < tableSize)
+    {
+        m_scaleTables.resize(tableSize);
+    }
+    int* tables[g_maxDownscaleOutputs];
+    int* table = m_scaleTables.data();
+    for (int i = 0; i < count; ++i)
+    {
+        tables[i] = table;
+        int srcWidth = levelWidth[levels[i]];
+        for (int x = 0; x < dst[i].width; ++x)
+        {
+            scalePosition(x, srcWidth, dst[i].width, table[2 * x], table[2 * x + 1]);
+            // Last pixel is taken with full weight of next position to keep
+            // interpolation branchless. Rows of 1 pixel are only copied.
+            if (table[2 * x] == srcWidth - 1 && srcWidth > 1)
+            {
+                table[2 * x] = srcWidth - 2;
+                table[2 * x + 1] = 256;
+            }
+        }
+        table += 2 * dst[i].width;
+    }
+
+    // Rows ready at each level and next row of each destination.
+    int ready[g_maxPyramidLevels] = {0};
+    int next[g_maxDownscaleOutputs] = {0};
+    for (int end = 0; end < height;)
+    {
+        end = std::min(height, end + g_downscaleBandRows);
+        ready[0] = end;
+
+        for (int l = 1; l < numLevels; ++l)
+        {
+            uint8_t* levelRows = m_scaleBuffer.data() + levelOffset[l];
+            while (ready[l] < levelHeight[l] && 2 * ready[l] + 1 < ready[l - 1])
+            {
+                const uint8_t* src0 = levelData[l - 1] + static_cast<size_t>(2 * ready[l]) * levelStride[l - 1];
+                m_halveRow(src0, src0 + levelStride[l - 1],
+                           levelRows + static_cast<size_t>(ready[l]) * levelStride[l], levelWidth[l]);
+                ++ready[l];
+            }
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            const ColorConverterPlane& plane = dst[i];
+            int l = levels[i];
+            while (next[i] < plane.height)
+            {
+                int y = 0;
+                int weight = 0;
+                scalePosition(next[i], levelHeight[l], plane.height, y, weight);
+                if (y + (weight != 0 ? 1 : 0) >= ready[l])
+                {
+                    break;
+                }
+
+                const uint8_t* srcRow = levelData[l] + static_cast<size_t>(y) * levelStride[l];
+                if (weight != 0)
+                {
+                    m_blendRow(srcRow, srcRow + levelStride[l], row, levelWidth[l], weight);
+                    srcRow = row;
+                }
+                uint8_t* dstRow = plane.data + static_cast<size_t>(next[i]) * plane.stride;
+                if (plane.width == levelWidth[l])
+                {
+                    memcpy(dstRow, srcRow, plane.width);
+                }
+                else
+                {
+                    resampleRow(srcRow, dstRow, tables[i], plane.width);
+                }
+                ++next[i];
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+bool ColorConverter::downscale(cr::video::Frame& src, cr::video::Frame** dst, int count)
+{
+    using cr::video::Fourcc;
+
+    int width = src.width;
+    int height = src.height;
+    if (src.fourcc != Fourcc::YU12 && src.fourcc != Fourcc::NV12 && src.fourcc != Fourcc::NV21)
+    {
+        std::cout << "Unsupported conversion" << std::endl;
+        return false;
+    }
+    if (src.data == nullptr || width <= 0 || height <= 0 || width % 2 != 0 || height % 2 != 0 ||
+        count < 0 || count > g_maxDownscaleOutputs)
+    {
+        std::cout << "Invalid frame size" << std::endl;
+        return false;
+    }
+
+    ColorConverterPlane y[g_maxDownscaleOutputs];
+    ColorConverterPlane u[g_maxDownscaleOutputs];
+    ColorConverterPlane v[g_maxDownscaleOutputs];
+    for (int i = 0; i < count; ++i)
+    {
+        cr::video::Frame& frame = *dst[i];
+        if (frame.fourcc != Fourcc::YU12 || frame.data == nullptr || frame.width <= 0 || frame.height <= 0 ||
+            frame.width % 2 != 0 || frame.height % 2 != 0 || frame.width > width || frame.height > height)
+        {
+            std::cout << "Invalid frame size" << std::endl;
+            return false;
+        }
+        int ySize = frame.width * frame.height;
+        int uvWidth = frame.width / 2;
+        int uvHeight = frame.height / 2;
+        y[i] = {frame.data, frame.width, frame.width, frame.height};
+        u[i] = {frame.data + ySize, uvWidth, uvWidth, uvHeight};
+        v[i] = {frame.data + ySize + uvWidth * uvHeight, uvWidth, uvWidth, uvHeight};
+        frame.size = ySize + 2 * uvWidth * uvHeight;
+        frame.frameId = src.frameId;
+        frame.sourceId = src.sourceId;
+    }
+
+    int ySize = width * height;
+    int uvWidth = width / 2;
+    int uvHeight = height / 2;
+    int uvSize = uvWidth * uvHeight;
+    const uint8_t* srcU = src.data + ySize;
+    const uint8_t* srcV = src.data + ySize + uvSize;
+    if (src.fourcc != Fourcc::YU12)
+    {
+        // Interleaved chroma is split once for all destinations.
+        if (m_chromaBuffer.size() < static_cast<size_t>(2 * uvSize))
+        {
+            m_chromaBuffer.resize(2 * uvSize);
+        }
+        uint8_t* first = m_chromaBuffer.data();
+        uint8_t* second = m_chromaBuffer.data() + uvSize;
+        for (int row = 0; row < uvHeight; ++row)
+        {
+            m_splitUvRow(src.data + ySize + row * width, first + row * uvWidth, second + row * uvWidth, uvWidth);
+        }
+        srcU = src.fourcc == Fourcc::NV12 ? first : second;
+        srcV = src.fourcc == Fourcc::NV12 ? second : first;
+    }
+
+    return downscale(src.data, width, width, height, y, count) &&
+           downscale(srcU, uvWidth, uvWidth, uvHeight, u, count) &&
+           downscale(srcV, uvWidth, uvWidth, uvHeight, v, count);
+}
@@ -0,0 +1,317 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Frame.h"
+
+
+
+/**
+ * @brief Instruction sets of color conversion kernels.
+ */
+enum class ColorConverterIsa
+{
+    /// Portable C++ reference implementation.
+    SCALAR = 0,
+    /// x86 SSE4.1.
+    SSE41,
+    /// x86 AVX2.
+    AVX2,
+    /// ARM NEON.
+    NEON
+};
+
+
+
+/**
+ * @brief Destination plane of downscaling.
+ */
+struct ColorConverterPlane
+{
+    /// Plane data.
+    uint8_t* data{nullptr};
+    /// Plane stride.
+    int stride{0};
+    /// Plane width.
+    int width{0};
+    /// Plane height.
+    int height{0};
+};
+
+
+
+/**
+ * @brief Color conversion with SIMD kernels selected at runtime. All kernels
+ * produce bit-exact results of scalar reference. YUV is BT.601 limited range,
+ * 4:2:0 formats require even width and height.
+ */
+class ColorConverter
+{
+public:
+
+    /**
+     * @brief Class constructor. Selects best instruction set of current CPU.
+     */
+    ColorConverter();
+
+    /**
+     * @brief Get best instruction set supported by current CPU.
+     * @return Instruction set.
+     */
+    static ColorConverterIsa getBestIsa();
+
+    /**
+     * @brief Check if instruction set is supported by build and CPU.
+     * @param isa Instruction set.
+     * @return TRUE if supported or FALSE.
+     */
+    static bool isSupported(ColorConverterIsa isa);
+
+    /**
+     * @brief Get name of instruction set.
+     * @param isa Instruction set.
+     * @return Name of instruction set.
+     */
+    static const char* getIsaName(ColorConverterIsa isa);
+
+    /**
+     * @brief Force instruction set (for tests and benchmarks).
+     * @param isa Instruction set.
+     * @return TRUE if instruction set is supported or FALSE.
+     */
+    bool setIsa(ColorConverterIsa isa);
+
+    /**
+     * @brief Get current instruction set.
+     * @return Instruction set.
+     */
+    ColorConverterIsa getIsa();
+
+    /**
+     * @brief Convert frame. Supported conversions: YU12, NV12, NV21 to BGR24,
+     * RGB24; BGR24, RGB24 to YU12, NV12, NV21; BGR24 <-> RGB24; YUYV, UYVY,
+     * NV12, NV21 to YU12.
+     * @param src Source frame.
+     * @param dst Destination frame. Re-allocated if size differs from src.
+     * @return TRUE if the frame was converted or FALSE.
+     */
+    bool convert(cr::video::Frame& src, cr::video::Frame& dst);
+
+    /**
+     * @brief Downscale YU12, NV12 or NV21 frame to several YU12 frames in one
+     * pass over source.
+     * @param src Source frame.
+     * @param dst Destination YU12 frames (up to 16). Sizes of frames define
+     * output sizes, sizes must be even and not bigger than source size.
+     * @param count Number of destination frames.
+     * @return TRUE if the frames were scaled or FALSE.
+     */
+    bool downscale(cr::video::Frame& src, cr::video::Frame** dst, int count);
+
+    /**
+     * @brief Downscale 8 bit plane to several sizes in one pass. Source is
+     * halved by 2x2 box filter to pyramid levels, each destination is
+     * interpolated bilinearly from the smallest level which is not smaller
+     * than destination. Source is processed by bands of rows, each band is
+     * used by all levels and destinations while it is in CPU cache.
+     * @param src Source plane.
+     * @param srcStride Source plane stride.
+     * @param width Source width.
+     * @param height Source height.
+     * @param dst Destination planes (up to 16), not bigger than source.
+     * @param count Number of destination planes.
+     * @return TRUE if the planes were scaled or FALSE.
+     */
+    bool downscale(const uint8_t* src, int srcStride, int width, int height,
+                   const ColorConverterPlane* dst, int count);
+
+    /**
+     * @brief Convert I420 (YU12) planes to packed BGR24 or RGB24.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param u U plane.
+     * @param uStride U plane stride.
+     * @param v V plane.
+     * @param vStride V plane stride.
+     * @param dst Destination image.
+     * @param dstStride Destination image stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param rgb TRUE - RGB24 output, FALSE - BGR24 output.
+     */
+    void i420ToBgr(const uint8_t* y, int yStride, const uint8_t* u, int uStride,
+                   const uint8_t* v, int vStride, uint8_t* dst, int dstStride,
+                   int width, int height, bool rgb);
+
+    /**
+     * @brief Convert NV12 or NV21 planes to packed BGR24 or RGB24.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param uv Interleaved chroma plane.
+     * @param uvStride Chroma plane stride.
+     * @param dst Destination image.
+     * @param dstStride Destination image stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param rgb TRUE - RGB24 output, FALSE - BGR24 output.
+     * @param nv21 TRUE - V first in chroma plane, FALSE - U first.
+     */
+    void nv12ToBgr(const uint8_t* y, int yStride, const uint8_t* uv, int uvStride,
+                   uint8_t* dst, int dstStride, int width, int height,
+                   bool rgb, bool nv21);
+
+    /**
+     * @brief Convert packed BGR24 or RGB24 to I420 (YU12) planes.
+     * @param src Source image.
+     * @param srcStride Source image stride.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param u U plane.
+     * @param uStride U plane stride.
+     * @param v V plane.
+     * @param vStride V plane stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param rgb TRUE - RGB24 input, FALSE - BGR24 input.
+     */
+    void bgrToI420(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                   uint8_t* u, int uStride, uint8_t* v, int vStride,
+                   int width, int height, bool rgb);
+
+    /**
+     * @brief Convert packed BGR24 or RGB24 to NV12 or NV21 planes.
+     * @param src Source image.
+     * @param srcStride Source image stride.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param uv Interleaved chroma plane.
+     * @param uvStride Chroma plane stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param rgb TRUE - RGB24 input, FALSE - BGR24 input.
+     * @param nv21 TRUE - V first in chroma plane, FALSE - U first.
+     */
+    void bgrToNv12(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                   uint8_t* uv, int uvStride, int width, int height,
+                   bool rgb, bool nv21);
+
+    /**
+     * @brief Convert NV12 or NV21 planes to I420 (YU12) planes: copy Y plane
+     * and split interleaved chroma plane.
+     * @param srcY Source Y plane.
+     * @param srcYStride Source Y plane stride.
+     * @param uv Source interleaved chroma plane.
+     * @param uvStride Source chroma plane stride.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param u U plane.
+     * @param uStride U plane stride.
+     * @param v V plane.
+     * @param vStride V plane stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param nv21 TRUE - V first in chroma plane, FALSE - U first.
+     */
+    void nv12ToI420(const uint8_t* srcY, int srcYStride, const uint8_t* uv, int uvStride,
+                    uint8_t* y, int yStride, uint8_t* u, int uStride, uint8_t* v, int vStride,
+                    int width, int height, bool nv21);
+
+    /**
+     * @brief Swap R and B channels of packed 24 bit image (BGR24 <-> RGB24).
+     * @param src Source image.
+     * @param srcStride Source image stride.
+     * @param dst Destination image.
+     * @param dstStride Destination image stride.
+     * @param width Image width.
+     * @param height Image height.
+     */
+    void bgrToRgb(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride,
+                  int width, int height);
+
+    /**
+     * @brief Convert packed YUYV or UYVY (4:2:2) to I420 (YU12) planes.
+     * Chroma of two rows is averaged.
+     * @param src Source image.
+     * @param srcStride Source image stride.
+     * @param y Y plane.
+     * @param yStride Y plane stride.
+     * @param u U plane.
+     * @param uStride U plane stride.
+     * @param v V plane.
+     * @param vStride V plane stride.
+     * @param width Image width.
+     * @param height Image height.
+     * @param uyvy TRUE - UYVY input, FALSE - YUYV input.
+     */
+    void yuyvToI420(const uint8_t* src, int srcStride, uint8_t* y, int yStride,
+                    uint8_t* u, int uStride, uint8_t* v, int vStride,
+                    int width, int height, bool uyvy);
+
+    /**
+     * @brief Row kernel: YUV 4:2:0 row to packed BGR24 / RGB24. Chroma samples
+     * are read with uvStep (1 - planar, 2 - interleaved).
+     */
+    typedef void (*YuvToBgrRow)(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                                int uvStep, uint8_t* dst, int width, bool rgb);
+
+    /**
+     * @brief Row kernel: two rows of packed BGR24 / RGB24 to two Y rows and
+     * one chroma row. Chroma samples are written with uvStep.
+     */
+    typedef void (*BgrToYuvRow)(const uint8_t* src0, const uint8_t* src1,
+                                uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                                int uvStep, int width, bool rgb);
+
+    /**
+     * @brief Row kernel: two rows of YUYV / UYVY to two Y rows and one row of
+     * U and V.
+     */
+    typedef void (*YuyvToYuvRow)(const uint8_t* src0, const uint8_t* src1,
+                                 uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                                 int width, bool uyvy);
+
+    /**
+     * @brief Row kernel: swap R and B channels of packed 24 bit row.
+     */
+    typedef void (*SwapRbRow)(const uint8_t* src, uint8_t* dst, int width);
+
+    /**
+     * @brief Row kernel: split interleaved chroma row to U and V rows.
+     */
+    typedef void (*SplitUvRow)(const uint8_t* uv, uint8_t* u, uint8_t* v, int count);
+
+    /**
+     * @brief Row kernel: halve two rows to one row by 2x2 box filter.
+     */
+    typedef void (*HalveRow)(const uint8_t* src0, const uint8_t* src1, uint8_t* dst, int width);
+
+    /**
+     * @brief Row kernel: blend two rows with 8 bit weight of second row (1..255).
+     */
+    typedef void (*BlendRow)(const uint8_t* src0, const uint8_t* src1, uint8_t* dst,
+                             int width, int weight);
+
+private:
+
+    /// Current instruction set.
+    ColorConverterIsa m_isa{ColorConverterIsa::SCALAR};
+    /// YUV to BGR row kernel.
+    YuvToBgrRow m_yuvToBgrRow{nullptr};
+    /// BGR to YUV row kernel.
+    BgrToYuvRow m_bgrToYuvRow{nullptr};
+    /// YUYV to YUV row kernel.
+    YuyvToYuvRow m_yuyvToYuvRow{nullptr};
+    /// R and B swap row kernel.
+    SwapRbRow m_swapRbRow{nullptr};
+    /// Chroma split row kernel.
+    SplitUvRow m_splitUvRow{nullptr};
+    /// Pyramid row kernel.
+    HalveRow m_halveRow{nullptr};
+    /// Vertical interpolation row kernel.
+    BlendRow m_blendRow{nullptr};
+    /// Downscaling buffer: pyramid levels and interpolated row.
+    std::vector<uint8_t> m_scaleBuffer;
+    /// U and V planes of NV12 / NV21 source of downscaling.
+    std::vector<uint8_t> m_chromaBuffer;
+    /// Horizontal interpolation tables of destinations: position and weight.
+    std::vector<int> m_scaleTables;
+};
@@ -1,44 +1,229 @@
 #include "VideoCodec.h"
 #include "VideoCodecVersion.h"
 
+
+
+/// x264 and x265 preset names in order of VideoCodecPreset.
+static const char* g_presetNames[] = {"ultrafast", "superfast", "veryfast", "faster",
+                                      "fast", "medium", "slow", "slower", "veryslow"};
+
+
+
+/// x264 speed params of adaptive preset levels.
+struct H264SpeedLevel
+{
+    int subme;
+    int meMethod;
+    int meRange;
+    int ref;
+    unsigned int intra;
+    unsigned int inter;
+    int trellis;
+    int mixedRefs;
+    int transform8x8;
+    int deblock;
+};
+
+/// x264 speed levels in order of VideoCodecPreset (values of x264 presets).
+/// Subpixel refinement is at least 1 because x264 can't leave subme 0 by
+/// reconfiguration.
+static const H264SpeedLevel g_h264Speed[] =
+{
+    {1, X264_ME_DIA, 16, 1, 0, 0, 0, 0, 0, 0},
+    {1, X264_ME_DIA, 16, 1, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8, 0, 0, 1, 1},
+    {2, X264_ME_HEX, 16, 1, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16, 0, 0, 1, 1},
+    {4, X264_ME_HEX, 16, 2, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16, 1, 0, 1, 1},
+    {6, X264_ME_HEX, 16, 2, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16, 1, 1, 1, 1},
+    {7, X264_ME_HEX, 16, 3, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16, 1, 1, 1, 1},
+    {8, X264_ME_UMH, 16, 5, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16, 2, 1, 1, 1},
+    {9, X264_ME_UMH, 16, 8, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_PSUB8x8 |
+     X264_ANALYSE_BSUB16x16, 2, 1, 1, 1},
+    {10, X264_ME_UMH, 24, 16, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+     X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_PSUB8x8 |
+     X264_ANALYSE_BSUB16x16, 2, 1, 1, 1}
+};
+
+
+
+/// x265 speed params of adaptive preset levels.
+struct H265SpeedLevel
+{
+    int subme;
+    int searchMethod;
+    int refs;
+    int mergeCand;
+    int rdLevel;
+    int rdoqLevel;
+    int rectInter;
+    int earlySkip;
+    int fastIntra;
+};
+
+/// x265 speed levels in order of VideoCodecPreset (values of x265 presets).
+/// Subpixel refinement is at least 1 because x265 can't leave subme 0 by
+/// reconfiguration.
+static const H265SpeedLevel g_h265Speed[] =
+{
+    {1, X265_DIA_SEARCH, 1, 2, 2, 0, 0, 1, 1},
+    {1, X265_HEX_SEARCH, 1, 2, 2, 0, 0, 1, 1},
+    {1, X265_HEX_SEARCH, 2, 2, 2, 0, 0, 1, 1},
+    {2, X265_HEX_SEARCH, 2, 2, 2, 0, 0, 1, 1},
+    {2, X265_HEX_SEARCH, 3, 2, 2, 0, 0, 1, 1},
+    {2, X265_HEX_SEARCH, 3, 3, 3, 0, 0, 1, 0},
+    {3, X265_STAR_SEARCH, 4, 3, 4, 2, 1, 0, 0},
+    {3, X265_STAR_SEARCH, 5, 4, 6, 2, 1, 0, 0},
+    {4, X265_STAR_SEARCH, 5, 5, 6, 2, 1, 0, 0}
+};
+
+
+
+/// Size type of libav buffer API (int before libavutil 57).
+#if LIBAVUTIL_VERSION_MAJOR < 57
+typedef int AvBufferSize;
+#else
+typedef size_t AvBufferSize;
+#endif
+
+/// Context of libav buffer pool which allocates buffers by codec allocator.
+/// Context is released by libav when pool and all its buffers are released,
+/// so decoded pictures can outlive decoder and codec.
+struct BufferPoolContext
+{
+    /// Allocator of pool buffers.
+    std::shared_ptr<VideoCodecAllocator> allocator;
+    /// Size of pool buffers.
+    size_t size;
+};
+
+static void freePoolBuffer(void *opaque, uint8_t *data)
+{
+    BufferPoolContext *context = static_cast<BufferPoolContext*>(opaque);
+    context->allocator->deallocate(data, context->size);
+}
+
+static AVBufferRef* allocPoolBuffer(void *opaque, AvBufferSize size)
+{
+    BufferPoolContext *context = static_cast<BufferPoolContext*>(opaque);
+    uint8_t *data = context->allocator->allocate(context->size);
+    if (data == nullptr)
+    {
+        return nullptr;
+    }
+    AVBufferRef *buffer = av_buffer_create(data, size, freePoolBuffer, context, 0);
+    if (buffer == nullptr)
+    {
+        context->allocator->deallocate(data, context->size);
+    }
+    return buffer;
+}
+
+static void freePoolContext(void *opaque)
+{
+    delete static_cast<BufferPoolContext*>(opaque);
+}
+
+
+
+VideoCodecBufferPool::VideoCodecBufferPool(size_t maxCachedBytes) :
+    m_maxCachedBytes(maxCachedBytes)
+{
+}
+
+VideoCodecBufferPool::~VideoCodecBufferPool()
+{
+    trim();
+}
+
+uint8_t *VideoCodecBufferPool::allocate(size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_buffers.find(size);
+        if (it != m_buffers.end() && !it->second.empty())
+        {
+            uint8_t *data = it->second.back();
+            it->second.pop_back();
+            m_cachedBytes -= size;
+            return data;
+        }
+        ++m_heapAllocations;
+    }
+
+    // av_malloc() aligns buffers for SIMD of libav and converter.
+    return static_cast<uint8_t*>(av_malloc(size));
+}
+
+void VideoCodecBufferPool::deallocate(uint8_t *data, size_t size)
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cachedBytes + size <= m_maxCachedBytes)
+        {
+            m_buffers[size].push_back(data);
+            m_cachedBytes += size;
+            return;
+        }
+    }
+
+    av_free(data);
+}
+
+void VideoCodecBufferPool::trim()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &buffers : m_buffers)
+    {
+        for (uint8_t *data : buffers.second)
+        {
+            av_free(data);
+        }
+    }
+    m_buffers.clear();
+    m_cachedBytes = 0;
+}
+
+uint64_t VideoCodecBufferPool::getHeapAllocations()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_heapAllocations;
+}
+
+
+
 VideoCodec::~VideoCodec()
 {
-    if (m_encoderInit)
+    // Stop worker thread before releasing encoders.
+    if (m_workerRunning)
     {
-        switch (m_pixelFormat)
         {
-        case cr::video::Fourcc::H264:
-            x264_picture_clean(&m_h264PicIn);
-            x264_encoder_close(m_h264Encoder);
-            m_h264Encoder = nullptr;
-            break;
-        case cr::video::Fourcc::HEVC:
-            x265_picture_free(m_h265PicIn);
-            m_h265PicIn = nullptr;
-            x265_encoder_close(m_h265Encoder);
-            m_h265Encoder = nullptr;
-            delete[] m_h265InternalBuffer;
-            m_h265InternalBuffer = nullptr;
-            break;
-        case cr::video::Fourcc::JPEG:
-            delete[] jpeg_buffer;
-            jpeg_buffer = nullptr;
-            jpeg_destroy_compress(&cinfo);
-            break;
-        default:
-            break;
+            std::lock_guard<std::mutex> lock(m_inMutex);
+            m_workerStop = true;
         }
+        m_inCond.notify_all();
+        m_workerThread.join();
+        m_workerRunning = false;
     }
 
+    // Close active encoder and parked sessions of all formats.
+    stopJpegBandThreads();
+    releaseEncoder();
+    releaseEncoderSessions();
+
     if (m_decoderInit)
     {
-        // It is h264 decoder
-        av_frame_free(&frame);
-        av_packet_free(&packet);
-        avcodec_free_context(&codec_ctx);
-
-        // Release sws context
-        sws_freeContext(sws_ctx);
+        releaseDecoder();
     }
 }
 
@@ -49,45 +234,185 @@ std::string VideoCodec::getVersion()
 
 bool VideoCodec::encode(cr::video::Frame &src, cr::video::Frame &dst)
 {
-    // Check of input frame is valid and destination frame has correct pixel format.
-    if (dst.fourcc != cr::video::Fourcc::H264 && dst.fourcc != cr::video::Fourcc::HEVC && dst.fourcc != cr::video::Fourcc::JPEG)
+    // Default layout of tightly packed frame.
+    return encode(src, VideoCodecPlaneLayout(), dst);
+}
+
+bool VideoCodec::encode(cr::video::Frame &src, const VideoCodecPlaneLayout &layout,
+                        cr::video::Frame &dst)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+
+    // Encode frame. Encoded data stays in encoder memory until next call.
+    if (!encodeFrame(src, layout, dst.fourcc))
+    {
+        ++m_stats.failedEncodes;
+        return false;
+    }
+    StageScope scope(*this, m_stats.nalGather, "VideoCodec::nalGather");
+
+    // Check if destination frame has enough memory
+    int totalSize = 0;
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        totalSize += nal.size;
+    }
+    reserveDst(dst, src.width, src.height, dst.fourcc, totalSize, m_dstData, m_dstCapacity);
+
+    // Copy NAL data to destination frame
+    int offset = 0;
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        memcpy(dst.data + offset, nal.data, nal.size);
+        offset += nal.size;
+    }
+    dst.size = offset; // Set correct size for the encoded frame
+    // Delayed encoder output has no encoded frame.
+    dst.frameId = m_nals.empty() ? src.frameId : static_cast<uint32_t>(m_outPts);
+
+    return true;
+}
+
+bool VideoCodec::encode(cr::video::Frame &src, cr::video::Fourcc fourcc,
+                        std::vector<VideoCodecNal> &nals, const VideoCodecPlaneLayout &layout)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    if (!encodeFrame(src, layout, fourcc))
+    {
+        ++m_stats.failedEncodes;
+        nals.clear();
+        return false;
+    }
+
+    // Only views are copied, vector keeps its capacity between calls.
+    nals = m_nals;
+
+    return true;
+}
+
+bool VideoCodec::encode(cr::video::Frame &src, cr::video::Fourcc fourcc, uint8_t *buffer,
+                        int capacity, int &size, const VideoCodecPlaneLayout &layout)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    size = 0;
+    if (!encodeFrame(src, layout, fourcc))
+    {
+        ++m_stats.failedEncodes;
+        return false;
+    }
+    StageScope scope(*this, m_stats.nalGather, "VideoCodec::nalGather");
+
+    // Check if encoded data fits into the buffer
+    int totalSize = 0;
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        totalSize += nal.size;
+    }
+    if (buffer == nullptr || totalSize > capacity)
+    {
+        std::cout << "Output buffer is too small" << std::endl;
+        size = totalSize; // Required capacity
+        return false;
+    }
+
+    // Copy NAL data to the buffer
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        memcpy(buffer + size, nal.data, nal.size);
+        size += nal.size;
+    }
+
+    return true;
+}
+
+bool VideoCodec::encodeFrame(cr::video::Frame &src, const VideoCodecPlaneLayout &layout,
+                             cr::video::Fourcc fourcc)
+{
+    // Check if codec type is valid.
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC && fourcc != cr::video::Fourcc::JPEG)
     {
         std::cout << "Invalid pixel format" << std::endl;
         return false;
     }
 
-    // Check if input frame is valid
-    switch (dst.fourcc)
+    // Check if input frame is valid.
+    switch (src.fourcc)
     {
-    case cr::video::Fourcc::H264: [[fallthrough]];
-    case cr::video::Fourcc::HEVC:
-        if (src.fourcc != cr::video::Fourcc::YU12)
-        {
-            std::cout << "Invalid pixel format" << std::endl;
-            return false;
-        }
-        break;
-    case cr::video::Fourcc::JPEG:
-        if (src.fourcc != cr::video::Fourcc::RGB24)
-        {
-            std::cout << "Invalid pixel format" << std::endl;
-            return false;
-        }
+    case cr::video::Fourcc::YU12: [[fallthrough]];
+    case cr::video::Fourcc::YV12: [[fallthrough]];
+    case cr::video::Fourcc::NV12: [[fallthrough]];
+    case cr::video::Fourcc::NV21: [[fallthrough]];
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY: [[fallthrough]];
+    case cr::video::Fourcc::BGR24: [[fallthrough]];
+    case cr::video::Fourcc::RGB24:
         break;
     default:
+        std::cout << "Invalid pixel format" << std::endl;
+        return false;
+    }
+    // Subsampled formats and RGB converted to I420 for x264 / x265 require
+    // even size, JPEG encoder takes RGB rows of any size.
+    bool rgb = src.fourcc == cr::video::Fourcc::BGR24 || src.fourcc == cr::video::Fourcc::RGB24;
+    bool evenSize = !rgb || fourcc != cr::video::Fourcc::JPEG;
+    if (src.width <= 0 || src.height <= 0 || (evenSize && (src.width % 2 != 0 || src.height % 2 != 0)))
+    {
+        std::cout << "Invalid frame size" << std::endl;
         return false;
     }
 
-    // Check if destination frame has enough memory
-    if (dst.width != src.width || dst.height != src.height)
+    // Check if all source planes are inside source frame data
+    VideoCodecPlaneLayout planes;
+    if (!getPlaneLayout(src, layout, planes))
     {
-        dst.release();
-        dst = cr::video::Frame(src.width, src.height, dst.fourcc);
+        std::cout << "Invalid source frame layout" << std::endl;
+        return false;
+    }
+
+    // Get frame in format accepted by encoder, convert if necessary
+    cr::video::Frame *input = nullptr;
+    VideoCodecPlaneLayout inputLayout;
+    {
+        StageScope scope(*this, m_stats.input, "VideoCodec::input");
+        prepareEncoderInput(src, planes, fourcc, input, inputLayout);
+    }
+
+    // Parked sessions were opened with previous params. Band threads are
+    // started again for bands of new encoder.
+    if (m_encoderReinit)
+    {
+        stopJpegBandThreads();
+        releaseEncoderSessions();
+    }
+
+    // Reuse open encoder of this format and resolution instead of
+    // re-initialization.
+    if (m_encoderInit && !m_encoderReinit && m_encoderCacheSize > 0 &&
+        (m_width != src.width || m_height != src.height || m_pixelFormat != fourcc ||
+         m_inputFourcc != input->fourcc))
+    {
+        switchEncoderSession(fourcc, src.width, src.height, input->fourcc);
+    }
+
+    // Apply rate control changes to running encoder without re-initialization
+    // if encoder supports them.
+    if (m_encoderReconfig && m_encoderInit && !m_encoderReinit && m_pixelFormat == fourcc &&
+        !reconfigEncoder())
+    {
+        m_encoderReinit = true;
     }
+    m_encoderReconfig = false;
 
-    if (!m_encoderInit || (m_width != src.width) || (m_height != src.height) || (m_pixelFormat != dst.fourcc))
+    if (!m_encoderInit || m_encoderReinit || m_encoderFlushed || (m_width != src.width) ||
+        (m_height != src.height) || (m_pixelFormat != fourcc) || (m_inputFourcc != input->fourcc))
     {
-        switch (dst.fourcc)
+        // Close encoder of any format before initialization.
+        releaseEncoder();
+
+        // Encoder input colorspace depends on source format
+        m_inputFourcc = input->fourcc;
+
+        switch (fourcc)
         {
         case cr::video::Fourcc::H264:
             if (!initH264Encoder(src.width, src.height))
@@ -113,27 +438,35 @@ bool VideoCodec::encode(cr::video::Frame &src, cr::video::Frame &dst)
 
         m_width = src.width;
         m_height = src.height;
-        m_pixelFormat = dst.fourcc;
+        m_pixelFormat = fourcc;
         m_encoderInit = true;
+        m_encoderReinit = false;
+        m_encoderFlushed = false;
+        m_openGopSize = m_gopSize;
+        m_framesSinceIdr = 0;
+        m_encodeTimeMs = 0.0;
+        m_framesSinceSpeedChange = 0;
+        ++m_stats.encoderInits;
     }
 
     // Encode frame
-    switch (dst.fourcc)
+    StageScope scope(*this, m_stats.encode, "VideoCodec::encode");
+    switch (fourcc)
     {
     case cr::video::Fourcc::H264:
-        if (!encodeH264Frame(src, dst))
+        if (!encodeH264Frame(*input, inputLayout))
         {
             return false;
         }
         break;
     case cr::video::Fourcc::HEVC:
-        if (!encodeH265Frame(src, dst))
+        if (!encodeH265Frame(*input, inputLayout))
         {
             return false;
         }
         break;
     case cr::video::Fourcc::JPEG:
-        if (!encodeJpegFrame(src, dst))
+        if (!encodeJpegFrame(*input, inputLayout))
         {
             return false;
         }
@@ -142,353 +475,3614 @@ bool VideoCodec::encode(cr::video::Frame &src, cr::video::Frame &dst)
         return false;
     }
 
+    double encodeTimeMs = scope.finish();
+    ++m_stats.encodedFrames;
+    m_stats.encoderBytesIn += static_cast<uint64_t>(src.size);
+    outputNals();
+
+    // Adapt encoder speed to encoding time.
+    if (m_adaptivePreset && fourcc != cr::video::Fourcc::JPEG)
+    {
+        updateEncoderSpeed(encodeTimeMs);
+    }
+    checkStatsCallback();
+
     return true;
 }
 
 bool VideoCodec::decode(cr::video::Frame &src, cr::video::Frame &dst)
 {
-    // Check if input frame is valid
-    if (src.fourcc != cr::video::Fourcc::H264 && src.fourcc != cr::video::Fourcc::HEVC && src.fourcc != cr::video::Fourcc::JPEG || dst.fourcc != cr::video::Fourcc::BGR24)
+    // Check if destination frame has supported pixel format
+    if (dst.fourcc != cr::video::Fourcc::BGR24 && dst.fourcc != cr::video::Fourcc::YU12 &&
+        dst.fourcc != cr::video::Fourcc::NV12 && dst.fourcc != cr::video::Fourcc::NV21)
     {
         std::cout << "Invalid pixel format" << std::endl;
+        ++m_stats.failedDecodes;
         return false;
     }
 
-    if (!m_decoderInit)
+    // Decode frame
+    if (!filterPacket(src))
     {
-        if (!initDecoder(src))
+        return false;
+    }
+    if (!prepareDecoder(src))
+    {
+        ++m_stats.failedDecodes;
+        return false;
+    }
+    m_stats.decoderBytesIn += static_cast<uint64_t>(src.size);
+    if (m_jpegDecoderInit)
+    {
+        // JPEG is decoded directly to destination frame.
+        StageScope scope(*this, m_stats.decode, "VideoCodec::decode");
+        if (!decodeJpegFrame(src, dst))
+        {
+            ++m_stats.failedDecodes;
+            return false;
+        }
+        scope.finish();
+        ++m_stats.decodedFrames;
+        m_stats.decoderBytesOut += static_cast<uint64_t>(dst.size);
+        checkStatsCallback();
+        return true;
+    }
+    {
+        StageScope scope(*this, m_stats.decode, "VideoCodec::decode");
+        if (!decodeFrame(src))
         {
-            std::cout << "Failed to initialize decoder" << std::endl;
             return false;
         }
-
-        m_decoderInit = true;
     }
 
+    return outputDecodedFrame(dst);
+}
+
+bool VideoCodec::decode(cr::video::Frame &src, VideoCodecPicture &dst)
+{
     // Decode frame
-    if (!decodeFrame(src, dst))
+    if (!filterPacket(src))
+    {
+        return false;
+    }
+    if (!prepareDecoder(src))
     {
+        ++m_stats.failedDecodes;
         return false;
     }
+    m_stats.decoderBytesIn += static_cast<uint64_t>(src.size);
+    {
+        StageScope scope(*this, m_stats.decode, "VideoCodec::decode");
+        if (m_jpegDecoderInit ? !decodeJpegPicture(src, frame) : !decodeFrame(src))
+        {
+            if (m_jpegDecoderInit)
+            {
+                ++m_stats.failedDecodes;
+            }
+            return false;
+        }
+    }
+    ++m_stats.decodedFrames;
+    checkStatsCallback();
+
+    // Pass decoder buffers reference to the picture without copy.
+    av_frame_unref(dst.m_frame);
+    av_frame_move_ref(dst.m_frame, frame);
 
     return true;
 }
 
-bool VideoCodec::initH264Encoder(int width, int height)
+bool VideoCodec::receiveFrame(cr::video::Frame &dst)
 {
-    // Check if it is already initialized and release resources
-    if (m_h264Encoder != nullptr)
+    if (!m_decoderInit || !receiveDecodedFrame())
     {
-        x264_picture_clean(&m_h264PicIn);
-        x264_encoder_close(m_h264Encoder);
+        return false;
     }
 
-    // Get default parameters
-    x264_param_default_preset(&m_h264Param, "ultrafast", "zerolatency");
-
-    // Initialize x264
-    m_h264Param.i_width = width;
-    m_h264Param.i_height = height;
-    m_h264Param.i_csp = X264_CSP_I420;
-    m_h264Param.i_bitdepth = 8;
-    m_h264Param.b_vfr_input = 0;
-    m_h264Param.b_repeat_headers = 1;
-    m_h264Param.b_annexb = 1;
-    // Set bitrate
-    m_h264Param.rc.i_bitrate = m_bitrate;
-    m_h264Param.rc.i_rc_method = X264_RC_CRF;
-    // Set GOP size
-    m_h264Param.i_keyint_max = 30;
-    // Set frame rate
-    m_h264Param.i_fps_num = 30;
-    // Set number of threads
-    m_h264Param.i_threads = 1;
+    return outputDecodedFrame(dst);
+}
 
-    // Apply profile
-    if (x264_param_apply_profile(&m_h264Param, "baseline") < 0)
+bool VideoCodec::receiveFrame(VideoCodecPicture &dst)
+{
+    if (!m_decoderInit || !receiveDecodedFrame())
     {
-        std::cout << "x264_param_apply_profile failed" << std::endl;
         return false;
     }
 
-    // Allocate picture
-    if (x264_picture_alloc(&m_h264PicIn, m_h264Param.i_csp, m_h264Param.i_width, m_h264Param.i_height) < 0)
+    av_frame_unref(dst.m_frame);
+    av_frame_move_ref(dst.m_frame, frame);
+    ++m_stats.decodedFrames;
+
+    return true;
+}
+
+bool VideoCodec::flushDecoder()
+{
+    if (!m_decoderInit)
     {
-        std::cout << "x264_picture_alloc failed" << std::endl;
         return false;
     }
 
-    // Open encoder
-    m_h264Encoder = x264_encoder_open(&m_h264Param);
+    // JPEG decoder has no delayed frames.
+    if (m_jpegDecoderInit)
+    {
+        return true;
+    }
+
+    // Empty packet switches decoder to draining mode.
+    if (avcodec_send_packet(codec_ctx, nullptr) < 0)
+    {
+        std::cout << "Error flushing decoder" << std::endl;
+        return false;
+    }
 
     return true;
 }
 
-bool VideoCodec::encodeH264Frame(cr::video::Frame &src, cr::video::Frame &dst)
+bool VideoCodec::submitFrame(cr::video::Frame &src, cr::video::Fourcc fourcc)
 {
-    // Copy Y plane
-    memcpy(m_h264PicIn.img.plane[0], src.data, src.width * src.height);
-    // Copy U plane
-    memcpy(m_h264PicIn.img.plane[1], src.data + src.width * src.height, src.width * src.height / 4);
-    // Copy V plane
-    memcpy(m_h264PicIn.img.plane[2], src.data + src.width * src.height * 5 / 4, src.width * src.height / 4);
-
-    int i_frame = 0; // Number of NAL units
-    // Encode frame
-    x264_nal_t *nal;
-    int i_frame_size = x264_encoder_encode(m_h264Encoder, &nal, &i_frame, &m_h264PicIn, &m_h264PicOut);
-    if (i_frame_size < 0)
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC && fourcc != cr::video::Fourcc::JPEG)
     {
-        std::cout << "x264_encoder_encode failed" << std::endl;
+        std::cout << "Invalid pixel format" << std::endl;
         return false;
     }
 
-    // Copy NAL data to destination frame
-    int offset = 0;
-    for (int i = 0; i < i_frame; ++i)
+    std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+    // Start worker thread on first frame
+    if (!m_workerRunning)
     {
-        memcpy(dst.data + offset, nal[i].p_payload, nal[i].i_payload);
-        offset += nal[i].i_payload;
+        m_inQueue.resize(m_queueSize);
+        m_inHead = 0;
+        m_inCount = 0;
+        m_workerStop = false;
+        m_workerRunning = true;
+        m_workerThread = std::thread(&VideoCodec::workerThreadFunc, this);
     }
-    dst.size = offset; // Set correct size for the encoded frame
+
+    // Wait for free slot
+    int index = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_inMutex);
+        m_inCond.wait(lock, [this]{ return m_inCount < static_cast<int>(m_inQueue.size()); });
+        index = (m_inHead + m_inCount) % static_cast<int>(m_inQueue.size());
+    }
+
+    // Copy frame outside of lock. Worker doesn't touch slots behind m_inCount.
+    // Frame buffer is reused if frame size is not changed.
+    InputSlot &slot = m_inQueue[index];
+    slot.frame = src;
+    slot.fourcc = fourcc;
+    slot.endOfStream = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_inMutex);
+        ++m_inCount;
+    }
+    m_inCond.notify_all();
 
     return true;
 }
 
-bool VideoCodec::initH265Encoder(int width, int height)
+bool VideoCodec::receivePacket(cr::video::Frame &dst, int timeoutMs)
 {
-    // Check if it is already initialized and release resources
-    if (m_h265Encoder != nullptr)
+    std::unique_lock<std::mutex> lock(m_outMutex);
+    auto ready = [this]{ return !m_outQueue.empty() || m_outEndOfStream; };
+    if (timeoutMs < 0)
     {
-        x265_picture_free(m_h265PicIn);
-        x265_encoder_close(m_h265Encoder);
-        delete[] m_h265InternalBuffer;
-        m_h265InternalBuffer = nullptr;
-        m_h265PicIn = nullptr;
+        m_outCond.wait(lock, ready);
     }
+    else if (!m_outCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready))
+    {
+        return false;
+    }
+
+    // All packets of flushed stream were received.
+    if (m_outQueue.empty())
+    {
+        m_outEndOfStream = false;
+        return false;
+    }
+
+    Packet &packet = m_outQueue.front();
+
+    // Check if destination frame has enough memory
+    reserveDst(dst, packet.width, packet.height, packet.fourcc, static_cast<int>(packet.data.size()),
+               m_packetDstData, m_packetDstCapacity);
+    memcpy(dst.data, packet.data.data(), packet.data.size());
+    dst.size = static_cast<int>(packet.data.size());
+    dst.frameId = packet.frameId;
+
+    // Keep packet memory for next packets
+    m_freePackets.push_back(std::move(packet));
+    m_outQueue.pop_front();
+
+    return true;
+}
+
+void VideoCodec::reserveDst(cr::video::Frame &dst, int width, int height, cr::video::Fourcc fourcc, int size,
+                            uint8_t *&lastData, int &lastCapacity)
+{
+    // Frame size field is overwritten by size of compressed data, so
+    // allocated size of frames allocated by codec is kept. Size of other
+    // frames is their allocated size.
+    int capacity = dst.data != nullptr && dst.data == lastData ? lastCapacity : dst.size;
+    if (dst.data == nullptr || dst.width != width || dst.height != height || dst.fourcc != fourcc)
+    {
+        dst.release();
+        dst = cr::video::Frame(width, height, fourcc);
+        capacity = dst.size;
+    }
+    if (size > capacity)
+    {
+        dst.release();
+        dst = cr::video::Frame(width, height, fourcc, size);
+        capacity = size;
+    }
+    lastData = dst.data;
+    lastCapacity = capacity;
+}
+
+bool VideoCodec::flush()
+{
+    std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+    // Synchronous mode: drain encoder in caller thread.
+    if (!m_workerRunning)
+    {
+        bool result = false;
+        {
+            std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+            result = drainEncoder();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_outMutex);
+            m_outEndOfStream = true;
+        }
+        m_outCond.notify_all();
+        return result;
+    }
+
+    // Put end of stream marker to input queue to keep frames order.
+    {
+        std::unique_lock<std::mutex> lock(m_inMutex);
+        m_inCond.wait(lock, [this]{ return m_inCount < static_cast<int>(m_inQueue.size()); });
+        int index = (m_inHead + m_inCount) % static_cast<int>(m_inQueue.size());
+        m_inQueue[index].endOfStream = true;
+        ++m_inCount;
+    }
+    m_inCond.notify_all();
+
+    return true;
+}
+
+void VideoCodec::setNalCallback(VideoCodecNalCallback callback)
+{
+    // x264 slice callback is set when encoder is opened.
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    m_nalCallback = callback;
+    m_encoderReinit = true;
+}
+
+VideoCodecStats VideoCodec::getStats()
+{
+    VideoCodecStats stats;
+    stats.encodedFrames = m_stats.encodedFrames;
+    stats.decodedFrames = m_stats.decodedFrames;
+    stats.failedEncodes = m_stats.failedEncodes;
+    stats.failedDecodes = m_stats.failedDecodes;
+    stats.droppedFrames = m_stats.droppedFrames;
+    stats.encoderInits = m_stats.encoderInits;
+    stats.decoderInits = m_stats.decoderInits;
+    stats.decoderFormatChanges = m_stats.decoderFormatChanges;
+    stats.decoderFilteredPackets = m_stats.decoderFilteredPackets;
+    stats.encoderBytesIn = m_stats.encoderBytesIn;
+    stats.encoderBytesOut = m_stats.encoderBytesOut;
+    stats.decoderBytesIn = m_stats.decoderBytesIn;
+    stats.decoderBytesOut = m_stats.decoderBytesOut;
+    m_stats.input.read(stats.input);
+    m_stats.encode.read(stats.encode);
+    m_stats.nalGather.read(stats.nalGather);
+    m_stats.decode.read(stats.decode);
+    m_stats.convert.read(stats.convert);
+    return stats;
+}
+
+void VideoCodec::resetStats()
+{
+    m_stats.encodedFrames = 0;
+    m_stats.decodedFrames = 0;
+    m_stats.failedEncodes = 0;
+    m_stats.failedDecodes = 0;
+    m_stats.droppedFrames = 0;
+    m_stats.encoderInits = 0;
+    m_stats.decoderInits = 0;
+    m_stats.decoderFormatChanges = 0;
+    m_stats.decoderFilteredPackets = 0;
+    m_stats.encoderBytesIn = 0;
+    m_stats.encoderBytesOut = 0;
+    m_stats.decoderBytesIn = 0;
+    m_stats.decoderBytesOut = 0;
+    m_stats.input.reset();
+    m_stats.encode.reset();
+    m_stats.nalGather.reset();
+    m_stats.decode.reset();
+    m_stats.convert.reset();
+}
+
+void VideoCodec::setStatsCallback(VideoCodecStatsCallback callback, int periodMs)
+{
+    m_statsCallback = callback;
+    m_statsPeriod = std::chrono::milliseconds(std::max(periodMs, 0));
+    m_statsTime = std::chrono::steady_clock::now() + m_statsPeriod;
+}
+
+void VideoCodec::setTraceCallback(VideoCodecTraceCallback callback)
+{
+    m_traceCallback = callback;
+}
+
+void VideoCodec::setAllocator(std::shared_ptr<VideoCodecAllocator> allocator)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    m_allocator = allocator ? allocator : std::make_shared<VideoCodecBufferPool>();
+    m_encoderReinit = true;
+    m_decoderReinit = true;
+}
+
+void VideoCodec::checkStatsCallback()
+{
+    if (!m_statsCallback)
+    {
+        return;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < m_statsTime)
+    {
+        return;
+    }
+    m_statsTime = now + m_statsPeriod;
+    m_statsCallback(getStats());
+}
+
+void VideoCodec::LatencyCounter::add(uint64_t ns)
+{
+    // Bin is index of highest bit of duration in microseconds.
+    uint64_t us = ns / 1000;
+    int bin = 0;
+    while (us > 0 && bin < VideoCodecLatency::BINS - 1)
+    {
+        us >>= 1;
+        ++bin;
+    }
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalNs.fetch_add(ns, std::memory_order_relaxed);
+    histogram[bin].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = maxNs.load(std::memory_order_relaxed);
+    while (ns > max && !maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+void VideoCodec::LatencyCounter::read(VideoCodecLatency &latency) const
+{
+    latency.count = count.load(std::memory_order_relaxed);
+    latency.averageUs = latency.count > 0 ? totalNs.load(std::memory_order_relaxed) / 1000.0 / latency.count : 0.0;
+    latency.maxUs = maxNs.load(std::memory_order_relaxed) / 1000.0;
+    uint64_t total = 0;
+    for (int i = 0; i < VideoCodecLatency::BINS; ++i)
+    {
+        latency.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+        total += latency.histogram[i];
+    }
+
+    // Percentiles are upper bounds of bins, but not above max duration.
+    latency.p50Us = 0.0;
+    latency.p99Us = 0.0;
+    uint64_t sum = 0;
+    for (int i = 0; i < VideoCodecLatency::BINS && total > 0; ++i)
+    {
+        sum += latency.histogram[i];
+        double bound = std::min(static_cast<double>(1ull << i), latency.maxUs);
+        if (latency.p50Us == 0.0 && sum * 2 >= total)
+        {
+            latency.p50Us = bound;
+        }
+        if (sum * 100 >= total * 99)
+        {
+            latency.p99Us = bound;
+            break;
+        }
+    }
+}
+
+void VideoCodec::LatencyCounter::reset()
+{
+    count = 0;
+    totalNs = 0;
+    maxNs = 0;
+    for (int i = 0; i < VideoCodecLatency::BINS; ++i)
+    {
+        histogram[i] = 0;
+    }
+}
+
+VideoCodec::StageScope::StageScope(VideoCodec &codec, LatencyCounter &counter, const char *name) :
+    m_codec(codec), m_counter(counter), m_name(name)
+{
+    if (m_codec.m_traceCallback)
+    {
+        m_codec.m_traceCallback(m_name, true);
+    }
+    m_start = std::chrono::steady_clock::now();
+}
+
+VideoCodec::StageScope::~StageScope()
+{
+    finish();
+}
+
+double VideoCodec::StageScope::finish()
+{
+    if (m_finished)
+    {
+        return 0.0;
+    }
+    m_finished = true;
+    std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - m_start;
+    m_counter.add(static_cast<uint64_t>(duration.count()));
+    if (m_codec.m_traceCallback)
+    {
+        m_codec.m_traceCallback(m_name, false);
+    }
+    return duration.count() / 1000000.0;
+}
+
+void VideoCodec::workerThreadFunc()
+{
+    while (true)
+    {
+        int index = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_inMutex);
+            m_inCond.wait(lock, [this]{ return m_inCount > 0 || m_workerStop; });
+            if (m_workerStop)
+            {
+                return;
+            }
+            index = m_inHead;
+        }
+
+        // Slot is owned by worker until it is released below. Encoder state
+        // is locked against encode() and setParam() of caller thread.
+        InputSlot &slot = m_inQueue[index];
+        std::unique_lock<std::recursive_mutex> encoderLock(m_encoderMutex);
+        if (slot.endOfStream)
+        {
+            drainEncoder();
+            {
+                std::lock_guard<std::mutex> lock(m_outMutex);
+                m_outEndOfStream = true;
+            }
+            m_outCond.notify_all();
+        }
+        else if (!encodeFrame(slot.frame, VideoCodecPlaneLayout(), slot.fourcc))
+        {
+            ++m_stats.failedEncodes;
+            ++m_stats.droppedFrames;
+        }
+        else if (!m_nals.empty())
+        {
+            pushPacket(slot.fourcc);
+        }
+        encoderLock.unlock();
+
+        // Release slot
+        {
+            std::lock_guard<std::mutex> lock(m_inMutex);
+            m_inHead = (m_inHead + 1) % static_cast<int>(m_inQueue.size());
+            --m_inCount;
+        }
+        m_inCond.notify_all();
+    }
+}
+
+void VideoCodec::pushPacket(cr::video::Fourcc fourcc)
+{
+    // Take packet from free list to avoid memory allocation
+    Packet packet;
+    {
+        std::lock_guard<std::mutex> lock(m_outMutex);
+        if (!m_freePackets.empty())
+        {
+            packet = std::move(m_freePackets.back());
+            m_freePackets.pop_back();
+        }
+    }
+
+    {
+        StageScope scope(*this, m_stats.nalGather, "VideoCodec::nalGather");
+        packet.data.clear();
+        for (const VideoCodecNal &nal : m_nals)
+        {
+            packet.data.insert(packet.data.end(), nal.data, nal.data + nal.size);
+        }
+    }
+    packet.fourcc = fourcc;
+    packet.width = m_width;
+    packet.height = m_height;
+    packet.frameId = static_cast<uint32_t>(m_outPts);
+
+    {
+        std::lock_guard<std::mutex> lock(m_outMutex);
+        m_outQueue.push_back(std::move(packet));
+    }
+    m_outCond.notify_all();
+}
+
+bool VideoCodec::drainEncoder()
+{
+    if (!m_encoderInit)
+    {
+        return true;
+    }
+
+    switch (m_pixelFormat)
+    {
+    case cr::video::Fourcc::H264:
+        while (x264_encoder_delayed_frames(m_h264Encoder) > 0)
+        {
+            x264_nal_t *nal;
+            int i_nal = 0;
+            m_sliceNals.clear();
+            int size = x264_encoder_encode(m_h264Encoder, &nal, &i_nal, nullptr, &m_h264PicOut);
+            if (size < 0)
+            {
+                std::cout << "x264_encoder_encode failed" << std::endl;
+                return false;
+            }
+            if (size == 0)
+            {
+                continue;
+            }
+            m_outPts = m_h264PicOut.i_pts;
+            collectH264Nals(nal, i_nal);
+            outputNals();
+            pushPacket(m_pixelFormat);
+        }
+        break;
+    case cr::video::Fourcc::HEVC:
+        while (true)
+        {
+            x265_nal *nal;
+            uint32_t i_nal = 0;
+            int result = x265_encoder_encode(m_h265Encoder, &nal, &i_nal, nullptr, &m_h265PicOut);
+            if (result < 0)
+            {
+                std::cout << "x265_encoder_encode failed" << std::endl;
+                return false;
+            }
+            if (result == 0)
+            {
+                break; // No more delayed frames
+            }
+            m_outPts = m_h265PicOut.pts;
+            m_nals.clear();
+            for (uint32_t i = 0; i < i_nal; ++i)
+            {
+                m_nals.push_back({nal[i].payload, static_cast<int>(nal[i].sizeBytes),
+                                  static_cast<int>(nal[i].type)});
+            }
+            outputNals();
+            pushPacket(m_pixelFormat);
+        }
+        break;
+    default:
+        break; // JPEG encoder has no delayed frames
+    }
+
+    // Flushed encoder can't accept new frames, only this encoder is re-opened.
+    // JPEG encoder has no delayed frames and continues.
+    if (m_pixelFormat != cr::video::Fourcc::JPEG)
+    {
+        m_encoderFlushed = true;
+    }
+
+    return true;
+}
+
+bool VideoCodec::setParam(VideoCodecParam id, float value)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    switch (id)
+    {
+    case VideoCodecParam::THREAD_MODE:
+    {
+        int mode = static_cast<int>(value);
+        if (mode < static_cast<int>(VideoCodecThreadMode::SINGLE) ||
+            mode > static_cast<int>(VideoCodecThreadMode::SLICE))
+        {
+            std::cout << "Invalid thread mode" << std::endl;
+            return false;
+        }
+        m_threadMode = static_cast<VideoCodecThreadMode>(mode);
+        break;
+    }
+    case VideoCodecParam::NUM_THREADS:
+        if (value < 0)
+        {
+            std::cout << "Invalid number of threads" << std::endl;
+            return false;
+        }
+        m_numThreads = static_cast<int>(value);
+        break;
+    case VideoCodecParam::POOL_THREADS:
+        if (value < -1)
+        {
+            std::cout << "Invalid number of pool threads" << std::endl;
+            return false;
+        }
+        m_poolThreads = static_cast<int>(value);
+        break;
+    case VideoCodecParam::PRESET:
+    {
+        int preset = static_cast<int>(value);
+        if (preset < static_cast<int>(VideoCodecPreset::ULTRAFAST) ||
+            preset > static_cast<int>(VideoCodecPreset::VERYSLOW))
+        {
+            std::cout << "Invalid preset" << std::endl;
+            return false;
+        }
+        m_preset = static_cast<VideoCodecPreset>(preset);
+        m_speedLevel = -1;
+        break;
+    }
+    case VideoCodecParam::ZERO_LATENCY:
+        m_zeroLatency = value != 0;
+        break;
+    case VideoCodecParam::B_FRAMES:
+        if (value < -1 || value > 16)
+        {
+            std::cout << "Invalid number of B-frames" << std::endl;
+            return false;
+        }
+        m_bFrames = static_cast<int>(value);
+        break;
+    case VideoCodecParam::LOOKAHEAD:
+        if (value < -1 || value > 250)
+        {
+            std::cout << "Invalid lookahead" << std::endl;
+            return false;
+        }
+        m_lookahead = static_cast<int>(value);
+        break;
+    case VideoCodecParam::MB_TREE:
+        if (value < -1 || value > 1)
+        {
+            std::cout << "Invalid macroblock tree mode" << std::endl;
+            return false;
+        }
+        m_mbTree = static_cast<int>(value);
+        break;
+    case VideoCodecParam::DECODER_THREADS:
+        if (value < 0)
+        {
+            std::cout << "Invalid number of decoder threads" << std::endl;
+            return false;
+        }
+        m_decoderThreads = static_cast<int>(value);
+        m_decoderReinit = true;
+        return true;
+    case VideoCodecParam::DECODER_THREAD_TYPE:
+        if (value < 1 || value > (FF_THREAD_FRAME | FF_THREAD_SLICE))
+        {
+            std::cout << "Invalid decoder thread type" << std::endl;
+            return false;
+        }
+        m_decoderThreadType = static_cast<int>(value);
+        m_decoderReinit = true;
+        return true;
+    case VideoCodecParam::JPEG_QUALITY:
+        if (value < 1 || value > 100)
+        {
+            std::cout << "Invalid JPEG quality" << std::endl;
+            return false;
+        }
+        m_jpegQuality = static_cast<int>(value);
+        break;
+    case VideoCodecParam::JPEG_FAST_DCT:
+        m_jpegFastDct = value != 0;
+        break;
+    case VideoCodecParam::JPEG_OPTIMIZE_CODING:
+        m_jpegOptimizeCoding = value != 0;
+        break;
+    case VideoCodecParam::JPEG_SUBSAMPLING:
+    {
+        int subsampling = static_cast<int>(value);
+        if (subsampling < static_cast<int>(VideoCodecJpegSubsampling::YUV420) ||
+            subsampling > static_cast<int>(VideoCodecJpegSubsampling::YUV444))
+        {
+            std::cout << "Invalid JPEG subsampling" << std::endl;
+            return false;
+        }
+        m_jpegSubsampling = static_cast<VideoCodecJpegSubsampling>(subsampling);
+        break;
+    }
+    case VideoCodecParam::JPEG_THREADS:
+        if (value < 0)
+        {
+            std::cout << "Invalid number of JPEG threads" << std::endl;
+            return false;
+        }
+        m_jpegThreads = static_cast<int>(value);
+        break;
+    case VideoCodecParam::JPEG_DECODE_SCALE:
+        if (value != 1 && value != 2 && value != 4 && value != 8)
+        {
+            std::cout << "Invalid JPEG decode scale" << std::endl;
+            return false;
+        }
+        m_jpegDecodeScale = static_cast<int>(value);
+        return true;
+    case VideoCodecParam::JPEG_DECODE_FAST_IDCT:
+        m_jpegDecodeFastIdct = value != 0;
+        return true;
+    case VideoCodecParam::RATE_CONTROL:
+    {
+        int rateControl = static_cast<int>(value);
+        if (rateControl < static_cast<int>(VideoCodecRateControl::CRF) ||
+            rateControl > static_cast<int>(VideoCodecRateControl::CBR))
+        {
+            std::cout << "Invalid rate control mode" << std::endl;
+            return false;
+        }
+        m_rateControl = static_cast<VideoCodecRateControl>(rateControl);
+        m_encoderReconfig = true;
+        return true;
+    }
+    case VideoCodecParam::BITRATE:
+        if (value < 1000)
+        {
+            std::cout << "Invalid bitrate" << std::endl;
+            return false;
+        }
+        m_bitrate = static_cast<int>(value);
+        m_encoderReconfig = true;
+        return true;
+    case VideoCodecParam::MAX_BITRATE:
+        if (value < 0)
+        {
+            std::cout << "Invalid max bitrate" << std::endl;
+            return false;
+        }
+        m_maxBitrate = static_cast<int>(value);
+        m_encoderReconfig = true;
+        return true;
+    case VideoCodecParam::VBV_BUFFER_SIZE:
+        if (value < 0)
+        {
+            std::cout << "Invalid VBV buffer size" << std::endl;
+            return false;
+        }
+        m_vbvBufferSize = static_cast<int>(value);
+        m_encoderReconfig = true;
+        return true;
+    case VideoCodecParam::CRF:
+        if (value != -1 && (value < 0 || value > 51))
+        {
+            std::cout << "Invalid CRF" << std::endl;
+            return false;
+        }
+        m_crf = value;
+        m_encoderReconfig = true;
+        return true;
+    case VideoCodecParam::GOP_SIZE:
+        if (value < 0)
+        {
+            std::cout << "Invalid GOP size" << std::endl;
+            return false;
+        }
+        m_gopSize = static_cast<int>(value);
+        m_encoderReconfig = true;
+        return true;
+    case VideoCodecParam::FORCE_IDR:
+        m_forceIdr = value != 0;
+        return true;
+    case VideoCodecParam::ADAPTIVE_PRESET:
+        // Encoder is opened with headroom for slowest speed level.
+        m_adaptivePreset = value != 0;
+        m_speedLevel = -1;
+        break;
+    case VideoCodecParam::ADAPTIVE_MAX_PRESET:
+    {
+        int preset = static_cast<int>(value);
+        if (preset < static_cast<int>(VideoCodecPreset::ULTRAFAST) ||
+            preset > static_cast<int>(VideoCodecPreset::VERYSLOW))
+        {
+            std::cout << "Invalid preset" << std::endl;
+            return false;
+        }
+        m_adaptiveMaxPreset = static_cast<VideoCodecPreset>(preset);
+        break;
+    }
+    case VideoCodecParam::FRAME_BUDGET_MS:
+        if (value <= 0)
+        {
+            std::cout << "Invalid frame budget" << std::endl;
+            return false;
+        }
+        m_frameBudgetMs = value;
+        return true;
+    case VideoCodecParam::SLICES:
+        if (value < 0 || value > 64)
+        {
+            std::cout << "Invalid number of slices" << std::endl;
+            return false;
+        }
+        m_slices = static_cast<int>(value);
+        break;
+    case VideoCodecParam::INTRA_REFRESH:
+        m_intraRefresh = value != 0;
+        break;
+    case VideoCodecParam::ENCODER_CACHE_SIZE:
+        // Applied on next format or resolution change.
+        if (value < 0 || value > 16)
+        {
+            std::cout << "Invalid encoder cache size" << std::endl;
+            return false;
+        }
+        m_encoderCacheSize = static_cast<int>(value);
+        return true;
+    case VideoCodecParam::DECODER_SKIP_FRAME:
+    case VideoCodecParam::DECODER_SKIP_LOOP_FILTER:
+    case VideoCodecParam::DECODER_SKIP_IDCT:
+    {
+        // Skip modes are read by decoder per frame: applied to running
+        // decoder without re-open.
+        if (value < static_cast<float>(VideoCodecDiscard::NONE) || value > static_cast<float>(VideoCodecDiscard::ALL))
+        {
+            std::cout << "Invalid decoder skip mode" << std::endl;
+            return false;
+        }
+        VideoCodecDiscard discard = static_cast<VideoCodecDiscard>(static_cast<int>(value));
+        if (id == VideoCodecParam::DECODER_SKIP_FRAME)
+        {
+            m_decoderSkipFrame = discard;
+        }
+        else if (id == VideoCodecParam::DECODER_SKIP_LOOP_FILTER)
+        {
+            m_decoderSkipLoopFilter = discard;
+        }
+        else
+        {
+            m_decoderSkipIdct = discard;
+        }
+        applyDecoderSkip();
+        return true;
+    }
+    case VideoCodecParam::DECODER_FAST:
+        m_decoderFast = value != 0;
+        m_decoderReinit = true;
+        return true;
+    case VideoCodecParam::DECODER_KEY_FRAMES_ONLY:
+        m_decoderKeyFramesOnly = value != 0;
+        return true;
+    case VideoCodecParam::QUEUE_SIZE:
+        // Queue can't be resized while worker thread uses it.
+        if (value < 1 || m_workerRunning)
+        {
+            std::cout << "Invalid queue size or encoding is running" << std::endl;
+            return false;
+        }
+        m_queueSize = static_cast<int>(value);
+        return true;
+    default:
+        return false;
+    }
+
+    m_encoderReinit = true;
+
+    return true;
+}
+
+bool VideoCodec::getPlaneLayout(cr::video::Frame &src, const VideoCodecPlaneLayout &layout,
+                                VideoCodecPlaneLayout &result)
+{
+    // Plane sizes: bytes per row and number of rows.
+    int numPlanes = 0;
+    int rowSize[3]{0, 0, 0};
+    int rows[3]{0, 0, 0};
+    switch (src.fourcc)
+    {
+    case cr::video::Fourcc::YU12: [[fallthrough]];
+    case cr::video::Fourcc::YV12:
+        numPlanes = 3;
+        rowSize[0] = src.width;
+        rowSize[1] = rowSize[2] = src.width / 2;
+        rows[0] = src.height;
+        rows[1] = rows[2] = src.height / 2;
+        break;
+    case cr::video::Fourcc::NV12: [[fallthrough]];
+    case cr::video::Fourcc::NV21:
+        numPlanes = 2;
+        rowSize[0] = rowSize[1] = src.width;
+        rows[0] = src.height;
+        rows[1] = src.height / 2;
+        break;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY:
+        numPlanes = 1;
+        rowSize[0] = src.width * 2;
+        rows[0] = src.height;
+        break;
+    case cr::video::Fourcc::BGR24: [[fallthrough]];
+    case cr::video::Fourcc::RGB24:
+        numPlanes = 1;
+        rowSize[0] = src.width * 3;
+        rows[0] = src.height;
+        break;
+    default:
+        return false;
+    }
+
+    if (layout.stride[0] == 0)
+    {
+        // Tightly packed planes one after another.
+        result = VideoCodecPlaneLayout();
+        int offset = 0;
+        for (int i = 0; i < numPlanes; ++i)
+        {
+            result.offset[i] = offset;
+            result.stride[i] = rowSize[i];
+            offset += rowSize[i] * rows[i];
+        }
+    }
+    else
+    {
+        result = layout;
+    }
+
+    // Check that every plane fits into source frame data.
+    for (int i = 0; i < numPlanes; ++i)
+    {
+        if (result.stride[i] < rowSize[i] || result.offset[i] < 0 ||
+            static_cast<int64_t>(result.offset[i]) + static_cast<int64_t>(result.stride[i]) *
+            (rows[i] - 1) + rowSize[i] > src.size)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void VideoCodec::prepareEncoderInput(cr::video::Frame &src, const VideoCodecPlaneLayout &planes,
+                                     cr::video::Fourcc fourcc, cr::video::Frame *&input,
+                                     VideoCodecPlaneLayout &inputLayout)
+{
+    input = &src;
+    inputLayout = planes;
+
+    // JPEG encoder converts rows during compression, x264 takes NV12 / NV21
+    // directly and YV12 is I420 with swapped chroma planes.
+    if (fourcc == cr::video::Fourcc::JPEG || src.fourcc == cr::video::Fourcc::YU12 ||
+        (fourcc == cr::video::Fourcc::H264 &&
+         (src.fourcc == cr::video::Fourcc::NV12 || src.fourcc == cr::video::Fourcc::NV21)))
+    {
+        return;
+    }
+    if (src.fourcc == cr::video::Fourcc::YV12)
+    {
+        std::swap(inputLayout.offset[1], inputLayout.offset[2]);
+        std::swap(inputLayout.stride[1], inputLayout.stride[2]);
+        return;
+    }
+
+    // Convert other formats to I420 in one pass over source data.
+    int width = src.width;
+    int height = src.height;
+    int ySize = width * height;
+    int uvWidth = width / 2;
+    if (m_convertFrame.width != width || m_convertFrame.height != height)
+    {
+        m_convertFrame.release();
+        m_convertFrame = cr::video::Frame(width, height, cr::video::Fourcc::YU12);
+    }
+    uint8_t *y = m_convertFrame.data;
+    uint8_t *u = y + ySize;
+    uint8_t *v = u + ySize / 4;
+    const uint8_t *data = src.data + planes.offset[0];
+
+    switch (src.fourcc)
+    {
+    case cr::video::Fourcc::NV12: [[fallthrough]];
+    case cr::video::Fourcc::NV21:
+        m_converter.nv12ToI420(data, planes.stride[0], src.data + planes.offset[1], planes.stride[1],
+                               y, width, u, uvWidth, v, uvWidth, width, height,
+                               src.fourcc == cr::video::Fourcc::NV21);
+        break;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY:
+        m_converter.yuyvToI420(data, planes.stride[0], y, width, u, uvWidth, v, uvWidth,
+                               width, height, src.fourcc == cr::video::Fourcc::UYVY);
+        break;
+    default:
+        m_converter.bgrToI420(data, planes.stride[0], y, width, u, uvWidth, v, uvWidth,
+                              width, height, src.fourcc == cr::video::Fourcc::RGB24);
+        break;
+    }
+
+    m_convertFrame.size = ySize + ySize / 2;
+    m_convertFrame.frameId = src.frameId;
+    m_convertFrame.sourceId = src.sourceId;
+    input = &m_convertFrame;
+    inputLayout = VideoCodecPlaneLayout();
+    inputLayout.offset[1] = ySize;
+    inputLayout.offset[2] = ySize + ySize / 4;
+    inputLayout.stride[0] = width;
+    inputLayout.stride[1] = inputLayout.stride[2] = uvWidth;
+}
+
+float VideoCodec::getParam(VideoCodecParam id)
+{
+    std::lock_guard<std::recursive_mutex> encoderLock(m_encoderMutex);
+    switch (id)
+    {
+    case VideoCodecParam::THREAD_MODE:
+        return static_cast<float>(m_threadMode);
+    case VideoCodecParam::NUM_THREADS:
+        return static_cast<float>(m_numThreads);
+    case VideoCodecParam::POOL_THREADS:
+        return static_cast<float>(m_poolThreads);
+    case VideoCodecParam::PRESET:
+        return static_cast<float>(m_preset);
+    case VideoCodecParam::ZERO_LATENCY:
+        return m_zeroLatency ? 1.0f : 0.0f;
+    case VideoCodecParam::B_FRAMES:
+        return static_cast<float>(m_bFrames);
+    case VideoCodecParam::LOOKAHEAD:
+        return static_cast<float>(m_lookahead);
+    case VideoCodecParam::MB_TREE:
+        return static_cast<float>(m_mbTree);
+    case VideoCodecParam::QUEUE_SIZE:
+        return static_cast<float>(m_queueSize);
+    case VideoCodecParam::DECODER_THREADS:
+        return static_cast<float>(m_decoderThreads);
+    case VideoCodecParam::DECODER_THREAD_TYPE:
+        return static_cast<float>(m_decoderThreadType);
+    case VideoCodecParam::JPEG_QUALITY:
+        return static_cast<float>(m_jpegQuality);
+    case VideoCodecParam::JPEG_FAST_DCT:
+        return m_jpegFastDct ? 1.0f : 0.0f;
+    case VideoCodecParam::JPEG_OPTIMIZE_CODING:
+        return m_jpegOptimizeCoding ? 1.0f : 0.0f;
+    case VideoCodecParam::JPEG_SUBSAMPLING:
+        return static_cast<float>(m_jpegSubsampling);
+    case VideoCodecParam::JPEG_THREADS:
+        return static_cast<float>(m_jpegThreads);
+    case VideoCodecParam::JPEG_DECODE_SCALE:
+        return static_cast<float>(m_jpegDecodeScale);
+    case VideoCodecParam::JPEG_DECODE_FAST_IDCT:
+        return m_jpegDecodeFastIdct ? 1.0f : 0.0f;
+    case VideoCodecParam::RATE_CONTROL:
+        return static_cast<float>(m_rateControl);
+    case VideoCodecParam::BITRATE:
+        return static_cast<float>(m_bitrate);
+    case VideoCodecParam::MAX_BITRATE:
+        return static_cast<float>(m_maxBitrate);
+    case VideoCodecParam::VBV_BUFFER_SIZE:
+        return static_cast<float>(m_vbvBufferSize);
+    case VideoCodecParam::CRF:
+        return m_crf;
+    case VideoCodecParam::GOP_SIZE:
+        return static_cast<float>(m_gopSize);
+    case VideoCodecParam::FORCE_IDR:
+        return m_forceIdr ? 1.0f : 0.0f;
+    case VideoCodecParam::ADAPTIVE_PRESET:
+        return m_adaptivePreset ? 1.0f : 0.0f;
+    case VideoCodecParam::ADAPTIVE_MAX_PRESET:
+        return static_cast<float>(m_adaptiveMaxPreset);
+    case VideoCodecParam::FRAME_BUDGET_MS:
+        return m_frameBudgetMs;
+    case VideoCodecParam::ADAPTIVE_CURRENT_PRESET:
+        return m_adaptivePreset && m_speedLevel >= 0 ? static_cast<float>(m_speedLevel) :
+                                                       static_cast<float>(m_preset);
+    case VideoCodecParam::SLICES:
+        return static_cast<float>(m_slices);
+    case VideoCodecParam::INTRA_REFRESH:
+        return m_intraRefresh ? 1.0f : 0.0f;
+    case VideoCodecParam::ENCODER_CACHE_SIZE:
+        return static_cast<float>(m_encoderCacheSize);
+    case VideoCodecParam::DECODER_SKIP_FRAME:
+        return static_cast<float>(m_decoderSkipFrame);
+    case VideoCodecParam::DECODER_SKIP_LOOP_FILTER:
+        return static_cast<float>(m_decoderSkipLoopFilter);
+    case VideoCodecParam::DECODER_SKIP_IDCT:
+        return static_cast<float>(m_decoderSkipIdct);
+    case VideoCodecParam::DECODER_FAST:
+        return m_decoderFast ? 1.0f : 0.0f;
+    case VideoCodecParam::DECODER_KEY_FRAMES_ONLY:
+        return m_decoderKeyFramesOnly ? 1.0f : 0.0f;
+    default:
+        return -1.0f;
+    }
+}
+
+void VideoCodec::setH264RateControl(x264_param_t &param)
+{
+    // x264 takes bitrates in kbps and VBV buffer in kbits.
+    param.rc.i_rc_method = m_rateControl == VideoCodecRateControl::CRF ? X264_RC_CRF : X264_RC_ABR;
+    param.rc.i_bitrate = m_bitrate / 1000;
+    param.rc.f_rf_constant = m_crf >= 0 ? m_crf : 23.0f;
+    int maxBitrate = m_rateControl == VideoCodecRateControl::CBR ? m_bitrate : m_maxBitrate;
+    param.rc.i_vbv_max_bitrate = maxBitrate / 1000;
+    param.rc.i_vbv_buffer_size = maxBitrate > 0 ? (m_vbvBufferSize > 0 ? m_vbvBufferSize : maxBitrate) / 1000 : 0;
+}
+
+void VideoCodec::setH265RateControl(x265_param &param)
+{
+    // x265 takes bitrates in kbps and VBV buffer in kbits.
+    param.rc.rateControlMode = m_rateControl == VideoCodecRateControl::CRF ? X265_RC_CRF : X265_RC_ABR;
+    param.rc.bitrate = m_bitrate / 1000;
+    param.rc.rfConstant = m_crf >= 0 ? m_crf : 28.0;
+    int maxBitrate = m_rateControl == VideoCodecRateControl::CBR ? m_bitrate : m_maxBitrate;
+    param.rc.vbvMaxBitrate = maxBitrate / 1000;
+    param.rc.vbvBufferSize = maxBitrate > 0 ? (m_vbvBufferSize > 0 ? m_vbvBufferSize : maxBitrate) / 1000 : 0;
+}
+
+bool VideoCodec::reconfigEncoder()
+{
+    // GOP longer than GOP of opened encoder needs new encoder, shorter GOP
+    // is produced by forced IDR frames.
+    if (m_openGopSize > 0 && (m_gopSize == 0 || m_gopSize > m_openGopSize))
+    {
+        return false;
+    }
+    // Intra refresh period is set when encoder is opened.
+    if (m_intraRefresh && m_gopSize != m_openGopSize)
+    {
+        return false;
+    }
+
+    // Encoders can't change rate control mode and turn VBV on or off. ABR
+    // bitrate can be changed only with VBV.
+    switch (m_pixelFormat)
+    {
+    case cr::video::Fourcc::H264:
+    {
+        x264_param_t param = m_h264Param;
+        setH264RateControl(param);
+        bool vbv = param.rc.i_vbv_max_bitrate > 0;
+        if (param.rc.i_rc_method != m_h264Param.rc.i_rc_method || vbv != (m_h264Param.rc.i_vbv_max_bitrate > 0) ||
+            (!vbv && param.rc.i_rc_method == X264_RC_ABR && param.rc.i_bitrate != m_h264Param.rc.i_bitrate))
+        {
+            return false;
+        }
+        if (x264_encoder_reconfig(m_h264Encoder, &param) < 0)
+        {
+            std::cout << "x264_encoder_reconfig failed" << std::endl;
+            return false;
+        }
+        m_h264Param = param;
+        return true;
+    }
+    case cr::video::Fourcc::HEVC:
+    {
+        x265_param param = m_h265Param;
+        setH265RateControl(param);
+        bool vbv = param.rc.vbvMaxBitrate > 0;
+        bool cbr = m_rateControl == VideoCodecRateControl::CBR;
+        if (param.rc.rateControlMode != m_h265Param.rc.rateControlMode || vbv != (m_h265Param.rc.vbvMaxBitrate > 0) ||
+            cbr != (m_h265Param.rc.bStrictCbr != 0) ||
+            (!vbv && param.rc.rateControlMode == X265_RC_ABR && param.rc.bitrate != m_h265Param.rc.bitrate))
+        {
+            return false;
+        }
+        if (x265_encoder_reconfig(m_h265Encoder, &param) < 0)
+        {
+            std::cout << "x265_encoder_reconfig failed" << std::endl;
+            return false;
+        }
+        m_h265Param = param;
+        return true;
+    }
+    default:
+        // JPEG encoder has no rate control.
+        return true;
+    }
+}
+
+void VideoCodec::setH264Speed(x264_param_t &param, int level)
+{
+    const H264SpeedLevel &speed = g_h264Speed[level];
+    param.analyse.i_subpel_refine = speed.subme;
+    param.analyse.i_me_method = speed.meMethod;
+    param.analyse.i_me_range = speed.meRange;
+    param.i_frame_reference = speed.ref;
+    param.analyse.intra = speed.intra;
+    param.analyse.inter = speed.inter;
+    param.analyse.i_trellis = speed.trellis;
+    param.analyse.b_mixed_references = speed.mixedRefs;
+    param.analyse.b_transform_8x8 = speed.transform8x8;
+    param.b_deblocking_filter = speed.deblock;
+}
+
+void VideoCodec::setH265Speed(x265_param &param, int level)
+{
+    const H265SpeedLevel &speed = g_h265Speed[level];
+    param.subpelRefine = speed.subme;
+    param.searchMethod = speed.searchMethod;
+    param.maxNumReferences = speed.refs;
+    param.maxNumMergeCand = speed.mergeCand;
+    param.rdLevel = speed.rdLevel;
+    param.rdoqLevel = speed.rdoqLevel;
+    param.bEnableRectInter = speed.rectInter;
+    param.bEnableEarlySkip = speed.earlySkip;
+    param.bEnableFastIntra = speed.fastIntra;
+}
+
+bool VideoCodec::setEncoderSpeed(cr::video::Fourcc fourcc, int level)
+{
+    switch (fourcc)
+    {
+    case cr::video::Fourcc::H264:
+    {
+        x264_param_t param = m_h264Param;
+        setH264Speed(param, level);
+        if (x264_encoder_reconfig(m_h264Encoder, &param) < 0)
+        {
+            std::cout << "x264_encoder_reconfig failed" << std::endl;
+            return false;
+        }
+        m_h264Param = param;
+        break;
+    }
+    case cr::video::Fourcc::HEVC:
+    {
+        x265_param param = m_h265Param;
+        setH265Speed(param, level);
+        if (x265_encoder_reconfig(m_h265Encoder, &param) < 0)
+        {
+            std::cout << "x265_encoder_reconfig failed" << std::endl;
+            return false;
+        }
+        m_h265Param = param;
+        break;
+    }
+    default:
+        return false;
+    }
+    m_speedLevel = level;
+    return true;
+}
+
+void VideoCodec::updateEncoderSpeed(double encodeTimeMs)
+{
+    // Average smooths out single slow frames (IDR frames, scene changes).
+    m_encodeTimeMs = m_encodeTimeMs > 0.0 ? m_encodeTimeMs * 0.9 + encodeTimeMs * 0.1 : encodeTimeMs;
+    ++m_framesSinceSpeedChange;
+
+    // Switch to faster level quickly when budget is almost exceeded and to
+    // slower level only after long period with enough spare time. The gap
+    // between thresholds prevents oscillation between neighbour levels.
+    int level = m_speedLevel;
+    if (m_encodeTimeMs > m_frameBudgetMs * 0.9 && m_framesSinceSpeedChange >= 8 && level > 0)
+    {
+        // Slower level which didn't fit the budget is tried again later.
+        m_speedUpHold = m_speedSteppedUp && m_framesSinceSpeedChange < m_speedUpHold ?
+                        std::min(m_speedUpHold * 2, 1920) : 60;
+        m_speedSteppedUp = false;
+        --level;
+    }
+    else if (m_encodeTimeMs < m_frameBudgetMs * 0.6 && m_framesSinceSpeedChange >= m_speedUpHold &&
+             level < static_cast<int>(m_adaptiveMaxPreset))
+    {
+        m_speedSteppedUp = true;
+        ++level;
+    }
+
+    if (level != m_speedLevel && setEncoderSpeed(m_pixelFormat, level))
+    {
+        m_framesSinceSpeedChange = 0;
+    }
+}
+
+bool VideoCodec::nextFrameIsIdr()
+{
+    bool idr = m_forceIdr || (!m_intraRefresh && m_gopSize > 0 && m_gopSize != m_openGopSize &&
+                              m_framesSinceIdr >= m_gopSize);
+    m_forceIdr = false;
+    m_framesSinceIdr = idr ? 1 : m_framesSinceIdr + 1;
+    return idr;
+}
+
+bool VideoCodec::initH264Encoder(int width, int height)
+{
+    // Check if it is already initialized and release resources
+    if (m_h264Encoder != nullptr)
+    {
+        x264_encoder_close(m_h264Encoder);
+        m_h264Encoder = nullptr;
+    }
+
+    // Get default parameters
+    if (x264_param_default_preset(&m_h264Param, g_presetNames[static_cast<int>(m_preset)],
+                                  m_zeroLatency ? "zerolatency" : nullptr) < 0)
+    {
+        std::cout << "x264_param_default_preset failed" << std::endl;
+        return false;
+    }
+
+    // Initialize x264
+    m_h264Param.i_width = width;
+    m_h264Param.i_height = height;
+    // Semi-planar input is taken without conversion.
+    switch (m_inputFourcc)
+    {
+    case cr::video::Fourcc::NV12:
+        m_h264Param.i_csp = X264_CSP_NV12;
+        break;
+    case cr::video::Fourcc::NV21:
+        m_h264Param.i_csp = X264_CSP_NV21;
+        break;
+    default:
+        m_h264Param.i_csp = X264_CSP_I420;
+        break;
+    }
+    m_h264Param.i_bitdepth = 8;
+    m_h264Param.b_vfr_input = 0;
+    m_h264Param.b_repeat_headers = 1;
+    m_h264Param.b_annexb = 1;
+    // Set rate control
+    setH264RateControl(m_h264Param);
+    // Set GOP size. Intra refresh needs finite refresh period.
+    m_h264Param.i_keyint_max = m_gopSize > 0 ? m_gopSize : (m_intraRefresh ? 30 : X264_KEYINT_MAX_INFINITE);
+    // Set slices and periodic intra refresh
+    if (m_slices > 0)
+    {
+        m_h264Param.i_slice_count = m_slices;
+    }
+    m_h264Param.b_intra_refresh = m_intraRefresh ? 1 : 0;
+    // Set frame rate
+    m_h264Param.i_fps_num = 30;
+    // Set number of threads
+    switch (m_threadMode)
+    {
+    case VideoCodecThreadMode::AUTO:
+        // Keep threading scheme selected by preset and tune.
+        m_h264Param.i_threads = m_numThreads > 0 ? m_numThreads : X264_THREADS_AUTO;
+        break;
+    case VideoCodecThreadMode::FRAME:
+        m_h264Param.i_threads = m_numThreads > 0 ? m_numThreads : X264_THREADS_AUTO;
+        m_h264Param.b_sliced_threads = 0;
+        break;
+    case VideoCodecThreadMode::SLICE:
+        m_h264Param.i_threads = m_numThreads > 0 ? m_numThreads : X264_THREADS_AUTO;
+        m_h264Param.b_sliced_threads = 1;
+        break;
+    default:
+        m_h264Param.i_threads = 1;
+        break;
+    }
+
+    // Set lookahead, B-frames and macroblock tree for recording
+    if (!m_zeroLatency && m_bFrames >= 0)
+    {
+        m_h264Param.i_bframe = m_bFrames;
+    }
+    if (m_lookahead >= 0)
+    {
+        m_h264Param.rc.i_lookahead = m_lookahead;
+    }
+    if (m_mbTree >= 0)
+    {
+        m_h264Param.rc.b_mb_tree = m_mbTree;
+    }
+
+    // Open encoder with references and 8x8 transform of slowest speed level,
+    // so any level can be set later by reconfiguration.
+    if (m_adaptivePreset)
+    {
+        if (m_speedLevel < 0 || m_speedLevel > static_cast<int>(m_adaptiveMaxPreset))
+        {
+            m_speedLevel = std::min(static_cast<int>(m_preset), static_cast<int>(m_adaptiveMaxPreset));
+        }
+        setH264Speed(m_h264Param, m_speedLevel);
+        m_h264Param.i_frame_reference = g_h264Speed[static_cast<int>(m_adaptiveMaxPreset)].ref;
+        m_h264Param.analyse.i_me_range = g_h264Speed[static_cast<int>(m_adaptiveMaxPreset)].meRange;
+        m_h264Param.analyse.b_transform_8x8 = 1;
+    }
+
+    // Report NAL units as soon as slices are encoded. Callback doesn't work
+    // with frame threads.
+    if (m_nalCallback)
+    {
+        m_h264Param.nalu_process = h264NaluProcess;
+        m_h264Param.b_sliced_threads = 1;
+    }
+
+    // Apply profile. Baseline profile doesn't allow B-frames.
+    if (x264_param_apply_profile(&m_h264Param, m_zeroLatency ? "baseline" : "high") < 0)
+    {
+        std::cout << "x264_param_apply_profile failed" << std::endl;
+        return false;
+    }
+
+    // Initialize picture without planes. Planes point to source frame data.
+    x264_picture_init(&m_h264PicIn);
+    m_h264PicIn.img.i_csp = m_h264Param.i_csp;
+    m_h264PicIn.img.i_plane = m_h264Param.i_csp == X264_CSP_I420 ? 3 : 2;
+    m_h264PicIn.opaque = this;
+
+    // Open encoder
+    m_h264Encoder = x264_encoder_open(&m_h264Param);
+    if (m_h264Encoder == nullptr)
+    {
+        std::cout << "x264_encoder_open failed" << std::endl;
+        return false;
+    }
+
+    // Set references of current speed level.
+    if (m_adaptivePreset)
+    {
+        setEncoderSpeed(cr::video::Fourcc::H264, m_speedLevel);
+    }
+
+    return true;
+}
+
+bool VideoCodec::encodeH264Frame(cr::video::Frame &src, const VideoCodecPlaneLayout &layout)
+{
+    // Set pointers to source planes. x264 copies picture to internal frame
+    // inside x264_encoder_encode(), so source data is used only during call.
+    for (int i = 0; i < m_h264PicIn.img.i_plane; ++i)
+    {
+        m_h264PicIn.img.plane[i] = src.data + layout.offset[i];
+        m_h264PicIn.img.i_stride[i] = layout.stride[i];
+    }
+
+    int i_frame = 0; // Number of NAL units
+    // Encode frame
+    x264_nal_t *nal;
+    m_h264PicIn.i_pts = src.frameId;
+    m_h264PicIn.i_type = nextFrameIsIdr() ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    m_sliceNals.clear();
+    int i_frame_size = x264_encoder_encode(m_h264Encoder, &nal, &i_frame, &m_h264PicIn, &m_h264PicOut);
+    if (i_frame_size < 0)
+    {
+        std::cout << "x264_encoder_encode failed" << std::endl;
+        return false;
+    }
+    if (i_frame_size > 0)
+    {
+        m_outPts = m_h264PicOut.i_pts;
+    }
+
+    collectH264Nals(nal, i_frame);
+
+    return true;
+}
+
+void VideoCodec::h264NaluProcess(x264_t *h, x264_nal_t *nal, void *opaque)
+{
+    VideoCodec *codec = static_cast<VideoCodec*>(opaque);
+
+    // Take own buffer for NAL unit, so slice threads encode in parallel.
+    std::vector<uint8_t> *buffer;
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(codec->m_sliceMutex);
+        index = codec->m_sliceNals.size();
+        if (index == codec->m_sliceBuffers.size())
+        {
+            codec->m_sliceBuffers.emplace_back(new std::vector<uint8_t>());
+        }
+        buffer = codec->m_sliceBuffers[index].get();
+        codec->m_sliceNals.push_back({-1, VideoCodecNal()});
+    }
+
+    // Buffer size required by x264_nal_encode().
+    buffer->resize(nal->i_payload * 3 / 2 + 5 + 64);
+    x264_nal_encode(h, buffer->data(), nal);
+
+    std::lock_guard<std::mutex> lock(codec->m_sliceMutex);
+    VideoCodecNal view{nal->p_payload, nal->i_payload, nal->i_type};
+    bool slice = nal->i_type == NAL_SLICE || nal->i_type == NAL_SLICE_IDR;
+    codec->m_sliceNals[index] = {slice ? nal->i_first_mb : -1, view};
+    codec->m_nalCallback(view);
+}
+
+void VideoCodec::collectH264Nals(x264_nal_t *nal, int count)
+{
+    m_nals.clear();
+    if (m_h264Param.nalu_process == nullptr)
+    {
+        // Keep views of NAL units. Payloads stay in x264 memory until next call.
+        for (int i = 0; i < count; ++i)
+        {
+            m_nals.push_back({nal[i].p_payload, nal[i].i_payload, nal[i].i_type});
+        }
+        return;
+    }
+
+    // Slice threads finish slices in any order. Parameter sets and SEI go
+    // first, slices are sorted by first macroblock.
+    std::stable_sort(m_sliceNals.begin(), m_sliceNals.end(),
+                     [](const std::pair<int, VideoCodecNal> &a, const std::pair<int, VideoCodecNal> &b)
+                     { return a.first < b.first; });
+    for (const std::pair<int, VideoCodecNal> &item : m_sliceNals)
+    {
+        m_nals.push_back(item.second);
+    }
+}
+
+void VideoCodec::outputNals()
+{
+    uint64_t size = 0;
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        size += static_cast<uint64_t>(nal.size);
+    }
+    m_stats.encoderBytesOut += size;
+
+    // x264 slice callback reports NAL units during encoding.
+    if (!m_nalCallback || (m_pixelFormat == cr::video::Fourcc::H264 && m_h264Param.nalu_process != nullptr))
+    {
+        return;
+    }
+    for (const VideoCodecNal &nal : m_nals)
+    {
+        m_nalCallback(nal);
+    }
+}
+
+bool VideoCodec::initH265Encoder(int width, int height)
+{
+    // Check if it is already initialized and release resources
+    if (m_h265Encoder != nullptr)
+    {
+        x265_picture_free(m_h265PicIn);
+        x265_encoder_close(m_h265Encoder);
+        m_h265Encoder = nullptr;
+        m_h265PicIn = nullptr;
+    }
+
+    // Get default parameters
+    if (x265_param_default_preset(&m_h265Param, g_presetNames[static_cast<int>(m_preset)],
+                                  m_zeroLatency ? "zerolatency" : nullptr) < 0)
+    {
+        std::cout << "x265_param_default_preset failed" << std::endl;
+        return false;
+    }
+
+    // Initialize x265
+    m_h265Param.sourceWidth = width;
+    m_h265Param.sourceHeight = height;
+    m_h265Param.sourceBitDepth = 8;
+    m_h265Param.bRepeatHeaders = 1;
+    m_h265Param.bAnnexB = 1;
+    m_h265Param.internalCsp = X265_CSP_I420;
+    // Set rate control
+    setH265RateControl(m_h265Param);
+    m_h265Param.rc.bStrictCbr = m_rateControl == VideoCodecRateControl::CBR ? 1 : 0;
+    // Set GOP size. Intra refresh needs finite refresh period.
+    m_h265Param.keyframeMax = m_gopSize > 0 ? m_gopSize : (m_intraRefresh ? 30 : -1);
+    // Set slices and periodic intra refresh
+    if (m_slices > 0)
+    {
+        m_h265Param.maxSlices = m_slices;
+    }
+    m_h265Param.bIntraRefresh = m_intraRefresh ? 1 : 0;
+    // Set frame rate
+    m_h265Param.fpsNum = 30;
+    m_h265Param.fpsDenom = 1;
+    // Set number of frame threads
+    switch (m_threadMode)
+    {
+    case VideoCodecThreadMode::AUTO: [[fallthrough]];
+    case VideoCodecThreadMode::FRAME:
+        m_h265Param.frameNumThreads = m_numThreads; // 0 - auto
+        break;
+    case VideoCodecThreadMode::SLICE:
+        // Single frame thread, rows of CTUs are encoded in parallel by pool.
+        m_h265Param.frameNumThreads = 1;
+        m_h265Param.bEnableWavefront = 1;
+        break;
+    default:
+        m_h265Param.frameNumThreads = 1;
+        break;
+    }
+    // Set thread pool size
+    m_h265Pools.clear();
+    if (m_poolThreads < 0)
+    {
+        m_h265Pools = "-";
+    }
+    else if (m_poolThreads > 0)
+    {
+        m_h265Pools = std::to_string(m_poolThreads);
+    }
+    else if (m_threadMode == VideoCodecThreadMode::SLICE && m_numThreads > 0)
+    {
+        m_h265Pools = std::to_string(m_numThreads);
+    }
+    if (!m_h265Pools.empty())
+    {
+        m_h265Param.numaPools = m_h265Pools.c_str();
+    }
+
+    // Set lookahead, B-frames and CU tree for recording
+    if (!m_zeroLatency && m_bFrames >= 0)
+    {
+        m_h265Param.bframes = m_bFrames;
+    }
+    if (m_lookahead >= 0)
+    {
+        m_h265Param.lookaheadDepth = m_lookahead;
+    }
+    if (m_mbTree >= 0)
+    {
+        m_h265Param.rc.cuTree = m_mbTree;
+    }
+
+    // Open encoder with references of slowest speed level, so any level can
+    // be set later by reconfiguration.
+    if (m_adaptivePreset)
+    {
+        if (m_speedLevel < 0 || m_speedLevel > static_cast<int>(m_adaptiveMaxPreset))
+        {
+            m_speedLevel = std::min(static_cast<int>(m_preset), static_cast<int>(m_adaptiveMaxPreset));
+        }
+        setH265Speed(m_h265Param, m_speedLevel);
+        m_h265Param.maxNumReferences = g_h265Speed[static_cast<int>(m_adaptiveMaxPreset)].refs;
+    }
+
+    // Apply profile
+    if (x265_param_apply_profile(&m_h265Param, "main") < 0)
+    {
+        std::cout << "x265_param_apply_profile failed" << std::endl;
+        return false;
+    }
+
+    // Allocate picture
+    m_h265PicIn = x265_picture_alloc();
+    x265_picture_init(&m_h265Param, m_h265PicIn);
+
+    // Open encoder
+    m_h265Encoder = x265_encoder_open(&m_h265Param);
+    if (m_h265Encoder == nullptr)
+    {
+        std::cout << "x265_encoder_open failed" << std::endl;
+        return false;
+    }
+
+    // Set references of current speed level.
+    if (m_adaptivePreset)
+    {
+        setEncoderSpeed(cr::video::Fourcc::HEVC, m_speedLevel);
+    }
+
+    return true;
+}
+
+bool VideoCodec::encodeH265Frame(cr::video::Frame &src, const VideoCodecPlaneLayout &layout)
+{
+    // Set pointers to source planes. x265 copies picture to internal frame
+    // inside x265_encoder_encode(), so source data is used only during call.
+    for (int i = 0; i < 3; ++i)
+    {
+        m_h265PicIn->planes[i] = src.data + layout.offset[i];
+        m_h265PicIn->stride[i] = layout.stride[i];
+    }
+
+    // Encode frame.
+    x265_nal *nal;
+    uint32_t i_nal;
+    m_h265PicIn->pts = src.frameId;
+    m_h265PicIn->sliceType = nextFrameIsIdr() ? X265_TYPE_IDR : X265_TYPE_AUTO;
+    if (x265_encoder_encode(m_h265Encoder, &nal, &i_nal, m_h265PicIn, &m_h265PicOut) < 0)
+    {
+        std::cout << "x265_encoder_encode failed" << std::endl;
+        return false;
+    }
+    if (i_nal > 0)
+    {
+        m_outPts = m_h265PicOut.pts;
+    }
+
+    // Keep views of NAL units. Payloads stay in x265 memory until next call.
+    m_nals.clear();
+    for (uint32_t i = 0; i < i_nal; ++i)
+    {
+        m_nals.push_back({nal[i].payload, static_cast<int>(nal[i].sizeBytes),
+                          static_cast<int>(nal[i].type)});
+    }
+
+    return true;
+}
+
+bool VideoCodec::initJpegEncoder(int width, int height)
+{
+    // Check if it is already initialized and release resources
+    releaseJpegBands();
+    if (m_jpegMemAllocator)
+    {
+        releaseJpegBuffer();
+        jpeg_destroy_compress(&cinfo);
+    }
+
+    // Allocate memory for the JPEG buffer. If allocation fails, libjpeg
+    // allocates buffer itself.
+    m_jpegMemAllocator = m_allocator;
+    m_jpegMemBuffer = m_allocator->allocate(static_cast<size_t>(width) * height * 3);
+    m_jpegMemCapacity = m_jpegMemBuffer != nullptr ? static_cast<unsigned long>(width) * height * 3 : 0;
+    jpeg_buffer = m_jpegMemBuffer;
+
+    // Luma sampling factors, chroma is always sampled 1x1.
+    int hSamp = m_jpegSubsampling == VideoCodecJpegSubsampling::YUV444 ? 1 : 2;
+    int vSamp = m_jpegSubsampling == VideoCodecJpegSubsampling::YUV420 ? 2 : 1;
+
+    // YUV sources with the same chroma subsampling skip color conversion
+    // and downsampling of libjpeg.
+    bool yuv420 = m_inputFourcc == cr::video::Fourcc::YU12 || m_inputFourcc == cr::video::Fourcc::YV12 ||
+                  m_inputFourcc == cr::video::Fourcc::NV12 || m_inputFourcc == cr::video::Fourcc::NV21;
+    bool yuv422 = m_inputFourcc == cr::video::Fourcc::YUYV || m_inputFourcc == cr::video::Fourcc::UYVY;
+    m_jpegRawInput = (yuv420 && m_jpegSubsampling == VideoCodecJpegSubsampling::YUV420) ||
+                     (yuv422 && m_jpegSubsampling == VideoCodecJpegSubsampling::YUV422);
+
+    size_t rowsSize = 0;
+    if (m_jpegRawInput)
+    {
+        // One MCU row: 8 * vSamp luma rows and 8 rows of each chroma plane.
+        // Rows are padded to whole DCT blocks, libjpeg reads padding.
+        m_jpegRawRowSize[0] = (width + 8 * hSamp - 1) / (8 * hSamp) * (8 * hSamp);
+        m_jpegRawRowSize[1] = ((width + hSamp - 1) / hSamp + 7) / 8 * 8;
+        rowsSize = m_jpegRawRowSize[0] * 8 * vSamp + m_jpegRawRowSize[1] * 8 * 2;
+    }
+    else
+    {
+        // Two RGB rows and two rows of I420 for YUV inputs converted during
+        // compression.
+        rowsSize = width * 3 * 2 + width * 3;
+    }
+    m_jpegRows.resize(rowsSize);
+
+    // Initialize JPEG compressor
+    setupJpegCompressor(cinfo, jerr, width, height, 0);
+
+    // Split frame to bands of whole MCU rows, one band per thread.
+    int threads = m_jpegThreads;
+    if (threads == 0)
+    {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    int mcuHeight = 8 * vSamp;
+    int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    int mcusPerRow = (width + 8 * hSamp - 1) / (8 * hSamp);
+    int bandRows = threads > 1 ? (mcuRows + threads - 1) / threads : mcuRows;
+    int numBands = (mcuRows + bandRows - 1) / bandRows;
+    if (numBands < 2)
+    {
+        return true;
+    }
+
+    // Restart interval divides band height, so decoder state is reset at
+    // band boundaries. Interval in MCUs must fit 16 bit field of DRI marker.
+    m_jpegBandRows = bandRows;
+    m_jpegRestartRows = bandRows;
+    while (m_jpegRestartRows > 1 &&
+           (m_jpegRestartRows * mcusPerRow > 65535 || bandRows % m_jpegRestartRows != 0))
+    {
+        --m_jpegRestartRows;
+    }
+
+    for (int i = 0; i < numBands; ++i)
+    {
+        std::unique_ptr<JpegBand> band(new JpegBand());
+        band->firstRow = i * bandRows * mcuHeight;
+        int rows = height - band->firstRow < bandRows * mcuHeight ?
+                   height - band->firstRow : bandRows * mcuHeight;
+        band->rows.resize(rowsSize);
+        // If allocation fails, libjpeg allocates buffer itself.
+        band->allocator = m_allocator;
+        band->buffer = m_allocator->allocate(static_cast<size_t>(width) * rows);
+        band->capacity = band->buffer != nullptr ? static_cast<unsigned long>(width) * rows : 0;
+        band->output = band->buffer;
+        setupJpegCompressor(band->cinfo, band->jerr, width, rows, m_jpegRestartRows);
+        m_jpegBands.push_back(std::move(band));
+    }
+
+    return true;
+}
+
+void VideoCodec::setupJpegCompressor(jpeg_compress_struct &info, jpeg_error_mgr &err,
+                                     int width, int height, int restartRows)
+{
+    info.err = jpeg_std_error(&err);
+    jpeg_create_compress(&info);
+    info.image_width = width;
+    info.image_height = height;
+    info.input_components = 3;
+    if (m_jpegRawInput)
+    {
+        info.in_color_space = JCS_YCbCr;
+    }
+    else
+    {
+#ifdef JCS_EXTENSIONS
+        // libjpeg-turbo reads BGR directly
+        info.in_color_space = m_inputFourcc == cr::video::Fourcc::BGR24 ? JCS_EXT_BGR : JCS_RGB;
+#else
+        info.in_color_space = JCS_RGB;
+#endif
+    }
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, m_jpegQuality, TRUE);
+    info.dct_method = m_jpegFastDct ? JDCT_IFAST : JDCT_ISLOW;
+    // Bands share Huffman tables of the first band header, so optimized
+    // tables are only used in single thread mode.
+    info.optimize_coding = m_jpegOptimizeCoding && restartRows == 0 ? TRUE : FALSE;
+    info.restart_in_rows = restartRows;
+    info.raw_data_in = m_jpegRawInput ? TRUE : FALSE;
+    info.comp_info[0].h_samp_factor = m_jpegSubsampling == VideoCodecJpegSubsampling::YUV444 ? 1 : 2;
+    info.comp_info[0].v_samp_factor = m_jpegSubsampling == VideoCodecJpegSubsampling::YUV420 ? 2 : 1;
+    for (int i = 1; i < 3; ++i)
+    {
+        info.comp_info[i].h_samp_factor = 1;
+        info.comp_info[i].v_samp_factor = 1;
+    }
+}
+
+bool VideoCodec::encodeJpegFrame(cr::video::Frame &src, const VideoCodecPlaneLayout &layout)
+{
+    if (!m_jpegBands.empty())
+    {
+        return encodeJpegBands(src, layout);
+    }
+
+    // libjpeg replaces destination buffer by malloc() buffer if image
+    // doesn't fit. Such buffer is released and codec buffer grows.
+    if (jpeg_buffer != m_jpegMemBuffer)
+    {
+        unsigned long capacity = jpeg_size + jpeg_size / 2;
+        releaseJpegBuffer();
+        m_jpegMemAllocator = m_allocator;
+        m_jpegMemBuffer = m_allocator->allocate(capacity);
+        m_jpegMemCapacity = m_jpegMemBuffer != nullptr ? capacity : 0;
+    }
+
+    // Set destination buffer
+    jpeg_buffer = m_jpegMemBuffer;
+    jpeg_size = m_jpegMemCapacity;
+    jpeg_mem_dest(&cinfo, &jpeg_buffer, &jpeg_size);
+
+    // Compress frame
+    jpeg_start_compress(&cinfo, TRUE);
+    writeJpegRows(cinfo, m_jpegRows.data(), src, layout, 0);
+    jpeg_finish_compress(&cinfo);
+
+    // Whole JPEG image is a single unit in libjpeg memory buffer.
+    m_outPts = src.frameId;
+    m_nals.clear();
+    m_nals.push_back({jpeg_buffer, static_cast<int>(jpeg_size), -1});
+
+    return true;
+}
+
+void VideoCodec::writeJpegRows(jpeg_compress_struct &info, uint8_t *rows, cr::video::Frame &src,
+                               const VideoCodecPlaneLayout &layout, int firstRow)
+{
+    // Write MCU rows of YCbCr planes
+    if (m_jpegRawInput)
+    {
+        int lumaRows = 8 * info.comp_info[0].v_samp_factor;
+        JSAMPROW rowPointers[3][16];
+        JSAMPARRAY planes[3] = {rowPointers[0], rowPointers[1], rowPointers[2]};
+        while (info.next_scanline < info.image_height)
+        {
+            fillJpegRawRows(rows, src, layout, firstRow + info.next_scanline, planes);
+            jpeg_write_raw_data(&info, planes, lumaRows);
+        }
+        return;
+    }
+
+    // Write scanlines
+    bool packed = src.fourcc == cr::video::Fourcc::RGB24;
+#ifdef JCS_EXTENSIONS
+    packed = packed || src.fourcc == cr::video::Fourcc::BGR24;
+#endif
+    JSAMPROW row_pointer[2];
+    while (info.next_scanline < info.image_height)
+    {
+        int row = firstRow + info.next_scanline;
+        if (packed)
+        {
+            row_pointer[0] = &src.data[layout.offset[0] + row * layout.stride[0]];
+            jpeg_write_scanlines(&info, row_pointer, 1);
+            continue;
+        }
+
+        // Other formats are converted by two rows, rows stay in CPU cache
+        // until compressed.
+        convertJpegRows(rows, src, layout, row);
+        row_pointer[0] = rows;
+        row_pointer[1] = rows + src.width * 3;
+        jpeg_write_scanlines(&info, row_pointer, 2);
+    }
+}
+
+bool VideoCodec::encodeJpegBands(cr::video::Frame &src, const VideoCodecPlaneLayout &layout)
+{
+    // Band threads are shared by JPEG sessions, start more threads if
+    // session has more bands.
+    for (size_t i = m_jpegBandThreads.size() + 1; i < m_jpegBands.size(); ++i)
+    {
+        m_jpegBandThreads.emplace_back(&VideoCodec::jpegBandThreadFunc, this, i, m_jpegBandJob);
+    }
+
+    // Start band threads and encode the first band in calling thread.
+    {
+        std::lock_guard<std::mutex> lock(m_jpegBandMutex);
+        m_jpegBandSrc = &src;
+        m_jpegBandLayout = layout;
+        m_jpegBandCount = m_jpegBands.size();
+        m_jpegBandsPending = static_cast<int>(m_jpegBandCount) - 1;
+        ++m_jpegBandJob;
+    }
+    m_jpegBandCond.notify_all();
+    encodeJpegBand(*m_jpegBands[0]);
+    {
+        std::unique_lock<std::mutex> lock(m_jpegBandMutex);
+        m_jpegBandDoneCond.wait(lock, [this] { return m_jpegBandsPending == 0; });
+    }
+
+    if (!joinJpegBands())
+    {
+        std::cout << "Can't join JPEG bands" << std::endl;
+        return false;
+    }
+
+    m_outPts = src.frameId;
+    m_nals.clear();
+    m_nals.push_back({m_jpegOutput.data(), static_cast<int>(m_jpegOutput.size()), -1});
+
+    return true;
+}
+
+void VideoCodec::encodeJpegBand(JpegBand &band)
+{
+    // libjpeg replaces destination buffer by malloc() buffer if band doesn't
+    // fit. Such buffer is released and band buffer grows.
+    if (band.output != band.buffer)
+    {
+        unsigned long capacity = band.size + band.size / 2;
+        releaseJpegBandBuffer(band);
+        band.allocator = m_allocator;
+        band.buffer = m_allocator->allocate(capacity);
+        band.capacity = band.buffer != nullptr ? capacity : 0;
+    }
+    band.output = band.buffer;
+    band.size = band.capacity;
+    jpeg_mem_dest(&band.cinfo, &band.output, &band.size);
+
+    jpeg_start_compress(&band.cinfo, TRUE);
+    writeJpegRows(band.cinfo, band.rows.data(), *m_jpegBandSrc, m_jpegBandLayout, band.firstRow);
+    jpeg_finish_compress(&band.cinfo);
+}
+
+/**
+ * @brief Find scan data of baseline JPEG image written by libjpeg.
+ * @param data JPEG image.
+ * @param size Size of image.
+ * @param sofPos Position of SOF marker.
+ * @return Position of scan data or 0 if image is invalid.
+ */
+static size_t findJpegScanData(const uint8_t *data, size_t size, size_t &sofPos)
+{
+    // Marker segments after SOI up to SOS, each has 16 bit length.
+    size_t pos = 2;
+    sofPos = 0;
+    while (pos + 4 <= size && data[pos] == 0xFF)
+    {
+        uint8_t marker = data[pos + 1];
+        size_t length = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+        if (marker >= 0xC0 && marker <= 0xC2)
+        {
+            sofPos = pos;
+        }
+        pos += 2 + length;
+        if (marker == 0xDA)
+        {
+            return sofPos != 0 && pos + 2 <= size ? pos : 0;
+        }
+    }
+    return 0;
+}
+
+bool VideoCodec::joinJpegBands()
+{
+    m_jpegOutput.clear();
+    for (size_t i = 0; i < m_jpegBands.size(); ++i)
+    {
+        JpegBand &band = *m_jpegBands[i];
+        size_t sofPos = 0;
+        size_t scanPos = findJpegScanData(band.output, band.size, sofPos);
+        if (scanPos == 0 || band.output[band.size - 2] != 0xFF || band.output[band.size - 1] != 0xD9)
+        {
+            return false;
+        }
+
+        // Each band ends with a restart interval. Band boundary gets next
+        // restart marker in modulo 8 sequence.
+        int intervals = static_cast<int>(i) * m_jpegBandRows / m_jpegRestartRows;
+        if (i == 0)
+        {
+            // Header of the first band with height of whole image.
+            m_jpegOutput.insert(m_jpegOutput.end(), band.output, band.output + scanPos);
+            m_jpegOutput[sofPos + 5] = static_cast<uint8_t>(m_height >> 8);
+            m_jpegOutput[sofPos + 6] = static_cast<uint8_t>(m_height & 0xFF);
+        }
+        else
+        {
+            m_jpegOutput.push_back(0xFF);
+            m_jpegOutput.push_back(static_cast<uint8_t>(0xD0 + (intervals - 1) % 8));
+        }
+        size_t start = m_jpegOutput.size();
+        m_jpegOutput.insert(m_jpegOutput.end(), band.output + scanPos, band.output + band.size - 2);
+
+        // Restart markers inside band are numbered from 0 by libjpeg. Byte
+        // stuffing guarantees that 0xFF in scan data is followed by 0.
+        for (size_t j = start; intervals % 8 != 0 && j + 1 < m_jpegOutput.size(); ++j)
+        {
+            uint8_t &marker = m_jpegOutput[j + 1];
+            if (m_jpegOutput[j] == 0xFF && marker >= 0xD0 && marker <= 0xD7)
+            {
+                marker = static_cast<uint8_t>(0xD0 + (marker - 0xD0 + intervals) % 8);
+            }
+        }
+    }
+
+    // End of image.
+    m_jpegOutput.push_back(0xFF);
+    m_jpegOutput.push_back(0xD9);
+
+    return true;
+}
+
+void VideoCodec::jpegBandThreadFunc(size_t index, uint64_t job)
+{
+    while (true)
+    {
+        size_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_jpegBandMutex);
+            m_jpegBandCond.wait(lock, [this, job] { return m_jpegBandStop || m_jpegBandJob != job; });
+            if (m_jpegBandStop)
+            {
+                return;
+            }
+            job = m_jpegBandJob;
+            count = m_jpegBandCount;
+        }
+
+        // Active session can have less bands than threads. Such threads
+        // aren't counted in pending bands and must not touch bands at all.
+        if (index >= count)
+        {
+            continue;
+        }
+
+        encodeJpegBand(*m_jpegBands[index]);
+
+        {
+            std::lock_guard<std::mutex> lock(m_jpegBandMutex);
+            if (--m_jpegBandsPending == 0)
+            {
+                m_jpegBandDoneCond.notify_one();
+            }
+        }
+    }
+}
+
+void VideoCodec::stopJpegBandThreads()
+{
+    if (!m_jpegBandThreads.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_jpegBandMutex);
+            m_jpegBandStop = true;
+        }
+        m_jpegBandCond.notify_all();
+        for (auto &thread : m_jpegBandThreads)
+        {
+            thread.join();
+        }
+        m_jpegBandThreads.clear();
+        m_jpegBandStop = false;
+    }
+}
+
+void VideoCodec::releaseJpegBands()
+{
+    for (auto &band : m_jpegBands)
+    {
+        jpeg_destroy_compress(&band->cinfo);
+        releaseJpegBandBuffer(*band);
+    }
+    m_jpegBands.clear();
+}
+
+void VideoCodec::releaseJpegBandBuffer(JpegBand &band)
+{
+    // Buffer allocated by libjpeg.
+    if (band.output != band.buffer)
+    {
+        free(band.output);
+    }
+    if (band.buffer != nullptr)
+    {
+        band.allocator->deallocate(band.buffer, band.capacity);
+    }
+    band.buffer = nullptr;
+    band.capacity = 0;
+    band.output = nullptr;
+    band.allocator.reset();
+}
+
+void VideoCodec::releaseEncoder()
+{
+    if (m_h264Encoder != nullptr)
+    {
+        x264_encoder_close(m_h264Encoder);
+        m_h264Encoder = nullptr;
+    }
+    if (m_h265Encoder != nullptr)
+    {
+        x265_picture_free(m_h265PicIn);
+        m_h265PicIn = nullptr;
+        x265_encoder_close(m_h265Encoder);
+        m_h265Encoder = nullptr;
+    }
+    if (m_jpegMemAllocator)
+    {
+        releaseJpegBuffer();
+        jpeg_destroy_compress(&cinfo);
+    }
+    releaseJpegBands();
+    m_encoderInit = false;
+    m_encoderFlushed = false;
+}
+
+void VideoCodec::swapEncoderSession(EncoderSession &session)
+{
+    std::swap(m_encoderInit, session.encoderInit);
+    std::swap(m_encoderFlushed, session.encoderFlushed);
+    std::swap(m_pixelFormat, session.pixelFormat);
+    std::swap(m_width, session.width);
+    std::swap(m_height, session.height);
+    std::swap(m_inputFourcc, session.inputFourcc);
+    std::swap(m_openGopSize, session.openGopSize);
+    std::swap(m_framesSinceIdr, session.framesSinceIdr);
+    std::swap(m_speedLevel, session.speedLevel);
+    std::swap(m_encodeTimeMs, session.encodeTimeMs);
+    std::swap(m_framesSinceSpeedChange, session.framesSinceSpeedChange);
+    std::swap(m_h264Param, session.h264Param);
+    std::swap(m_h264PicIn, session.h264PicIn);
+    std::swap(m_h264PicOut, session.h264PicOut);
+    std::swap(m_h264Encoder, session.h264Encoder);
+    std::swap(m_h265Param, session.h265Param);
+    std::swap(m_h265PicIn, session.h265PicIn);
+    std::swap(m_h265PicOut, session.h265PicOut);
+    std::swap(m_h265Encoder, session.h265Encoder);
+    std::swap(m_h265Pools, session.h265Pools);
+    std::swap(cinfo, session.cinfo);
+    std::swap(jerr, session.jerr);
+    std::swap(jpeg_buffer, session.jpegBuffer);
+    std::swap(jpeg_size, session.jpegSize);
+    std::swap(m_jpegMemBuffer, session.jpegMemBuffer);
+    std::swap(m_jpegMemCapacity, session.jpegMemCapacity);
+    std::swap(m_jpegMemAllocator, session.jpegMemAllocator);
+    std::swap(m_jpegRows, session.jpegRows);
+    std::swap(m_jpegRawInput, session.jpegRawInput);
+    std::swap(m_jpegRawRowSize, session.jpegRawRowSize);
+    std::swap(m_jpegBands, session.jpegBands);
+    std::swap(m_jpegBandRows, session.jpegBandRows);
+    std::swap(m_jpegRestartRows, session.jpegRestartRows);
+
+    // Pointers to swapped members. libjpeg destination is set before each
+    // image, so only error handler is referenced by compressor.
+    cinfo.err = &jerr;
+    session.cinfo.err = &session.jerr;
+    if (m_h265Encoder != nullptr && !m_h265Pools.empty())
+    {
+        m_h265Param.numaPools = m_h265Pools.c_str();
+    }
+    if (session.h265Encoder != nullptr && !session.h265Pools.empty())
+    {
+        session.h265Param.numaPools = session.h265Pools.c_str();
+    }
+}
+
+void VideoCodec::switchEncoderSession(cr::video::Fourcc fourcc, int width, int height,
+                                      cr::video::Fourcc inputFourcc)
+{
+    // Park active encoder as most recently used session.
+    std::unique_ptr<EncoderSession> parked(new EncoderSession());
+    swapEncoderSession(*parked);
+    m_encoderSessions.push_front(std::move(parked));
+
+    // Activate session of required format and resolution.
+    for (auto it = m_encoderSessions.begin(); it != m_encoderSessions.end(); ++it)
+    {
+        EncoderSession &session = **it;
+        if (session.pixelFormat == fourcc && session.width == width && session.height == height &&
+            session.inputFourcc == inputFourcc)
+        {
+            swapEncoderSession(session);
+            m_encoderSessions.erase(it);
+            // Rate control params could be changed while session was parked.
+            m_encoderReconfig = true;
+            break;
+        }
+    }
+
+    // Close least recently used sessions.
+    while (static_cast<int>(m_encoderSessions.size()) > m_encoderCacheSize)
+    {
+        releaseEncoderSession(*m_encoderSessions.back());
+        m_encoderSessions.pop_back();
+    }
+}
+
+void VideoCodec::releaseEncoderSession(EncoderSession &session)
+{
+    // Session is released as active encoder.
+    swapEncoderSession(session);
+    releaseEncoder();
+    swapEncoderSession(session);
+}
+
+void VideoCodec::releaseEncoderSessions()
+{
+    for (auto &session : m_encoderSessions)
+    {
+        releaseEncoderSession(*session);
+    }
+    m_encoderSessions.clear();
+}
+
+void VideoCodec::convertJpegRows(uint8_t *rows, cr::video::Frame &src,
+                                 const VideoCodecPlaneLayout &layout, int row)
+{
+    int width = src.width;
+    uint8_t *rgb = rows;
+    const uint8_t *y = src.data + layout.offset[0] + row * layout.stride[0];
+    const uint8_t *u = src.data + layout.offset[1] + (row / 2) * layout.stride[1];
+    const uint8_t *v = src.data + layout.offset[2] + (row / 2) * layout.stride[2];
+
+    switch (src.fourcc)
+    {
+    case cr::video::Fourcc::YU12:
+        m_converter.i420ToBgr(y, layout.stride[0], u, layout.stride[1], v, layout.stride[2],
+                              rgb, width * 3, width, 2, true);
+        break;
+    case cr::video::Fourcc::YV12:
+        m_converter.i420ToBgr(y, layout.stride[0], v, layout.stride[2], u, layout.stride[1],
+                              rgb, width * 3, width, 2, true);
+        break;
+    case cr::video::Fourcc::NV12: [[fallthrough]];
+    case cr::video::Fourcc::NV21:
+        m_converter.nv12ToBgr(y, layout.stride[0], u, layout.stride[1], rgb, width * 3, width, 2,
+                              true, src.fourcc == cr::video::Fourcc::NV21);
+        break;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY:
+    {
+        uint8_t *yuv = rgb + width * 3 * 2;
+        m_converter.yuyvToI420(y, layout.stride[0], yuv, width, yuv + width * 2, width / 2,
+                               yuv + width * 2 + width / 2, width / 2, width, 2,
+                               src.fourcc == cr::video::Fourcc::UYVY);
+        m_converter.i420ToBgr(yuv, width, yuv + width * 2, width / 2, yuv + width * 2 + width / 2, width / 2,
+                              rgb, width * 3, width, 2, true);
+        break;
+    }
+    default:
+        m_converter.bgrToRgb(y, layout.stride[0], rgb, width * 3, width, 2);
+        break;
+    }
+}
+
+/**
+ * @brief Lookup tables of expansion from video range (Y 16..235, C 16..240)
+ * to full range used by JFIF.
+ */
+struct JpegRangeTables
+{
+    uint8_t luma[256];
+    uint8_t chroma[256];
+
+    JpegRangeTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            int y = ((i - 16) * 255 + 109) / 219;
+            int c = ((i - 128) * 255 + (i >= 128 ? 112 : -112)) / 224 + 128;
+            luma[i] = static_cast<uint8_t>(y < 0 ? 0 : (y > 255 ? 255 : y));
+            chroma[i] = static_cast<uint8_t>(c < 0 ? 0 : (c > 255 ? 255 : c));
+        }
+    }
+};
+
+static const JpegRangeTables g_jpegRange;
+
+/// Copy row through lookup table, pad row by last sample.
+static void copyJpegRow(uint8_t *dst, int dstSize, const uint8_t *src, int step, int count,
+                        const uint8_t *table)
+{
+    for (int x = 0; x < count; ++x)
+    {
+        dst[x] = table[src[x * step]];
+    }
+    memset(dst + count, dst[count - 1], dstSize - count);
+}
+
+void VideoCodec::fillJpegRawRows(uint8_t *rows, cr::video::Frame &src, const VideoCodecPlaneLayout &layout,
+                                 int row, JSAMPARRAY planes[3])
+{
+    int width = src.width;
+    int height = src.height;
+    int vSamp = m_jpegSubsampling == VideoCodecJpegSubsampling::YUV420 ? 2 : 1;
+    int lumaRows = 8 * vSamp;
+    int lumaSize = m_jpegRawRowSize[0];
+    int chromaSize = m_jpegRawRowSize[1];
+    uint8_t *yBuffer = rows;
+    uint8_t *cbBuffer = yBuffer + lumaSize * lumaRows;
+    uint8_t *crBuffer = cbBuffer + chromaSize * 8;
+
+    // Rows below the image repeat last row, libjpeg reads whole DCT blocks.
+    for (int i = 0; i < lumaRows; ++i)
+    {
+        int srcRow = row + i < height ? row + i : height - 1;
+        planes[0][i] = yBuffer + i * lumaSize;
+        const uint8_t *srcData = src.data + layout.offset[0] + srcRow * layout.stride[0];
+        switch (src.fourcc)
+        {
+        case cr::video::Fourcc::YUYV:
+            copyJpegRow(planes[0][i], lumaSize, srcData, 2, width, g_jpegRange.luma);
+            break;
+        case cr::video::Fourcc::UYVY:
+            copyJpegRow(planes[0][i], lumaSize, srcData + 1, 2, width, g_jpegRange.luma);
+            break;
+        default:
+            copyJpegRow(planes[0][i], lumaSize, srcData, 1, width, g_jpegRange.luma);
+            break;
+        }
+    }
+
+    int chromaWidth = width / 2;
+    int chromaHeight = vSamp == 2 ? height / 2 : height;
+    int chromaRow = vSamp == 2 ? row / 2 : row;
+    for (int i = 0; i < 8; ++i)
+    {
+        int srcRow = chromaRow + i < chromaHeight ? chromaRow + i : chromaHeight - 1;
+        planes[1][i] = cbBuffer + i * chromaSize;
+        planes[2][i] = crBuffer + i * chromaSize;
+        const uint8_t *p0 = src.data + layout.offset[0] + srcRow * layout.stride[0];
+        const uint8_t *p1 = src.data + layout.offset[1] + srcRow * layout.stride[1];
+        const uint8_t *p2 = src.data + layout.offset[2] + srcRow * layout.stride[2];
+        const uint8_t *cbData = p1;
+        const uint8_t *crData = p2;
+        int step = 1;
+        switch (src.fourcc)
+        {
+        case cr::video::Fourcc::YV12:
+            cbData = p2;
+            crData = p1;
+            break;
+        case cr::video::Fourcc::NV12:
+            crData = p1 + 1;
+            step = 2;
+            break;
+        case cr::video::Fourcc::NV21:
+            cbData = p1 + 1;
+            crData = p1;
+            step = 2;
+            break;
+        case cr::video::Fourcc::YUYV:
+            cbData = p0 + 1;
+            crData = p0 + 3;
+            step = 4;
+            break;
+        case cr::video::Fourcc::UYVY:
+            cbData = p0;
+            crData = p0 + 2;
+            step = 4;
+            break;
+        default:
+            break;
+        }
+        copyJpegRow(planes[1][i], chromaSize, cbData, step, chromaWidth, g_jpegRange.chroma);
+        copyJpegRow(planes[2][i], chromaSize, crData, step, chromaWidth, g_jpegRange.chroma);
+    }
+}
+
+bool VideoCodec::initDecoder(cr::video::Frame src)
+{
+    auto codecType = AV_CODEC_ID_NONE;
+    switch (src.fourcc)
+    {
+    case cr::video::Fourcc::H264:
+        codecType = AV_CODEC_ID_H264;
+        break;
+    case cr::video::Fourcc::HEVC:
+        codecType = AV_CODEC_ID_HEVC;
+        break;
+    case cr::video::Fourcc::JPEG:
+        // JPEG is decoded by libjpeg directly. Libav frame is used only for
+        // VideoCodecPicture output.
+        frame = av_frame_alloc();
+        if (!frame)
+        {
+            std::cout << "Could not allocate video frame" << std::endl;
+            return false;
+        }
+        m_jpegDinfo.err = jpeg_std_error(&m_jpegDerr.mgr);
+        m_jpegDerr.mgr.error_exit = jpegDecoderErrorExit;
+        jpeg_create_decompress(&m_jpegDinfo);
+        m_jpegDecoderInit = true;
+        return true;
+    default:
+        std::cout << "Invalid format" << std::endl;
+        return false;
+    }
+
+    m_decoder = avcodec_find_decoder(codecType);
+    if (!m_decoder) 
+    {
+        std::cout << "H.264 codec not found" << std::endl;
+        return false;
+    }
+
+    codec_ctx = avcodec_alloc_context3(m_decoder);
+    if (!codec_ctx) 
+    {
+        std::cout << "Could not allocate video codec context" << std::endl;
+        return false;
+    }
+
+    // Decoded pictures are allocated from codec buffer pool.
+    codec_ctx->opaque = this;
+    if (m_decoder->capabilities & AV_CODEC_CAP_DR1)
+    {
+        codec_ctx->get_buffer2 = getDecoderBuffer;
+    }
+
+    // Set decoder threading. Must be set before avcodec_open2().
+    codec_ctx->thread_count = m_decoderThreads; // 0 - auto, 1 by default
+    codec_ctx->thread_type = m_decoderThreadType;
+    if (m_decoderFast)
+    {
+        codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    applyDecoderSkip();
+
+    if (avcodec_open2(codec_ctx, m_decoder, NULL) < 0) 
+    {
+        std::cout << "Could not open codec" << std::endl;
+        avcodec_free_context(&codec_ctx);
+        return false;
+    }
+
+    packet = av_packet_alloc();
+    if (!packet) 
+    {
+        std::cout << "Could not allocate packet" << std::endl;
+        avcodec_free_context(&codec_ctx);
+        return false;
+    }
+
+    frame = av_frame_alloc();
+    if (!frame) 
+    {
+        std::cout << "Could not allocate video frame" << std::endl;
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_ctx);
+        return false;
+    }
+
+    return true;
+}
+
+bool VideoCodec::prepareDecoder(cr::video::Frame &src)
+{
+    // Check if input frame is valid
+    if (src.fourcc != cr::video::Fourcc::H264 && src.fourcc != cr::video::Fourcc::HEVC && src.fourcc != cr::video::Fourcc::JPEG)
+    {
+        std::cout << "Invalid pixel format" << std::endl;
+        return false;
+    }
+
+    // Apply new decoder params
+    if (m_decoderInit && m_decoderReinit)
+    {
+        releaseDecoder();
+        m_decoderInit = false;
+    }
+
+    if (!m_decoderInit)
+    {
+        if (!initDecoder(src))
+        {
+            std::cout << "Failed to initialize decoder" << std::endl;
+            return false;
+        }
+
+        m_decoderInit = true;
+        m_decoderReinit = false;
+        ++m_stats.decoderInits;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read slice type of H264 slice header. Emulation prevention bytes
+ * are skipped.
+ * @param data Slice data after NAL unit header.
+ * @param size Size of data.
+ * @return Slice type (0..9) or -1 if header is truncated.
+ */
+static int readH264SliceType(const uint8_t *data, int size)
+{
+    // first_mb_in_slice and slice_type are Exp-Golomb codes.
+    int pos = 0;
+    int bit = 8;
+    auto readBit = [&]() -> int
+    {
+        if (bit == 8)
+        {
+            if (pos >= 2 && data[pos - 1] == 0 && data[pos - 2] == 0 && pos < size && data[pos] == 3)
+            {
+                ++pos;
+            }
+            if (pos >= size)
+            {
+                return -1;
+            }
+            ++pos;
+            bit = 0;
+        }
+        return (data[pos - 1] >> (7 - bit++)) & 1;
+    };
+    auto readUe = [&]() -> int
+    {
+        int leadingZeros = 0;
+        int value = readBit();
+        while (value == 0 && leadingZeros < 24)
+        {
+            ++leadingZeros;
+            value = readBit();
+        }
+        if (value != 1)
+        {
+            return -1;
+        }
+        int code = 0;
+        for (int i = 0; i < leadingZeros; ++i)
+        {
+            value = readBit();
+            if (value < 0)
+            {
+                return -1;
+            }
+            code = (code << 1) | value;
+        }
+        return (1 << leadingZeros) - 1 + code;
+    };
+
+    if (readUe() < 0)
+    {
+        return -1;
+    }
+    int type = readUe();
+    return type >= 0 && type <= 9 ? type : -1;
+}
+
+/**
+ * @brief Check if Annex-B packet has slices of key frame: H264 IDR or
+ * picture of I / SI slices only (resync point of open GOP streams), HEVC
+ * IRAP (IDR, CRA, BLA). Packets without slices (parameter sets only) are
+ * treated as key packets.
+ */
+static bool hasKeySlice(const uint8_t *data, int size, bool hevc)
+{
+    bool hasSlice = false;
+    bool intraOnly = true;
+    for (int i = 0; i + 3 < size; ++i)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            continue;
+        }
+        int header = data[i + 3];
+        int type = hevc ? (header >> 1) & 0x3F : header & 0x1F;
+        if (hevc ? (type >= 16 && type <= 21) : type == 5)
+        {
+            return true;
+        }
+        if (hevc ? type <= 31 : (type >= 1 && type <= 4))
+        {
+            hasSlice = true;
+            // Slice type of partitioned slices (2..4) is in partition A.
+            int sliceType = !hevc && type == 1 ? readH264SliceType(data + i + 4, size - i - 4) : -1;
+            intraOnly &= sliceType % 5 == 2 || sliceType % 5 == 4;
+        }
+        i += 2;
+    }
+
+    return !hasSlice || (!hevc && intraOnly);
+}
+
+bool VideoCodec::filterPacket(cr::video::Frame &src)
+{
+    if (!m_decoderKeyFramesOnly || src.data == nullptr ||
+        (src.fourcc != cr::video::Fourcc::H264 && src.fourcc != cr::video::Fourcc::HEVC))
+    {
+        return true;
+    }
+
+    // Only NAL unit headers are parsed, decoder doesn't see dropped packets.
+    if (hasKeySlice(src.data, src.size, src.fourcc == cr::video::Fourcc::HEVC))
+    {
+        return true;
+    }
+    ++m_stats.decoderFilteredPackets;
+    return false;
+}
+
+/**
+ * @brief Libav discard level of skip mode.
+ */
+static AVDiscard toAvDiscard(VideoCodecDiscard discard)
+{
+    switch (discard)
+    {
+    case VideoCodecDiscard::NONREF: return AVDISCARD_NONREF;
+    case VideoCodecDiscard::BIDIR: return AVDISCARD_BIDIR;
+    case VideoCodecDiscard::NONINTRA: return AVDISCARD_NONINTRA;
+    case VideoCodecDiscard::NONKEY: return AVDISCARD_NONKEY;
+    case VideoCodecDiscard::ALL: return AVDISCARD_ALL;
+    default: return AVDISCARD_DEFAULT;
+    }
+}
+
+void VideoCodec::applyDecoderSkip()
+{
+    // Frame threads take values from user context before each packet.
+    if (!codec_ctx)
+    {
+        return;
+    }
+    codec_ctx->skip_frame = toAvDiscard(m_decoderSkipFrame);
+    codec_ctx->skip_loop_filter = toAvDiscard(m_decoderSkipLoopFilter);
+    codec_ctx->skip_idct = toAvDiscard(m_decoderSkipIdct);
+}
+
+bool VideoCodec::decodeFrame(cr::video::Frame &src)
+{
+    // Copy encoded frame to pooled packet buffer with zeroed padding, so
+    // libav doesn't allocate own copy of packet. Pool buffers grow by powers
+    // of two to fit largest packet.
+    size_t required = static_cast<size_t>(src.size) + AV_INPUT_BUFFER_PADDING_SIZE;
+    size_t poolSize = m_packetBufferSize < 65536 ? 65536 : m_packetBufferSize;
+    while (poolSize < required)
+    {
+        poolSize *= 2;
+    }
+    packet->buf = getPoolBuffer(m_packetBufferPool, m_packetBufferSize, poolSize);
+    if (packet->buf != nullptr)
+    {
+        memcpy(packet->buf->data, src.data, src.size);
+        memset(packet->buf->data + src.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        packet->data = packet->buf->data;
+    }
+    else
+    {
+        packet->data = src.data;
+    }
+    packet->size = src.size;
+
+    // Send packet to decoder.
+    int result = avcodec_send_packet(codec_ctx, packet);
+    if (result == AVERROR(EAGAIN))
+    {
+        // Decoder output is full: take decoded frame and send packet again.
+        bool decoded = receiveDecodedFrame();
+        result = avcodec_send_packet(codec_ctx, packet);
+        av_buffer_unref(&packet->buf);
+        if (result < 0)
+        {
+            // Packet is lost, frame taken from decoder output is returned.
+            std::cout << "Error decoding frame" << std::endl;
+            ++m_stats.failedDecodes;
+        }
+        return decoded;
+    }
+    av_buffer_unref(&packet->buf);
+    if (result < 0)
+    {
+        std::cout << "Error decoding frame" << std::endl;
+        ++m_stats.failedDecodes;
+        return false;
+    }
+
+    // Frame can be delayed by decoder (frame threads).
+    return receiveDecodedFrame();
+}
+
+bool VideoCodec::receiveDecodedFrame()
+{
+    // JPEG decoder returns frames by decode() only.
+    if (m_jpegDecoderInit)
+    {
+        return false;
+    }
+
+    int result = avcodec_receive_frame(codec_ctx, frame);
+    if (result == AVERROR_EOF)
+    {
+        // Decoder is drained, reset it to accept next packets.
+        avcodec_flush_buffers(codec_ctx);
+        return false;
+    }
+    if (result < 0)
+    {
+        // AVERROR(EAGAIN): decoder needs more packets.
+        if (result != AVERROR(EAGAIN))
+        {
+            std::cout << "Error decoding frame" << std::endl;
+            ++m_stats.failedDecodes;
+        }
+        return false;
+    }
+    checkDecodedFormat(frame->width, frame->height, frame->format);
+
+    return true;
+}
+
+void VideoCodec::checkDecodedFormat(int width, int height, int format)
+{
+    // Decoders apply new sequence parameters without re-opening, so stream
+    // continues with new geometry. Output frames and scaler contexts follow
+    // size of each decoded frame.
+    if (width == m_decodedWidth && height == m_decodedHeight && format == m_decodedFormat)
+    {
+        return;
+    }
+    if (m_decodedWidth != -1)
+    {
+        ++m_stats.decoderFormatChanges;
+    }
+    m_decodedWidth = width;
+    m_decodedHeight = height;
+    m_decodedFormat = format;
+}
+
+bool VideoCodec::outputDecodedFrame(cr::video::Frame &dst)
+{
+    {
+        StageScope scope(*this, m_stats.convert, "VideoCodec::convert");
+        if (!convertDecodedFrame(dst))
+        {
+            ++m_stats.failedDecodes;
+            return false;
+        }
+    }
+    ++m_stats.decodedFrames;
+    m_stats.decoderBytesOut += static_cast<uint64_t>(dst.size);
+    checkStatsCallback();
+
+    return true;
+}
+
+/**
+ * @brief Copy image plane row by row.
+ */
+static void copyPlane(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride,
+                      int rowSize, int rows)
+{
+    if (dstStride == srcStride)
+    {
+        memcpy(dst, src, static_cast<size_t>(srcStride) * (rows - 1) + rowSize);
+        return;
+    }
+    for (int y = 0; y < rows; ++y)
+    {
+        memcpy(dst + y * dstStride, src + y * srcStride, rowSize);
+    }
+}
+
+/**
+ * @brief Re-allocate decoded frame if its size differs or memory is too small.
+ * Chroma planes of YUV 4:2:0 frame of odd size are rounded up.
+ * @return TRUE if the frame has enough memory or FALSE.
+ */
+static bool prepareDecodedFrame(cr::video::Frame &dst, int width, int height)
+{
+    int required = dst.fourcc == cr::video::Fourcc::BGR24 ? width * height * 3 :
+                   width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    if (dst.width == width && dst.height == height && dst.size >= required)
+    {
+        return true;
+    }
+
+    cr::video::Fourcc fourcc = dst.fourcc;
+    dst.release();
+    dst = cr::video::Frame(width, height, fourcc);
+    if (dst.size < required)
+    {
+        dst.release();
+        dst = cr::video::Frame(width, height, fourcc, required);
+    }
+    if (dst.size < required)
+    {
+        std::cout << "Can't allocate frame " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool VideoCodec::convertDecodedFrame(cr::video::Frame &dst)
+{
+    int width = frame->width;
+    int height = frame->height;
+
+    // Check if destination frame has enough memory
+    if (!prepareDecodedFrame(dst, width, height))
+    {
+        return false;
+    }
+
+    int ySize = width * height;
+    int uvWidth = (width + 1) / 2;
+    int uvHeight = (height + 1) / 2;
+    bool isYuv420 = frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P;
+
+    switch (dst.fourcc)
+    {
+    case cr::video::Fourcc::BGR24:
+        if (frame->format == AV_PIX_FMT_YUV420P && width % 2 == 0 && height % 2 == 0)
+        {
+            // Same size conversion with SIMD kernels
+            m_converter.i420ToBgr(frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+                                  frame->data[2], frame->linesize[2], dst.data, width * 3, width, height, false);
+        }
+        else
+        {
+            // Full range (MJPEG), other chroma subsampling or odd size
+            SwsContext* scaler = getScaler(width, height, static_cast<AVPixelFormat>(frame->format), AV_PIX_FMT_BGR24);
+            if (scaler == nullptr)
+            {
+                return false;
+            }
+            uint8_t* dstData[4] = {dst.data, nullptr, nullptr, nullptr};
+            int dstLinesize[4] = {width * 3, 0, 0, 0};
+            sws_scale(scaler, frame->data, frame->linesize, 0, height, dstData, dstLinesize);
+        }
+        dst.size = width * height * 3;
+        break;
+    case cr::video::Fourcc::YU12:
+        if (isYuv420)
+        {
+            // Copy planes without conversion
+            copyPlane(dst.data, width, frame->data[0], frame->linesize[0], width, height);
+            copyPlane(dst.data + ySize, uvWidth, frame->data[1], frame->linesize[1], uvWidth, uvHeight);
+            copyPlane(dst.data + ySize + uvWidth * uvHeight, uvWidth, frame->data[2], frame->linesize[2], uvWidth, uvHeight);
+        }
+        else
+        {
+            // Other chroma subsampling (for example MJPEG 4:2:2)
+            SwsContext* scaler = getScaler(width, height, static_cast<AVPixelFormat>(frame->format), AV_PIX_FMT_YUV420P);
+            if (scaler == nullptr)
+            {
+                return false;
+            }
+            uint8_t* dstData[4] = {dst.data, dst.data + ySize, dst.data + ySize + uvWidth * uvHeight, nullptr};
+            int dstLinesize[4] = {width, uvWidth, uvWidth, 0};
+            sws_scale(scaler, frame->data, frame->linesize, 0, height, dstData, dstLinesize);
+        }
+        dst.size = ySize + 2 * uvWidth * uvHeight;
+        break;
+    case cr::video::Fourcc::NV12: [[fallthrough]];
+    case cr::video::Fourcc::NV21:
+        if (isYuv420)
+        {
+            // Copy Y plane and interleave U and V planes
+            copyPlane(dst.data, width, frame->data[0], frame->linesize[0], width, height);
+            const uint8_t *first = dst.fourcc == cr::video::Fourcc::NV12 ? frame->data[1] : frame->data[2];
+            const uint8_t *second = dst.fourcc == cr::video::Fourcc::NV12 ? frame->data[2] : frame->data[1];
+            for (int y = 0; y < uvHeight; ++y)
+            {
+                uint8_t *dstRow = dst.data + ySize + y * uvWidth * 2;
+                const uint8_t *firstRow = first + y * frame->linesize[1];
+                const uint8_t *secondRow = second + y * frame->linesize[2];
+                for (int x = 0; x < uvWidth; ++x)
+                {
+                    dstRow[2 * x] = firstRow[x];
+                    dstRow[2 * x + 1] = secondRow[x];
+                }
+            }
+        }
+        else
+        {
+            SwsContext* scaler = getScaler(width, height, static_cast<AVPixelFormat>(frame->format),
+                dst.fourcc == cr::video::Fourcc::NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_NV21);
+            if (scaler == nullptr)
+            {
+                return false;
+            }
+            uint8_t* dstData[4] = {dst.data, dst.data + ySize, nullptr, nullptr};
+            int dstLinesize[4] = {width, uvWidth * 2, 0, 0};
+            sws_scale(scaler, frame->data, frame->linesize, 0, height, dstData, dstLinesize);
+        }
+        dst.size = ySize + 2 * uvWidth * uvHeight;
+        break;
+    default:
+        std::cout << "Invalid pixel format" << std::endl;
+        return false;
+    }
+
+    return true;
+}
 
-    // Get default parameters
-    x265_param_default_preset(&m_h265Param, "ultrafast", "zerolatency");
+SwsContext* VideoCodec::getScaler(int width, int height,
+                                  AVPixelFormat srcFormat, AVPixelFormat dstFormat)
+{
+    for (size_t i = 0; i < m_scalers.size(); ++i)
+    {
+        const ScalerContext& scaler = m_scalers[i];
+        if (scaler.width == width && scaler.height == height &&
+            scaler.srcFormat == srcFormat && scaler.dstFormat == dstFormat)
+        {
+            // Move to front to keep most recently used contexts.
+            std::rotate(m_scalers.begin(), m_scalers.begin() + i, m_scalers.begin() + i + 1);
+            return m_scalers.front().context;
+        }
+    }
 
-    // Initialize x265
-    m_h265Param.sourceWidth = width;
-    m_h265Param.sourceHeight = height;
-    m_h265Param.frameNumThreads = 1;
-    m_h265Param.sourceBitDepth = 8;
-    m_h265Param.bRepeatHeaders = 1;
-    m_h265Param.bAnnexB = 1;
-    m_h265Param.internalCsp = X265_CSP_I420;
-    // Set bitrate
-    m_h265Param.rc.bitrate = m_bitrate;
-    m_h265Param.rc.rateControlMode = X265_RC_CRF;
-    // Set GOP size
-    m_h265Param.keyframeMax = 30;
-    // Set frame rate
-    m_h265Param.fpsNum = 30;
-    m_h265Param.fpsDenom = 1;
-    m_h265Param.frameNumThreads = 1;
+    ScalerContext scaler;
+    scaler.context = sws_getContext(width, height, srcFormat, width, height, dstFormat,
+                                    SWS_BILINEAR, NULL, NULL, NULL);
+    if (scaler.context == nullptr)
+    {
+        std::cout << "Can't create scaler context" << std::endl;
+        return nullptr;
+    }
+    scaler.width = width;
+    scaler.height = height;
+    scaler.srcFormat = srcFormat;
+    scaler.dstFormat = dstFormat;
 
-    // Apply profile
-    if (x265_param_apply_profile(&m_h265Param, "main") < 0)
+    // Release least recently used context.
+    if (m_scalers.size() >= m_maxScalers)
     {
-        std::cout << "x265_param_apply_profile failed" << std::endl;
-        return false;
+        sws_freeContext(m_scalers.back().context);
+        m_scalers.pop_back();
     }
+    m_scalers.insert(m_scalers.begin(), scaler);
 
-    // Allocate picture
-    m_h265PicIn = x265_picture_alloc();
-    x265_picture_init(&m_h265Param, m_h265PicIn);
+    return m_scalers.front().context;
+}
 
-    // Open encoder
-    m_h265Encoder = x265_encoder_open(&m_h265Param);
+void VideoCodec::releaseDecoder()
+{
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
 
-    m_h265InternalBuffer = new uint8_t[width * height * 3]; // Enough memory for any frame.
+    // Release sws contexts
+    for (ScalerContext& scaler : m_scalers)
+    {
+        sws_freeContext(scaler.context);
+    }
+    m_scalers.clear();
+    m_decodedWidth = -1;
+    m_decodedHeight = -1;
+    m_decodedFormat = -1;
 
-    return true;
+    if (m_jpegDecoderInit)
+    {
+        jpeg_destroy_decompress(&m_jpegDinfo);
+        m_jpegDecoderInit = false;
+    }
+
+    // Pools are released when pictures which reference them are released.
+    av_buffer_pool_uninit(&m_pictureBufferPool);
+    m_pictureBufferSize = 0;
+    av_buffer_pool_uninit(&m_packetBufferPool);
+    m_packetBufferSize = 0;
 }
 
-bool VideoCodec::encodeH265Frame(cr::video::Frame &src, cr::video::Frame &dst)
+void VideoCodec::releaseJpegBuffer()
 {
-    // Copy YUV420 frame to the x265 picture
-    memcpy(m_h265InternalBuffer, src.data, src.size);
+    // Buffer allocated by libjpeg.
+    if (jpeg_buffer != m_jpegMemBuffer)
+    {
+        free(jpeg_buffer);
+    }
+    if (m_jpegMemBuffer != nullptr)
+    {
+        m_jpegMemAllocator->deallocate(m_jpegMemBuffer, m_jpegMemCapacity);
+    }
+    jpeg_buffer = nullptr;
+    jpeg_size = 0;
+    m_jpegMemBuffer = nullptr;
+    m_jpegMemCapacity = 0;
+    m_jpegMemAllocator.reset();
+}
 
-    // Set only Pointer to the Y plane
-    m_h265PicIn->planes[0] = m_h265InternalBuffer;
-    m_h265PicIn->planes[1] = m_h265InternalBuffer + src.width * src.height;
-    m_h265PicIn->planes[2] = m_h265InternalBuffer + src.width * src.height * 5 / 4;
+AVBufferRef *VideoCodec::getPoolBuffer(AVBufferPool *&pool, size_t &poolSize, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_bufferPoolMutex);
+    if (pool == nullptr || poolSize != size)
+    {
+        // Buffers of previous pool are released with their last references.
+        av_buffer_pool_uninit(&pool);
+        poolSize = 0;
+        BufferPoolContext *context = new BufferPoolContext{m_allocator, size};
+        pool = av_buffer_pool_init2(static_cast<AvBufferSize>(size), context, allocPoolBuffer, freePoolContext);
+        if (pool == nullptr)
+        {
+            delete context;
+            return nullptr;
+        }
+        poolSize = size;
+    }
 
-    m_h265PicIn->stride[0] = src.width;     // Y stride
-    m_h265PicIn->stride[1] = src.width / 2; // U stride
-    m_h265PicIn->stride[2] = src.width / 2; // V stride
+    return av_buffer_pool_get(pool);
+}
 
-    // Encode frame.
-    x265_nal *nal;
-    uint32_t i_nal;
-    if (x265_encoder_encode(m_h265Encoder, &nal, &i_nal, m_h265PicIn, &m_h265PicOut) < 0)
+bool VideoCodec::getPictureBuffer(AVFrame *dst, int width, int height)
+{
+    AVPixelFormat format = static_cast<AVPixelFormat>(dst->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    if (desc == nullptr || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)))
     {
-        std::cout << "x265_encoder_encode failed" << std::endl;
         return false;
     }
 
-    // Copy NAL data to destination frame
-    int offset = 0;
-    for (uint32_t i = 0; i < i_nal; ++i)
+    int linesizes[4] = {0};
+    if (av_image_fill_linesizes(linesizes, format, width) < 0)
+    {
+        return false;
+    }
+
+    // All planes in one buffer, lines are aligned by 64 bytes for SIMD.
+    int planes = av_pix_fmt_count_planes(format);
+    size_t offsets[4] = {0};
+    size_t size = 0;
+    for (int i = 0; i < planes; ++i)
     {
-        memcpy(dst.data + offset, nal[i].payload, nal[i].sizeBytes);
-        offset += nal[i].sizeBytes;
+        linesizes[i] = (linesizes[i] + 63) & ~63;
+        int planeHeight = i == 1 || i == 2 ? -((-height) >> desc->log2_chroma_h) : height;
+        offsets[i] = size;
+        size += static_cast<size_t>(linesizes[i]) * planeHeight;
     }
-    dst.size = offset; // Set correct size for the encoded frame
+    // Decoders can read a few bytes after last line.
+    size += 16 + 64;
+
+    AVBufferRef *buffer = getPoolBuffer(m_pictureBufferPool, m_pictureBufferSize, size);
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+    dst->buf[0] = buffer;
+    for (int i = 0; i < planes; ++i)
+    {
+        dst->data[i] = buffer->data + offsets[i];
+        dst->linesize[i] = linesizes[i];
+    }
+    dst->extended_data = dst->data;
 
     return true;
 }
 
-bool VideoCodec::initJpegEncoder(int width, int height)
+int VideoCodec::getDecoderBuffer(AVCodecContext *ctx, AVFrame *frame, int flags)
 {
-    // Check if it is already initialized and release resources
-    if (jpeg_buffer != nullptr)
+    VideoCodec *codec = static_cast<VideoCodec*>(ctx->opaque);
+
+    // Decoders write whole blocks, so planes are aligned as by default libav
+    // allocator.
+    int width = frame->width;
+    int height = frame->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesizeAlign);
+    if (!codec->getPictureBuffer(frame, width, height))
     {
-        delete[] jpeg_buffer;
-        jpeg_buffer = nullptr;
-        jpeg_destroy_compress(&cinfo);
+        return avcodec_default_get_buffer2(ctx, frame, flags);
     }
 
-    // Allocate memory for the JPEG buffer
-    jpeg_buffer = new unsigned char[width * height * 3];
-
-    // Initialize JPEG compressor
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 50, TRUE);
-
-    return true;
+    return 0;
 }
 
-bool VideoCodec::encodeJpegFrame(cr::video::Frame &src, cr::video::Frame &dst)
+void VideoCodec::jpegDecoderErrorExit(j_common_ptr info)
 {
-    // Set destination buffer
-    jpeg_mem_dest(&cinfo, &jpeg_buffer, &jpeg_size);
+    // Print libjpeg message and return to decoding method.
+    (*info->err->output_message)(info);
+    JpegDecoderError *error = reinterpret_cast<JpegDecoderError*>(info->err);
+    longjmp(error->jump, 1);
+}
 
-    // Start compression
-    jpeg_start_compress(&cinfo, TRUE);
+bool VideoCodec::readJpegHeader(cr::video::Frame &src)
+{
+    jpeg_mem_src(&m_jpegDinfo, src.data, static_cast<unsigned long>(src.size));
+    if (jpeg_read_header(&m_jpegDinfo, TRUE) != JPEG_HEADER_OK)
+    {
+        std::cout << "Invalid JPEG header" << std::endl;
+        return false;
+    }
 
-    // Write scanlines
-    JSAMPROW row_pointer[1];
-    while (cinfo.next_scanline < cinfo.image_height)
+    // Grayscale or YCbCr images with luma sampled at max resolution and
+    // chroma subsampled by 1, 2 or 4.
+    bool valid = m_jpegDinfo.num_components == 1 ||
+                 (m_jpegDinfo.num_components == 3 && m_jpegDinfo.jpeg_color_space == JCS_YCbCr);
+    for (int i = 0; valid && i < m_jpegDinfo.num_components; ++i)
+    {
+        int hStep = m_jpegDinfo.max_h_samp_factor / m_jpegDinfo.comp_info[i].h_samp_factor;
+        int vStep = m_jpegDinfo.max_v_samp_factor / m_jpegDinfo.comp_info[i].v_samp_factor;
+        valid = m_jpegDinfo.max_h_samp_factor % m_jpegDinfo.comp_info[i].h_samp_factor == 0 &&
+                m_jpegDinfo.max_v_samp_factor % m_jpegDinfo.comp_info[i].v_samp_factor == 0 &&
+                (hStep == 1 || hStep == 2 || hStep == 4) && (vStep == 1 || vStep == 2 || vStep == 4) &&
+                (i > 0 || (hStep == 1 && vStep == 1));
+    }
+    if (!valid)
     {
-        row_pointer[0] = &src.data[cinfo.next_scanline * src.width * 3];
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        std::cout << "Unsupported JPEG color space" << std::endl;
+        return false;
     }
 
-    // Finish compression
-    jpeg_finish_compress(&cinfo);
+    m_jpegDinfo.scale_num = 1;
+    m_jpegDinfo.scale_denom = m_jpegDecodeScale;
+    m_jpegDinfo.dct_method = m_jpegDecodeFastIdct ? JDCT_IFAST : JDCT_ISLOW;
 
-    // Copy JPEG data to destination frame
-    memcpy(dst.data, jpeg_buffer, jpeg_size);
-    dst.size = jpeg_size;
+    // Images are tracked by output size, chroma subsampling of each image
+    // is handled by decoding.
+    jpeg_calc_output_dimensions(&m_jpegDinfo);
+    checkDecodedFormat(static_cast<int>(m_jpegDinfo.output_width),
+                       static_cast<int>(m_jpegDinfo.output_height), AV_PIX_FMT_NONE);
 
     return true;
 }
 
-bool VideoCodec::initDecoder(cr::video::Frame src)
+/// Size of scaled DCT block of component in raw output. With downscaling
+/// libjpeg scales chroma blocks up by IDCT instead of upsampling.
+static int rawBlockSize(const jpeg_component_info &comp, bool vertical)
 {
-    auto codecType = AV_CODEC_ID_NONE;
-    switch (src.fourcc)
+#if JPEG_LIB_VERSION >= 70
+    return vertical ? comp.DCT_v_scaled_size : comp.DCT_h_scaled_size;
+#else
+    (void)vertical;
+    return comp.DCT_scaled_size;
+#endif
+}
+
+/// Number of component rows in iMCU row of raw output.
+static int rawRows(const jpeg_decompress_struct &info, int component)
+{
+    return info.comp_info[component].v_samp_factor * rawBlockSize(info.comp_info[component], true);
+}
+
+/// Log2 of ratio of luma and component resolution in raw output (1, 2 or 4).
+static int rawSamplingShift(const jpeg_decompress_struct &info, int component, bool vertical)
+{
+    const jpeg_component_info &luma = info.comp_info[0];
+    const jpeg_component_info &comp = info.comp_info[component];
+    int ratio = vertical ?
+                luma.v_samp_factor * rawBlockSize(luma, true) / (comp.v_samp_factor * rawBlockSize(comp, true)) :
+                luma.h_samp_factor * rawBlockSize(luma, false) / (comp.h_samp_factor * rawBlockSize(comp, false));
+    return ratio == 4 ? 2 : ratio - 1;
+}
+
+bool VideoCodec::decodeJpegFrame(cr::video::Frame &src, cr::video::Frame &dst)
+{
+    // libjpeg errors return here. No objects with destructors are alive
+    // while libjpeg functions are called.
+    if (setjmp(m_jpegDerr.jump))
     {
-    case cr::video::Fourcc::H264:
-        codecType = AV_CODEC_ID_H264;
-        break;
-    case cr::video::Fourcc::HEVC:
-        codecType = AV_CODEC_ID_HEVC;
-        break;
-    case cr::video::Fourcc::JPEG:
-        codecType = AV_CODEC_ID_MJPEG;
-        break;
-    default:
-        std::cout << "Invalid format" << std::endl;
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    m_decoder = avcodec_find_decoder(codecType);
-    if (!m_decoder) 
+    if (!readJpegHeader(src))
     {
-        std::cout << "H.264 codec not found" << std::endl;
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    codec_ctx = avcodec_alloc_context3(m_decoder);
-    if (!codec_ctx) 
+    // 4:2:0 output takes pairs of luma rows. iMCU row has one luma row with
+    // 1/8 scale and no vertical subsampling, so two iMCU rows are read at once.
+    int group = m_jpegDinfo.max_v_samp_factor * DCTSIZE / m_jpegDecodeScale == 1 ? 2 : 1;
+    if (dst.fourcc == cr::video::Fourcc::BGR24)
     {
-        std::cout << "Could not allocate video codec context" << std::endl;
+#ifdef JCS_EXTENSIONS
+        m_jpegDinfo.out_color_space = JCS_EXT_BGR;
+#else
+        m_jpegDinfo.out_color_space = JCS_RGB;
+#endif
+        jpeg_start_decompress(&m_jpegDinfo);
+    }
+    else
+    {
+        startJpegRawDecoding(group);
+    }
+
+    // Check if destination frame has enough memory
+    int width = static_cast<int>(m_jpegDinfo.output_width);
+    int height = static_cast<int>(m_jpegDinfo.output_height);
+    if (!prepareDecodedFrame(dst, width, height))
+    {
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    if (avcodec_open2(codec_ctx, m_decoder, NULL) < 0) 
+    if (dst.fourcc == cr::video::Fourcc::BGR24)
     {
-        std::cout << "Could not open codec" << std::endl;
-        avcodec_free_context(&codec_ctx);
+        // Decode scanlines directly to destination frame
+        JSAMPROW rows[16];
+        while (m_jpegDinfo.output_scanline < m_jpegDinfo.output_height)
+        {
+            int row = static_cast<int>(m_jpegDinfo.output_scanline);
+            int count = height - row < 16 ? height - row : 16;
+#ifdef JCS_EXTENSIONS
+            for (int i = 0; i < count; ++i)
+            {
+                rows[i] = dst.data + (row + i) * width * 3;
+            }
+            jpeg_read_scanlines(&m_jpegDinfo, rows, count);
+#else
+            m_jpegDecodeRows.resize(width * 3 * 16);
+            for (int i = 0; i < count; ++i)
+            {
+                rows[i] = m_jpegDecodeRows.data() + i * width * 3;
+            }
+            count = jpeg_read_scanlines(&m_jpegDinfo, rows, count);
+            m_converter.bgrToRgb(m_jpegDecodeRows.data(), width * 3, dst.data + row * width * 3,
+                                 width * 3, width, count);
+#endif
+        }
+        dst.size = width * height * 3;
+    }
+    else
+    {
+        // Raw YCbCr rows are converted while they are in CPU cache
+        while (m_jpegDinfo.output_scanline < m_jpegDinfo.output_height)
+        {
+            int row = static_cast<int>(m_jpegDinfo.output_scanline);
+            int rows = readJpegRawRows();
+            writeJpegYuvRows(dst, row, rows);
+        }
+        dst.size = width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    }
+
+    jpeg_finish_decompress(&m_jpegDinfo);
+
+    return true;
+}
+
+bool VideoCodec::decodeJpegPicture(cr::video::Frame &src, AVFrame *dst)
+{
+    // libjpeg errors return here.
+    if (setjmp(m_jpegDerr.jump))
+    {
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    packet = av_packet_alloc();
-    if (!packet) 
+    if (!readJpegHeader(src))
     {
-        std::cout << "Could not allocate packet" << std::endl;
-        avcodec_free_context(&codec_ctx);
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    av_init_packet(packet);
+    startJpegRawDecoding(1);
 
-    frame = av_frame_alloc();
-    if (!frame) 
+    // Pixel format of chroma subsampling of raw output
+    AVPixelFormat format = AV_PIX_FMT_GRAY8;
+    if (m_jpegDinfo.num_components == 3)
+    {
+        int hShift = rawSamplingShift(m_jpegDinfo, 1, false);
+        int vShift = rawSamplingShift(m_jpegDinfo, 1, true);
+        bool sameChroma = hShift == rawSamplingShift(m_jpegDinfo, 2, false) &&
+                          vShift == rawSamplingShift(m_jpegDinfo, 2, true);
+        format = AV_PIX_FMT_NONE;
+        if (sameChroma && hShift == 1 && vShift == 1)
+        {
+            format = AV_PIX_FMT_YUVJ420P;
+        }
+        else if (sameChroma && hShift == 1 && vShift == 0)
+        {
+            format = AV_PIX_FMT_YUVJ422P;
+        }
+        else if (sameChroma && hShift == 0 && vShift == 0)
+        {
+            format = AV_PIX_FMT_YUVJ444P;
+        }
+        else if (sameChroma && hShift == 0 && vShift == 1)
+        {
+            format = AV_PIX_FMT_YUVJ440P;
+        }
+        else if (sameChroma && hShift == 2 && vShift == 0)
+        {
+            format = AV_PIX_FMT_YUVJ411P;
+        }
+    }
+    if (format == AV_PIX_FMT_NONE)
+    {
+        std::cout << "Unsupported JPEG chroma subsampling" << std::endl;
+        jpeg_abort_decompress(&m_jpegDinfo);
+        return false;
+    }
+
+    av_frame_unref(dst);
+    dst->format = format;
+    dst->width = static_cast<int>(m_jpegDinfo.output_width);
+    dst->height = static_cast<int>(m_jpegDinfo.output_height);
+    dst->color_range = AVCOL_RANGE_JPEG;
+    if (!getPictureBuffer(dst, dst->width, dst->height))
     {
         std::cout << "Could not allocate video frame" << std::endl;
-        av_packet_free(&packet);
-        avcodec_free_context(&codec_ctx);
+        jpeg_abort_decompress(&m_jpegDinfo);
         return false;
     }
 
-    sws_ctx = sws_getContext(
-                src.width, src.height, AV_PIX_FMT_YUV420P,    // Input width, height, and format (YUV420P)
-                src.width, src.height, AV_PIX_FMT_BGR24,      // Output width, height, and format (BGR24)
-                SWS_BICUBIC, NULL, NULL, NULL);       // Scaling algorithm (e.g., bicubic)
+    // Copy rows of each component to frame planes
+    while (m_jpegDinfo.output_scanline < m_jpegDinfo.output_height)
+    {
+        int row = static_cast<int>(m_jpegDinfo.output_scanline);
+        readJpegRawRows();
+        JSAMPROW *rows = m_jpegDecodeRowPointers.data();
+        for (int i = 0; i < m_jpegDinfo.num_components; ++i)
+        {
+            int hShift = i > 0 ? rawSamplingShift(m_jpegDinfo, i, false) : 0;
+            int vShift = i > 0 ? rawSamplingShift(m_jpegDinfo, i, true) : 0;
+            int planeWidth = -((-dst->width) >> hShift);
+            int planeHeight = -((-dst->height) >> vShift);
+            int compRows = rawRows(m_jpegDinfo, i);
+            int planeRow = row >> vShift;
+            for (int j = 0; j < compRows && planeRow + j < planeHeight; ++j)
+            {
+                memcpy(dst->data[i] + (planeRow + j) * dst->linesize[i], rows[j], planeWidth);
+            }
+            rows += compRows;
+        }
+    }
+
+    jpeg_finish_decompress(&m_jpegDinfo);
 
     return true;
 }
 
-bool VideoCodec::decodeFrame(cr::video::Frame &src, cr::video::Frame &dst)
+void VideoCodec::startJpegRawDecoding(int group)
 {
-    // Copy encoded frame to packet.
-    packet->data = src.data;
-    packet->size = src.size;
-    int  got_picture;
+    m_jpegDinfo.raw_data_out = TRUE;
+    jpeg_start_decompress(&m_jpegDinfo);
+    m_jpegDecodeGroup = group;
+
+    // Each component has v_samp_factor rows of scaled DCT blocks in iMCU
+    // row, rows are padded to whole blocks.
+    size_t size = 0;
+    size_t numRows = 0;
+    for (int i = 0; i < m_jpegDinfo.num_components; ++i)
+    {
+        jpeg_component_info &comp = m_jpegDinfo.comp_info[i];
+        numRows += rawRows(m_jpegDinfo, i) * group;
+        size += static_cast<size_t>(rawRows(m_jpegDinfo, i) * group) * comp.width_in_blocks *
+                rawBlockSize(comp, false);
+    }
+    m_jpegDecodeRows.resize(size);
+    m_jpegDecodeRowPointers.resize(numRows);
 
-    // Decode frame.
-    if (avcodec_decode_video2(codec_ctx, frame, &got_picture, packet) < 0) 
+    uint8_t *data = m_jpegDecodeRows.data();
+    JSAMPROW *rows = m_jpegDecodeRowPointers.data();
+    for (int i = 0; i < m_jpegDinfo.num_components; ++i)
     {
-        std::cout << "Error decoding frame" << std::endl;
-        return false;
+        jpeg_component_info &comp = m_jpegDinfo.comp_info[i];
+        int rowSize = comp.width_in_blocks * rawBlockSize(comp, false);
+        for (int j = 0; j < rawRows(m_jpegDinfo, i) * group; ++j)
+        {
+            *rows++ = data;
+            data += rowSize;
+        }
     }
+}
 
-    if (got_picture) 
+int VideoCodec::readJpegRawRows()
+{
+    int group = m_jpegDecodeGroup;
+    int lumaRows = rawRows(m_jpegDinfo, 0);
+    int result = 0;
+    for (int g = 0; g < group && m_jpegDinfo.output_scanline < m_jpegDinfo.output_height; ++g)
     {
-        int width = frame->width;
-        int height = frame->height;
+        JSAMPARRAY planes[MAX_COMPONENTS];
+        JSAMPROW *rows = m_jpegDecodeRowPointers.data();
+        for (int i = 0; i < m_jpegDinfo.num_components; ++i)
+        {
+            int compRows = rawRows(m_jpegDinfo, i);
+            planes[i] = rows + g * compRows;
+            rows += compRows * group;
+        }
+        result += static_cast<int>(jpeg_read_raw_data(&m_jpegDinfo, planes, lumaRows));
+    }
+    return result;
+}
 
-        // Convert YUV420P frame to BGR24
-        uint8_t* dstData[4] = {dst.data, nullptr, nullptr, nullptr};
-        int dstLinesize[4] = {width * 3, 0, 0, 0};  // BGR24 requires 3 bytes per pixel
+/**
+ * @brief Lookup tables of compression from full range used by JFIF to video
+ * range (Y 16..235, C 16..240).
+ */
+struct VideoRangeTables
+{
+    uint8_t luma[256];
+    uint8_t chroma[256];
 
-        // Perform the conversion
-        sws_scale(sws_ctx, frame->data, frame->linesize, 0, height, dstData, dstLinesize);
-        dst.size = width * height * 3; // BGR24 format size
-        return true;
+    VideoRangeTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            luma[i] = static_cast<uint8_t>(16 + (i * 219 + 127) / 255);
+            chroma[i] = static_cast<uint8_t>(128 + ((i - 128) * 224 + (i >= 128 ? 127 : -127)) / 255);
+        }
     }
+};
 
-    return false;
+static const VideoRangeTables g_videoRange;
+
+void VideoCodec::writeJpegYuvRows(cr::video::Frame &dst, int row, int rows)
+{
+    int width = dst.width;
+    int height = dst.height;
+    int uvWidth = (width + 1) / 2;
+    int uvHeight = (height + 1) / 2;
+    int ySize = width * height;
+    rows = row + rows < height ? rows : height - row;
+
+    // Luma rows
+    JSAMPROW *yRows = m_jpegDecodeRowPointers.data();
+    for (int i = 0; i < rows; ++i)
+    {
+        uint8_t *dstRow = dst.data + (row + i) * width;
+        for (int x = 0; x < width; ++x)
+        {
+            dstRow[x] = g_videoRange.luma[yRows[i][x]];
+        }
+    }
+
+    // Chroma rows of 4:2:0 frame covered by luma rows. Chroma planes of other
+    // subsampling are averaged or repeated.
+    int firstRow = row / 2;
+    int lastRow = (row + rows + 1) / 2 < uvHeight ? (row + rows + 1) / 2 : uvHeight;
+    int uStep = dst.fourcc == cr::video::Fourcc::YU12 ? 1 : 2;
+    uint8_t *u = dst.data + ySize;
+    uint8_t *v = dst.data + ySize + uvWidth * uvHeight;
+    if (dst.fourcc != cr::video::Fourcc::YU12)
+    {
+        u = dst.data + ySize + (dst.fourcc == cr::video::Fourcc::NV12 ? 0 : 1);
+        v = dst.data + ySize + (dst.fourcc == cr::video::Fourcc::NV12 ? 1 : 0);
+    }
+    int uvStride = uvWidth * uStep;
+
+    if (m_jpegDinfo.num_components == 1)
+    {
+        // Grayscale image has neutral chroma
+        for (int y = firstRow; y < lastRow; ++y)
+        {
+            for (int x = 0; x < uvWidth; ++x)
+            {
+                u[y * uvStride + x * uStep] = 128;
+                v[y * uvStride + x * uStep] = 128;
+            }
+        }
+        return;
+    }
+
+    JSAMPROW *compRows = yRows + rawRows(m_jpegDinfo, 0) * m_jpegDecodeGroup;
+    for (int i = 1; i < 3; ++i)
+    {
+        int hShift = rawSamplingShift(m_jpegDinfo, i, false);
+        int vShift = rawSamplingShift(m_jpegDinfo, i, true);
+        uint8_t *plane = i == 1 ? u : v;
+        int compFirstRow = row >> vShift;
+        for (int y = firstRow; y < lastRow; ++y)
+        {
+            const uint8_t *row0 = compRows[((2 * y) >> vShift) - compFirstRow];
+            const uint8_t *row1 = compRows[((2 * y + 1) >> vShift) - compFirstRow];
+            uint8_t *dstRow = plane + y * uvStride;
+            if (hShift == 1 && vShift == 1)
+            {
+                // 4:2:0 image
+                for (int x = 0; x < uvWidth; ++x)
+                {
+                    dstRow[x * uStep] = g_videoRange.chroma[row0[x]];
+                }
+                continue;
+            }
+            for (int x = 0; x < uvWidth; ++x)
+            {
+                int x0 = (2 * x) >> hShift;
+                int x1 = (2 * x + 1) >> hShift;
+                int value = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+                dstRow[x * uStep] = g_videoRange.chroma[value];
+            }
+        }
+        compRows += rawRows(m_jpegDinfo, i) * m_jpegDecodeGroup;
+    }
+}
+
+
+
+VideoCodecPicture::VideoCodecPicture()
+{
+    m_frame = av_frame_alloc();
+}
+
+VideoCodecPicture::~VideoCodecPicture()
+{
+    av_frame_free(&m_frame);
+}
+
+VideoCodecPicture::VideoCodecPicture(const VideoCodecPicture &src)
+{
+    m_frame = av_frame_alloc();
+    av_frame_ref(m_frame, src.m_frame);
+}
+
+VideoCodecPicture &VideoCodecPicture::operator=(const VideoCodecPicture &src)
+{
+    if (this != &src)
+    {
+        av_frame_unref(m_frame);
+        av_frame_ref(m_frame, src.m_frame);
+    }
+    return *this;
+}
+
+void VideoCodecPicture::release()
+{
+    av_frame_unref(m_frame);
+}
+
+bool VideoCodecPicture::empty() const
+{
+    return m_frame->data[0] == nullptr;
+}
+
+int VideoCodecPicture::width() const
+{
+    return m_frame->width;
+}
+
+int VideoCodecPicture::height() const
+{
+    return m_frame->height;
+}
+
+int VideoCodecPicture::pixelFormat() const
+{
+    return m_frame->format;
+}
+
+const uint8_t *VideoCodecPicture::data(int plane) const
+{
+    return plane >= 0 && plane < AV_NUM_DATA_POINTERS ? m_frame->data[plane] : nullptr;
+}
+
+int VideoCodecPicture::stride(int plane) const
+{
+    return plane >= 0 && plane < AV_NUM_DATA_POINTERS ? m_frame->linesize[plane] : 0;
+}
+
+const AVFrame *VideoCodecPicture::avFrame() const
+{
+    return m_frame;
 }
\ No newline at end of file
@@ -1,6 +1,19 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <utility>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <atomic>
+#include <csetjmp>
 #include <stdint.h>
 #include <x264.h>
 #include <x265.h>
@@ -11,12 +24,495 @@ extern "C"
     #include <libavcodec/avcodec.h>
     #include <libavutil/frame.h>
     #include <libavutil/imgutils.h>
+    #include <libavutil/pixdesc.h>
     #include <libavformat/avformat.h>
     #include <libswscale/swscale.h>
     #include <libavfilter/avfilter.h>
 }
 
 #include "Frame.h"
+#include "ColorConverter.h"
+
+
+
+/**
+ * @brief Encoder threading modes.
+ */
+enum class VideoCodecThreadMode
+{
+    /// One encoding thread per frame (default).
+    SINGLE = 0,
+    /// Codec library selects threading scheme and number of threads.
+    AUTO,
+    /// Frame-parallel threading. Adds (threads - 1) frames of latency.
+    FRAME,
+    /// Slice threading (x264) or wavefront threading (x265). Zero latency.
+    SLICE
+};
+
+
+
+/**
+ * @brief Encoder speed presets (x264 and x265 preset names).
+ */
+enum class VideoCodecPreset
+{
+    ULTRAFAST = 0,
+    SUPERFAST,
+    VERYFAST,
+    FASTER,
+    FAST,
+    MEDIUM,
+    SLOW,
+    SLOWER,
+    VERYSLOW
+};
+
+
+
+/**
+ * @brief JPEG chroma subsampling.
+ */
+enum class VideoCodecJpegSubsampling
+{
+    /// Chroma is subsampled 2x horizontally and vertically (default).
+    YUV420 = 0,
+    /// Chroma is subsampled 2x horizontally.
+    YUV422,
+    /// No chroma subsampling.
+    YUV444
+};
+
+
+
+/**
+ * @brief Encoder rate control mode.
+ */
+enum class VideoCodecRateControl
+{
+    /// Constant rate factor (quality), optionally capped by VBV (default).
+    CRF = 0,
+    /// Average bitrate, optionally constrained by VBV.
+    ABR,
+    /// Constant bitrate: average bitrate with VBV max bitrate equal to bitrate.
+    CBR
+};
+
+
+
+/**
+ * @brief Frames skipped by H264 / HEVC decoder or decoding steps skipped for
+ * frames (libav AVDiscard).
+ */
+enum class VideoCodecDiscard
+{
+    /// Nothing is skipped (default).
+    NONE = 0,
+    /// Non-reference frames.
+    NONREF,
+    /// Bidirectional (B) frames.
+    BIDIR,
+    /// All frames except intra frames.
+    NONINTRA,
+    /// All frames except key frames.
+    NONKEY,
+    /// All frames.
+    ALL
+};
+
+
+
+/**
+ * @brief Video codec params.
+ */
+enum class VideoCodecParam
+{
+    /// Encoder threading mode. Value is one of VideoCodecThreadMode.
+    THREAD_MODE = 1,
+    /// Number of encoder threads. 0 - number of CPU cores.
+    NUM_THREADS,
+    /// Number of x265 thread pool threads (numaPools). 0 - auto, -1 - no pool.
+    POOL_THREADS,
+    /// Encoder preset. Value is one of VideoCodecPreset.
+    PRESET,
+    /// Zero latency tuning: 1 (default) - on, 0 - off (lookahead, B-frames).
+    ZERO_LATENCY,
+    /// Number of B-frames. -1 - preset default. Ignored with zero latency.
+    B_FRAMES,
+    /// Rate control lookahead in frames. -1 - preset default.
+    LOOKAHEAD,
+    /// Macroblock tree (x264) / CU tree (x265): -1 - preset default, 0 - off, 1 - on.
+    MB_TREE,
+    /// Size of submitFrame() input queue in frames.
+    QUEUE_SIZE,
+    /// Number of decoder threads. 1 (default) - single thread, 0 - auto.
+    DECODER_THREADS,
+    /// Decoder threading: 1 - frame, 2 (default) - slice, 3 - frame and slice.
+    DECODER_THREAD_TYPE,
+    /// JPEG quality 1..100. Default 50.
+    JPEG_QUALITY,
+    /// JPEG DCT: 0 (default) - accurate integer DCT, 1 - fast integer DCT.
+    JPEG_FAST_DCT,
+    /// Optimized Huffman tables: 0 (default) - off, 1 - on (smaller, slower).
+    JPEG_OPTIMIZE_CODING,
+    /// JPEG chroma subsampling. Value is one of VideoCodecJpegSubsampling.
+    JPEG_SUBSAMPLING,
+    /// JPEG encoder threads: 1 (default) - single thread, 0 - number of CPU
+    /// cores. Frame is split to horizontal bands joined by restart markers.
+    JPEG_THREADS,
+    /// JPEG decoding scale denominator: 1 (default), 2, 4 or 8. Picture is
+    /// downscaled by libjpeg in DCT domain.
+    JPEG_DECODE_SCALE,
+    /// JPEG IDCT: 0 (default) - accurate integer IDCT, 1 - fast integer IDCT.
+    JPEG_DECODE_FAST_IDCT,
+    /// Rate control mode. Value is one of VideoCodecRateControl.
+    RATE_CONTROL,
+    /// Target bitrate of ABR and CBR modes, bps. Default 5000000.
+    BITRATE,
+    /// VBV max bitrate, bps. 0 (default) - VBV off (except CBR).
+    MAX_BITRATE,
+    /// VBV buffer size, bits. 0 (default) - one second of max bitrate.
+    VBV_BUFFER_SIZE,
+    /// Constant rate factor. -1 (default) - codec default (x264 23, x265 28).
+    CRF,
+    /// Max distance between IDR frames (GOP size). 0 - infinite. Default 30.
+    GOP_SIZE,
+    /// 1 - next encoded frame is IDR frame (reset after the frame).
+    FORCE_IDR,
+    /// Adaptive preset: 0 (default) - off, 1 - encoder speed settings are
+    /// changed between ULTRAFAST and ADAPTIVE_MAX_PRESET to fit FRAME_BUDGET_MS.
+    ADAPTIVE_PRESET,
+    /// Slowest preset of adaptive preset. Default MEDIUM.
+    ADAPTIVE_MAX_PRESET,
+    /// Target encoding time of one frame, ms. Default 33.
+    FRAME_BUDGET_MS,
+    /// Current preset selected by adaptive preset (read only).
+    ADAPTIVE_CURRENT_PRESET,
+    /// Number of slices per frame. 0 (default) - encoder default.
+    SLICES,
+    /// Periodic intra refresh instead of IDR frames: 0 (default) - off, 1 - on.
+    /// Refresh period is GOP_SIZE.
+    INTRA_REFRESH,
+    /// Number of encoder sessions of other formats or resolutions kept open.
+    /// Default 2. 0 - encoder is re-initialized on format or resolution change.
+    ENCODER_CACHE_SIZE,
+    /// Frames skipped by decoder. Value is one of VideoCodecDiscard.
+    DECODER_SKIP_FRAME,
+    /// Frames decoded without loop filter. Value is one of VideoCodecDiscard.
+    DECODER_SKIP_LOOP_FILTER,
+    /// Frames decoded without IDCT. Value is one of VideoCodecDiscard.
+    DECODER_SKIP_IDCT,
+    /// Fast not conforming decoding tricks: 0 (default) - off, 1 - on.
+    DECODER_FAST,
+    /// Packet filter: 0 (default) - off, 1 - packets without IDR or I slices
+    /// only (H264) or IRAP (HEVC) slices are dropped before decoder. Intra
+    /// refresh streams have no key frames after the first one.
+    DECODER_KEY_FRAMES_ONLY
+};
+
+
+
+/**
+ * @brief Memory layout of source frame planes. Zero stride of the first plane
+ * means tightly packed frame (default layout for frame fourcc and size).
+ */
+struct VideoCodecPlaneLayout
+{
+    /// Offsets of planes from the beginning of frame data in bytes.
+    int offset[3]{0, 0, 0};
+    /// Strides (bytes per row) of planes.
+    int stride[3]{0, 0, 0};
+};
+
+
+
+/**
+ * @brief View of encoded NAL unit. Data belongs to the encoder and stays valid
+ * until next encode() call or codec destruction.
+ */
+struct VideoCodecNal
+{
+    /// Pointer to NAL unit data including Annex-B start code.
+    const uint8_t* data{nullptr};
+    /// Size of NAL unit in bytes.
+    int size{0};
+    /// NAL unit type: H264 nal_unit_type, HEVC NalUnitType or -1 for JPEG.
+    int type{-1};
+};
+
+
+
+/**
+ * @brief Encoded NAL unit callback. NAL unit data is valid during the call.
+ */
+typedef std::function<void(const VideoCodecNal& nal)> VideoCodecNalCallback;
+
+
+
+/**
+ * @brief Latency statistics of processing stage.
+ */
+struct VideoCodecLatency
+{
+    /// Number of histogram bins.
+    static const int BINS = 32;
+    /// Number of measured calls.
+    uint64_t count{0};
+    /// Average duration, us.
+    double averageUs{0.0};
+    /// Max duration, us.
+    double maxUs{0.0};
+    /// Median duration (upper bound of histogram bin), us.
+    double p50Us{0.0};
+    /// 99th percentile of duration (upper bound of histogram bin), us.
+    double p99Us{0.0};
+    /// Histogram of durations: bin 0 - below 1 us, bin i - from 2^(i-1) to
+    /// 2^i us, last bin - longer durations.
+    uint64_t histogram[BINS]{};
+};
+
+
+
+/**
+ * @brief Codec statistics since creation or last resetStats() call.
+ */
+struct VideoCodecStats
+{
+    /// Number of encoded frames.
+    uint64_t encodedFrames{0};
+    /// Number of decoded frames.
+    uint64_t decodedFrames{0};
+    /// Number of frames failed to encode.
+    uint64_t failedEncodes{0};
+    /// Number of frames failed to decode.
+    uint64_t failedDecodes{0};
+    /// Number of frames submitted by submitFrame() and not encoded.
+    uint64_t droppedFrames{0};
+    /// Number of encoder initializations (first and re-initializations).
+    uint64_t encoderInits{0};
+    /// Number of decoder initializations (first and re-initializations).
+    uint64_t decoderInits{0};
+    /// Number of resolution or pixel format changes of decoded stream.
+    uint64_t decoderFormatChanges{0};
+    /// Number of packets dropped by DECODER_KEY_FRAMES_ONLY filter.
+    uint64_t decoderFilteredPackets{0};
+    /// Size of source frames passed to encoder, bytes.
+    uint64_t encoderBytesIn{0};
+    /// Size of encoded data, bytes.
+    uint64_t encoderBytesOut{0};
+    /// Size of packets passed to decoder, bytes.
+    uint64_t decoderBytesIn{0};
+    /// Size of decoded frames, bytes (zero-copy pictures are not counted).
+    uint64_t decoderBytesOut{0};
+    /// Copy and color conversion of encoder input.
+    VideoCodecLatency input;
+    /// Encoder call.
+    VideoCodecLatency encode;
+    /// Gathering of encoded NAL units to output frame or buffer.
+    VideoCodecLatency nalGather;
+    /// Decoder call.
+    VideoCodecLatency decode;
+    /// Copy and color conversion of decoded frame (SIMD or sws_scale).
+    VideoCodecLatency convert;
+};
+
+
+
+/**
+ * @brief Statistics callback. Called periodically from encoding or decoding
+ * thread.
+ */
+typedef std::function<void(const VideoCodecStats& stats)> VideoCodecStatsCallback;
+
+
+
+/**
+ * @brief Trace marker callback: name of processing stage and TRUE at the
+ * beginning or FALSE at the end of stage. Called from encoding or decoding
+ * thread.
+ */
+typedef std::function<void(const char* name, bool begin)> VideoCodecTraceCallback;
+
+
+
+/**
+ * @brief Memory allocator of codec buffers: JPEG encoder output, decoder
+ * packets and decoded pictures. Allocator can be shared by several codecs and
+ * is called from decoder threads, so implementation must be thread-safe.
+ */
+class VideoCodecAllocator
+{
+public:
+
+    /**
+     * @brief Class destructor.
+     */
+    virtual ~VideoCodecAllocator() {}
+
+    /**
+     * @brief Allocate buffer.
+     * @param size Size of buffer, bytes.
+     * @return Pointer to buffer aligned by 64 bytes or nullptr.
+     */
+    virtual uint8_t* allocate(size_t size) = 0;
+
+    /**
+     * @brief Release buffer.
+     * @param data Buffer returned by allocate().
+     * @param size Size of buffer passed to allocate().
+     */
+    virtual void deallocate(uint8_t* data, size_t size) = 0;
+};
+
+
+
+/**
+ * @brief Default allocator of codec buffers. Released buffers are kept and
+ * returned by next allocations of the same size, so codecs with constant
+ * resolution don't use system heap after first frames.
+ */
+class VideoCodecBufferPool : public VideoCodecAllocator
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     * @param maxCachedBytes Max size of released buffers kept for reuse.
+     */
+    explicit VideoCodecBufferPool(size_t maxCachedBytes = 256 * 1024 * 1024);
+
+    /**
+     * @brief Class destructor. Releases cached buffers.
+     */
+    ~VideoCodecBufferPool();
+
+    /**
+     * @brief Allocate buffer: reuse released buffer of the same size or
+     * allocate new one.
+     * @param size Size of buffer, bytes.
+     * @return Pointer to buffer aligned by 64 bytes or nullptr.
+     */
+    uint8_t* allocate(size_t size) override;
+
+    /**
+     * @brief Return buffer to pool.
+     * @param data Buffer returned by allocate().
+     * @param size Size of buffer passed to allocate().
+     */
+    void deallocate(uint8_t* data, size_t size) override;
+
+    /**
+     * @brief Release all cached buffers to system heap.
+     */
+    void trim();
+
+    /**
+     * @brief Get number of buffers allocated from system heap.
+     * @return Number of heap allocations since pool creation.
+     */
+    uint64_t getHeapAllocations();
+
+private:
+
+    /// Mutex to protect cached buffers.
+    std::mutex m_mutex;
+    /// Released buffers by size.
+    std::map<size_t, std::vector<uint8_t*>> m_buffers;
+    /// Total size of cached buffers, bytes.
+    size_t m_cachedBytes{0};
+    /// Max size of cached buffers, bytes.
+    size_t m_maxCachedBytes{0};
+    /// Number of heap allocations.
+    uint64_t m_heapAllocations{0};
+};
+
+
+
+/**
+ * @brief Decoded picture which references decoder buffers without copy.
+ * Buffers are reference-counted: picture stays valid after next decode() calls
+ * until it is released or destroyed. Copy of picture shares the same buffers.
+ */
+class VideoCodecPicture
+{
+public:
+
+    /**
+     * @brief Class constructor. Creates empty picture.
+     */
+    VideoCodecPicture();
+
+    /**
+     * @brief Class destructor. Releases reference to decoder buffers.
+     */
+    ~VideoCodecPicture();
+
+    /**
+     * @brief Copy constructor. Adds reference to the same buffers.
+     */
+    VideoCodecPicture(const VideoCodecPicture& src);
+
+    /**
+     * @brief Assignment operator. Adds reference to the same buffers.
+     */
+    VideoCodecPicture& operator=(const VideoCodecPicture& src);
+
+    /**
+     * @brief Release reference to decoder buffers.
+     */
+    void release();
+
+    /**
+     * @brief Check if picture is empty.
+     * @return TRUE if picture has no data or FALSE.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Get picture width.
+     * @return Picture width in pixels.
+     */
+    int width() const;
+
+    /**
+     * @brief Get picture height.
+     * @return Picture height in pixels.
+     */
+    int height() const;
+
+    /**
+     * @brief Get libav pixel format, usually AV_PIX_FMT_YUV420P (h264, h265)
+     * or AV_PIX_FMT_YUVJ420P / AV_PIX_FMT_YUVJ422P (jpeg).
+     * @return Pixel format (AVPixelFormat).
+     */
+    int pixelFormat() const;
+
+    /**
+     * @brief Get plane data.
+     * @param plane Plane index.
+     * @return Pointer to plane data or nullptr.
+     */
+    const uint8_t* data(int plane) const;
+
+    /**
+     * @brief Get plane stride.
+     * @param plane Plane index.
+     * @return Plane stride in bytes (can be larger than plane width).
+     */
+    int stride(int plane) const;
+
+    /**
+     * @brief Get libav frame.
+     * @return Pointer to libav frame.
+     */
+    const AVFrame* avFrame() const;
+
+private:
+
+    friend class VideoCodec;
+    /// Libav frame which holds references to decoder buffers.
+    AVFrame* m_frame{nullptr};
+};
 
 
 
@@ -50,45 +546,492 @@ public:
     static std::string getVersion();
 
     /**
-     * @brief Encodes a video frame.
-     * @param src Source frame.
+     * @brief Encodes a video frame. Encoders read source planes directly from
+     * src.data without intermediate copy. src.data must stay valid and
+     * unchanged only until the method returns.
+     * @param src Source frame: YU12, YV12, NV12, NV21, YUYV, UYVY, BGR24 or
+     * RGB24. Subsampled and converted formats require even width and height.
      * @param dst Destination frame.
      * @return TRUE if the frame was encoded successfully or FALSE.
      */
     bool encode(cr::video::Frame& src, cr::video::Frame& dst);
 
+    /**
+     * @brief Encodes a video frame with padded planes. Same buffer lifetime
+     * rules as encode(src, dst).
+     * @param src Source frame. src.size must cover all planes of the layout.
+     * @param layout Offsets and strides of source frame planes.
+     * @param dst Destination frame.
+     * @return TRUE if the frame was encoded successfully or FALSE.
+     */
+    bool encode(cr::video::Frame& src, const VideoCodecPlaneLayout& layout,
+                cr::video::Frame& dst);
+
+    /**
+     * @brief Encodes a video frame without copying encoded data.
+     * @param src Source frame.
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @param nals Views of encoded NAL units (single unit for JPEG). Valid
+     * until next encode() call.
+     * @param layout Source frame planes layout.
+     * @return TRUE if the frame was encoded successfully or FALSE.
+     */
+    bool encode(cr::video::Frame& src, cr::video::Fourcc fourcc,
+                std::vector<VideoCodecNal>& nals,
+                const VideoCodecPlaneLayout& layout = VideoCodecPlaneLayout());
+
+    /**
+     * @brief Encodes a video frame into caller buffer.
+     * @param src Source frame.
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @param buffer Output buffer.
+     * @param capacity Output buffer size in bytes.
+     * @param size Encoded data size or required capacity if buffer is too small.
+     * @param layout Source frame planes layout.
+     * @return TRUE if the frame was encoded and fits into buffer or FALSE.
+     */
+    bool encode(cr::video::Frame& src, cr::video::Fourcc fourcc, uint8_t* buffer,
+                int capacity, int& size,
+                const VideoCodecPlaneLayout& layout = VideoCodecPlaneLayout());
+
     /**
      * @brief Decodes a video frame.
      * @param src Source frame.
-     * @param dst Destination frame.
+     * @param dst Destination frame: BGR24, YU12, NV12 or NV21.
      * @return TRUE if the frame was decoded successfully or FALSE.
      */
     bool decode(cr::video::Frame& src, cr::video::Frame& dst);
 
+    /**
+     * @brief Decodes a video frame without copying decoded picture.
+     * @param src Source frame.
+     * @param dst Picture which references decoder buffers.
+     * @return TRUE if the frame was decoded successfully or FALSE.
+     */
+    bool decode(cr::video::Frame& src, VideoCodecPicture& dst);
+
+    /**
+     * @brief Get next frame already decoded by decoder without sending new
+     * packet. Used to get all frames after decode() and flushDecoder().
+     * @param dst Destination frame: BGR24, YU12, NV12 or NV21.
+     * @return TRUE if a frame was returned or FALSE if no decoded frames.
+     */
+    bool receiveFrame(cr::video::Frame& dst);
+
+    /**
+     * @brief Get next frame already decoded by decoder without copy.
+     * @param dst Picture which references decoder buffers.
+     * @return TRUE if a frame was returned or FALSE if no decoded frames.
+     */
+    bool receiveFrame(VideoCodecPicture& dst);
+
+    /**
+     * @brief Signals end of stream to decoder. Remaining frames are returned
+     * by receiveFrame(). After last frame decoder accepts new packets.
+     * @return TRUE if decoder switched to draining mode or FALSE.
+     */
+    bool flushDecoder();
+
+    /**
+     * @brief Submits a frame to asynchronous encoding. Frame is copied to input
+     * queue and encoded by internal worker thread. Blocks while queue is full.
+     * @param src Source frame. src.frameId is returned in packet frameId.
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @return TRUE if the frame was queued or FALSE.
+     */
+    bool submitFrame(cr::video::Frame& src, cr::video::Fourcc fourcc);
+
+    /**
+     * @brief Receives encoded packet produced by submitFrame() or flush().
+     * @param dst Destination frame for compressed data.
+     * @param timeoutMs Wait timeout in milliseconds. -1 - wait infinitely.
+     * @return TRUE if a packet was received or FALSE on timeout or when all
+     * packets of flushed stream were received.
+     */
+    bool receivePacket(cr::video::Frame& dst, int timeoutMs = -1);
+
+    /**
+     * @brief Signals end of stream. Encoder delayed frames (lookahead,
+     * B-frames, frame threads) are drained to packets queue. Encoder is
+     * re-opened on next frame.
+     * @return TRUE if the request was accepted or FALSE.
+     */
+    bool flush();
+
+    /**
+     * @brief Set encoded NAL unit callback. H264 NAL units are reported as
+     * soon as each slice is encoded, before encode() returns. Other codecs
+     * report NAL units of frame after encoding. Encoder is re-initialized.
+     * @param callback NAL unit callback or nullptr to disable. Can be called
+     * from encoder threads, calls are serialized.
+     */
+    void setNalCallback(VideoCodecNalCallback callback);
+
+    /**
+     * @brief Get codec statistics. Can be called from any thread.
+     * @return Counters and latency histograms of processing stages.
+     */
+    VideoCodecStats getStats();
+
+    /**
+     * @brief Reset codec statistics.
+     */
+    void resetStats();
+
+    /**
+     * @brief Set statistics callback. Set it before encoding or decoding.
+     * @param callback Statistics callback or nullptr to disable.
+     * @param periodMs Min period between callback calls, ms.
+     */
+    void setStatsCallback(VideoCodecStatsCallback callback, int periodMs = 1000);
+
+    /**
+     * @brief Set trace marker callback for external profilers (Perfetto,
+     * perf). Set it before encoding or decoding.
+     * @param callback Trace callback or nullptr to disable.
+     */
+    void setTraceCallback(VideoCodecTraceCallback callback);
+
+    /**
+     * @brief Set allocator of codec buffers. By default each codec has own
+     * VideoCodecBufferPool, set the same allocator to share memory between
+     * codecs. Encoder and decoder are re-initialized.
+     * @param allocator Allocator or nullptr to use default pool.
+     */
+    void setAllocator(std::shared_ptr<VideoCodecAllocator> allocator);
+
+    /**
+     * @brief Set codec parameter. New value is applied on next encode() call.
+     * @param id Parameter ID.
+     * @param value Parameter value.
+     * @return TRUE if the parameter was set or FALSE.
+     */
+    bool setParam(VideoCodecParam id, float value);
+
+    /**
+     * @brief Get codec parameter.
+     * @param id Parameter ID.
+     * @return Parameter value or -1 if the parameter is not supported.
+     */
+    float getParam(VideoCodecParam id);
+
 private:
 
     /// Encoder initialization flags.
     bool m_encoderInit{false};
     /// Decoder initialization flags.
     bool m_decoderInit{false};
+    /// Decoder must be re-initialized on next packet (params changed).
+    bool m_decoderReinit{false};
+    /// Number of decoder threads. 0 - auto. Single thread by default: each
+    /// packet returns its frame.
+    int m_decoderThreads{1};
+    /// Decoder thread type: FF_THREAD_FRAME and / or FF_THREAD_SLICE. Frame
+    /// threads delay output, so they are enabled only explicitly.
+    int m_decoderThreadType{FF_THREAD_SLICE};
+    /// Frames skipped by decoder (libav skip_frame).
+    VideoCodecDiscard m_decoderSkipFrame{VideoCodecDiscard::NONE};
+    /// Frames decoded without loop filter (libav skip_loop_filter).
+    VideoCodecDiscard m_decoderSkipLoopFilter{VideoCodecDiscard::NONE};
+    /// Frames decoded without IDCT (libav skip_idct).
+    VideoCodecDiscard m_decoderSkipIdct{VideoCodecDiscard::NONE};
+    /// Decoder fast mode (AV_CODEC_FLAG2_FAST).
+    bool m_decoderFast{false};
+    /// Packets without key frame slices are dropped before decoder.
+    bool m_decoderKeyFramesOnly{false};
     /// Video frame width.
     int m_width{-1};
     /// Video frame height.
     int m_height{-1};
+    /// Encoder rate control mode.
+    VideoCodecRateControl m_rateControl{VideoCodecRateControl::CRF};
     /// Encdoer bitrate in bps.
     int m_bitrate{5000000}; // 5 Mbps
+    /// VBV max bitrate in bps. 0 - VBV off.
+    int m_maxBitrate{0};
+    /// VBV buffer size in bits. 0 - one second of max bitrate.
+    int m_vbvBufferSize{0};
+    /// Constant rate factor. -1 - codec default.
+    float m_crf{-1.0f};
+    /// GOP size. 0 - infinite.
+    int m_gopSize{30};
+    /// GOP size of opened encoder.
+    int m_openGopSize{30};
+    /// Number of frames since last IDR frame forced by VideoCodec.
+    int m_framesSinceIdr{0};
+    /// Next frame must be IDR frame.
+    bool m_forceIdr{false};
+    /// Rate control params are changed, apply them on next frame.
+    bool m_encoderReconfig{false};
+    /// Adaptive preset is enabled.
+    bool m_adaptivePreset{false};
+    /// Slowest preset of adaptive preset.
+    VideoCodecPreset m_adaptiveMaxPreset{VideoCodecPreset::MEDIUM};
+    /// Target encoding time of one frame, ms.
+    float m_frameBudgetMs{33.0f};
+    /// Current speed level (preset) of adaptive preset. -1 - start from PRESET.
+    int m_speedLevel{-1};
+    /// Average encoding time of one frame, ms.
+    double m_encodeTimeMs{0.0};
+    /// Number of frames encoded since last speed level change.
+    int m_framesSinceSpeedChange{0};
+    /// Number of frames to wait before switching to slower speed level.
+    int m_speedUpHold{60};
+    /// Last speed level change was switch to slower level.
+    bool m_speedSteppedUp{false};
+    /// Number of slices per frame. 0 - encoder default.
+    int m_slices{0};
+    /// Periodic intra refresh instead of IDR frames.
+    bool m_intraRefresh{false};
+    /// Encoded NAL unit callback.
+    VideoCodecNalCallback m_nalCallback;
+    /// Mutex of x264 slice callback, it is called from slice threads.
+    std::mutex m_sliceMutex;
+    /// Buffers of NAL units encoded by x264 slice callback. Valid until next
+    /// x264_encoder_encode() call.
+    std::vector<std::unique_ptr<std::vector<uint8_t>>> m_sliceBuffers;
+    /// NAL units of current frame from x264 slice callback and number of first
+    /// macroblock of slice (-1 for parameter sets and SEI).
+    std::vector<std::pair<int, VideoCodecNal>> m_sliceNals;
     /// Pixel format.
     cr::video::Fourcc m_pixelFormat{cr::video::Fourcc::YUYV};
+    /// Encoder threading mode.
+    VideoCodecThreadMode m_threadMode{VideoCodecThreadMode::SINGLE};
+    /// Number of encoder threads. 0 - number of CPU cores.
+    int m_numThreads{0};
+    /// Number of x265 thread pool threads. 0 - auto, -1 - no pool.
+    int m_poolThreads{0};
+    /// Encoders must be re-initialized on next frame (params changed).
+    /// Parked encoder sessions are closed too.
+    bool m_encoderReinit{false};
+    /// Active encoder is flushed and must be re-opened on next frame of its
+    /// format. Parked sessions are kept.
+    bool m_encoderFlushed{false};
+    /// Encoder preset.
+    VideoCodecPreset m_preset{VideoCodecPreset::ULTRAFAST};
+    /// Zero latency tuning flag.
+    bool m_zeroLatency{true};
+    /// Number of B-frames. -1 - preset default.
+    int m_bFrames{-1};
+    /// Rate control lookahead. -1 - preset default.
+    int m_lookahead{-1};
+    /// Macroblock tree. -1 - preset default.
+    int m_mbTree{-1};
+    /// Source format of current encoder session (defines encoder input colorspace).
+    cr::video::Fourcc m_inputFourcc{cr::video::Fourcc::YU12};
+    /// I420 frame for source formats which encoder doesn't take directly.
+    cr::video::Frame m_convertFrame;
+    /// Views of NAL units of last encoded frame.
+    std::vector<VideoCodecNal> m_nals;
+    /// Presentation timestamp (source frameId) of last encoded frame.
+    int64_t m_outPts{0};
+    /// Data of last destination frame of encode() allocated by codec.
+    uint8_t* m_dstData{nullptr};
+    /// Allocated size of last destination frame of encode().
+    int m_dstCapacity{0};
+    /// Data and allocated size of last destination frame of receivePacket().
+    uint8_t* m_packetDstData{nullptr};
+    int m_packetDstCapacity{0};
+
+    /**
+     * @brief Encoded packet in output queue.
+     */
+    struct Packet
+    {
+        /// Encoded data.
+        std::vector<uint8_t> data;
+        /// Codec type.
+        cr::video::Fourcc fourcc{cr::video::Fourcc::H264};
+        /// Frame width.
+        int width{0};
+        /// Frame height.
+        int height{0};
+        /// Source frame ID.
+        uint32_t frameId{0};
+    };
+
+    /**
+     * @brief Input queue slot.
+     */
+    struct InputSlot
+    {
+        /// Copy of source frame.
+        cr::video::Frame frame;
+        /// Codec type.
+        cr::video::Fourcc fourcc{cr::video::Fourcc::H264};
+        /// End of stream marker (flush request).
+        bool endOfStream{false};
+    };
+
+    /// Size of input queue.
+    int m_queueSize{8};
+    /// Input queue (ring buffer).
+    std::vector<InputSlot> m_inQueue;
+    /// Index of first slot in input queue.
+    int m_inHead{0};
+    /// Number of slots in input queue.
+    int m_inCount{0};
+    /// Input queue mutex.
+    std::mutex m_inMutex;
+    /// Input queue condition variable.
+    std::condition_variable m_inCond;
+    /// Mutex to serialize submitFrame() callers.
+    std::mutex m_submitMutex;
+    /// Output packets queue.
+    std::deque<Packet> m_outQueue;
+    /// Released packets to reuse their memory.
+    std::vector<Packet> m_freePackets;
+    /// End of stream reached (all flushed packets are in output queue).
+    bool m_outEndOfStream{false};
+    /// Output queue mutex.
+    std::mutex m_outMutex;
+    /// Output queue condition variable.
+    std::condition_variable m_outCond;
+    /// Worker thread.
+    std::thread m_workerThread;
+    /// Worker thread running flag.
+    std::atomic<bool> m_workerRunning{false};
+    /// Worker thread stop flag.
+    bool m_workerStop{false};
+    /// Mutex of encoder state shared by worker thread and encode(),
+    /// setParam() and other methods of caller thread. Recursive: callbacks
+    /// called from encoding thread can call setParam().
+    std::recursive_mutex m_encoderMutex;
+
+    /**
+     * @brief Worker thread function. Encodes frames from input queue.
+     */
+    void workerThreadFunc();
+
+    /**
+     * @brief Put encoded NAL units of last frame to output queue.
+     * @param fourcc Codec type.
+     */
+    void pushPacket(cr::video::Fourcc fourcc);
+
+    /**
+     * @brief Prepare destination frame for compressed data. Frame is
+     * re-allocated if its size differs or allocated memory is too small.
+     * @param dst Destination frame.
+     * @param width Frame width.
+     * @param height Frame height.
+     * @param fourcc Codec type.
+     * @param size Size of compressed data.
+     * @param lastData Data of last frame allocated by codec.
+     * @param lastCapacity Allocated size of last frame allocated by codec.
+     */
+    void reserveDst(cr::video::Frame& dst, int width, int height, cr::video::Fourcc fourcc, int size,
+                    uint8_t*& lastData, int& lastCapacity);
+
+    /**
+     * @brief Encode delayed frames of current encoder and put them to output
+     * queue. Encoder is re-initialized on next frame.
+     * @return TRUE if encoder was drained successfully or FALSE.
+     */
+    bool drainEncoder();
+
+    /**
+     * @brief Check source frame, initialize encoder if needed and encode frame.
+     * @param src Source frame.
+     * @param layout Source frame planes layout.
+     * @param fourcc Codec type.
+     * @return TRUE if the frame was encoded successfully or FALSE.
+     */
+    bool encodeFrame(cr::video::Frame& src, const VideoCodecPlaneLayout& layout,
+                     cr::video::Fourcc fourcc);
 
     /// x264 encoder parameters.
     x264_param_t m_h264Param;
-    /// x264 input picture.
+    /// x264 input picture. Planes point to source frame data.
     x264_picture_t m_h264PicIn;
     /// x264 output picture.
     x264_picture_t m_h264PicOut;
     /// x264 encoder.
     x264_t *m_h264Encoder{nullptr};
 
+    /**
+     * @brief Set rate control params of x264 encoder.
+     * @param param x264 params.
+     */
+    void setH264RateControl(x264_param_t& param);
+
+    /**
+     * @brief Set rate control params of x265 encoder.
+     * @param param x265 params.
+     */
+    void setH265RateControl(x265_param& param);
+
+    /**
+     * @brief Apply changed rate control params and GOP size to running
+     * encoder by x264_encoder_reconfig() / x265_encoder_reconfig().
+     * @return TRUE if changes were applied or FALSE if encoder must be
+     * re-initialized (rate control mode changed, VBV turned on or off,
+     * bitrate changed without VBV or GOP is longer than GOP of opened encoder).
+     */
+    bool reconfigEncoder();
+
+    /**
+     * @brief Set speed params (motion estimation, subpixel refinement,
+     * references, partitions, trellis) of x264 speed level.
+     * @param param x264 params.
+     * @param level Speed level (VideoCodecPreset value).
+     */
+    void setH264Speed(x264_param_t& param, int level);
+
+    /**
+     * @brief Set speed params (motion estimation, subpixel refinement,
+     * references, RDO level, merge candidates) of x265 speed level.
+     * @param param x265 params.
+     * @param level Speed level (VideoCodecPreset value).
+     */
+    void setH265Speed(x265_param& param, int level);
+
+    /**
+     * @brief Apply speed level to running encoder by x264_encoder_reconfig()
+     * / x265_encoder_reconfig().
+     * @param fourcc Codec type: H264 or HEVC.
+     * @param level Speed level (VideoCodecPreset value).
+     * @return TRUE if speed level was applied or FALSE.
+     */
+    bool setEncoderSpeed(cr::video::Fourcc fourcc, int level);
+
+    /**
+     * @brief Adaptive preset controller. Compares average encoding time with
+     * frame budget and switches speed level with hysteresis.
+     * @param encodeTimeMs Encoding time of last frame, ms.
+     */
+    void updateEncoderSpeed(double encodeTimeMs);
+
+    /**
+     * @brief Check if next frame must be encoded as IDR frame: forced by
+     * FORCE_IDR param or end of GOP shorter than GOP of opened encoder.
+     * @return TRUE if next frame is IDR frame.
+     */
+    bool nextFrameIsIdr();
+
+    /**
+     * @brief x264 low-latency callback (nalu_process). Encodes NAL unit to
+     * Annex-B and reports it to NAL callback.
+     * @param h x264 encoder.
+     * @param nal Finished NAL unit.
+     * @param opaque VideoCodec object.
+     */
+    static void h264NaluProcess(x264_t* h, x264_nal_t* nal, void* opaque);
+
+    /**
+     * @brief Fill list of encoded NAL units from x264 output or, if slice
+     * callback is used, from NAL units collected by callback.
+     * @param nal x264 NAL units.
+     * @param count Number of x264 NAL units.
+     */
+    void collectH264Nals(x264_nal_t* nal, int count);
+
+    /**
+     * @brief Count encoded data and report encoded NAL units to NAL callback
+     * if they were not reported by x264 slice callback.
+     */
+    void outputNals();
+
     /**
      * @brief Initialize x264 encoder.
      * @param width Frame width.
@@ -100,21 +1043,21 @@ private:
     /**
      * @brief Encode a frame using x264 encoder.
      * @param src Source frame.
-     * @param dst Destination frame.
+     * @param layout Source frame planes layout.
      * @return TRUE if the frame was encoded successfully or FALSE.
      */
-    bool encodeH264Frame(cr::video::Frame& src, cr::video::Frame& dst);
+    bool encodeH264Frame(cr::video::Frame& src, const VideoCodecPlaneLayout& layout);
 
     /// x265 encoder parameters.
     x265_param m_h265Param;
-    /// x265 input picture.
-    x265_picture *m_h265PicIn;
+    /// x265 input picture. Planes point to source frame data.
+    x265_picture *m_h265PicIn{nullptr};
     /// x265 output picture.
     x265_picture m_h265PicOut;
     /// x265 encoder.
     x265_encoder *m_h265Encoder{nullptr};
-    /// Internal buffer for YUV420 frame. H.265 encoder requires proving buffer.
-    uint8_t *m_h265InternalBuffer{nullptr};
+    /// x265 thread pool description (numaPools). Must live as long as encoder.
+    std::string m_h265Pools;
 
     /**
      * @brief Initialize x265 encoder.
@@ -127,19 +1070,300 @@ private:
     /**
      * @brief Encode a frame using x265 encoder.
      * @param src Source frame.
-     * @param dst Destination frame.
+     * @param layout Source frame planes layout.
      * @return TRUE if the frame was encoded successfully or FALSE.
      */
-    bool encodeH265Frame(cr::video::Frame& src, cr::video::Frame& dst);
+    bool encodeH265Frame(cr::video::Frame& src, const VideoCodecPlaneLayout& layout);
 
     /// Jpeg encoder parameters.
     struct jpeg_compress_struct cinfo;
     /// Error handler
     struct jpeg_error_mgr jerr;
-    /// Jpeg buffer.
+    /// Jpeg buffer: m_jpegMemBuffer or buffer allocated by libjpeg with
+    /// malloc() if encoded image didn't fit.
     unsigned char* jpeg_buffer = nullptr;
     /// Jpeg buffer size.
     unsigned long jpeg_size = 0;
+    /// Jpeg buffer allocated by codec allocator.
+    unsigned char* m_jpegMemBuffer{nullptr};
+    /// Size of m_jpegMemBuffer.
+    unsigned long m_jpegMemCapacity{0};
+    /// Allocator of m_jpegMemBuffer.
+    std::shared_ptr<VideoCodecAllocator> m_jpegMemAllocator;
+    /// Rows converted from source frame during JPEG compression: RGB rows
+    /// or one MCU row of YCbCr planes in raw mode.
+    std::vector<uint8_t> m_jpegRows;
+    /// JPEG quality.
+    int m_jpegQuality{50};
+    /// JPEG fast DCT flag.
+    bool m_jpegFastDct{false};
+    /// JPEG optimized Huffman tables flag.
+    bool m_jpegOptimizeCoding{false};
+    /// JPEG chroma subsampling.
+    VideoCodecJpegSubsampling m_jpegSubsampling{VideoCodecJpegSubsampling::YUV420};
+    /// Raw YCbCr input mode: source planes are passed to jpeg_write_raw_data.
+    bool m_jpegRawInput{false};
+    /// Row sizes of luma and chroma buffers in raw mode (padded to DCT blocks).
+    int m_jpegRawRowSize[2]{0, 0};
+
+    /// Number of JPEG encoder threads.
+    int m_jpegThreads{1};
+
+    /**
+     * @brief Lock-free latency counter of processing stage.
+     */
+    struct LatencyCounter
+    {
+        /// Number of measured calls.
+        std::atomic<uint64_t> count{0};
+        /// Total duration, ns.
+        std::atomic<uint64_t> totalNs{0};
+        /// Max duration, ns.
+        std::atomic<uint64_t> maxNs{0};
+        /// Histogram of durations (see VideoCodecLatency).
+        std::atomic<uint64_t> histogram[VideoCodecLatency::BINS]{};
+
+        /**
+         * @brief Add measured duration.
+         * @param ns Duration, ns.
+         */
+        void add(uint64_t ns);
+
+        /**
+         * @brief Read counter.
+         * @param latency Latency statistics.
+         */
+        void read(VideoCodecLatency& latency) const;
+
+        /**
+         * @brief Reset counter.
+         */
+        void reset();
+    };
+
+    /**
+     * @brief Lock-free codec counters (see VideoCodecStats).
+     */
+    struct StatsCounters
+    {
+        std::atomic<uint64_t> encodedFrames{0};
+        std::atomic<uint64_t> decodedFrames{0};
+        std::atomic<uint64_t> failedEncodes{0};
+        std::atomic<uint64_t> failedDecodes{0};
+        std::atomic<uint64_t> droppedFrames{0};
+        std::atomic<uint64_t> encoderInits{0};
+        std::atomic<uint64_t> decoderInits{0};
+        std::atomic<uint64_t> decoderFormatChanges{0};
+        std::atomic<uint64_t> decoderFilteredPackets{0};
+        std::atomic<uint64_t> encoderBytesIn{0};
+        std::atomic<uint64_t> encoderBytesOut{0};
+        std::atomic<uint64_t> decoderBytesIn{0};
+        std::atomic<uint64_t> decoderBytesOut{0};
+        LatencyCounter input;
+        LatencyCounter encode;
+        LatencyCounter nalGather;
+        LatencyCounter decode;
+        LatencyCounter convert;
+    };
+
+    /**
+     * @brief Scoped measurement of processing stage with trace markers.
+     */
+    class StageScope
+    {
+    public:
+        /**
+         * @brief Start measurement.
+         * @param codec Codec.
+         * @param counter Latency counter of stage.
+         * @param name Stage name for trace markers.
+         */
+        StageScope(VideoCodec& codec, LatencyCounter& counter, const char* name);
+
+        /**
+         * @brief Finish measurement if it was not finished by finish().
+         */
+        ~StageScope();
+
+        /**
+         * @brief Finish measurement.
+         * @return Duration, ms.
+         */
+        double finish();
+
+    private:
+        /// Codec.
+        VideoCodec& m_codec;
+        /// Latency counter of stage.
+        LatencyCounter& m_counter;
+        /// Stage name.
+        const char* m_name;
+        /// Start time.
+        std::chrono::steady_clock::time_point m_start;
+        /// Measurement is finished.
+        bool m_finished{false};
+    };
+
+    /// Codec statistics.
+    StatsCounters m_stats;
+    /// Statistics callback.
+    VideoCodecStatsCallback m_statsCallback;
+    /// Min period between statistics callback calls.
+    std::chrono::milliseconds m_statsPeriod{1000};
+    /// Time of next statistics callback call.
+    std::chrono::steady_clock::time_point m_statsTime;
+    /// Trace marker callback.
+    VideoCodecTraceCallback m_traceCallback;
+
+    /**
+     * @brief Call statistics callback if its period is elapsed.
+     */
+    void checkStatsCallback();
+
+    /**
+     * @brief Convert decoded frame to destination frame and count it.
+     * @param dst Destination frame.
+     * @return TRUE if the frame was converted or FALSE.
+     */
+    bool outputDecodedFrame(cr::video::Frame& dst);
+
+    /**
+     * @brief Horizontal band of frame (whole MCU rows) encoded by parallel
+     * JPEG encoder.
+     */
+    struct JpegBand
+    {
+        /// Band compressor.
+        struct jpeg_compress_struct cinfo;
+        /// Error handler.
+        struct jpeg_error_mgr jerr;
+        /// Band buffer allocated by codec allocator.
+        unsigned char* buffer{nullptr};
+        /// Size of band buffer.
+        unsigned long capacity{0};
+        /// Allocator of band buffer.
+        std::shared_ptr<VideoCodecAllocator> allocator;
+        /// Compressed band: band buffer or buffer allocated by libjpeg by
+        /// malloc() if band doesn't fit.
+        unsigned char* output{nullptr};
+        /// Size of compressed band.
+        unsigned long size{0};
+        /// Rows converted from source frame.
+        std::vector<uint8_t> rows;
+        /// Index of first luma row of the band.
+        int firstRow{0};
+    };
+
+    /// Bands of parallel JPEG encoder. Empty in single thread mode.
+    std::vector<std::unique_ptr<JpegBand>> m_jpegBands;
+    /// Height of band in MCU rows (last band can be lower).
+    int m_jpegBandRows{0};
+    /// Restart interval in MCU rows. Band height is a multiple of it.
+    int m_jpegRestartRows{0};
+    /// Band threads. First band is encoded by calling thread.
+    std::vector<std::thread> m_jpegBandThreads;
+    /// Band threads mutex.
+    std::mutex m_jpegBandMutex;
+    /// Condition variable to start band threads.
+    std::condition_variable m_jpegBandCond;
+    /// Condition variable to wait for band threads.
+    std::condition_variable m_jpegBandDoneCond;
+    /// Index of current job of band threads.
+    uint64_t m_jpegBandJob{0};
+    /// Number of bands of current job. Published with job index, threads
+    /// don't read size of m_jpegBands which changes between sessions.
+    size_t m_jpegBandCount{0};
+    /// Number of bands being encoded by band threads.
+    int m_jpegBandsPending{0};
+    /// Band threads stop flag.
+    bool m_jpegBandStop{false};
+    /// Source frame of current job.
+    cr::video::Frame* m_jpegBandSrc{nullptr};
+    /// Source planes layout of current job.
+    VideoCodecPlaneLayout m_jpegBandLayout;
+    /// Joined JPEG image.
+    std::vector<uint8_t> m_jpegOutput;
+
+    /**
+     * @brief Encoder session kept open while encoder of other format or
+     * resolution is active. Fields hold the same state as members of active
+     * encoder and are swapped with them.
+     */
+    struct EncoderSession
+    {
+        bool encoderInit{false};
+        bool encoderFlushed{false};
+        cr::video::Fourcc pixelFormat{cr::video::Fourcc::YUYV};
+        int width{-1};
+        int height{-1};
+        cr::video::Fourcc inputFourcc{cr::video::Fourcc::YU12};
+        int openGopSize{30};
+        int framesSinceIdr{0};
+        int speedLevel{-1};
+        double encodeTimeMs{0.0};
+        int framesSinceSpeedChange{0};
+        x264_param_t h264Param;
+        x264_picture_t h264PicIn;
+        x264_picture_t h264PicOut;
+        x264_t* h264Encoder{nullptr};
+        x265_param h265Param;
+        x265_picture* h265PicIn{nullptr};
+        x265_picture h265PicOut;
+        x265_encoder* h265Encoder{nullptr};
+        std::string h265Pools;
+        struct jpeg_compress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        unsigned char* jpegBuffer{nullptr};
+        unsigned long jpegSize{0};
+        unsigned char* jpegMemBuffer{nullptr};
+        unsigned long jpegMemCapacity{0};
+        std::shared_ptr<VideoCodecAllocator> jpegMemAllocator;
+        std::vector<uint8_t> jpegRows;
+        bool jpegRawInput{false};
+        int jpegRawRowSize[2]{0, 0};
+        std::vector<std::unique_ptr<JpegBand>> jpegBands;
+        int jpegBandRows{0};
+        int jpegRestartRows{0};
+    };
+
+    /// Parked encoder sessions, most recently used first.
+    std::deque<std::unique_ptr<EncoderSession>> m_encoderSessions;
+    /// Max number of parked encoder sessions.
+    int m_encoderCacheSize{2};
+
+    /**
+     * @brief Swap state of active encoder with encoder session.
+     * @param session Encoder session.
+     */
+    void swapEncoderSession(EncoderSession& session);
+
+    /**
+     * @brief Park active encoder and activate parked session of required
+     * format and resolution if there is one. Least recently used sessions
+     * above cache size are closed.
+     * @param fourcc Codec type.
+     * @param width Frame width.
+     * @param height Frame height.
+     * @param inputFourcc Encoder input format.
+     */
+    void switchEncoderSession(cr::video::Fourcc fourcc, int width, int height,
+                              cr::video::Fourcc inputFourcc);
+
+    /**
+     * @brief Close encoder of parked session.
+     * @param session Encoder session.
+     */
+    void releaseEncoderSession(EncoderSession& session);
+
+    /**
+     * @brief Close all parked encoder sessions.
+     */
+    void releaseEncoderSessions();
+
+    /**
+     * @brief Close active encoder of any type.
+     */
+    void releaseEncoder();
 
     /**
      * @brief Initialize JPEG encoder.
@@ -152,21 +1376,199 @@ private:
     /**
      * @brief Encode a frame using JPEG encoder.
      * @param src Source frame.
-     * @param dst Destination frame.
+     * @param layout Source frame planes layout.
      * @return TRUE if the frame was encoded successfully or FALSE.
      */
-    bool encodeJpegFrame(cr::video::Frame& src, cr::video::Frame& dst);
+    bool encodeJpegFrame(cr::video::Frame& src, const VideoCodecPlaneLayout& layout);
+
+    /**
+     * @brief Create and configure JPEG compressor.
+     * @param info Compressor.
+     * @param err Error handler.
+     * @param width Image width.
+     * @param height Image height.
+     * @param restartRows Restart interval in MCU rows, 0 - no restart markers.
+     */
+    void setupJpegCompressor(jpeg_compress_struct& info, jpeg_error_mgr& err,
+                             int width, int height, int restartRows);
+
+    /**
+     * @brief Write all rows of image to started JPEG compressor.
+     * @param info Compressor.
+     * @param rows Row buffers of compressor.
+     * @param src Source frame.
+     * @param layout Source planes layout.
+     * @param firstRow Index of source row of the first image row.
+     */
+    void writeJpegRows(jpeg_compress_struct& info, uint8_t* rows, cr::video::Frame& src,
+                       const VideoCodecPlaneLayout& layout, int firstRow);
+
+    /**
+     * @brief Convert two source rows to RGB rows for JPEG encoder.
+     * @param rows Row buffers.
+     * @param src Source frame.
+     * @param layout Source planes layout.
+     * @param row Index of first row.
+     */
+    void convertJpegRows(uint8_t* rows, cr::video::Frame& src,
+                         const VideoCodecPlaneLayout& layout, int row);
+
+    /**
+     * @brief Copy one MCU row of source planes to raw YCbCr buffers with
+     * expansion from video range to full (JFIF) range.
+     * @param rows Row buffers.
+     * @param src Source frame.
+     * @param layout Source planes layout.
+     * @param row Index of first luma row.
+     * @param planes Row pointers of Y, Cb and Cr buffers.
+     */
+    void fillJpegRawRows(uint8_t* rows, cr::video::Frame& src, const VideoCodecPlaneLayout& layout,
+                         int row, JSAMPARRAY planes[3]);
+
+    /**
+     * @brief Encode frame by bands in parallel and join bands.
+     * @param src Source frame.
+     * @param layout Source frame planes layout.
+     * @return TRUE if the frame was encoded successfully or FALSE.
+     */
+    bool encodeJpegBands(cr::video::Frame& src, const VideoCodecPlaneLayout& layout);
+
+    /**
+     * @brief Encode one band of current job source frame.
+     * @param band Band.
+     */
+    void encodeJpegBand(JpegBand& band);
+
+    /**
+     * @brief Join compressed bands to single JPEG image: header of the first
+     * band with full image height, scan data of bands separated by restart
+     * markers.
+     * @return TRUE if bands were joined or FALSE.
+     */
+    bool joinJpegBands();
+
+    /**
+     * @brief Band thread function.
+     * @param index Band index.
+     * @param job Current job index when thread was started.
+     */
+    void jpegBandThreadFunc(size_t index, uint64_t job);
+
+    /**
+     * @brief Release bands of active JPEG encoder.
+     */
+    void releaseJpegBands();
+
+    /**
+     * @brief Release output buffers of JPEG band.
+     * @param band Band.
+     */
+    void releaseJpegBandBuffer(JpegBand& band);
+
+    /**
+     * @brief Stop band threads.
+     */
+    void stopJpegBandThreads();
+
+    /**
+     * @brief Resolve and check source frame planes layout.
+     * @param src Source frame.
+     * @param layout Requested layout. Zero stride of first plane - default layout.
+     * @param result Resolved layout.
+     * @return TRUE if all planes fit into source frame data or FALSE.
+     */
+    bool getPlaneLayout(cr::video::Frame& src, const VideoCodecPlaneLayout& layout,
+                        VideoCodecPlaneLayout& result);
+
+    /**
+     * @brief Get frame in format accepted by encoder. Formats which encoder
+     * doesn't take directly are converted to I420.
+     * @param src Source frame.
+     * @param planes Source planes layout.
+     * @param fourcc Codec type.
+     * @param input Frame to encode: source frame or converted frame.
+     * @param inputLayout Planes layout of frame to encode.
+     */
+    void prepareEncoderInput(cr::video::Frame& src, const VideoCodecPlaneLayout& planes,
+                             cr::video::Fourcc fourcc, cr::video::Frame*& input,
+                             VideoCodecPlaneLayout& inputLayout);
 
     /// Libav software decoder.
-    AVCodec *m_decoder;
+    AVCodec *m_decoder{nullptr};
     /// Libav codec context.
-    AVCodecContext *codec_ctx;
+    AVCodecContext *codec_ctx{nullptr};
     /// Libav packet to store encoded frame.
-    AVPacket *packet;
+    AVPacket *packet{nullptr};
     /// Libav frame to store decoded frame.
-    AVFrame *frame;
-    /// Libav software scaler context.
-    struct SwsContext* sws_ctx;
+    AVFrame *frame{nullptr};
+    /// Libav software scaler context with its conversion.
+    struct ScalerContext
+    {
+        /// Scaler context.
+        struct SwsContext* context{nullptr};
+        /// Frame width.
+        int width{0};
+        /// Frame height.
+        int height{0};
+        /// Pixel format of decoded frame.
+        AVPixelFormat srcFormat{AV_PIX_FMT_NONE};
+        /// Pixel format of output frame.
+        AVPixelFormat dstFormat{AV_PIX_FMT_NONE};
+    };
+    /// Scaler contexts for conversions not supported by SIMD converter, most
+    /// recently used first. Contexts of previous resolutions are kept, so
+    /// streams switching between resolutions don't recreate them.
+    std::vector<ScalerContext> m_scalers;
+    /// Max number of cached scaler contexts.
+    static const size_t m_maxScalers{4};
+    /// Size and pixel format of last decoded frame (-1 - no frames yet).
+    int m_decodedWidth{-1};
+    int m_decodedHeight{-1};
+    int m_decodedFormat{-1};
+    /// SIMD color converter for same size conversions.
+    ColorConverter m_converter;
+    /// Allocator of codec buffers.
+    std::shared_ptr<VideoCodecAllocator> m_allocator{std::make_shared<VideoCodecBufferPool>()};
+    /// Mutex to protect buffer pools, libav calls get_buffer2 from decoder
+    /// threads.
+    std::mutex m_bufferPoolMutex;
+    /// Pool of decoded picture buffers.
+    AVBufferPool* m_pictureBufferPool{nullptr};
+    /// Size of picture buffers.
+    size_t m_pictureBufferSize{0};
+    /// Pool of decoder packet buffers.
+    AVBufferPool* m_packetBufferPool{nullptr};
+    /// Size of packet buffers.
+    size_t m_packetBufferSize{0};
+
+    /**
+     * @brief libjpeg error handler which returns control to JPEG decoding
+     * method instead of exit().
+     */
+    struct JpegDecoderError
+    {
+        /// libjpeg error handler.
+        struct jpeg_error_mgr mgr;
+        /// Return point of decoding method.
+        jmp_buf jump;
+    };
+
+    /// JPEG decoder is used instead of libav for JPEG source frames.
+    bool m_jpegDecoderInit{false};
+    /// JPEG decompressor.
+    struct jpeg_decompress_struct m_jpegDinfo;
+    /// JPEG decoder error handler.
+    JpegDecoderError m_jpegDerr;
+    /// JPEG decoding scale denominator.
+    int m_jpegDecodeScale{1};
+    /// JPEG fast IDCT flag.
+    bool m_jpegDecodeFastIdct{false};
+    /// Raw YCbCr rows of JPEG decoder (one or two iMCU rows).
+    std::vector<uint8_t> m_jpegDecodeRows;
+    /// Row pointers of raw YCbCr rows of each component.
+    std::vector<JSAMPROW> m_jpegDecodeRowPointers;
+    /// Number of iMCU rows in raw YCbCr rows.
+    int m_jpegDecodeGroup{1};
 
     /**
      * @brief Initialize decoder.
@@ -176,10 +1578,153 @@ private:
     bool initDecoder(cr::video::Frame frame);
 
     /**
-     * @brief Decode a frame using software decoder.
+     * @brief Check source frame and initialize decoder if needed.
+     * @param src Source frame.
+     * @return TRUE if decoder is ready or FALSE.
+     */
+    bool prepareDecoder(cr::video::Frame& src);
+
+    /**
+     * @brief Check if packet passes DECODER_KEY_FRAMES_ONLY filter. Dropped
+     * packets are counted in statistics.
+     * @param src Source frame.
+     * @return TRUE if the packet must be decoded or FALSE.
+     */
+    bool filterPacket(cr::video::Frame& src);
+
+    /**
+     * @brief Apply skip params to libav decoder context.
+     */
+    void applyDecoderSkip();
+
+    /**
+     * @brief Decode a frame using software decoder. Decoded frame is stored
+     * in libav frame.
+     * @param src Source frame.
+     * @return TRUE if the frame was decoded successfully or FALSE.
+     */
+    bool decodeFrame(cr::video::Frame& src);
+
+    /**
+     * @brief Receive decoded frame from decoder to libav frame.
+     * @return TRUE if a frame was received or FALSE.
+     */
+    bool receiveDecodedFrame();
+
+    /**
+     * @brief Convert or copy decoded libav frame to destination frame.
+     * @param dst Destination frame: BGR24, YU12, NV12 or NV21.
+     * @return TRUE if the frame was converted successfully or FALSE.
+     */
+    bool convertDecodedFrame(cr::video::Frame& dst);
+
+    /**
+     * @brief Get cached scaler context or create new one.
+     * @param width Frame width.
+     * @param height Frame height.
+     * @param srcFormat Pixel format of decoded frame.
+     * @param dstFormat Pixel format of output frame.
+     * @return Scaler context or nullptr in case of error.
+     */
+    struct SwsContext* getScaler(int width, int height,
+                                 AVPixelFormat srcFormat, AVPixelFormat dstFormat);
+
+    /**
+     * @brief Track size and pixel format of decoded frames.
+     * @param width Decoded frame width.
+     * @param height Decoded frame height.
+     * @param format Libav pixel format of decoded frame.
+     */
+    void checkDecodedFormat(int width, int height, int format);
+
+    /**
+     * @brief Release decoder resources.
+     */
+    void releaseDecoder();
+
+    /**
+     * @brief Release JPEG encoder output buffer.
+     */
+    void releaseJpegBuffer();
+
+    /**
+     * @brief Get buffer from libav buffer pool allocated by codec allocator.
+     * Pool is re-created if buffer size is changed.
+     * @param pool Buffer pool.
+     * @param poolSize Size of pool buffers.
+     * @param size Required size of buffer.
+     * @return Reference to buffer or nullptr.
+     */
+    AVBufferRef* getPoolBuffer(AVBufferPool*& pool, size_t& poolSize, size_t size);
+
+    /**
+     * @brief Allocate planes of video frame from picture buffer pool.
+     * @param dst Frame with set format, width and height.
+     * @param width Width of planes, can be aligned frame width.
+     * @param height Height of planes, can be aligned frame height.
+     * @return TRUE if buffer was allocated or FALSE.
+     */
+    bool getPictureBuffer(AVFrame* dst, int width, int height);
+
+    /**
+     * @brief libav get_buffer2 callback which allocates decoded frames from
+     * picture buffer pool.
+     * @param ctx Codec context, opaque is pointer to VideoCodec.
+     * @param frame Frame to allocate.
+     * @param flags libav flags.
+     * @return 0 on success or negative error code.
+     */
+    static int getDecoderBuffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+
+    /**
+     * @brief libjpeg error_exit handler of JPEG decoder.
+     * @param info libjpeg decompressor.
+     */
+    static void jpegDecoderErrorExit(j_common_ptr info);
+
+    /**
+     * @brief Read JPEG header and set decompression params.
+     * @param src Source frame.
+     * @return TRUE if header is valid or FALSE.
+     */
+    bool readJpegHeader(cr::video::Frame& src);
+
+    /**
+     * @brief Decode JPEG frame to BGR24 frame or to YU12, NV12 and NV21
+     * frames through raw YCbCr planes.
      * @param src Source frame.
      * @param dst Destination frame.
      * @return TRUE if the frame was decoded successfully or FALSE.
      */
-    bool decodeFrame(cr::video::Frame& src, cr::video::Frame& dst);
+    bool decodeJpegFrame(cr::video::Frame& src, cr::video::Frame& dst);
+
+    /**
+     * @brief Decode JPEG frame to libav frame with native chroma subsampling
+     * (YUVJ420P, YUVJ422P, YUVJ444P, YUVJ440P, YUVJ411P or GRAY8).
+     * @param src Source frame.
+     * @param dst Destination libav frame.
+     * @return TRUE if the frame was decoded successfully or FALSE.
+     */
+    bool decodeJpegPicture(cr::video::Frame& src, AVFrame* dst);
+
+    /**
+     * @brief Start raw decompression and allocate raw rows buffer.
+     * @param group Number of iMCU rows read at once.
+     */
+    void startJpegRawDecoding(int group);
+
+    /**
+     * @brief Read next group of iMCU rows of raw YCbCr data.
+     * @return Number of luma rows read.
+     */
+    int readJpegRawRows();
+
+    /**
+     * @brief Write raw YCbCr rows to YU12, NV12 or NV21 frame with conversion
+     * from full (JFIF) range to video range and chroma resampling to 4:2:0.
+     * @param dst Destination frame.
+     * @param row Index of first luma row.
+     * @param rows Number of luma rows.
+     */
+    void writeJpegYuvRows(cr::video::Frame& dst, int row, int rows);
 };
\ No newline at end of file
@@ -0,0 +1,371 @@
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include "VideoCodecBatchEncoder.h"
+
+
+
+/// Segment size if GOP is infinite and segment size is not set.
+static const int g_defaultSegmentFrames = 30;
+
+
+
+VideoCodecBatchEncoder::VideoCodecBatchEncoder(int numThreads, int segmentFrames, int maxSegments)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (numThreads <= 0)
+        {
+            numThreads = 1;
+        }
+    }
+
+    // Segment per worker, one segment being filled and one being received.
+    m_segmentFrames = segmentFrames > 0 ? segmentFrames : 0;
+    m_maxSegments = maxSegments > 0 ? maxSegments : numThreads + 2;
+
+    // Segments are encoded in parallel: segment encoders are single-threaded
+    // and x265 doesn't create thread pool of all cores per segment. Params
+    // are applied first, so they can be changed by setParam().
+    setParam(VideoCodecParam::THREAD_MODE, static_cast<float>(VideoCodecThreadMode::SINGLE));
+    setParam(VideoCodecParam::NUM_THREADS, 1);
+    setParam(VideoCodecParam::POOL_THREADS, -1);
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_threads.emplace_back(&VideoCodecBatchEncoder::workerThreadFunc, this);
+    }
+}
+
+VideoCodecBatchEncoder::~VideoCodecBatchEncoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobCond.notify_all();
+    m_freeCond.notify_all();
+    m_doneCond.notify_all();
+    for (std::thread &thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+bool VideoCodecBatchEncoder::setParam(VideoCodecParam id, float value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Value is validated by codec, segment encoders get the same sequence of
+    // params.
+    if (!m_paramsCodec.setParam(id, value))
+    {
+        return false;
+    }
+    auto params = std::make_shared<std::vector<std::pair<VideoCodecParam, float>>>(*m_params);
+    params->push_back({id, value});
+    m_params = params;
+
+    return true;
+}
+
+float VideoCodecBatchEncoder::getParam(VideoCodecParam id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_paramsCodec.getParam(id);
+}
+
+bool VideoCodecBatchEncoder::submitFrame(cr::video::Frame &src, cr::video::Fourcc fourcc)
+{
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC && fourcc != cr::video::Fourcc::JPEG)
+    {
+        std::cout << "Invalid pixel format" << std::endl;
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Codec, frame size or source format change starts new segment: segment
+    // encoder is initialized by the first frame and packets of segment have
+    // the same size.
+    if (m_current != nullptr && m_current->numFrames > 0 &&
+        (m_current->fourcc != fourcc || m_current->width != src.width ||
+         m_current->height != src.height || m_current->srcFourcc != src.fourcc))
+    {
+        pushCurrent();
+    }
+    if (m_current == nullptr)
+    {
+        m_current = takeSegment(lock);
+        if (m_current == nullptr)
+        {
+            return false;
+        }
+    }
+    Segment *segment = m_current;
+    if (segment->numFrames == 0)
+    {
+        segment->fourcc = fourcc;
+        segment->srcFourcc = src.fourcc;
+        segment->width = src.width;
+        segment->height = src.height;
+    }
+    int segmentFrames = m_segmentFrames;
+    if (segmentFrames == 0)
+    {
+        int gopSize = static_cast<int>(m_paramsCodec.getParam(VideoCodecParam::GOP_SIZE));
+        segmentFrames = gopSize > 0 ? gopSize : g_defaultSegmentFrames;
+    }
+
+    // Copy frame outside of lock. Workers don't see current segment. Frame
+    // buffers are reused if frame size is not changed.
+    lock.unlock();
+    if (static_cast<int>(segment->frames.size()) <= segment->numFrames)
+    {
+        segment->frames.emplace_back();
+    }
+    segment->frames[segment->numFrames] = src;
+    ++segment->numFrames;
+    lock.lock();
+
+    if (segment->numFrames >= segmentFrames)
+    {
+        pushCurrent();
+    }
+
+    return true;
+}
+
+bool VideoCodecBatchEncoder::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (m_current != nullptr && m_current->numFrames > 0)
+    {
+        pushCurrent();
+    }
+
+    // End of stream marker keeps position in stream order.
+    Segment *marker = m_current != nullptr ? m_current : takeSegment(lock);
+    m_current = nullptr;
+    if (marker == nullptr)
+    {
+        return false;
+    }
+    marker->endOfStream = true;
+    marker->done = true;
+    m_order.push_back(marker);
+    lock.unlock();
+    m_doneCond.notify_all();
+
+    return true;
+}
+
+bool VideoCodecBatchEncoder::receivePacket(cr::video::Frame &dst, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto ready = [this]{ return m_stop || (!m_order.empty() && m_order.front()->done); };
+
+    while (true)
+    {
+        if (timeoutMs < 0)
+        {
+            m_doneCond.wait(lock, ready);
+        }
+        else if (!m_doneCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready))
+        {
+            return false;
+        }
+        if (m_stop)
+        {
+            return false;
+        }
+
+        Segment *segment = m_order.front();
+        if (segment->endOfStream || segment->nextPacket >= segment->packets.size())
+        {
+            // Segment is received: buffers are kept for next segments.
+            bool endOfStream = segment->endOfStream;
+            m_order.pop_front();
+            m_free.push_back(segment);
+            m_freeCond.notify_one();
+            if (endOfStream)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        // Encoded segment is not changed by other threads until it is freed.
+        const Packet &packet = segment->packets[segment->nextPacket++];
+        lock.unlock();
+        // Frame size field is overwritten by packet size, so allocated size of
+        // frames allocated here is kept. Size of other frames is their
+        // allocated size.
+        int capacity = dst.data != nullptr && dst.data == m_dstData ? m_dstCapacity : dst.size;
+        if (dst.data == nullptr || dst.width != segment->width || dst.height != segment->height ||
+            dst.fourcc != segment->fourcc)
+        {
+            dst.release();
+            dst = cr::video::Frame(segment->width, segment->height, segment->fourcc);
+            capacity = dst.size;
+        }
+        if (packet.size > capacity)
+        {
+            dst.release();
+            dst = cr::video::Frame(segment->width, segment->height, segment->fourcc, packet.size);
+            capacity = packet.size;
+        }
+        m_dstData = dst.data;
+        m_dstCapacity = capacity;
+        memcpy(dst.data, segment->data.data() + packet.offset, static_cast<size_t>(packet.size));
+        dst.size = packet.size;
+        dst.frameId = packet.frameId;
+
+        return true;
+    }
+}
+
+uint64_t VideoCodecBatchEncoder::getNumSegments()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numSegments;
+}
+
+uint64_t VideoCodecBatchEncoder::getNumErrors()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numErrors;
+}
+
+VideoCodecBatchEncoder::Segment* VideoCodecBatchEncoder::takeSegment(std::unique_lock<std::mutex> &lock)
+{
+    m_freeCond.wait(lock, [this]
+    {
+        return m_stop || !m_free.empty() || static_cast<int>(m_segments.size()) < m_maxSegments;
+    });
+    if (m_stop)
+    {
+        return nullptr;
+    }
+
+    Segment *segment = nullptr;
+    if (!m_free.empty())
+    {
+        segment = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        m_segments.emplace_back(new Segment());
+        segment = m_segments.back().get();
+    }
+
+    segment->numFrames = 0;
+    segment->data.clear();
+    segment->packets.clear();
+    segment->nextPacket = 0;
+    segment->errors = 0;
+    segment->done = false;
+    segment->endOfStream = false;
+
+    return segment;
+}
+
+void VideoCodecBatchEncoder::pushCurrent()
+{
+    m_current->params = m_params;
+    m_order.push_back(m_current);
+    m_jobs.push_back(m_current);
+    m_current = nullptr;
+    m_jobCond.notify_one();
+}
+
+void VideoCodecBatchEncoder::workerThreadFunc()
+{
+    // Each worker has own encoder, segments are independent streams.
+    VideoCodec codec;
+    codec.setAllocator(m_buffers);
+    cr::video::Frame packet;
+    std::shared_ptr<const std::vector<std::pair<VideoCodecParam, float>>> params;
+
+    while (true)
+    {
+        Segment *segment = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobCond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_stop)
+            {
+                return;
+            }
+            segment = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        // Params are only appended, new params are applied in order of
+        // setting, so encoder state is the same as after the same calls on
+        // single codec.
+        if (segment->params != params)
+        {
+            size_t first = params ? params->size() : 0;
+            for (size_t i = first; i < segment->params->size(); ++i)
+            {
+                codec.setParam((*segment->params)[i].first, (*segment->params)[i].second);
+            }
+            params = segment->params;
+        }
+
+        encodeSegment(codec, packet, *segment);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            segment->done = true;
+            ++m_numSegments;
+            m_numErrors += static_cast<uint64_t>(segment->errors);
+        }
+        m_doneCond.notify_all();
+    }
+}
+
+void VideoCodecBatchEncoder::encodeSegment(VideoCodec &codec, cr::video::Frame &packet, Segment &segment)
+{
+    // Encoder detects codec type by destination frame fourcc.
+    if (packet.fourcc != segment.fourcc)
+    {
+        packet = cr::video::Frame(segment.width, segment.height, segment.fourcc);
+    }
+
+    auto append = [&segment](cr::video::Frame &encoded)
+    {
+        Packet item;
+        item.offset = segment.data.size();
+        item.size = encoded.size;
+        item.frameId = encoded.frameId;
+        segment.data.insert(segment.data.end(), encoded.data, encoded.data + encoded.size);
+        segment.packets.push_back(item);
+    };
+
+    for (int i = 0; i < segment.numFrames; ++i)
+    {
+        if (!codec.encode(segment.frames[i], packet))
+        {
+            ++segment.errors;
+            continue;
+        }
+        // Delayed frame has no packet.
+        if (packet.size > 0)
+        {
+            append(packet);
+        }
+    }
+
+    // Delayed frames are flushed, next segment starts new encoder with IDR
+    // frame, so segments don't reference each other.
+    codec.flush();
+    while (codec.receivePacket(packet))
+    {
+        append(packet);
+    }
+}
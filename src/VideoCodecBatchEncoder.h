@@ -0,0 +1,226 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "VideoCodec.h"
+
+
+
+/**
+ * @brief Offline encoding of one stream by closed GOP segments in parallel.
+ * Frames are grouped to segments of fixed number of frames, each segment is
+ * encoded by own encoder (starts with IDR frame and parameter sets, delayed
+ * frames are flushed at the end of segment), segments are encoded by worker
+ * threads in parallel. Packets are returned in order, concatenated packets
+ * are one valid Annex-B stream. Throughput scales with number of cores,
+ * latency is at least one segment.
+ */
+class VideoCodecBatchEncoder
+{
+public:
+
+    /**
+     * @brief Class constructor. Starts worker threads. Segment encoders are
+     * single-threaded (NUM_THREADS 1, POOL_THREADS -1), can be changed by
+     * setParam().
+     * @param numThreads Number of worker threads (parallel segments).
+     * 0 - number of CPU cores.
+     * @param segmentFrames Number of frames in segment. 0 - GOP_SIZE param.
+     * @param maxSegments Max number of segments in memory (filled, encoded
+     * and not received). submitFrame() waits if limit is reached.
+     * 0 - number of threads + 2.
+     */
+    VideoCodecBatchEncoder(int numThreads = 0, int segmentFrames = 0, int maxSegments = 0);
+
+    /**
+     * @brief Class destructor. Stops worker threads, not received packets
+     * are lost.
+     */
+    ~VideoCodecBatchEncoder();
+
+    /**
+     * @brief Video codec batch encoder is not copyable.
+     */
+    VideoCodecBatchEncoder(VideoCodecBatchEncoder&) = delete;
+    void operator=(VideoCodecBatchEncoder&) = delete;
+
+    /**
+     * @brief Set codec parameter of segment encoders. Applied from next
+     * segment.
+     * @param id Parameter ID.
+     * @param value Parameter value.
+     * @return TRUE if the parameter was set or FALSE.
+     */
+    bool setParam(VideoCodecParam id, float value);
+
+    /**
+     * @brief Get codec parameter of segment encoders.
+     * @param id Parameter ID.
+     * @return Parameter value or -1.
+     */
+    float getParam(VideoCodecParam id);
+
+    /**
+     * @brief Copy frame to current segment. Full segment is passed to worker
+     * threads. Change of codec, frame size or source format starts new
+     * segment. Must be called from one thread. Waits if max number of
+     * segments is reached, so packets must be received by other thread.
+     * @param src Source frame. Supported formats are the same as for
+     * VideoCodec::encode().
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @return TRUE if the frame was queued or FALSE.
+     */
+    bool submitFrame(cr::video::Frame& src, cr::video::Fourcc fourcc);
+
+    /**
+     * @brief Signal end of stream: last incomplete segment is passed to
+     * worker threads. After last packet receivePacket() returns FALSE once.
+     * @return TRUE if end of stream was queued.
+     */
+    bool flush();
+
+    /**
+     * @brief Receive next encoded packet in stream order (segment by segment,
+     * decoding order inside segment).
+     * @param dst Destination frame for compressed data. Frame is re-allocated
+     * if size or Fourcc differ from packet or packet doesn't fit.
+     * @param timeoutMs Wait timeout in milliseconds. -1 - wait until packet
+     * is available.
+     * @return TRUE if packet is received, FALSE on timeout or if all packets
+     * of flushed stream have been received (end of stream).
+     */
+    bool receivePacket(cr::video::Frame& dst, int timeoutMs = -1);
+
+    /**
+     * @brief Get number of segments encoded since construction.
+     * @return Number of segments.
+     */
+    uint64_t getNumSegments();
+
+    /**
+     * @brief Get number of frames failed to encode since construction.
+     * Failed frames have no packets, other frames of segment are encoded.
+     * @return Number of errors.
+     */
+    uint64_t getNumErrors();
+
+private:
+
+    /**
+     * @brief Encoded packet of segment.
+     */
+    struct Packet
+    {
+        /// Offset of packet data in segment data.
+        size_t offset{0};
+        /// Packet size.
+        int size{0};
+        /// Source frame ID.
+        uint32_t frameId{0};
+    };
+
+    /**
+     * @brief Segment of consecutive frames encoded by one encoder.
+     */
+    struct Segment
+    {
+        /// Source frames. Frames are kept for next segments.
+        std::vector<cr::video::Frame> frames;
+        /// Number of frames in segment.
+        int numFrames{0};
+        /// Codec type.
+        cr::video::Fourcc fourcc{cr::video::Fourcc::H264};
+        /// Source frames format.
+        cr::video::Fourcc srcFourcc{cr::video::Fourcc::YU12};
+        /// Encoded data of all packets.
+        std::vector<uint8_t> data;
+        /// Encoded packets.
+        std::vector<Packet> packets;
+        /// Index of next packet to receive.
+        size_t nextPacket{0};
+        /// Frame size of source frames and encoded packets.
+        int width{0};
+        int height{0};
+        /// Number of frames failed to encode.
+        int errors{0};
+        /// Segment is encoded.
+        bool done{false};
+        /// End of stream marker without frames.
+        bool endOfStream{false};
+        /// Codec params of segment encoder.
+        std::shared_ptr<const std::vector<std::pair<VideoCodecParam, float>>> params;
+    };
+
+    /// Number of frames in segment. 0 - GOP_SIZE param.
+    int m_segmentFrames{0};
+    /// Max number of segments in memory.
+    int m_maxSegments{0};
+    /// Codec params of segment encoders in order of setting. Copied on
+    /// change, segments keep params at the moment of passing to workers.
+    std::shared_ptr<const std::vector<std::pair<VideoCodecParam, float>>> m_params{
+        std::make_shared<const std::vector<std::pair<VideoCodecParam, float>>>()};
+    /// Codec which validates and keeps params for getParam().
+    VideoCodec m_paramsCodec;
+    /// Buffer pool shared by segment encoders.
+    std::shared_ptr<VideoCodecBufferPool> m_buffers{std::make_shared<VideoCodecBufferPool>()};
+    /// All allocated segments.
+    std::vector<std::unique_ptr<Segment>> m_segments;
+    /// Free segments.
+    std::vector<Segment*> m_free;
+    /// Segment filled by submitFrame().
+    Segment* m_current{nullptr};
+    /// Segments in stream order: encoding, encoded and end of stream markers.
+    std::deque<Segment*> m_order;
+    /// Segments waiting for worker thread.
+    std::deque<Segment*> m_jobs;
+    /// Number of encoded segments.
+    uint64_t m_numSegments{0};
+    /// Number of frames failed to encode.
+    uint64_t m_numErrors{0};
+    /// Data of last destination frame allocated by receivePacket().
+    uint8_t* m_dstData{nullptr};
+    /// Allocated size of last destination frame.
+    int m_dstCapacity{0};
+    /// Worker threads.
+    std::vector<std::thread> m_threads;
+    /// Mutex of segment queues and params.
+    std::mutex m_mutex;
+    /// Condition variable of new jobs.
+    std::condition_variable m_jobCond;
+    /// Condition variable of encoded segments.
+    std::condition_variable m_doneCond;
+    /// Condition variable of free segments.
+    std::condition_variable m_freeCond;
+    /// Stop flag of worker threads.
+    bool m_stop{false};
+
+    /**
+     * @brief Take free or new segment. Waits if max number of segments is
+     * reached. Must be called under lock.
+     * @param lock Lock of mutex.
+     * @return Segment or nullptr if encoder is stopped.
+     */
+    Segment* takeSegment(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * @brief Pass current segment to worker threads. Must be called under
+     * lock.
+     */
+    void pushCurrent();
+
+    /**
+     * @brief Worker thread function.
+     */
+    void workerThreadFunc();
+
+    /**
+     * @brief Encode segment by encoder of worker thread.
+     * @param codec Encoder. Encoder is flushed after the segment.
+     * @param packet Encoded frame buffer of worker thread.
+     * @param segment Segment.
+     */
+    void encodeSegment(VideoCodec& codec, cr::video::Frame& packet, Segment& segment);
+};
@@ -0,0 +1,187 @@
+#include "VideoCodecLadder.h"
+
+
+
+VideoCodecLadder::~VideoCodecLadder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobCond.notify_all();
+    for (std::thread &thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+int VideoCodecLadder::addRendition(int width, int height, int bitrate, cr::video::Fourcc fourcc)
+{
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC && fourcc != cr::video::Fourcc::JPEG)
+    {
+        std::cout << "Invalid pixel format" << std::endl;
+        return -1;
+    }
+    if (width <= 0 || height <= 0 || width % 2 != 0 || height % 2 != 0)
+    {
+        std::cout << "Invalid rendition size" << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<Rendition> rendition(new Rendition());
+    rendition->fourcc = fourcc;
+    rendition->frame = cr::video::Frame(width, height, cr::video::Fourcc::YU12);
+    rendition->codec.setAllocator(m_buffers);
+    if (bitrate > 0 && !rendition->codec.setParam(VideoCodecParam::BITRATE, static_cast<float>(bitrate)))
+    {
+        std::cout << "Invalid rendition bitrate" << std::endl;
+        return -1;
+    }
+
+    m_renditions.push_back(std::move(rendition));
+    m_scaledFrames.reserve(m_renditions.size());
+
+    return static_cast<int>(m_renditions.size()) - 1;
+}
+
+int VideoCodecLadder::getNumRenditions()
+{
+    return static_cast<int>(m_renditions.size());
+}
+
+bool VideoCodecLadder::setParam(int index, VideoCodecParam id, float value)
+{
+    if (index < 0 || index >= static_cast<int>(m_renditions.size()))
+    {
+        return false;
+    }
+
+    return m_renditions[index]->codec.setParam(id, value);
+}
+
+float VideoCodecLadder::getParam(int index, VideoCodecParam id)
+{
+    if (index < 0 || index >= static_cast<int>(m_renditions.size()))
+    {
+        return -1.0f;
+    }
+
+    return m_renditions[index]->codec.getParam(id);
+}
+
+bool VideoCodecLadder::getStats(int index, VideoCodecStats &stats)
+{
+    if (index < 0 || index >= static_cast<int>(m_renditions.size()))
+    {
+        return false;
+    }
+
+    stats = m_renditions[index]->codec.getStats();
+    return true;
+}
+
+bool VideoCodecLadder::encode(cr::video::Frame &src, std::vector<cr::video::Frame> &dst)
+{
+    if (m_renditions.empty())
+    {
+        std::cout << "No renditions" << std::endl;
+        return false;
+    }
+
+    // Renditions of source size are encoded from source, others are
+    // downscaled in one pass.
+    m_scaledFrames.clear();
+    for (auto &rendition : m_renditions)
+    {
+        if (rendition->frame.width > src.width || rendition->frame.height > src.height)
+        {
+            std::cout << "Rendition is bigger than source" << std::endl;
+            return false;
+        }
+        if (rendition->frame.width == src.width && rendition->frame.height == src.height)
+        {
+            rendition->src = &src;
+        }
+        else
+        {
+            rendition->src = &rendition->frame;
+            m_scaledFrames.push_back(&rendition->frame);
+        }
+    }
+    if (!m_scaledFrames.empty() &&
+        !m_converter.downscale(src, m_scaledFrames.data(), static_cast<int>(m_scaledFrames.size())))
+    {
+        return false;
+    }
+
+    // Encoder detects codec type by destination frame fourcc.
+    dst.resize(m_renditions.size());
+    for (size_t i = 0; i < m_renditions.size(); ++i)
+    {
+        Rendition &rendition = *m_renditions[i];
+        if (dst[i].fourcc != rendition.fourcc)
+        {
+            dst[i] = cr::video::Frame(rendition.frame.width, rendition.frame.height, rendition.fourcc);
+        }
+        rendition.dst = &dst[i];
+    }
+
+    // Start threads of added renditions.
+    for (size_t i = m_threads.size() + 1; i < m_renditions.size(); ++i)
+    {
+        m_threads.emplace_back(&VideoCodecLadder::threadFunc, this, i, m_job);
+    }
+
+    // Encode first rendition in calling thread, others in parallel.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending = static_cast<int>(m_renditions.size()) - 1;
+        ++m_job;
+    }
+    m_jobCond.notify_all();
+    Rendition &first = *m_renditions[0];
+    first.result = first.codec.encode(*first.src, *first.dst);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCond.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    bool result = true;
+    for (auto &rendition : m_renditions)
+    {
+        if (!rendition->result)
+        {
+            rendition->dst->size = 0;
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+void VideoCodecLadder::threadFunc(size_t index, uint64_t job)
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobCond.wait(lock, [this, job] { return m_stop || m_job != job; });
+            if (m_stop)
+            {
+                return;
+            }
+            job = m_job;
+        }
+
+        Rendition &rendition = *m_renditions[index];
+        rendition.result = rendition.codec.encode(*rendition.src, *rendition.dst);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0)
+            {
+                m_doneCond.notify_one();
+            }
+        }
+    }
+}
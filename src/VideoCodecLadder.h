@@ -0,0 +1,141 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "VideoCodec.h"
+#include "ColorConverter.h"
+
+
+
+/**
+ * @brief Encoding of one source to several renditions of different size and
+ * bitrate (simulcast ladder). Source is downscaled to all rendition sizes in
+ * one pass, renditions are encoded in parallel. Methods must be called from
+ * one thread.
+ */
+class VideoCodecLadder
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     */
+    VideoCodecLadder() = default;
+
+    /**
+     * @brief Class destructor. Stops encoding threads.
+     */
+    ~VideoCodecLadder();
+
+    /**
+     * @brief Video codec ladder is not copyable.
+     */
+    VideoCodecLadder(VideoCodecLadder&) = delete;
+    void operator=(VideoCodecLadder&) = delete;
+
+    /**
+     * @brief Add rendition.
+     * @param width Rendition width. Must be even and not bigger than source.
+     * @param height Rendition height. Must be even and not bigger than source.
+     * @param bitrate Target bitrate, bps. 0 - BITRATE param is not changed.
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @return Rendition index or -1 in case of error.
+     */
+    int addRendition(int width, int height, int bitrate = 0,
+                     cr::video::Fourcc fourcc = cr::video::Fourcc::H264);
+
+    /**
+     * @brief Get number of renditions.
+     * @return Number of renditions.
+     */
+    int getNumRenditions();
+
+    /**
+     * @brief Set codec parameter of rendition.
+     * @param index Rendition index.
+     * @param id Parameter ID.
+     * @param value Parameter value.
+     * @return TRUE if the parameter was set or FALSE.
+     */
+    bool setParam(int index, VideoCodecParam id, float value);
+
+    /**
+     * @brief Get codec parameter of rendition.
+     * @param index Rendition index.
+     * @param id Parameter ID.
+     * @return Parameter value or -1 if rendition doesn't exist.
+     */
+    float getParam(int index, VideoCodecParam id);
+
+    /**
+     * @brief Get codec statistics of rendition.
+     * @param index Rendition index.
+     * @param stats Codec statistics.
+     * @return TRUE if the rendition exists or FALSE.
+     */
+    bool getStats(int index, VideoCodecStats& stats);
+
+    /**
+     * @brief Encode frame to all renditions.
+     * @param src Source frame: YU12, NV12 or NV21.
+     * @param dst Encoded frames, one per rendition in order of adding. Vector
+     * is resized to number of renditions. Frame size is 0 if encoder delayed
+     * output.
+     * @return TRUE if all renditions were encoded or FALSE.
+     */
+    bool encode(cr::video::Frame& src, std::vector<cr::video::Frame>& dst);
+
+private:
+
+    /**
+     * @brief Rendition encoder.
+     */
+    struct Rendition
+    {
+        /// Encoder.
+        VideoCodec codec;
+        /// Codec type.
+        cr::video::Fourcc fourcc{cr::video::Fourcc::H264};
+        /// Downscaled source frame.
+        cr::video::Frame frame;
+        /// Frame to encode: downscaled frame or source of same size.
+        cr::video::Frame* src{nullptr};
+        /// Encoded frame.
+        cr::video::Frame* dst{nullptr};
+        /// Encoding result.
+        bool result{false};
+    };
+
+    /// Renditions.
+    std::vector<std::unique_ptr<Rendition>> m_renditions;
+    /// Downscaled frames of current source.
+    std::vector<cr::video::Frame*> m_scaledFrames;
+    /// Pyramid downscaler.
+    ColorConverter m_converter;
+    /// Buffer pool shared by codecs of all renditions.
+    std::shared_ptr<VideoCodecBufferPool> m_buffers{std::make_shared<VideoCodecBufferPool>()};
+    /// Encoding threads. Thread index + 1 is rendition index, first rendition
+    /// is encoded by calling thread.
+    std::vector<std::thread> m_threads;
+    /// Encoding threads mutex.
+    std::mutex m_mutex;
+    /// Condition variable to start encoding job.
+    std::condition_variable m_jobCond;
+    /// Condition variable of finished renditions.
+    std::condition_variable m_doneCond;
+    /// Encoding job counter.
+    uint64_t m_job{0};
+    /// Number of renditions not encoded yet by threads.
+    int m_pending{0};
+    /// Stop flag of threads.
+    bool m_stop{false};
+
+    /**
+     * @brief Encoding thread function.
+     * @param index Rendition index.
+     * @param job Encoding job at thread start.
+     */
+    void threadFunc(size_t index, uint64_t job);
+};
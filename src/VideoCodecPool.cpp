@@ -0,0 +1,368 @@
+#include "VideoCodecPool.h"
+
+
+
+VideoCodecPool::VideoCodecPool(int numThreads)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (numThreads <= 0)
+        {
+            numThreads = 1;
+        }
+    }
+
+    m_lastStatsTime = Clock::now();
+
+    // One task queue per worker. Workers steal from other queues when idle.
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_queues.emplace_back(new WorkerQueue());
+    }
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_threads.emplace_back(&VideoCodecPool::workerThreadFunc, this, i);
+    }
+}
+
+VideoCodecPool::~VideoCodecPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_stop = true;
+    }
+    m_idleCond.notify_all();
+    for (std::thread &thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+int VideoCodecPool::addStream(cr::video::Fourcc fourcc, VideoCodecPoolCallback callback,
+                              int priority, int deadlineMs)
+{
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC && fourcc != cr::video::Fourcc::JPEG)
+    {
+        std::cout << "Invalid pixel format" << std::endl;
+        return -1;
+    }
+
+    std::shared_ptr<Stream> stream = std::make_shared<Stream>();
+    stream->fourcc = fourcc;
+    stream->callback = callback;
+    stream->priority = priority;
+    stream->deadlineMs = deadlineMs < 0 ? 0 : deadlineMs;
+    // Encoder detects codec type by destination frame fourcc.
+    stream->packet.fourcc = fourcc;
+    stream->lastStatsTime = Clock::now();
+    stream->codec.setAllocator(m_buffers);
+    // Pool encodes streams in parallel: stream encoders are single-threaded
+    // and x265 doesn't create thread pool of all cores per stream. Can be
+    // changed by setParam().
+    stream->codec.setParam(VideoCodecParam::THREAD_MODE, static_cast<float>(VideoCodecThreadMode::SINGLE));
+    stream->codec.setParam(VideoCodecParam::NUM_THREADS, 1);
+    stream->codec.setParam(VideoCodecParam::POOL_THREADS, -1);
+
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    stream->id = m_nextStreamId++;
+    m_streams[stream->id] = stream;
+
+    return stream->id;
+}
+
+bool VideoCodecPool::removeStream(int streamId)
+{
+    std::shared_ptr<Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(m_streamsMutex);
+        auto it = m_streams.find(streamId);
+        if (it == m_streams.end())
+        {
+            return false;
+        }
+        stream = it->second;
+        m_streams.erase(it);
+    }
+
+    // Stream memory is released when last task with the stream is finished.
+    // Counters of removed stream stay in pool statistics, frame in progress
+    // is counted by worker.
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->removed = true;
+    stream->hasPending = false;
+    m_removedEncodedFrames += stream->encodedFrames;
+    m_removedDroppedFrames += stream->droppedFrames;
+    m_removedFailedFrames += stream->failedFrames;
+
+    return true;
+}
+
+bool VideoCodecPool::setParam(int streamId, VideoCodecParam id, float value)
+{
+    std::shared_ptr<Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(m_streamsMutex);
+        auto it = m_streams.find(streamId);
+        if (it == m_streams.end())
+        {
+            return false;
+        }
+        stream = it->second;
+    }
+
+    std::lock_guard<std::mutex> lock(stream->codecMutex);
+    return stream->codec.setParam(id, value);
+}
+
+bool VideoCodecPool::submitFrame(int streamId, cr::video::Frame &src)
+{
+    std::shared_ptr<Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(m_streamsMutex);
+        auto it = m_streams.find(streamId);
+        if (it == m_streams.end())
+        {
+            return false;
+        }
+        stream = it->second;
+    }
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+
+    // Stream is behind: previous frame wasn't started, replace it by newer one.
+    bool replaced = stream->hasPending;
+    if (replaced)
+    {
+        ++stream->droppedFrames;
+    }
+
+    // Worker uses other buffer, pending buffer can be overwritten.
+    stream->frames[stream->pendingIndex] = src;
+    stream->hasPending = true;
+    stream->submitTime = Clock::now();
+
+    if (!stream->scheduled)
+    {
+        stream->scheduled = true;
+        // Same worker for the stream by default to keep encoder data in cache.
+        pushTask(stream, stream->id % static_cast<int>(m_queues.size()));
+    }
+    else if (replaced)
+    {
+        // Queued task is scheduled by deadline of new frame.
+        updateTaskDeadline(stream);
+    }
+
+    return true;
+}
+
+bool VideoCodecPool::getStats(int streamId, VideoCodecPoolStats &stats)
+{
+    std::shared_ptr<Stream> stream;
+    {
+        std::lock_guard<std::mutex> lock(m_streamsMutex);
+        auto it = m_streams.find(streamId);
+        if (it == m_streams.end())
+        {
+            return false;
+        }
+        stream = it->second;
+    }
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stats.encodedFrames = stream->encodedFrames;
+    stats.droppedFrames = stream->droppedFrames;
+    stats.failedFrames = stream->failedFrames;
+
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - stream->lastStatsTime).count();
+    stats.fps = seconds > 0 ? static_cast<float>((stats.encodedFrames - stream->lastEncodedFrames) / seconds) : 0.0f;
+    stream->lastEncodedFrames = stats.encodedFrames;
+    stream->lastStatsTime = now;
+
+    return true;
+}
+
+VideoCodecPoolStats VideoCodecPool::getStats()
+{
+    VideoCodecPoolStats stats;
+
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    stats.encodedFrames = m_removedEncodedFrames;
+    stats.droppedFrames = m_removedDroppedFrames;
+    stats.failedFrames = m_removedFailedFrames;
+    for (auto &item : m_streams)
+    {
+        stats.encodedFrames += item.second->encodedFrames;
+        stats.droppedFrames += item.second->droppedFrames;
+        stats.failedFrames += item.second->failedFrames;
+    }
+
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - m_lastStatsTime).count();
+    if (seconds > 0 && stats.encodedFrames >= m_lastEncodedFrames)
+    {
+        stats.fps = static_cast<float>((stats.encodedFrames - m_lastEncodedFrames) / seconds);
+    }
+    m_lastEncodedFrames = stats.encodedFrames;
+    m_lastStatsTime = now;
+
+    return stats;
+}
+
+int VideoCodecPool::getNumThreads()
+{
+    return static_cast<int>(m_threads.size());
+}
+
+VideoCodecPool::Clock::time_point VideoCodecPool::getDeadline(const Stream &stream)
+{
+    return stream.deadlineMs > 0 ? stream.submitTime + std::chrono::milliseconds(stream.deadlineMs) :
+                                   Clock::time_point::max();
+}
+
+void VideoCodecPool::pushTask(const std::shared_ptr<Stream> &stream, int index)
+{
+    Task task;
+    task.stream = stream;
+    task.priority = stream->priority;
+    task.deadline = getDeadline(*stream);
+    stream->queueIndex = index;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(task);
+    }
+
+    // Lock guarantees that idle worker doesn't miss notification.
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        ++m_numTasks;
+    }
+    m_idleCond.notify_one();
+}
+
+void VideoCodecPool::updateTaskDeadline(const std::shared_ptr<Stream> &stream)
+{
+    WorkerQueue &queue = *m_queues[stream->queueIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    for (Task &task : queue.tasks)
+    {
+        if (task.stream == stream)
+        {
+            task.deadline = getDeadline(*stream);
+            return;
+        }
+    }
+}
+
+bool VideoCodecPool::popTask(int index, Task &task)
+{
+    WorkerQueue &queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+    {
+        return false;
+    }
+
+    // Highest priority first, earliest deadline among equal priorities.
+    auto best = queue.tasks.begin();
+    for (auto it = queue.tasks.begin() + 1; it != queue.tasks.end(); ++it)
+    {
+        if (it->priority > best->priority ||
+            (it->priority == best->priority && it->deadline < best->deadline))
+        {
+            best = it;
+        }
+    }
+    task = *best;
+    queue.tasks.erase(best);
+    --m_numTasks;
+
+    return true;
+}
+
+void VideoCodecPool::workerThreadFunc(int index)
+{
+    int numQueues = static_cast<int>(m_queues.size());
+    while (!m_stop)
+    {
+        // Own queue first, then steal from other workers.
+        Task task;
+        bool found = popTask(index, task);
+        for (int i = 1; !found && i < numQueues; ++i)
+        {
+            found = popTask((index + i) % numQueues, task);
+        }
+
+        if (!found)
+        {
+            std::unique_lock<std::mutex> lock(m_idleMutex);
+            m_idleCond.wait(lock, [this]{ return m_stop || m_numTasks > 0; });
+            continue;
+        }
+
+        runStream(task.stream, index);
+    }
+}
+
+void VideoCodecPool::runStream(const std::shared_ptr<Stream> &stream, int index)
+{
+    int frameIndex = 0;
+    bool late = false;
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (stream->removed || !stream->hasPending)
+        {
+            stream->scheduled = false;
+            return;
+        }
+
+        // Take pending frame, new frames go to other buffer.
+        frameIndex = stream->pendingIndex;
+        stream->pendingIndex ^= 1;
+        stream->hasPending = false;
+
+        late = stream->deadlineMs > 0 &&
+               Clock::now() - stream->submitTime > std::chrono::milliseconds(stream->deadlineMs);
+    }
+
+    bool result = false;
+    if (!late)
+    {
+        {
+            std::lock_guard<std::mutex> lock(stream->codecMutex);
+            result = stream->codec.encode(stream->frames[frameIndex], stream->packet);
+        }
+        if (result && stream->packet.size > 0 && stream->callback)
+        {
+            stream->callback(stream->id, stream->packet);
+        }
+    }
+
+    // Frame is counted under stream lock: stream removed during encoding is
+    // already added to pool statistics.
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (late)
+    {
+        ++(stream->removed ? m_removedDroppedFrames : stream->droppedFrames);
+    }
+    else if (!result)
+    {
+        ++(stream->removed ? m_removedFailedFrames : stream->failedFrames);
+    }
+    else
+    {
+        ++(stream->removed ? m_removedEncodedFrames : stream->encodedFrames);
+    }
+
+    // Re-schedule stream if new frame arrived during encoding.
+    if (stream->hasPending && !stream->removed)
+    {
+        pushTask(stream, index);
+    }
+    else
+    {
+        stream->scheduled = false;
+    }
+}
@@ -0,0 +1,265 @@
+#pragma once
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "VideoCodec.h"
+
+
+
+/**
+ * @brief Encoded packet callback: stream ID and encoded frame.
+ */
+typedef std::function<void(int streamId, cr::video::Frame& packet)> VideoCodecPoolCallback;
+
+
+
+/**
+ * @brief Encoding statistics of stream or whole pool.
+ */
+struct VideoCodecPoolStats
+{
+    /// Number of encoded frames.
+    uint64_t encodedFrames{0};
+    /// Number of dropped frames (overwritten by newer frame or deadline missed).
+    uint64_t droppedFrames{0};
+    /// Number of frames failed to encode.
+    uint64_t failedFrames{0};
+    /// Encoded frames per second since previous getStats() call.
+    float fps{0.0f};
+};
+
+
+
+/**
+ * @brief Pool of encoding sessions (streams) sharing one work-stealing thread
+ * pool. Each stream is encoded by one thread at a time, streams run in
+ * parallel. If stream is behind, only the newest submitted frame is kept.
+ */
+class VideoCodecPool
+{
+public:
+
+    /**
+     * @brief Class constructor. Starts worker threads.
+     * @param numThreads Number of worker threads. 0 - number of CPU cores.
+     */
+    VideoCodecPool(int numThreads = 0);
+
+    /**
+     * @brief Class destructor. Stops worker threads, pending frames are lost.
+     */
+    ~VideoCodecPool();
+
+    /**
+     * @brief Video codec pool is not copyable.
+     */
+    VideoCodecPool(VideoCodecPool&) = delete;
+    void operator=(VideoCodecPool&) = delete;
+
+    /**
+     * @brief Add encoding stream.
+     * @param fourcc Codec type: H264, HEVC or JPEG.
+     * @param callback Encoded packet callback. Called from worker thread.
+     * @param priority Stream priority. Higher value - scheduled first.
+     * @param deadlineMs Max time from submit to encoding start. Frames which
+     * miss deadline are dropped. 0 - no deadline.
+     * @return Stream ID or -1 in case of error.
+     */
+    int addStream(cr::video::Fourcc fourcc, VideoCodecPoolCallback callback,
+                  int priority = 0, int deadlineMs = 0);
+
+    /**
+     * @brief Remove stream. Frame in progress is finished, pending frame is
+     * dropped.
+     * @param streamId Stream ID.
+     * @return TRUE if the stream was removed or FALSE if not exists.
+     */
+    bool removeStream(int streamId);
+
+    /**
+     * @brief Set codec parameter of stream.
+     * @param streamId Stream ID.
+     * @param id Parameter ID.
+     * @param value Parameter value.
+     * @return TRUE if the parameter was set or FALSE.
+     */
+    bool setParam(int streamId, VideoCodecParam id, float value);
+
+    /**
+     * @brief Submit frame to stream. Frame is copied, method doesn't wait for
+     * encoding. Not encoded previous frame of the stream is dropped.
+     * @param streamId Stream ID.
+     * @param src Source frame.
+     * @return TRUE if the frame was queued or FALSE if stream doesn't exist.
+     */
+    bool submitFrame(int streamId, cr::video::Frame& src);
+
+    /**
+     * @brief Get statistics of stream.
+     * @param streamId Stream ID.
+     * @param stats Stream statistics.
+     * @return TRUE if the stream exists or FALSE.
+     */
+    bool getStats(int streamId, VideoCodecPoolStats& stats);
+
+    /**
+     * @brief Get aggregate statistics of all streams. Counters of removed
+     * streams are kept.
+     * @return Pool statistics.
+     */
+    VideoCodecPoolStats getStats();
+
+    /**
+     * @brief Get number of worker threads.
+     * @return Number of worker threads.
+     */
+    int getNumThreads();
+
+private:
+
+    /// Clock type.
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @brief Encoding stream.
+     */
+    struct Stream
+    {
+        /// Stream ID.
+        int id{-1};
+        /// Codec type.
+        cr::video::Fourcc fourcc{cr::video::Fourcc::H264};
+        /// Encoder. Used only by worker which runs the stream.
+        VideoCodec codec;
+        /// Encoder mutex. Protects encoder from setParam() during encoding.
+        std::mutex codecMutex;
+        /// Encoded packet callback.
+        VideoCodecPoolCallback callback;
+        /// Priority.
+        int priority{0};
+        /// Deadline in milliseconds.
+        int deadlineMs{0};
+        /// Stream mutex. Protects fields below.
+        std::mutex mutex;
+        /// Double buffer: pending frame and frame in progress.
+        cr::video::Frame frames[2];
+        /// Index of pending frame.
+        int pendingIndex{0};
+        /// Pending frame flag.
+        bool hasPending{false};
+        /// Submit time of pending frame.
+        Clock::time_point submitTime;
+        /// Stream is in task queue or is being encoded.
+        bool scheduled{false};
+        /// Index of worker queue of last stream task.
+        int queueIndex{0};
+        /// Stream removed flag.
+        bool removed{false};
+        /// Encoded packet.
+        cr::video::Frame packet;
+        /// Statistics.
+        std::atomic<uint64_t> encodedFrames{0};
+        std::atomic<uint64_t> droppedFrames{0};
+        std::atomic<uint64_t> failedFrames{0};
+        /// Encoded frames and time of previous stats request.
+        uint64_t lastEncodedFrames{0};
+        Clock::time_point lastStatsTime;
+    };
+
+    /**
+     * @brief Task in worker queue.
+     */
+    struct Task
+    {
+        /// Stream to encode.
+        std::shared_ptr<Stream> stream;
+        /// Stream priority.
+        int priority{0};
+        /// Time when pending frame must be started.
+        Clock::time_point deadline;
+    };
+
+    /**
+     * @brief Worker task queue.
+     */
+    struct WorkerQueue
+    {
+        /// Queue mutex.
+        std::mutex mutex;
+        /// Tasks.
+        std::deque<Task> tasks;
+    };
+
+    /// Streams.
+    std::map<int, std::shared_ptr<Stream>> m_streams;
+    /// Streams mutex.
+    std::mutex m_streamsMutex;
+    /// Next stream ID.
+    int m_nextStreamId{0};
+    /// Buffer pool shared by codecs of all streams.
+    std::shared_ptr<VideoCodecBufferPool> m_buffers{std::make_shared<VideoCodecBufferPool>()};
+    /// Worker queues. One per worker thread.
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    /// Worker threads.
+    std::vector<std::thread> m_threads;
+    /// Number of tasks in all queues.
+    std::atomic<int> m_numTasks{0};
+    /// Stop flag.
+    std::atomic<bool> m_stop{false};
+    /// Mutex for idle workers.
+    std::mutex m_idleMutex;
+    /// Condition variable for idle workers.
+    std::condition_variable m_idleCond;
+    /// Statistics of removed streams.
+    std::atomic<uint64_t> m_removedEncodedFrames{0};
+    std::atomic<uint64_t> m_removedDroppedFrames{0};
+    std::atomic<uint64_t> m_removedFailedFrames{0};
+    /// Pool statistics: frames count and time of previous request.
+    uint64_t m_lastEncodedFrames{0};
+    Clock::time_point m_lastStatsTime;
+
+    /**
+     * @brief Worker thread function.
+     * @param index Worker index.
+     */
+    void workerThreadFunc(int index);
+
+    /**
+     * @brief Get time when pending frame of stream must be started.
+     * @param stream Stream. Called under stream lock.
+     * @return Deadline or max time point if stream has no deadline.
+     */
+    Clock::time_point getDeadline(const Stream& stream);
+
+    /**
+     * @brief Put stream task to worker queue and wake up idle worker.
+     * @param stream Stream.
+     * @param index Worker queue index.
+     */
+    void pushTask(const std::shared_ptr<Stream>& stream, int index);
+
+    /**
+     * @brief Set deadline of queued stream task to deadline of new pending
+     * frame. Does nothing if the task was already taken by worker.
+     * @param stream Stream.
+     */
+    void updateTaskDeadline(const std::shared_ptr<Stream>& stream);
+
+    /**
+     * @brief Take most urgent task from worker queue.
+     * @param index Worker queue index.
+     * @param task Task.
+     * @return TRUE if the task was taken or FALSE if queue is empty.
+     */
+    bool popTask(int index, Task& task);
+
+    /**
+     * @brief Encode pending frame of stream.
+     * @param stream Stream.
+     * @param index Worker index.
+     */
+    void runStream(const std::shared_ptr<Stream>& stream, int index);
+};
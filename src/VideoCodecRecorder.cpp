@@ -0,0 +1,608 @@
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#if defined(_WIN32)
+    #include <io.h>
+    #include <malloc.h>
+    #include <sys/stat.h>
+#else
+    #include <unistd.h>
+    #include <stdlib.h>
+#endif
+#include "VideoCodecRecorder.h"
+
+
+
+/// Alignment of write buffers, sizes and offsets for O_DIRECT.
+static const size_t g_ioAlignment = 4096;
+/// Size of libav I/O buffer.
+static const int g_avioBufferSize = 65536;
+
+
+
+static uint8_t* allocateAligned(size_t size)
+{
+#if defined(_WIN32)
+    return static_cast<uint8_t*>(_aligned_malloc(size, g_ioAlignment));
+#else
+    void* data = nullptr;
+    return posix_memalign(&data, g_ioAlignment, size) == 0 ? static_cast<uint8_t*>(data) : nullptr;
+#endif
+}
+
+
+
+static void freeAligned(uint8_t* data)
+{
+#if defined(_WIN32)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+
+
+/**
+ * @brief Open file for writing. O_DIRECT falls back to buffered writes if
+ * file system doesn't support it.
+ */
+static int openFile(const std::string& path, bool& directIo)
+{
+#if defined(_WIN32)
+    directIo = false;
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (directIo)
+    {
+        int fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0)
+        {
+            return fd;
+        }
+        std::cout << "O_DIRECT is not supported, buffered writes are used" << std::endl;
+    }
+#endif
+    directIo = false;
+    return ::open(path.c_str(), flags, 0644);
+#endif
+}
+
+
+
+/**
+ * @brief Write whole data to file.
+ */
+static bool writeFile(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+#if defined(_WIN32)
+        int result = _write(fd, data, static_cast<unsigned int>(size));
+#else
+        ssize_t result = ::write(fd, data, size);
+#endif
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        data += result;
+        size -= static_cast<size_t>(result);
+    }
+    return true;
+}
+
+
+
+static bool syncFile(int fd)
+{
+#if defined(_WIN32)
+    return _commit(fd) == 0;
+#elif defined(__APPLE__)
+    return fsync(fd) == 0;
+#else
+    return fdatasync(fd) == 0;
+#endif
+}
+
+
+
+static void closeFile(int fd)
+{
+#if defined(_WIN32)
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+
+
+/**
+ * @brief Split Annex-B data to NAL units.
+ */
+static void splitNals(const uint8_t* data, int size, bool hevc, std::vector<VideoCodecNal>& nals)
+{
+    nals.clear();
+    int start = -1;
+    for (int i = 0; i + 2 < size; ++i)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            continue;
+        }
+        // 4 byte start code belongs to next NAL unit.
+        int codeStart = i > 0 && data[i - 1] == 0 ? i - 1 : i;
+        if (start >= 0)
+        {
+            nals.back().size = codeStart - start;
+        }
+        start = codeStart;
+        int header = i + 3 < size ? data[i + 3] : 0;
+        nals.push_back({data + start, size - start, hevc ? (header >> 1) & 0x3F : header & 0x1F});
+        i += 2;
+    }
+}
+
+
+
+VideoCodecRecorder::~VideoCodecRecorder()
+{
+    close();
+}
+
+bool VideoCodecRecorder::open(const std::string &path, cr::video::Fourcc fourcc, int width, int height,
+                              float fps, const VideoCodecRecorderParams &params)
+{
+    close();
+
+    if (fourcc != cr::video::Fourcc::H264 && fourcc != cr::video::Fourcc::HEVC)
+    {
+        std::cout << "Invalid pixel format" << std::endl;
+        return false;
+    }
+    if (path.empty() || width <= 0 || height <= 0 || fps <= 0.0f ||
+        params.bufferSize <= 0 || params.numBuffers < 2 || params.segmentDuration < 0.0f || params.bFrames < 0)
+    {
+        std::cout << "Invalid recording parameters" << std::endl;
+        return false;
+    }
+
+    m_params = params;
+    m_path = path;
+    m_fourcc = fourcc;
+    m_width = width;
+    m_height = height;
+    m_fps = fps;
+    m_extradata.clear();
+    m_segmentIndex = 0;
+
+    // Full buffers are multiple of alignment to keep O_DIRECT file offsets
+    // aligned.
+    m_bufferSize = (static_cast<size_t>(params.bufferSize) + g_ioAlignment - 1) / g_ioAlignment * g_ioAlignment;
+    for (int i = 0; i < params.numBuffers; ++i)
+    {
+        uint8_t *buffer = allocateAligned(m_bufferSize);
+        if (buffer == nullptr)
+        {
+            std::cout << "Can't allocate write buffers" << std::endl;
+            for (uint8_t *data : m_buffers)
+            {
+                freeAligned(data);
+            }
+            m_buffers.clear();
+            return false;
+        }
+        m_buffers.push_back(buffer);
+    }
+    m_freeBuffers.assign(m_buffers.begin() + 1, m_buffers.end());
+    m_buffer = m_buffers[0];
+    m_bufferUsed = 0;
+
+    m_packet = av_packet_alloc();
+    m_stop = false;
+    m_thread = std::thread(&VideoCodecRecorder::ioThreadFunc, this);
+    m_open = true;
+
+    return true;
+}
+
+bool VideoCodecRecorder::write(cr::video::Frame &packet)
+{
+    splitNals(packet.data, packet.size, m_fourcc == cr::video::Fourcc::HEVC, m_nals);
+    return write(m_nals, packet.frameId);
+}
+
+bool VideoCodecRecorder::write(const std::vector<VideoCodecNal> &nals, uint32_t frameId)
+{
+    if (!m_open)
+    {
+        std::cout << "Recording is not open" << std::endl;
+        return false;
+    }
+    if (nals.empty())
+    {
+        return true;
+    }
+
+    // Key frame and parameter sets: H264 IDR, SPS, PPS; HEVC IRAP, VPS, SPS, PPS.
+    bool hevc = m_fourcc == cr::video::Fourcc::HEVC;
+    bool key = false;
+    bool hasParams = false;
+    bool contiguous = true;
+    for (size_t i = 0; i < nals.size(); ++i)
+    {
+        int type = nals[i].type;
+        key |= hevc ? (type >= 16 && type <= 21) : type == 5;
+        hasParams |= hevc ? (type >= 32 && type <= 34) : (type == 7 || type == 8);
+        contiguous &= i == 0 || nals[i - 1].data + nals[i - 1].size == nals[i].data;
+    }
+    if (key && hasParams)
+    {
+        m_extradata.clear();
+        for (const VideoCodecNal &nal : nals)
+        {
+            if (hevc ? (nal.type >= 32 && nal.type <= 34) : (nal.type == 7 || nal.type == 8))
+            {
+                m_extradata.insert(m_extradata.end(), nal.data, nal.data + nal.size);
+            }
+        }
+    }
+
+    if (m_context == nullptr)
+    {
+        // Stream starts from key frame with parameter sets.
+        if (!key || m_extradata.empty())
+        {
+            ++m_skippedPackets;
+            return true;
+        }
+        m_firstFrameId = frameId;
+        m_segmentPts = 0;
+        m_reorderPts.clear();
+        if (!startSegment())
+        {
+            return false;
+        }
+    }
+
+    // Decoding timestamp is the lowest timestamp of reordering window of
+    // bFrames + 1 packets, so it doesn't exceed pts when frame IDs have gaps.
+    // Timestamps of the first packets are delayed by missing packets.
+    int64_t pts = static_cast<int64_t>(static_cast<uint32_t>(frameId - m_firstFrameId));
+    m_reorderPts.insert(std::upper_bound(m_reorderPts.begin(), m_reorderPts.end(), pts), pts);
+    int64_t dts = m_reorderPts.front() - (m_params.bFrames + 1 - static_cast<int64_t>(m_reorderPts.size()));
+    if (static_cast<int>(m_reorderPts.size()) > m_params.bFrames)
+    {
+        m_reorderPts.erase(m_reorderPts.begin());
+    }
+    if (key && m_params.segmentDuration > 0.0f &&
+        pts - m_segmentPts >= static_cast<int64_t>(m_params.segmentDuration * m_fps))
+    {
+        finishSegment(true);
+        ++m_segmentIndex;
+        m_segmentPts = pts;
+        if (!startSegment())
+        {
+            return false;
+        }
+    }
+
+    // Encoder NAL units are usually contiguous and are passed without copy.
+    // Each MPEG-TS key frame must carry parameter sets (x265 writes them only
+    // to the first key frame by default), so segments are decodable alone.
+    const uint8_t *data = nals[0].data;
+    size_t size = static_cast<size_t>(nals.back().data + nals.back().size - data);
+    bool addParams = key && !hasParams && m_params.container == VideoCodecContainer::MPEGTS;
+    if (!contiguous || addParams)
+    {
+        m_packetData.clear();
+        if (addParams)
+        {
+            m_packetData.insert(m_packetData.end(), m_extradata.begin(), m_extradata.end());
+        }
+        for (const VideoCodecNal &nal : nals)
+        {
+            m_packetData.insert(m_packetData.end(), nal.data, nal.data + nal.size);
+        }
+        data = m_packetData.data();
+        size = m_packetData.size();
+    }
+
+    // Timestamps of segment start from the first packet of segment.
+    AVRational frameBase = {1000, static_cast<int>(m_fps * 1000.0f + 0.5f)};
+    AVStream *stream = m_context->streams[0];
+    av_packet_unref(m_packet);
+    m_packet->data = const_cast<uint8_t*>(data);
+    m_packet->size = static_cast<int>(size);
+    m_packet->stream_index = 0;
+    m_packet->flags = key ? AV_PKT_FLAG_KEY : 0;
+    m_packet->pts = av_rescale_q(pts - m_segmentPts, frameBase, stream->time_base);
+    m_packet->dts = av_rescale_q(dts - m_segmentPts, frameBase, stream->time_base);
+    m_packet->duration = av_rescale_q(1, frameBase, stream->time_base);
+    if (av_write_frame(m_context, m_packet) < 0)
+    {
+        std::cout << "Can't write packet" << std::endl;
+        return false;
+    }
+
+    ++m_packets;
+
+    return true;
+}
+
+void VideoCodecRecorder::close()
+{
+    if (!m_open)
+    {
+        return;
+    }
+
+    if (m_context != nullptr)
+    {
+        finishSegment(true);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobCond.notify_one();
+    m_thread.join();
+
+    for (uint8_t *buffer : m_buffers)
+    {
+        freeAligned(buffer);
+    }
+    m_buffers.clear();
+    m_freeBuffers.clear();
+    m_buffer = nullptr;
+    av_packet_free(&m_packet);
+    m_open = false;
+}
+
+bool VideoCodecRecorder::isOpen()
+{
+    return m_open;
+}
+
+VideoCodecRecorderStats VideoCodecRecorder::getStats()
+{
+    VideoCodecRecorderStats stats;
+    stats.packets = m_packets;
+    stats.skippedPackets = m_skippedPackets;
+    stats.bytesWritten = m_bytesWritten;
+    stats.segments = m_segments;
+    stats.writeStalls = m_writeStalls;
+    stats.writeErrors = m_writeErrors;
+    return stats;
+}
+
+bool VideoCodecRecorder::startSegment()
+{
+    std::string path = m_path;
+    if (m_params.segmentDuration > 0.0f)
+    {
+        char index[16];
+        snprintf(index, sizeof(index), "_%06d", m_segmentIndex);
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        {
+            dot = path.size();
+        }
+        path.insert(dot, index);
+    }
+
+    const char *format = m_params.container == VideoCodecContainer::FMP4 ? "mp4" : "mpegts";
+    if (avformat_alloc_output_context2(&m_context, nullptr, format, nullptr) < 0 || m_context == nullptr)
+    {
+        std::cout << "Can't create output context" << std::endl;
+        m_context = nullptr;
+        return false;
+    }
+
+    // Muxer writes to write buffers through I/O context without seeking.
+    uint8_t *ioBuffer = static_cast<uint8_t*>(av_malloc(g_avioBufferSize));
+    m_io = avio_alloc_context(ioBuffer, g_avioBufferSize, 1, this, nullptr, writeData, nullptr);
+    if (m_io == nullptr)
+    {
+        std::cout << "Can't create I/O context" << std::endl;
+        av_free(ioBuffer);
+        avformat_free_context(m_context);
+        m_context = nullptr;
+        return false;
+    }
+    m_context->pb = m_io;
+
+    AVStream *stream = avformat_new_stream(m_context, nullptr);
+    stream->time_base = {1, 90000};
+    stream->avg_frame_rate = {static_cast<int>(m_fps * 1000.0f + 0.5f), 1000};
+    AVCodecParameters *codecpar = stream->codecpar;
+    codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    codecpar->codec_id = m_fourcc == cr::video::Fourcc::HEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    codecpar->width = m_width;
+    codecpar->height = m_height;
+    codecpar->extradata = static_cast<uint8_t*>(av_mallocz(m_extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+    memcpy(codecpar->extradata, m_extradata.data(), m_extradata.size());
+    codecpar->extradata_size = static_cast<int>(m_extradata.size());
+
+    // Fragment per key frame, moov without samples is written at start, so
+    // file is playable while recording and after crash.
+    AVDictionary *options = nullptr;
+    if (m_params.container == VideoCodecContainer::FMP4)
+    {
+        av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    }
+
+    pushJob({path, nullptr, 0, false});
+    int result = avformat_write_header(m_context, &options);
+    av_dict_free(&options);
+    if (result < 0)
+    {
+        std::cout << "Can't write container header" << std::endl;
+        finishSegment(false);
+        return false;
+    }
+
+    ++m_segments;
+
+    return true;
+}
+
+void VideoCodecRecorder::finishSegment(bool trailer)
+{
+    if (trailer)
+    {
+        av_write_trailer(m_context);
+    }
+    avio_flush(m_io);
+    av_freep(&m_io->buffer);
+    avio_context_free(&m_io);
+    avformat_free_context(m_context);
+    m_context = nullptr;
+
+    // Last buffer of segment is written even if it isn't full.
+    pushJob({std::string(), m_buffer, m_bufferUsed, true});
+    takeBuffer();
+}
+
+void VideoCodecRecorder::pushJob(IoJob &&job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobCond.notify_one();
+}
+
+void VideoCodecRecorder::takeBuffer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_freeBuffers.empty())
+    {
+        ++m_writeStalls;
+        m_freeCond.wait(lock, [this] { return !m_freeBuffers.empty(); });
+    }
+    m_buffer = m_freeBuffers.back();
+    m_freeBuffers.pop_back();
+    m_bufferUsed = 0;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int VideoCodecRecorder::writeData(void *opaque, const uint8_t *data, int size)
+#else
+int VideoCodecRecorder::writeData(void *opaque, uint8_t *data, int size)
+#endif
+{
+    VideoCodecRecorder *recorder = static_cast<VideoCodecRecorder*>(opaque);
+    int written = 0;
+    while (written < size)
+    {
+        size_t count = std::min(static_cast<size_t>(size - written), recorder->m_bufferSize - recorder->m_bufferUsed);
+        memcpy(recorder->m_buffer + recorder->m_bufferUsed, data + written, count);
+        recorder->m_bufferUsed += count;
+        written += static_cast<int>(count);
+        if (recorder->m_bufferUsed == recorder->m_bufferSize)
+        {
+            recorder->pushJob({std::string(), recorder->m_buffer, recorder->m_bufferUsed, false});
+            recorder->takeBuffer();
+        }
+    }
+    return size;
+}
+
+void VideoCodecRecorder::ioThreadFunc()
+{
+    int fd = -1;
+    bool directIo = false;
+    while (true)
+    {
+        IoJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobCond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty())
+            {
+                break;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        if (!job.path.empty())
+        {
+            if (fd >= 0)
+            {
+                closeFile(fd);
+            }
+            directIo = m_params.directIo;
+            fd = openFile(job.path, directIo);
+            if (fd < 0)
+            {
+                std::cout << "Can't open file " << job.path << std::endl;
+                ++m_writeErrors;
+            }
+        }
+
+        if (job.buffer != nullptr && job.size > 0 && fd >= 0)
+        {
+            size_t aligned = directIo ? job.size / g_ioAlignment * g_ioAlignment : job.size;
+            bool result = writeFile(fd, job.buffer, aligned);
+#if defined(O_DIRECT) && !defined(_WIN32)
+            if (result && aligned < job.size)
+            {
+                // Tail of segment isn't aligned, it is written through page cache.
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                directIo = false;
+                result = writeFile(fd, job.buffer + aligned, job.size - aligned);
+            }
+#endif
+            if (result && m_params.syncPolicy == VideoCodecSyncPolicy::BUFFER)
+            {
+                result = syncFile(fd);
+            }
+            if (result)
+            {
+                m_bytesWritten += job.size;
+            }
+            else
+            {
+                std::cout << "Can't write file" << std::endl;
+                ++m_writeErrors;
+            }
+        }
+
+        if (job.buffer != nullptr)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_freeBuffers.push_back(job.buffer);
+            }
+            m_freeCond.notify_one();
+        }
+
+        if (job.close && fd >= 0)
+        {
+            if (m_params.syncPolicy != VideoCodecSyncPolicy::NONE && !syncFile(fd))
+            {
+                ++m_writeErrors;
+            }
+            closeFile(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0)
+    {
+        closeFile(fd);
+    }
+}
@@ -0,0 +1,280 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "VideoCodec.h"
+
+
+
+/**
+ * @brief Container format of recording.
+ */
+enum class VideoCodecContainer
+{
+    /// Fragmented MP4: fragment per key frame, file is playable while written.
+    FMP4 = 0,
+    /// MPEG transport stream.
+    MPEGTS
+};
+
+
+
+/**
+ * @brief Data sync policy of recording files.
+ */
+enum class VideoCodecSyncPolicy
+{
+    /// No explicit sync, data is written back by OS.
+    NONE = 0,
+    /// fdatasync() when segment file is closed.
+    SEGMENT,
+    /// fdatasync() after each write buffer.
+    BUFFER
+};
+
+
+
+/**
+ * @brief Recording parameters.
+ */
+struct VideoCodecRecorderParams
+{
+    /// Container format.
+    VideoCodecContainer container{VideoCodecContainer::FMP4};
+    /// Segment duration, seconds. New segment file starts from the first key
+    /// frame after duration. 0 - single file.
+    float segmentDuration{0.0f};
+    /// Size of write buffer, bytes. Rounded up to multiple of 4096.
+    int bufferSize{4 * 1024 * 1024};
+    /// Number of write buffers. Writing thread waits if all buffers are
+    /// queued to disk.
+    int numBuffers{4};
+    /// Write full buffers with O_DIRECT (Linux), bypassing page cache.
+    bool directIo{false};
+    /// Data sync policy.
+    VideoCodecSyncPolicy syncPolicy{VideoCodecSyncPolicy::SEGMENT};
+    /// Number of B-frames of encoder (B_FRAMES param). Decoding timestamps
+    /// are delayed by this number of frames.
+    int bFrames{0};
+};
+
+
+
+/**
+ * @brief Recording statistics.
+ */
+struct VideoCodecRecorderStats
+{
+    /// Number of written packets (frames).
+    uint64_t packets{0};
+    /// Number of packets skipped before the first key frame.
+    uint64_t skippedPackets{0};
+    /// Number of bytes written to files.
+    uint64_t bytesWritten{0};
+    /// Number of started segment files.
+    uint64_t segments{0};
+    /// Number of waits for free write buffer (disk is slower than input).
+    uint64_t writeStalls{0};
+    /// Number of failed file operations.
+    uint64_t writeErrors{0};
+};
+
+
+
+/**
+ * @brief Recording of encoded H264 / HEVC stream to fragmented MP4 or MPEG-TS
+ * files. Packets are muxed by libavformat to large aligned buffers, full
+ * buffers are written to disk by background thread, so writing thread
+ * doesn't wait for disk. Methods must be called from one thread.
+ */
+class VideoCodecRecorder
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     */
+    VideoCodecRecorder() = default;
+
+    /**
+     * @brief Class destructor. Closes recording.
+     */
+    ~VideoCodecRecorder();
+
+    /**
+     * @brief Video codec recorder is not copyable.
+     */
+    VideoCodecRecorder(VideoCodecRecorder&) = delete;
+    void operator=(VideoCodecRecorder&) = delete;
+
+    /**
+     * @brief Open recording. Previous recording is closed.
+     * @param path File path. With segments index of segment is added before
+     * extension: "cam.mp4" -> "cam_000000.mp4", "cam_000001.mp4", ...
+     * @param fourcc Codec type: H264 or HEVC.
+     * @param width Frame width.
+     * @param height Frame height.
+     * @param fps Frame rate. Timestamps are frame IDs of packets / fps.
+     * @param params Recording parameters.
+     * @return TRUE if the recording was opened or FALSE.
+     */
+    bool open(const std::string& path, cr::video::Fourcc fourcc, int width, int height,
+              float fps, const VideoCodecRecorderParams& params = VideoCodecRecorderParams());
+
+    /**
+     * @brief Write encoded packet (Annex-B data of encode() output).
+     * Packets before the first key frame are skipped.
+     * @param packet Encoded frame.
+     * @return TRUE if the packet was written or skipped, FALSE in case of error.
+     */
+    bool write(cr::video::Frame& packet);
+
+    /**
+     * @brief Write NAL units of one encoded frame without copy to
+     * intermediate frame (encode() overload with NAL views).
+     * @param nals NAL units of frame.
+     * @param frameId Frame ID (presentation order) of encoded frame.
+     * @return TRUE if the packet was written or skipped, FALSE in case of error.
+     */
+    bool write(const std::vector<VideoCodecNal>& nals, uint32_t frameId);
+
+    /**
+     * @brief Close recording: finish current segment and wait until all
+     * buffers are written.
+     */
+    void close();
+
+    /**
+     * @brief Check if recording is open.
+     * @return TRUE if the recording is open or FALSE.
+     */
+    bool isOpen();
+
+    /**
+     * @brief Get recording statistics.
+     * @return Recording statistics.
+     */
+    VideoCodecRecorderStats getStats();
+
+private:
+
+    /**
+     * @brief Job of writing thread.
+     */
+    struct IoJob
+    {
+        /// Path of file to open before writing. Empty - current file.
+        std::string path;
+        /// Buffer to write or nullptr.
+        uint8_t* buffer{nullptr};
+        /// Size of data in buffer.
+        size_t size{0};
+        /// Close file after writing.
+        bool close{false};
+    };
+
+    /// Recording parameters.
+    VideoCodecRecorderParams m_params;
+    /// File path.
+    std::string m_path;
+    /// Codec type.
+    cr::video::Fourcc m_fourcc{cr::video::Fourcc::H264};
+    /// Frame size.
+    int m_width{0};
+    int m_height{0};
+    /// Frame rate.
+    float m_fps{0.0f};
+    /// Recording is open.
+    bool m_open{false};
+    /// Libav output context of current segment.
+    AVFormatContext* m_context{nullptr};
+    /// Libav I/O context of current segment.
+    AVIOContext* m_io{nullptr};
+    /// Libav packet of written frame.
+    AVPacket* m_packet{nullptr};
+    /// Parameter sets of stream (Annex-B) from the last key frame.
+    std::vector<uint8_t> m_extradata;
+    /// Packet data when NAL units are not contiguous.
+    std::vector<uint8_t> m_packetData;
+    /// NAL units of packet.
+    std::vector<VideoCodecNal> m_nals;
+    /// Frame ID of the first packet.
+    uint32_t m_firstFrameId{0};
+    /// Index of current segment.
+    int m_segmentIndex{0};
+    /// Timestamp of the first packet of segment, frames.
+    int64_t m_segmentPts{0};
+    /// Sorted timestamps of reordering window (up to bFrames packets).
+    std::vector<int64_t> m_reorderPts;
+    /// Write buffers.
+    std::vector<uint8_t*> m_buffers;
+    /// Size of write buffer.
+    size_t m_bufferSize{0};
+    /// Buffer filled by muxer.
+    uint8_t* m_buffer{nullptr};
+    /// Size of data in buffer filled by muxer.
+    size_t m_bufferUsed{0};
+    /// Free buffers.
+    std::vector<uint8_t*> m_freeBuffers;
+    /// Jobs of writing thread.
+    std::deque<IoJob> m_jobs;
+    /// Writing thread.
+    std::thread m_thread;
+    /// Mutex of jobs and free buffers.
+    std::mutex m_mutex;
+    /// Condition variable of new jobs.
+    std::condition_variable m_jobCond;
+    /// Condition variable of free buffers.
+    std::condition_variable m_freeCond;
+    /// Stop flag of writing thread.
+    bool m_stop{false};
+    /// Statistics.
+    std::atomic<uint64_t> m_packets{0};
+    std::atomic<uint64_t> m_skippedPackets{0};
+    std::atomic<uint64_t> m_bytesWritten{0};
+    std::atomic<uint64_t> m_segments{0};
+    std::atomic<uint64_t> m_writeStalls{0};
+    std::atomic<uint64_t> m_writeErrors{0};
+
+    /**
+     * @brief Start new segment: open output context and write header.
+     * @return TRUE if the segment was started or FALSE.
+     */
+    bool startSegment();
+
+    /**
+     * @brief Finish segment: write trailer and queue file close.
+     * @param trailer TRUE - write trailer, FALSE - header was not written.
+     */
+    void finishSegment(bool trailer);
+
+    /**
+     * @brief Queue job to writing thread.
+     * @param job Job.
+     */
+    void pushJob(IoJob&& job);
+
+    /**
+     * @brief Take free buffer for muxer output. Waits if all buffers are
+     * queued to disk.
+     */
+    void takeBuffer();
+
+    /**
+     * @brief Libav I/O write callback: copy muxed data to write buffers.
+     */
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    static int writeData(void* opaque, const uint8_t* data, int size);
+#else
+    static int writeData(void* opaque, uint8_t* data, int size);
+#endif
+
+    /**
+     * @brief Writing thread function.
+     */
+    void ioThreadFunc();
+};
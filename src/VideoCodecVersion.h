@@ -1,7 +1,7 @@
 #pragma once
 
 #define VIDEO_CODEC_MAJOR_VERSION 1
-#define VIDEO_CODEC_MINOR_VERSION 1
-#define VIDEO_CODEC_PATCH_VERSION 1
+#define VIDEO_CODEC_MINOR_VERSION 24
+#define VIDEO_CODEC_PATCH_VERSION 0
 
-#define VIDEO_CODEC_VERSION "1.1.1"
+#define VIDEO_CODEC_VERSION "1.24.0"
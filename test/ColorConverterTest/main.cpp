@@ -0,0 +1,218 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstring>
+#include "ColorConverter.h"
+
+
+
+/// Conversion to check.
+struct Conversion
+{
+    /// Name.
+    const char* name;
+    /// Source format.
+    cr::video::Fourcc src;
+    /// Destination format.
+    cr::video::Fourcc dst;
+};
+
+
+
+/// SIMD instruction sets compared with scalar kernels.
+static const ColorConverterIsa g_isas[] =
+{
+    ColorConverterIsa::SSE41, ColorConverterIsa::AVX2, ColorConverterIsa::NEON
+};
+
+/// Frame sizes: small sizes check tails of vector loops.
+static const int g_sizes[][2] = {{2, 2}, {18, 4}, {46, 6}, {98, 10}, {640, 360}};
+
+
+
+/**
+ * @brief Frame size for given format.
+ * @param fourcc Frame format.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @return Frame size in bytes.
+ */
+int frameSize(cr::video::Fourcc fourcc, int width, int height)
+{
+    switch (fourcc)
+    {
+    case cr::video::Fourcc::BGR24: [[fallthrough]];
+    case cr::video::Fourcc::RGB24: return width * height * 3;
+    case cr::video::Fourcc::YUYV: [[fallthrough]];
+    case cr::video::Fourcc::UYVY: return width * height * 2;
+    default: return width * height * 3 / 2;
+    }
+}
+
+
+
+/**
+ * @brief Fill frame with random data.
+ * @param frame Frame.
+ * @param random Random generator.
+ */
+void fillRandom(cr::video::Frame& frame, std::mt19937& random)
+{
+    for (int i = 0; i < frame.size; ++i)
+    {
+        frame.data[i] = static_cast<uint8_t>(random());
+    }
+}
+
+
+
+/**
+ * @brief Compare conversion results of all supported SIMD kernels with scalar
+ * kernels.
+ * @param conversion Conversion.
+ * @param random Random generator.
+ * @return Number of errors.
+ */
+int testConversion(const Conversion& conversion, std::mt19937& random)
+{
+    int numErrors = 0;
+    for (const auto &size : g_sizes)
+    {
+        int width = size[0];
+        int height = size[1];
+        cr::video::Frame src(width, height, conversion.src, frameSize(conversion.src, width, height));
+        fillRandom(src, random);
+
+        ColorConverter reference;
+        reference.setIsa(ColorConverterIsa::SCALAR);
+        cr::video::Frame expected(width, height, conversion.dst, frameSize(conversion.dst, width, height));
+        if (!reference.convert(src, expected))
+        {
+            std::cout << conversion.name << ": scalar conversion failed at " << width << "x" << height << std::endl;
+            ++numErrors;
+            continue;
+        }
+
+        for (ColorConverterIsa isa : g_isas)
+        {
+            ColorConverter converter;
+            if (!converter.setIsa(isa))
+            {
+                continue;
+            }
+            cr::video::Frame result(width, height, conversion.dst, frameSize(conversion.dst, width, height));
+            if (!converter.convert(src, result) || result.size != expected.size ||
+                memcmp(result.data, expected.data, expected.size) != 0)
+            {
+                std::cout << conversion.name << ": " << ColorConverter::getIsaName(isa)
+                          << " result differs from scalar at " << width << "x" << height << std::endl;
+                ++numErrors;
+            }
+        }
+    }
+
+    std::cout << conversion.name << ": " << (numErrors == 0 ? "OK" : "FAILED") << std::endl;
+    return numErrors;
+}
+
+
+
+/**
+ * @brief Compare downscaling of YU12 frame to ladder of 2/3, 1/3 and 1/4
+ * sizes by all supported SIMD kernels with scalar kernels.
+ * @param random Random generator.
+ * @return Number of errors.
+ */
+int testDownscale(std::mt19937& random)
+{
+    int numErrors = 0;
+    for (const auto &size : g_sizes)
+    {
+        int width = size[0] < 8 ? 8 : size[0];
+        int height = size[1] < 8 ? 8 : size[1];
+        cr::video::Frame src(width, height, cr::video::Fourcc::YU12,
+                             frameSize(cr::video::Fourcc::YU12, width, height));
+        fillRandom(src, random);
+
+        const int ladder[][2] = {{width * 2 / 3 / 2 * 2, height * 2 / 3 / 2 * 2},
+                                 {width / 3 / 2 * 2, height / 3 / 2 * 2},
+                                 {width / 4 / 2 * 2, height / 4 / 2 * 2}};
+        std::vector<cr::video::Frame> expected;
+        std::vector<cr::video::Frame> result;
+        for (const auto &rendition : ladder)
+        {
+            int renditionSize = frameSize(cr::video::Fourcc::YU12, rendition[0], rendition[1]);
+            expected.emplace_back(rendition[0], rendition[1], cr::video::Fourcc::YU12, renditionSize);
+            result.emplace_back(rendition[0], rendition[1], cr::video::Fourcc::YU12, renditionSize);
+        }
+        cr::video::Frame* expectedFrames[3] = {&expected[0], &expected[1], &expected[2]};
+        cr::video::Frame* resultFrames[3] = {&result[0], &result[1], &result[2]};
+
+        ColorConverter reference;
+        reference.setIsa(ColorConverterIsa::SCALAR);
+        if (!reference.downscale(src, expectedFrames, 3))
+        {
+            std::cout << "Downscale: scalar downscaling failed at " << width << "x" << height << std::endl;
+            ++numErrors;
+            continue;
+        }
+
+        for (ColorConverterIsa isa : g_isas)
+        {
+            ColorConverter converter;
+            if (!converter.setIsa(isa))
+            {
+                continue;
+            }
+            bool same = converter.downscale(src, resultFrames, 3);
+            for (int i = 0; same && i < 3; ++i)
+            {
+                same = memcmp(result[i].data, expected[i].data, expected[i].size) == 0;
+            }
+            if (!same)
+            {
+                std::cout << "Downscale: " << ColorConverter::getIsaName(isa)
+                          << " result differs from scalar at " << width << "x" << height << std::endl;
+                ++numErrors;
+            }
+        }
+    }
+
+    std::cout << "YU12 -> YU12 ladder: " << (numErrors == 0 ? "OK" : "FAILED") << std::endl;
+    return numErrors;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    ColorConverter converter;
+    std::cout << "ColorConverter bit-exactness test, ISA: "
+              << ColorConverter::getIsaName(converter.getIsa()) << std::endl;
+
+    const Conversion conversions[] =
+    {
+        {"YU12 -> BGR24", cr::video::Fourcc::YU12, cr::video::Fourcc::BGR24},
+        {"NV12 -> BGR24", cr::video::Fourcc::NV12, cr::video::Fourcc::BGR24},
+        {"NV21 -> RGB24", cr::video::Fourcc::NV21, cr::video::Fourcc::RGB24},
+        {"BGR24 -> YU12", cr::video::Fourcc::BGR24, cr::video::Fourcc::YU12},
+        {"RGB24 -> NV12", cr::video::Fourcc::RGB24, cr::video::Fourcc::NV12},
+        {"BGR24 -> NV21", cr::video::Fourcc::BGR24, cr::video::Fourcc::NV21},
+        {"BGR24 -> RGB24", cr::video::Fourcc::BGR24, cr::video::Fourcc::RGB24},
+        {"NV12 -> YU12", cr::video::Fourcc::NV12, cr::video::Fourcc::YU12},
+        {"YUYV -> YU12", cr::video::Fourcc::YUYV, cr::video::Fourcc::YU12},
+        {"UYVY -> YU12", cr::video::Fourcc::UYVY, cr::video::Fourcc::YU12},
+    };
+
+    std::mt19937 random(12345);
+    int numErrors = 0;
+    for (const Conversion &conversion : conversions)
+    {
+        numErrors += testConversion(conversion, random);
+    }
+    numErrors += testDownscale(random);
+
+    std::cout << (numErrors == 0 ? "Test passed" : "Test failed") << std::endl;
+
+    return numErrors == 0 ? 0 : -1;
+}
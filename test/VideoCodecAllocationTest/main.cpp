@@ -0,0 +1,203 @@
+#include <iostream>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <functional>
+#include "VideoCodec.h"
+
+
+
+/// Number of operator new calls.
+static std::atomic<uint64_t> g_allocations{0};
+
+
+
+void* operator new(size_t size)
+{
+    ++g_allocations;
+    void* data = malloc(size > 0 ? size : 1);
+    if (data == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* data) noexcept
+{
+    free(data);
+}
+
+void operator delete[](void* data) noexcept
+{
+    free(data);
+}
+
+void operator delete(void* data, size_t) noexcept
+{
+    free(data);
+}
+
+void operator delete[](void* data, size_t) noexcept
+{
+    free(data);
+}
+
+
+
+/// Test frame width.
+static const int g_width = 640;
+/// Test frame height.
+static const int g_height = 480;
+/// Number of frames before measurement.
+static const int g_warmUpFrames = 50;
+/// Number of measured frames.
+static const int g_testFrames = 100;
+
+
+
+/**
+ * @brief Draw moving gradient to YU12 frame.
+ * @param frame Frame.
+ * @param index Frame index.
+ */
+void drawFrame(cr::video::Frame& frame, int index)
+{
+    int ySize = frame.width * frame.height;
+    for (int y = 0; y < frame.height; ++y)
+    {
+        for (int x = 0; x < frame.width; ++x)
+        {
+            frame.data[y * frame.width + x] = static_cast<uint8_t>(x + y + index * 4);
+        }
+    }
+    memset(frame.data + ySize, 128, ySize / 2);
+    frame.frameId = static_cast<uint32_t>(index);
+}
+
+
+
+/**
+ * @brief Run test case: warm up, then count allocations of measured frames.
+ * Case must not allocate memory by operator new and must not allocate new
+ * buffers from codec buffer pool after warm-up.
+ * @param name Test case name.
+ * @param pool Buffer pool of codecs.
+ * @param step Processing of one frame.
+ * @return TRUE if there were no allocations or FALSE.
+ */
+bool runCase(const char* name, std::shared_ptr<VideoCodecBufferPool> pool,
+             std::function<bool(int)> step)
+{
+    for (int i = 0; i < g_warmUpFrames; ++i)
+    {
+        if (!step(i))
+        {
+            std::cout << name << ": processing failed" << std::endl;
+            return false;
+        }
+    }
+
+    uint64_t allocations = g_allocations;
+    uint64_t heapAllocations = pool->getHeapAllocations();
+    for (int i = g_warmUpFrames; i < g_warmUpFrames + g_testFrames; ++i)
+    {
+        if (!step(i))
+        {
+            std::cout << name << ": processing failed" << std::endl;
+            return false;
+        }
+    }
+    allocations = g_allocations - allocations;
+    heapAllocations = pool->getHeapAllocations() - heapAllocations;
+
+    bool result = allocations == 0 && heapAllocations == 0;
+    std::cout << name << ": " << allocations << " operator new calls, " << heapAllocations
+              << " pool heap allocations per " << g_testFrames << " frames - "
+              << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Encode and decode test case.
+ * @param name Test case name.
+ * @param fourcc Codec type.
+ * @param threads Number of JPEG encoder threads.
+ * @return TRUE if there were no allocations and frames were decoded or FALSE.
+ */
+bool testCodec(const char* name, cr::video::Fourcc fourcc, int threads)
+{
+    std::shared_ptr<VideoCodecBufferPool> pool = std::make_shared<VideoCodecBufferPool>();
+    VideoCodec encoder;
+    VideoCodec decoder;
+    VideoCodec pictureDecoder;
+    encoder.setAllocator(pool);
+    decoder.setAllocator(pool);
+    pictureDecoder.setAllocator(pool);
+    encoder.setParam(VideoCodecParam::JPEG_THREADS, static_cast<float>(threads));
+    encoder.setParam(VideoCodecParam::ZERO_LATENCY, 1);
+    encoder.setParam(VideoCodecParam::GOP_SIZE, 10);
+
+    cr::video::Frame src(g_width, g_height, cr::video::Fourcc::YU12);
+    cr::video::Frame encoded(g_width, g_height, fourcc);
+    cr::video::Frame decoded(g_width, g_height, cr::video::Fourcc::YU12);
+    VideoCodecPicture picture;
+    int decodedFrames = 0;
+    int decodedPictures = 0;
+
+    bool result = runCase(name, pool, [&](int index)
+    {
+        drawFrame(src, index);
+        if (!encoder.encode(src, encoded))
+        {
+            return false;
+        }
+        // Decoders don't return frames for empty packets of delayed encoder.
+        if (encoded.size == 0)
+        {
+            return true;
+        }
+        bool frameDecoded = decoder.decode(encoded, decoded);
+        bool pictureDecoded = pictureDecoder.decode(encoded, picture);
+        decodedFrames += frameDecoded ? 1 : 0;
+        decodedPictures += pictureDecoded ? 1 : 0;
+        // JPEG is decoded synchronously: each packet returns frame.
+        return fourcc != cr::video::Fourcc::JPEG || (frameDecoded && pictureDecoded);
+    });
+
+    // Broken decoder doesn't allocate memory too.
+    if (decodedFrames == 0 || decodedPictures == 0)
+    {
+        std::cout << name << ": no decoded frames - FAILED" << std::endl;
+        return false;
+    }
+
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " allocation test" << std::endl;
+
+    // x265 is not tested: it is C++ library and its internal allocations by
+    // operator new can't be separated from allocations of codec.
+    bool result = true;
+    result &= testCodec("JPEG", cr::video::Fourcc::JPEG, 1);
+    result &= testCodec("JPEG 4 threads", cr::video::Fourcc::JPEG, 4);
+    result &= testCodec("H264", cr::video::Fourcc::H264, 1);
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,195 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <cstring>
+#include "VideoCodecBatchEncoder.h"
+
+
+
+/// Number of frames in segment.
+static const int g_segmentFrames = 10;
+/// Number of test frames.
+static const int g_numFrames = 95;
+/// Index of the first frame of smaller size (starts new segment).
+static const int g_sizeChangeFrame = 45;
+
+
+
+/// Packet received from batch encoder.
+struct ReceivedPacket
+{
+    /// Packet data.
+    std::vector<uint8_t> data;
+    /// Source frame ID.
+    uint32_t frameId{0};
+    /// Frame size.
+    int width{0};
+    int height{0};
+};
+
+
+
+/**
+ * @brief Fill YU12 frame by flat gray level of frame index. Content doesn't
+ * matter for segment checks, each frame only has own frame ID.
+ * @param frame Frame.
+ * @param index Frame index.
+ */
+void setFrameIndex(cr::video::Frame& frame, int index)
+{
+    int ySize = frame.width * frame.height;
+    memset(frame.data, 16 + index % 200, ySize);
+    memset(frame.data + ySize, 128, ySize / 2);
+    frame.frameId = static_cast<uint32_t>(index);
+}
+
+
+
+/**
+ * @brief Check if packet can start stream: H264 packet has IDR slice, JPEG
+ * packet starts with SOI marker.
+ * @param packet Packet.
+ * @param fourcc Codec type.
+ * @return TRUE if packet is key frame or FALSE.
+ */
+bool isKeyFrame(const ReceivedPacket& packet, cr::video::Fourcc fourcc)
+{
+    const std::vector<uint8_t> &data = packet.data;
+    if (fourcc == cr::video::Fourcc::JPEG)
+    {
+        return data.size() > 2 && data[0] == 0xFF && data[1] == 0xD8;
+    }
+    for (size_t i = 0; i + 3 < data.size(); ++i)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1F) == 5)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Encode frames by batch encoder and check packets: all frames are
+ * encoded, packets are in frame order with continuous frame IDs, packets of
+ * each segment have frame size of segment and each segment starts with key
+ * frame.
+ * @param name Test case name.
+ * @param fourcc Codec type.
+ * @return TRUE if packets are valid or FALSE.
+ */
+bool testCodec(const char* name, cr::video::Fourcc fourcc)
+{
+    VideoCodecBatchEncoder encoder(4, g_segmentFrames);
+    encoder.setParam(VideoCodecParam::GOP_SIZE, g_segmentFrames);
+    encoder.setParam(VideoCodecParam::ZERO_LATENCY, 1);
+
+    std::vector<ReceivedPacket> packets;
+    std::thread receiver([&encoder, &packets]
+    {
+        cr::video::Frame packet;
+        while (encoder.receivePacket(packet))
+        {
+            ReceivedPacket item;
+            item.data.assign(packet.data, packet.data + packet.size);
+            item.frameId = packet.frameId;
+            item.width = packet.width;
+            item.height = packet.height;
+            packets.push_back(std::move(item));
+        }
+    });
+
+    // Segment is started by the first frame, frame size change and full
+    // previous segment.
+    cr::video::Frame large(320, 240, cr::video::Fourcc::YU12);
+    cr::video::Frame small(160, 128, cr::video::Fourcc::YU12);
+    std::vector<int> segmentStarts;
+    int segmentSize = 0;
+    bool result = true;
+    for (int i = 0; i < g_numFrames; ++i)
+    {
+        if (i == 0 || i == g_sizeChangeFrame || segmentSize == g_segmentFrames)
+        {
+            segmentStarts.push_back(i);
+            segmentSize = 0;
+        }
+        ++segmentSize;
+
+        cr::video::Frame &src = i < g_sizeChangeFrame ? large : small;
+        setFrameIndex(src, i);
+        if (!encoder.submitFrame(src, fourcc))
+        {
+            std::cout << name << ": frame " << i << " not submitted" << std::endl;
+            result = false;
+        }
+    }
+    encoder.flush();
+    receiver.join();
+
+    if (encoder.getNumErrors() != 0)
+    {
+        std::cout << name << ": " << encoder.getNumErrors() << " frames failed to encode" << std::endl;
+        result = false;
+    }
+    if (encoder.getNumSegments() != segmentStarts.size())
+    {
+        std::cout << name << ": " << encoder.getNumSegments() << " segments, expected "
+                  << segmentStarts.size() << std::endl;
+        result = false;
+    }
+    if (static_cast<int>(packets.size()) != g_numFrames)
+    {
+        std::cout << name << ": " << packets.size() << " packets, expected " << g_numFrames << std::endl;
+        result = false;
+    }
+
+    // Zero latency encoders don't reorder frames, so packets of segments in
+    // stream order have frame IDs of source frames.
+    size_t segment = 0;
+    for (int i = 0; i < static_cast<int>(packets.size()); ++i)
+    {
+        const ReceivedPacket &packet = packets[i];
+        const cr::video::Frame &src = i < g_sizeChangeFrame ? large : small;
+        if (packet.frameId != static_cast<uint32_t>(i))
+        {
+            std::cout << name << ": packet " << i << " has frame ID " << packet.frameId << std::endl;
+            result = false;
+        }
+        if (packet.width != src.width || packet.height != src.height)
+        {
+            std::cout << name << ": packet " << i << " has frame size " << packet.width << "x"
+                      << packet.height << std::endl;
+            result = false;
+        }
+        if (segment < segmentStarts.size() && segmentStarts[segment] == i)
+        {
+            ++segment;
+            if (!isKeyFrame(packet, fourcc))
+            {
+                std::cout << name << ": segment " << segment - 1 << " doesn't start with key frame" << std::endl;
+                result = false;
+            }
+        }
+    }
+
+    std::cout << name << ": " << packets.size() << " packets, " << encoder.getNumSegments() << " segments - "
+              << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " batch encoder test" << std::endl;
+
+    bool result = true;
+    result &= testCodec("H264", cr::video::Fourcc::H264);
+    result &= testCodec("MJPEG", cr::video::Fourcc::JPEG);
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
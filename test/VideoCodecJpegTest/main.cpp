@@ -0,0 +1,217 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "VideoCodec.h"
+
+
+
+/// Frame sizes: HD and size which is not multiple of MCU size.
+static const int g_sizes[][2] = {{1280, 720}, {642, 362}};
+
+/// Numbers of JPEG encoder threads (bands) compared with single thread.
+static const int g_threads[] = {2, 3, 4, 8};
+
+
+
+/**
+ * @brief JPEG image decoded by libjpeg.
+ */
+struct DecodedImage
+{
+    /// RGB pixels.
+    std::vector<uint8_t> rgb;
+    /// Image width.
+    int width{0};
+    /// Image height.
+    int height{0};
+    /// Number of libjpeg warnings (corrupt data, wrong restart markers).
+    long warnings{0};
+};
+
+
+
+/**
+ * @brief Draw diagonal color pattern to BGR24 frame and convert it to YU12.
+ * Pattern changes across band boundaries.
+ * @param frame YU12 frame.
+ */
+void drawFrame(cr::video::Frame& frame)
+{
+    cr::video::Frame bgr(frame.width, frame.height, cr::video::Fourcc::BGR24);
+    for (int y = 0; y < frame.height; ++y)
+    {
+        for (int x = 0; x < frame.width; ++x)
+        {
+            uint8_t *pixel = bgr.data + (y * frame.width + x) * 3;
+            pixel[0] = static_cast<uint8_t>(x * 255 / frame.width);
+            pixel[1] = static_cast<uint8_t>(y * 255 / frame.height);
+            pixel[2] = static_cast<uint8_t>((x + y) * 7);
+        }
+    }
+    ColorConverter converter;
+    converter.convert(bgr, frame);
+}
+
+
+
+/**
+ * @brief Decode JPEG image by libjpeg to RGB pixels.
+ * @param data JPEG image.
+ * @param size Size of image.
+ * @param image Decoded image.
+ * @return TRUE if image is decoded or FALSE.
+ */
+bool decodeJpeg(const uint8_t* data, int size, DecodedImage& image)
+{
+    struct jpeg_decompress_struct info;
+    struct jpeg_error_mgr err;
+    info.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+    if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK)
+    {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+    image.width = static_cast<int>(info.output_width);
+    image.height = static_cast<int>(info.output_height);
+    image.rgb.resize(static_cast<size_t>(image.width) * image.height * 3);
+    while (info.output_scanline < info.output_height)
+    {
+        JSAMPROW row = image.rgb.data() + static_cast<size_t>(info.output_scanline) * image.width * 3;
+        jpeg_read_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_decompress(&info);
+    image.warnings = err.num_warnings;
+    jpeg_destroy_decompress(&info);
+
+    return true;
+}
+
+
+
+/**
+ * @brief Check if JPEG image has restart interval (DRI marker) of joined
+ * bands.
+ * @param packet JPEG image.
+ * @return TRUE if image has DRI marker or FALSE.
+ */
+bool hasRestartInterval(const cr::video::Frame& packet)
+{
+    for (int i = 0; i + 1 < packet.size; ++i)
+    {
+        if (packet.data[i] == 0xFF && packet.data[i + 1] == 0xDD)
+        {
+            return true;
+        }
+        // Scan data starts after SOS marker.
+        if (packet.data[i] == 0xFF && packet.data[i + 1] == 0xDA)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Encode frame by JPEG encoder.
+ * @param src Source frame.
+ * @param threads Number of JPEG encoder threads.
+ * @param image Decoded image.
+ * @param packet Encoded image.
+ * @return TRUE if image is encoded and decoded without warnings or FALSE.
+ */
+bool encodeDecode(cr::video::Frame& src, int threads, DecodedImage& image, cr::video::Frame& packet)
+{
+    VideoCodec encoder;
+    encoder.setParam(VideoCodecParam::JPEG_QUALITY, 90);
+    encoder.setParam(VideoCodecParam::JPEG_THREADS, static_cast<float>(threads));
+    // The second image is encoded by band buffers of the first one.
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!encoder.encode(src, packet))
+        {
+            std::cout << src.width << "x" << src.height << ", " << threads << " threads: encode failed" << std::endl;
+            return false;
+        }
+    }
+    if (!decodeJpeg(packet.data, packet.size, image) || image.warnings != 0 ||
+        image.width != src.width || image.height != src.height)
+    {
+        std::cout << src.width << "x" << src.height << ", " << threads << " threads: decoded "
+                  << image.width << "x" << image.height << " with " << image.warnings << " warnings" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+
+/**
+ * @brief Check that JPEG image joined from bands (restart markers renumbered,
+ * DRI marker, image height patched in SOF) is decoded by standard decoder to
+ * the same pixels as single thread image.
+ * @param width Frame width.
+ * @param height Frame height.
+ * @return TRUE if all images are valid or FALSE.
+ */
+bool testBands(int width, int height)
+{
+    cr::video::Frame src(width, height, cr::video::Fourcc::YU12);
+    drawFrame(src);
+
+    DecodedImage reference;
+    cr::video::Frame packet(width, height, cr::video::Fourcc::JPEG);
+    if (!encodeDecode(src, 1, reference, packet))
+    {
+        return false;
+    }
+
+    bool result = true;
+    for (int threads : g_threads)
+    {
+        DecodedImage image;
+        if (!encodeDecode(src, threads, image, packet))
+        {
+            result = false;
+            continue;
+        }
+        if (!hasRestartInterval(packet))
+        {
+            std::cout << width << "x" << height << ", " << threads << " threads: image is not joined from bands"
+                      << std::endl;
+            result = false;
+        }
+        if (image.rgb != reference.rgb)
+        {
+            std::cout << width << "x" << height << ", " << threads << " threads: pixels differ from single thread"
+                      << std::endl;
+            result = false;
+        }
+    }
+
+    std::cout << width << "x" << height << ": " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " JPEG bands test" << std::endl;
+
+    bool result = true;
+    for (const auto &size : g_sizes)
+    {
+        result &= testBands(size[0], size[1]);
+    }
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
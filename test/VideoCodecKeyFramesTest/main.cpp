@@ -0,0 +1,190 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "VideoCodec.h"
+
+
+
+/// Test frame width.
+static const int g_width = 320;
+/// Test frame height.
+static const int g_height = 240;
+/// GOP size of encoded stream.
+static const int g_gopSize = 10;
+/// Number of encoded frames.
+static const int g_numFrames = 35;
+
+
+
+/**
+ * @brief Synthetic packet of NAL units and expected filter decision.
+ */
+struct FilterCase
+{
+    /// Case name.
+    const char* name;
+    /// Codec type.
+    cr::video::Fourcc fourcc;
+    /// NAL units without start codes.
+    std::vector<std::vector<uint8_t>> nals;
+    /// Packet must be passed to decoder.
+    bool passed;
+};
+
+
+
+/**
+ * @brief Check if H264 packet has IDR slice.
+ * @param packet Packet.
+ * @return TRUE if packet is IDR frame or FALSE.
+ */
+bool isIdr(const cr::video::Frame& packet)
+{
+    for (int i = 0; i + 3 < packet.size; ++i)
+    {
+        if (packet.data[i] == 0 && packet.data[i + 1] == 0 && packet.data[i + 2] == 1 &&
+            (packet.data[i + 3] & 0x1F) == 5)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Decode packet and check if it was dropped by filter.
+ * @param decoder Decoder.
+ * @param packet Packet.
+ * @return TRUE if packet was dropped by DECODER_KEY_FRAMES_ONLY filter.
+ */
+bool isDropped(VideoCodec& decoder, cr::video::Frame& packet)
+{
+    cr::video::Frame decoded(g_width, g_height, cr::video::Fourcc::YU12);
+    uint64_t filtered = decoder.getStats().decoderFilteredPackets;
+    decoder.decode(packet, decoded);
+    return decoder.getStats().decoderFilteredPackets != filtered;
+}
+
+
+
+/**
+ * @brief Encode H264 stream and decode it by key frames filter: packets are
+ * dropped until next IDR frame, all packets are decoded when filter is off.
+ * @return TRUE if filter dropped only non-key packets or FALSE.
+ */
+bool testEncodedStream()
+{
+    VideoCodec encoder;
+    encoder.setParam(VideoCodecParam::GOP_SIZE, g_gopSize);
+    VideoCodec decoder;
+    decoder.setParam(VideoCodecParam::DECODER_KEY_FRAMES_ONLY, 1);
+
+    cr::video::Frame src(g_width, g_height, cr::video::Fourcc::YU12);
+    cr::video::Frame packet(g_width, g_height, cr::video::Fourcc::H264);
+    bool result = true;
+    int keyFrames = 0;
+    for (int i = 0; i < g_numFrames; ++i)
+    {
+        memset(src.data, i * 4, src.size);
+        src.frameId = static_cast<uint32_t>(i);
+        if (!encoder.encode(src, packet) || packet.size == 0)
+        {
+            std::cout << "Encoded stream: frame " << i << " not encoded" << std::endl;
+            return false;
+        }
+
+        // Filter is switched off for the last GOP.
+        bool filter = i < g_numFrames / g_gopSize * g_gopSize;
+        decoder.setParam(VideoCodecParam::DECODER_KEY_FRAMES_ONLY, filter ? 1 : 0);
+        bool key = isIdr(packet);
+        keyFrames += key ? 1 : 0;
+        if (isDropped(decoder, packet) != (filter && !key))
+        {
+            std::cout << "Encoded stream: frame " << i << (key ? " (IDR)" : "") << " filtered wrong" << std::endl;
+            result = false;
+        }
+    }
+
+    int expectedKeyFrames = (g_numFrames + g_gopSize - 1) / g_gopSize;
+    if (keyFrames != expectedKeyFrames)
+    {
+        std::cout << "Encoded stream: " << keyFrames << " IDR frames, expected " << expectedKeyFrames << std::endl;
+        result = false;
+    }
+
+    std::cout << "Encoded stream: " << decoder.getStats().decoderFilteredPackets << " packets dropped - "
+              << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Check resync points of synthetic packets: after dropped packets
+ * decoding resumes from IDR, H264 I slices pictures and HEVC IRAP pictures.
+ * @return TRUE if all packets are filtered as expected or FALSE.
+ */
+bool testResync()
+{
+    // Slice headers begin with Exp-Golomb first_mb_in_slice and slice_type:
+    // 0xB8 - MB 0, I (2); 0x88 - MB 0, I (7); 0xE0 - MB 0, P (0); 0x98 - MB
+    // 0, P (5); 0x00 0x7D 0x22 0x1F - MB 1000, I (7).
+    const cr::video::Fourcc h264 = cr::video::Fourcc::H264;
+    const cr::video::Fourcc hevc = cr::video::Fourcc::HEVC;
+    const FilterCase cases[] =
+    {
+        {"H264 parameter sets", h264, {{0x67, 0x42, 0x00, 0x1E}, {0x68, 0xCE, 0x38, 0x80}}, true},
+        {"H264 IDR", h264, {{0x65, 0x88, 0x80}}, true},
+        {"H264 P slice", h264, {{0x41, 0xE0}}, false},
+        {"H264 P slice (5)", h264, {{0x41, 0x98}}, false},
+        {"H264 I slice", h264, {{0x61, 0xB8, 0x80}}, true},
+        {"H264 P slice after I", h264, {{0x21, 0xE0}}, false},
+        {"H264 two I slices", h264, {{0x41, 0x88}, {0x41, 0x00, 0x7D, 0x22, 0x1F}}, true},
+        {"H264 I and P slices", h264, {{0x41, 0x88}, {0x41, 0x98}}, false},
+        {"H264 recovery point SEI and P slice", h264, {{0x06, 0x06, 0x01, 0x80, 0x80}, {0x41, 0xE0}}, false},
+        {"H264 truncated slice header", h264, {{0x41}}, false},
+        {"H264 IDR after loss", h264, {{0x09, 0x10}, {0x65, 0x88, 0x80}}, true},
+        {"HEVC CRA", hevc, {{0x2A, 0x01, 0xAF}}, true},
+        {"HEVC TRAIL_R", hevc, {{0x02, 0x01, 0xD0}}, false},
+        {"HEVC IDR_W_RADL", hevc, {{0x26, 0x01, 0xAF}}, true},
+    };
+
+    VideoCodec decoder;
+    decoder.setParam(VideoCodecParam::DECODER_KEY_FRAMES_ONLY, 1);
+    bool result = true;
+    for (const FilterCase &filterCase : cases)
+    {
+        std::vector<uint8_t> data;
+        for (const std::vector<uint8_t> &nal : filterCase.nals)
+        {
+            data.insert(data.end(), {0x00, 0x00, 0x00, 0x01});
+            data.insert(data.end(), nal.begin(), nal.end());
+        }
+        cr::video::Frame packet(g_width, g_height, filterCase.fourcc, static_cast<int>(data.size()), data.data());
+        if (isDropped(decoder, packet) == filterCase.passed)
+        {
+            std::cout << filterCase.name << ": " << (filterCase.passed ? "dropped" : "passed") << std::endl;
+            result = false;
+        }
+    }
+
+    std::cout << "Resync points: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " key frames filter test" << std::endl;
+
+    bool result = true;
+    result &= testEncodedStream();
+    result &= testResync();
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
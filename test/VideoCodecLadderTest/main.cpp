@@ -0,0 +1,214 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "VideoCodecLadder.h"
+
+
+
+/// Source frame width.
+static const int g_width = 1280;
+/// Source frame height.
+static const int g_height = 720;
+/// Number of frames encoded before rendition is added.
+static const int g_numFrames = 4;
+
+
+
+/**
+ * @brief Rendition of test ladder.
+ */
+struct TestRendition
+{
+    /// Rendition width.
+    int width;
+    /// Rendition height.
+    int height;
+    /// Codec type.
+    cr::video::Fourcc fourcc;
+};
+
+
+
+/**
+ * @brief Fill YU12 frame by flat gray level of frame index.
+ * @param frame Frame.
+ * @param index Frame index.
+ */
+void setFrameIndex(cr::video::Frame& frame, int index)
+{
+    int ySize = frame.width * frame.height;
+    memset(frame.data, 16 + index % 200, ySize);
+    memset(frame.data + ySize, 128, ySize / 2);
+    frame.frameId = static_cast<uint32_t>(index);
+}
+
+
+
+/**
+ * @brief Read image size from SOF marker of JPEG image.
+ * @param packet JPEG image.
+ * @param width Image width.
+ * @param height Image height.
+ * @return TRUE if SOF marker is found or FALSE.
+ */
+bool readJpegSize(const cr::video::Frame& packet, int& width, int& height)
+{
+    for (int i = 0; i + 8 < packet.size; ++i)
+    {
+        if (packet.data[i] == 0xFF && (packet.data[i + 1] == 0xC0 || packet.data[i + 1] == 0xC1))
+        {
+            height = (packet.data[i + 5] << 8) | packet.data[i + 6];
+            width = (packet.data[i + 7] << 8) | packet.data[i + 8];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Check encoded frames of ladder: one frame per rendition in order of
+ * adding, with rendition size, codec type and source frame ID.
+ * @param renditions Renditions.
+ * @param dst Encoded frames.
+ * @param frameId Source frame ID.
+ * @return TRUE if encoded frames are valid or FALSE.
+ */
+bool checkFrames(const std::vector<TestRendition>& renditions, std::vector<cr::video::Frame>& dst, uint32_t frameId)
+{
+    if (dst.size() != renditions.size())
+    {
+        std::cout << "Frame " << frameId << ": " << dst.size() << " encoded frames, expected "
+                  << renditions.size() << std::endl;
+        return false;
+    }
+
+    bool result = true;
+    for (size_t i = 0; i < renditions.size(); ++i)
+    {
+        const TestRendition &rendition = renditions[i];
+        cr::video::Frame &packet = dst[i];
+        int width = packet.width;
+        int height = packet.height;
+        if (rendition.fourcc == cr::video::Fourcc::JPEG && !readJpegSize(packet, width, height))
+        {
+            width = 0;
+            height = 0;
+        }
+        if (packet.size <= 0 || packet.fourcc != rendition.fourcc || packet.frameId != frameId ||
+            width != rendition.width || height != rendition.height)
+        {
+            std::cout << "Frame " << frameId << ", rendition " << i << ": " << packet.size << " bytes "
+                      << width << "x" << height << " frame ID " << packet.frameId << ", expected "
+                      << rendition.width << "x" << rendition.height << std::endl;
+            result = false;
+        }
+    }
+    return result;
+}
+
+
+
+/**
+ * @brief Encode source to renditions of mixed sizes and codec types (source
+ * size renditions are encoded without downscaling) and check that encoded
+ * frames follow order of renditions. Rendition added after the first frames
+ * gets own thread and is appended to output.
+ * @return TRUE if all frames are encoded in rendition order or FALSE.
+ */
+bool testFanOut()
+{
+    std::vector<TestRendition> renditions =
+    {
+        {640, 360, cr::video::Fourcc::H264},
+        {g_width, g_height, cr::video::Fourcc::JPEG},
+        {320, 180, cr::video::Fourcc::JPEG},
+        {g_width, g_height, cr::video::Fourcc::H264},
+        {854, 480, cr::video::Fourcc::JPEG},
+    };
+    const TestRendition added = {480, 270, cr::video::Fourcc::JPEG};
+
+    VideoCodecLadder ladder;
+    bool result = true;
+    for (const TestRendition &rendition : renditions)
+    {
+        int index = ladder.addRendition(rendition.width, rendition.height, 0, rendition.fourcc);
+        result &= index == ladder.getNumRenditions() - 1;
+        ladder.setParam(index, VideoCodecParam::ZERO_LATENCY, 1);
+    }
+
+    cr::video::Frame src(g_width, g_height, cr::video::Fourcc::YU12);
+    std::vector<cr::video::Frame> dst;
+    for (int i = 0; i < 2 * g_numFrames; ++i)
+    {
+        if (i == g_numFrames)
+        {
+            result &= ladder.addRendition(added.width, added.height, 0, added.fourcc) ==
+                      static_cast<int>(renditions.size());
+            renditions.push_back(added);
+        }
+        setFrameIndex(src, i);
+        if (!ladder.encode(src, dst))
+        {
+            std::cout << "Frame " << i << " not encoded" << std::endl;
+            result = false;
+            continue;
+        }
+        result &= checkFrames(renditions, dst, static_cast<uint32_t>(i));
+    }
+
+    // Statistics follow rendition order too: added rendition has encoded
+    // only the second half of frames.
+    for (size_t i = 0; i < renditions.size(); ++i)
+    {
+        VideoCodecStats stats;
+        uint64_t frames = i < renditions.size() - 1 ? 2 * g_numFrames : g_numFrames;
+        if (!ladder.getStats(static_cast<int>(i), stats) || stats.encodedFrames != frames)
+        {
+            std::cout << "Rendition " << i << ": " << stats.encodedFrames << " frames, expected " << frames
+                      << std::endl;
+            result = false;
+        }
+    }
+
+    std::cout << "Fan-out: " << renditions.size() << " renditions - " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Check invalid renditions: odd size is rejected by addRendition(),
+ * rendition bigger than source fails encode().
+ * @return TRUE if invalid renditions are rejected or FALSE.
+ */
+bool testInvalidRendition()
+{
+    VideoCodecLadder ladder;
+    bool result = ladder.addRendition(641, 360) == -1;
+    result &= ladder.addRendition(1920, 1080, 0, cr::video::Fourcc::JPEG) == 0;
+
+    cr::video::Frame src(g_width, g_height, cr::video::Fourcc::YU12);
+    setFrameIndex(src, 0);
+    std::vector<cr::video::Frame> dst;
+    result &= !ladder.encode(src, dst);
+
+    std::cout << "Invalid renditions: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " ladder test" << std::endl;
+
+    bool result = true;
+    result &= testFanOut();
+    result &= testInvalidRendition();
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,291 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include "VideoCodecPool.h"
+
+
+
+/// Max time of waiting for worker events.
+static const int g_timeoutMs = 5000;
+/// Deadline of streams which miss it.
+static const int g_shortDeadlineMs = 50;
+/// Deadline of streams which never miss it.
+static const int g_longDeadlineMs = 5000;
+
+
+
+/**
+ * @brief Events of stream callbacks. Blocker stream callback holds worker
+ * until it is released.
+ */
+struct Events
+{
+    /// Mutex.
+    std::mutex mutex;
+    /// Condition of state change.
+    std::condition_variable cond;
+    /// Stream IDs in order of encoded packets.
+    std::vector<int> order;
+    /// Threads of encoded packets.
+    std::vector<std::thread::id> threads;
+    /// Blocker callback is entered.
+    bool blocked{false};
+    /// Blocker callback can return.
+    bool released{false};
+
+    /// Record encoded packet of stream.
+    void packet(int streamId)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(streamId);
+        threads.push_back(std::this_thread::get_id());
+        cond.notify_all();
+    }
+
+    /// Blocker callback: hold worker until released or timeout.
+    bool block()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        blocked = true;
+        cond.notify_all();
+        return cond.wait_for(lock, std::chrono::milliseconds(g_timeoutMs), [this]{ return released; });
+    }
+
+    /// Wait until blocker callback is entered.
+    bool waitBlocked()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cond.wait_for(lock, std::chrono::milliseconds(g_timeoutMs), [this]{ return blocked; });
+    }
+
+    /// Release blocker callback.
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released = true;
+        cond.notify_all();
+    }
+
+    /// Wait until number of encoded packets.
+    bool waitPackets(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cond.wait_for(lock, std::chrono::milliseconds(g_timeoutMs), [this, count]{ return order.size() >= count; });
+    }
+};
+
+
+
+/**
+ * @brief Fill YU12 frame by flat gray level.
+ * @param frame Frame.
+ * @param index Frame index.
+ */
+void setFrameIndex(cr::video::Frame& frame, int index)
+{
+    int ySize = frame.width * frame.height;
+    memset(frame.data, 16 + index % 200, ySize);
+    memset(frame.data + ySize, 128, ySize / 2);
+    frame.frameId = static_cast<uint32_t>(index);
+}
+
+
+
+/**
+ * @brief Wait until stream frames are encoded or dropped.
+ * @param pool Pool.
+ * @param streamId Stream ID.
+ * @param count Number of encoded and dropped frames.
+ * @param stats Stream statistics.
+ * @return TRUE if all frames are done or FALSE on timeout.
+ */
+bool waitStreamFrames(VideoCodecPool& pool, int streamId, uint64_t count, VideoCodecPoolStats& stats)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(g_timeoutMs);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        pool.getStats(streamId, stats);
+        if (stats.encodedFrames + stats.droppedFrames + stats.failedFrames >= count)
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Check work stealing: two streams are queued to the same worker (stream
+ * ID modulo number of workers). While the worker is held by callback of the
+ * first stream, frame of the second stream is encoded by other worker.
+ * @return TRUE if the second stream is encoded in parallel or FALSE.
+ */
+bool testWorkStealing()
+{
+    const int numThreads = 4;
+    VideoCodecPool pool(numThreads);
+    Events events;
+    int blocker = -1;
+    int stolen = -1;
+    for (int i = 0; i <= numThreads; ++i)
+    {
+        int id = pool.addStream(cr::video::Fourcc::JPEG, [&events, &blocker](int streamId, cr::video::Frame&)
+        {
+            if (streamId == blocker)
+            {
+                events.block();
+            }
+            events.packet(streamId);
+        });
+        blocker = i == 0 ? id : blocker;
+        stolen = i == numThreads ? id : stolen;
+    }
+
+    cr::video::Frame frame(320, 240, cr::video::Fourcc::YU12);
+    setFrameIndex(frame, 0);
+    pool.submitFrame(blocker, frame);
+    bool result = events.waitBlocked();
+    pool.submitFrame(stolen, frame);
+    result &= events.waitPackets(1);
+    events.release();
+    result &= events.waitPackets(2);
+
+    // Stolen frame is encoded first, by other thread than held worker.
+    if (!result || events.order[0] != stolen || events.threads[0] == events.threads[1])
+    {
+        std::cout << "Work stealing: frame of stream queued to busy worker isn't encoded by other worker"
+                  << std::endl;
+        result = false;
+    }
+
+    std::cout << "Work stealing: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Check deadlines: frames replaced by newer frame and frames which wait
+ * longer than deadline are dropped, next frame in time is encoded.
+ * @return TRUE if frames are dropped as expected or FALSE.
+ */
+bool testDeadline()
+{
+    VideoCodecPool pool(1);
+    Events events;
+    int blocker = pool.addStream(cr::video::Fourcc::JPEG, [&events](int streamId, cr::video::Frame&)
+    {
+        events.block();
+        events.packet(streamId);
+    });
+    int stream = pool.addStream(cr::video::Fourcc::JPEG, [&events](int streamId, cr::video::Frame&)
+    {
+        events.packet(streamId);
+    }, 0, g_shortDeadlineMs);
+
+    cr::video::Frame frame(320, 240, cr::video::Fourcc::YU12);
+    setFrameIndex(frame, 0);
+    pool.submitFrame(blocker, frame);
+    bool result = events.waitBlocked();
+
+    // Two frames are replaced, the last one misses deadline.
+    for (int i = 1; i <= 3; ++i)
+    {
+        setFrameIndex(frame, i);
+        pool.submitFrame(stream, frame);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_shortDeadlineMs * 3));
+    events.release();
+
+    VideoCodecPoolStats stats;
+    result &= waitStreamFrames(pool, stream, 3, stats);
+    if (stats.encodedFrames != 0 || stats.droppedFrames != 3)
+    {
+        std::cout << "Deadline: " << stats.encodedFrames << " encoded, " << stats.droppedFrames
+                  << " dropped of late frames" << std::endl;
+        result = false;
+    }
+
+    // Idle worker starts frame before deadline.
+    setFrameIndex(frame, 4);
+    pool.submitFrame(stream, frame);
+    result &= waitStreamFrames(pool, stream, 4, stats);
+    if (stats.encodedFrames != 1 || stats.droppedFrames != 3)
+    {
+        std::cout << "Deadline: " << stats.encodedFrames << " encoded, " << stats.droppedFrames
+                  << " dropped after frame in time" << std::endl;
+        result = false;
+    }
+
+    std::cout << "Deadline: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Check that queued task gets deadline of replacing frame: stream
+ * whose pending frame is replaced is scheduled after stream with earlier
+ * submitted frame.
+ * @return TRUE if streams are encoded in order of deadlines or FALSE.
+ */
+bool testDeadlineRefresh()
+{
+    VideoCodecPool pool(1);
+    Events events;
+    int blocker = pool.addStream(cr::video::Fourcc::JPEG, [&events](int streamId, cr::video::Frame&)
+    {
+        events.block();
+        events.packet(streamId);
+    });
+    auto callback = [&events](int streamId, cr::video::Frame&)
+    {
+        events.packet(streamId);
+    };
+    int replaced = pool.addStream(cr::video::Fourcc::JPEG, callback, 0, g_longDeadlineMs);
+    int other = pool.addStream(cr::video::Fourcc::JPEG, callback, 0, g_longDeadlineMs);
+
+    cr::video::Frame frame(320, 240, cr::video::Fourcc::YU12);
+    setFrameIndex(frame, 0);
+    pool.submitFrame(blocker, frame);
+    bool result = events.waitBlocked();
+
+    pool.submitFrame(replaced, frame);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool.submitFrame(other, frame);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    setFrameIndex(frame, 1);
+    pool.submitFrame(replaced, frame);
+    events.release();
+    result &= events.waitPackets(3);
+
+    if (!result || events.order[1] != other || events.order[2] != replaced)
+    {
+        std::cout << "Deadline refresh: replaced frame is scheduled by deadline of dropped frame" << std::endl;
+        result = false;
+    }
+
+    std::cout << "Deadline refresh: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " pool test" << std::endl;
+
+    bool result = true;
+    result &= testWorkStealing();
+    result &= testDeadline();
+    result &= testDeadlineRefresh();
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,258 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include "VideoCodecRecorder.h"
+
+
+
+/// Frame rate of recordings.
+static const float g_fps = 10.0f;
+/// Frame duration in MPEG-TS time base (1/90000).
+static const int64_t g_frameDuration = 9000;
+/// GOP size of segmented recording.
+static const int g_gopSize = 5;
+/// Number of frames of segmented recording.
+static const int g_numFrames = 30;
+/// Segment duration, seconds: two GOPs.
+static const float g_segmentDuration = 1.0f;
+
+
+
+/**
+ * @brief Packet read back from recording.
+ */
+struct RecordedPacket
+{
+    /// Presentation timestamp.
+    int64_t pts{0};
+    /// Decoding timestamp.
+    int64_t dts{0};
+    /// Packet has IDR slice.
+    bool key{false};
+};
+
+
+
+/**
+ * @brief Make synthetic H264 packet: parameter sets (key frames) and one
+ * slice.
+ * @param frameId Frame ID.
+ * @param key TRUE - IDR frame with SPS / PPS, FALSE - P frame.
+ * @return Annex-B packet.
+ */
+cr::video::Frame makePacket(uint32_t frameId, bool key)
+{
+    std::vector<uint8_t> data;
+    if (key)
+    {
+        data.insert(data.end(), {0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x1E, 0xAB});
+        data.insert(data.end(), {0x00, 0x00, 0x00, 0x01, 0x68, 0xCE, 0x38, 0x80});
+    }
+    data.insert(data.end(), {0x00, 0x00, 0x00, 0x01, static_cast<uint8_t>(key ? 0x65 : 0x41), 0x88});
+    data.insert(data.end(), 200, static_cast<uint8_t>(frameId));
+
+    cr::video::Frame packet(320, 240, cr::video::Fourcc::H264, static_cast<int>(data.size()));
+    memcpy(packet.data, data.data(), data.size());
+    packet.size = static_cast<int>(data.size());
+    packet.frameId = frameId;
+    return packet;
+}
+
+
+
+/**
+ * @brief Read packets of MPEG-TS file by libavformat without parser, so
+ * packets and timestamps are the same as written by muxer.
+ * @param path File path.
+ * @param packets Packets of the first stream.
+ * @return TRUE if the file was read or FALSE.
+ */
+bool readRecording(const std::string& path, std::vector<RecordedPacket>& packets)
+{
+    packets.clear();
+    AVFormatContext *context = avformat_alloc_context();
+    context->flags |= AVFMT_FLAG_NOPARSE;
+    if (avformat_open_input(&context, path.c_str(), nullptr, nullptr) < 0)
+    {
+        std::cout << "Can't open " << path << std::endl;
+        return false;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    while (av_read_frame(context, packet) >= 0)
+    {
+        if (packet->stream_index == 0)
+        {
+            RecordedPacket item;
+            item.pts = packet->pts;
+            item.dts = packet->dts;
+            for (int i = 0; i + 3 < packet->size; ++i)
+            {
+                if (packet->data[i] == 0 && packet->data[i + 1] == 0 && packet->data[i + 2] == 1 &&
+                    (packet->data[i + 3] & 0x1F) == 5)
+                {
+                    item.key = true;
+                    break;
+                }
+            }
+            packets.push_back(item);
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&context);
+
+    return true;
+}
+
+
+
+/**
+ * @brief Record stream to segments of two GOPs. Packets before the first key
+ * frame are skipped, each segment file starts from key frame and timestamps
+ * of segment start from zero.
+ * @return TRUE if segments are valid or FALSE.
+ */
+bool testSegments()
+{
+    VideoCodecRecorderParams params;
+    params.container = VideoCodecContainer::MPEGTS;
+    params.segmentDuration = g_segmentDuration;
+    params.syncPolicy = VideoCodecSyncPolicy::NONE;
+    VideoCodecRecorder recorder;
+    if (!recorder.open("VideoCodecRecorderTest.ts", cr::video::Fourcc::H264, 320, 240, g_fps, params))
+    {
+        std::cout << "Segments: recording not opened" << std::endl;
+        return false;
+    }
+
+    // Two P frames before the first key frame are skipped.
+    const int skipped = 2;
+    bool result = true;
+    for (int i = 0; i < skipped + g_numFrames; ++i)
+    {
+        bool key = i >= skipped && (i - skipped) % g_gopSize == 0;
+        cr::video::Frame packet = makePacket(static_cast<uint32_t>(i), key);
+        result &= recorder.write(packet);
+    }
+    recorder.close();
+
+    int segmentFrames = static_cast<int>(g_segmentDuration * g_fps);
+    int numSegments = (g_numFrames + segmentFrames - 1) / segmentFrames;
+    VideoCodecRecorderStats stats = recorder.getStats();
+    if (stats.packets != g_numFrames || stats.skippedPackets != skipped ||
+        stats.segments != static_cast<uint64_t>(numSegments) || stats.writeErrors != 0)
+    {
+        std::cout << "Segments: " << stats.packets << " packets, " << stats.skippedPackets << " skipped, "
+                  << stats.segments << " segments, " << stats.writeErrors << " write errors" << std::endl;
+        result = false;
+    }
+
+    for (int segment = 0; segment < numSegments; ++segment)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "VideoCodecRecorderTest_%06d.ts", segment);
+        std::vector<RecordedPacket> packets;
+        bool read = readRecording(path, packets);
+        remove(path);
+        if (!read || static_cast<int>(packets.size()) != segmentFrames || !packets[0].key)
+        {
+            std::cout << "Segments: " << path << " has " << packets.size() << " packets"
+                      << (packets.empty() || packets[0].key ? "" : ", doesn't start with key frame") << std::endl;
+            result = false;
+            continue;
+        }
+        for (int i = 0; i < segmentFrames; ++i)
+        {
+            if (packets[i].pts - packets[0].pts != i * g_frameDuration || packets[i].dts != packets[i].pts)
+            {
+                std::cout << "Segments: " << path << " packet " << i << " pts " << packets[i].pts
+                          << " dts " << packets[i].dts << std::endl;
+                result = false;
+            }
+        }
+    }
+
+    std::cout << "Segments: " << stats.segments << " segments - " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+/**
+ * @brief Record stream with B-frames order and lost frame. Decoding timestamp
+ * is the lowest presentation timestamp of last bFrames + 1 packets, first
+ * packets are delayed by bFrames, so dts grows and never exceeds pts.
+ * @return TRUE if timestamps are valid or FALSE.
+ */
+bool testDts()
+{
+    // Frame 4 is lost. Expected dts in frames relative to the first packet.
+    const uint32_t frameIds[] = {0, 3, 1, 2, 7, 5, 6, 10, 8, 9};
+    const int64_t expectedDts[] = {-2, -1, 0, 1, 2, 3, 5, 6, 7, 8};
+    const uint32_t firstFrameId = 100;
+    const std::string path = "VideoCodecRecorderTestDts.ts";
+
+    VideoCodecRecorderParams params;
+    params.container = VideoCodecContainer::MPEGTS;
+    params.syncPolicy = VideoCodecSyncPolicy::NONE;
+    params.bFrames = 2;
+    VideoCodecRecorder recorder;
+    if (!recorder.open(path, cr::video::Fourcc::H264, 320, 240, g_fps, params))
+    {
+        std::cout << "Decoding timestamps: recording not opened" << std::endl;
+        return false;
+    }
+    bool result = true;
+    for (size_t i = 0; i < sizeof(frameIds) / sizeof(frameIds[0]); ++i)
+    {
+        cr::video::Frame packet = makePacket(firstFrameId + frameIds[i], i == 0);
+        result &= recorder.write(packet);
+    }
+    recorder.close();
+
+    std::vector<RecordedPacket> packets;
+    bool read = readRecording(path, packets);
+    remove(path.c_str());
+    if (!read || packets.size() != sizeof(frameIds) / sizeof(frameIds[0]))
+    {
+        std::cout << "Decoding timestamps: " << packets.size() << " packets" << std::endl;
+        return false;
+    }
+
+    // Muxer may shift all timestamps by the same offset.
+    int64_t offset = packets[0].pts;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+        const RecordedPacket &packet = packets[i];
+        if (packet.pts - offset != frameIds[i] * g_frameDuration ||
+            packet.dts - offset != expectedDts[i] * g_frameDuration ||
+            packet.dts > packet.pts || (i > 0 && packet.dts <= packets[i - 1].dts))
+        {
+            std::cout << "Decoding timestamps: packet " << i << " pts " << packet.pts - offset << " dts "
+                      << packet.dts - offset << ", expected pts " << frameIds[i] * g_frameDuration
+                      << " dts " << expectedDts[i] * g_frameDuration << std::endl;
+            result = false;
+        }
+    }
+
+    std::cout << "Decoding timestamps: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " recorder test" << std::endl;
+
+    bool result = true;
+    result &= testSegments();
+    result &= testDts();
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <cstring>
+#include "VideoCodec.h"
+
+
+
+/// Test frame width.
+static const int g_width = 320;
+/// Test frame height.
+static const int g_height = 240;
+
+
+
+/**
+ * @brief Encode step of test sequence.
+ */
+struct Step
+{
+    /// Step name.
+    const char* name;
+    /// Codec type of encoded frame.
+    cr::video::Fourcc fourcc;
+    /// Flush active encoder before encoding.
+    bool flush;
+    /// Expected number of encoder initializations after the step.
+    uint64_t encoderInits;
+    /// Packet must be key frame (JPEG or the first frame of H264 encoder).
+    bool keyFrame;
+};
+
+
+
+/**
+ * @brief Check if packet starts new stream: H264 packet has IDR slice, JPEG
+ * packet starts with SOI marker.
+ * @param packet Packet.
+ * @return TRUE if packet is key frame or FALSE.
+ */
+bool isKeyFrame(const cr::video::Frame& packet)
+{
+    if (packet.fourcc == cr::video::Fourcc::JPEG)
+    {
+        return packet.size > 2 && packet.data[0] == 0xFF && packet.data[1] == 0xD8;
+    }
+    for (int i = 0; i + 3 < packet.size; ++i)
+    {
+        if (packet.data[i] == 0 && packet.data[i + 1] == 0 && packet.data[i + 2] == 1 &&
+            (packet.data[i + 3] & 0x1F) == 5)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/**
+ * @brief Alternate H264 and JPEG frames with flush of H264 encoder: flush
+ * re-opens only flushed encoder, parked JPEG encoder (and its band threads)
+ * is kept.
+ * @param jpegThreads Number of JPEG encoder threads.
+ * @return TRUE if encoders were re-used or FALSE.
+ */
+bool testFlush(int jpegThreads)
+{
+    VideoCodec codec;
+    codec.setParam(VideoCodecParam::JPEG_THREADS, static_cast<float>(jpegThreads));
+    codec.setParam(VideoCodecParam::ENCODER_CACHE_SIZE, 2);
+
+    const Step steps[] =
+    {
+        {"H264", cr::video::Fourcc::H264, false, 1, true},
+        {"JPEG", cr::video::Fourcc::JPEG, false, 2, true},
+        {"H264 from cache", cr::video::Fourcc::H264, false, 2, false},
+        {"JPEG from cache after H264 flush", cr::video::Fourcc::JPEG, true, 2, true},
+        {"H264 re-opened after flush", cr::video::Fourcc::H264, false, 3, true},
+        {"JPEG from cache", cr::video::Fourcc::JPEG, false, 3, true},
+        {"JPEG after JPEG flush", cr::video::Fourcc::JPEG, true, 3, true},
+    };
+
+    cr::video::Frame src(g_width, g_height, cr::video::Fourcc::YU12);
+    memset(src.data, 128, src.size);
+    bool result = true;
+    uint32_t frameId = 0;
+    for (const Step &step : steps)
+    {
+        if (step.flush)
+        {
+            cr::video::Frame delayed;
+            codec.flush();
+            while (codec.receivePacket(delayed))
+            {
+            }
+        }
+
+        cr::video::Frame packet(g_width, g_height, step.fourcc);
+        src.frameId = frameId++;
+        if (!codec.encode(src, packet) || packet.size == 0)
+        {
+            std::cout << jpegThreads << " JPEG threads, " << step.name << ": encode failed" << std::endl;
+            result = false;
+            continue;
+        }
+
+        uint64_t encoderInits = codec.getStats().encoderInits;
+        if (encoderInits != step.encoderInits)
+        {
+            std::cout << jpegThreads << " JPEG threads, " << step.name << ": " << encoderInits
+                      << " encoder initializations, expected " << step.encoderInits << std::endl;
+            result = false;
+        }
+        if (step.keyFrame && !isKeyFrame(packet))
+        {
+            std::cout << jpegThreads << " JPEG threads, " << step.name << ": not key frame" << std::endl;
+            result = false;
+        }
+    }
+
+    std::cout << jpegThreads << " JPEG threads: " << (result ? "OK" : "FAILED") << std::endl;
+    return result;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    std::cout << "VideoCodec v" << VideoCodec::getVersion() << " encoder session test" << std::endl;
+
+    bool result = true;
+    result &= testFlush(1);
+    result &= testFlush(4);
+
+    std::cout << (result ? "Test passed" : "Test failed") << std::endl;
+
+    return result ? 0 : -1;
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include "VideoCodec.h"
 
@@ -19,12 +20,10 @@ int main (int argc, char *argv[])
 
     // Frames 
     cv::Mat inputFrame(height, width, CV_8UC3);
-    cv::Mat YUV420Frame(height, width, CV_8UC3);
-    cv::Mat rgbFrame(height, width, CV_8UC3);
     cr::video::Frame YU12Frame(width, height, cr::video::Fourcc::YU12);
     cr::video::Frame h264Frame(width, height, cr::video::Fourcc::H264);
     cr::video::Frame h265Frame(width, height, cr::video::Fourcc::HEVC);
-    cr::video::Frame rgb24Frame(width, height, cr::video::Fourcc::RGB24);
+    cr::video::Frame bgr24Frame(width, height, cr::video::Fourcc::BGR24);
     cr::video::Frame jpegFrame(width, height, cr::video::Fourcc::JPEG);
 
     // Decoded frames.
@@ -37,6 +36,25 @@ int main (int argc, char *argv[])
     VideoCodec h265Codec;
     VideoCodec jpegCodec;
 
+    // Multi-threaded encoders to measure threading speedup.
+    VideoCodec h264MtCodec;
+    VideoCodec h265MtCodec;
+    h264MtCodec.setParam(VideoCodecParam::THREAD_MODE, static_cast<float>(VideoCodecThreadMode::SLICE));
+    h265MtCodec.setParam(VideoCodecParam::THREAD_MODE, static_cast<float>(VideoCodecThreadMode::SLICE));
+    cr::video::Frame h264MtFrame(width, height, cr::video::Fourcc::H264);
+    cr::video::Frame h265MtFrame(width, height, cr::video::Fourcc::HEVC);
+
+    // Color converter for encoder input.
+    ColorConverter converter;
+    std::cout << "Color converter ISA: " << ColorConverter::getIsaName(converter.getIsa()) << std::endl;
+
+    // Total encoding times in microseconds: single thread and multi-threaded.
+    long long h264TotalTime = 0;
+    long long h265TotalTime = 0;
+    long long h264MtTotalTime = 0;
+    long long h265MtTotalTime = 0;
+    int numFrames = 0;
+
     // Decoders.
     VideoCodec h264Decoder;
     VideoCodec h265Decoder;
@@ -52,26 +70,40 @@ int main (int argc, char *argv[])
             break;
         }
 
-        // Convert the frame to YUV420
-        cv::cvtColor(inputFrame, YUV420Frame, cv::COLOR_BGR2YUV_I420);
-        cv::cvtColor(inputFrame, rgbFrame, cv::COLOR_BGR2RGB);
+        // Convert the frame to YUV420 with SIMD converter
+        int ySize = width * height;
+        converter.bgrToI420(inputFrame.data, static_cast<int>(inputFrame.step), YU12Frame.data, width,
+                            YU12Frame.data + ySize, width / 2, YU12Frame.data + ySize + ySize / 4, width / 2,
+                            width, height, false);
 
-        // Copy the frame data
-        memcpy(YU12Frame.data, YUV420Frame.data, YUV420Frame.total() * YUV420Frame.elemSize());
-        memcpy(rgb24Frame.data, rgbFrame.data, rgbFrame.total() * rgbFrame.elemSize());
+        // JPEG encoder takes BGR24 directly
+        memcpy(bgr24Frame.data, inputFrame.data, width * height * 3);
 
         auto start = std::chrono::high_resolution_clock::now();
         h264Codec.encode(YU12Frame, h264Frame);
         auto end = std::chrono::high_resolution_clock::now();
         auto h264EncodeTime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        h264TotalTime += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
 
         start = std::chrono::high_resolution_clock::now();
         h265Codec.encode(YU12Frame, h265Frame);
         end = std::chrono::high_resolution_clock::now();
         auto h265EncodeTime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        h265TotalTime += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        h264MtCodec.encode(YU12Frame, h264MtFrame);
+        end = std::chrono::high_resolution_clock::now();
+        h264MtTotalTime += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        h265MtCodec.encode(YU12Frame, h265MtFrame);
+        end = std::chrono::high_resolution_clock::now();
+        h265MtTotalTime += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        ++numFrames;
 
         start = std::chrono::high_resolution_clock::now();
-        jpegCodec.encode(rgb24Frame, jpegFrame);
+        jpegCodec.encode(bgr24Frame, jpegFrame);
         end = std::chrono::high_resolution_clock::now();
         auto jpegEncodeTime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
@@ -184,5 +216,18 @@ int main (int argc, char *argv[])
     // Release the video file
     cap.release();
 
+    // Report threading speedup
+    if (numFrames > 0 && h264MtTotalTime > 0 && h265MtTotalTime > 0)
+    {
+        std::cout << "Encoded frames: " << numFrames << " hardware threads: "
+                  << std::thread::hardware_concurrency() << std::endl;
+        std::cout << "h264 average encoding time: " << h264TotalTime / numFrames << " us (1 thread), "
+                  << h264MtTotalTime / numFrames << " us (slice threads), speedup x"
+                  << static_cast<double>(h264TotalTime) / h264MtTotalTime << std::endl;
+        std::cout << "h265 average encoding time: " << h265TotalTime / numFrames << " us (1 thread), "
+                  << h265MtTotalTime / numFrames << " us (wavefront threads), speedup x"
+                  << static_cast<double>(h265TotalTime) / h265MtTotalTime << std::endl;
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,670 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+#include "InputStream.h"
+
+
+
+/// Max size of Y4M stream and frame header lines.
+static const size_t g_maxY4mHeader = 1024;
+
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cout << "Can't open file " << path << std::endl;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        std::cout << "Empty file " << path << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (data == nullptr)
+    {
+        std::cout << "Can't map file " << path << std::endl;
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "Can't open file " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        std::cout << "Empty file " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    // Private read-only mapping: file can't be changed through returned frame pointers.
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Can't map file " << path << std::endl;
+        return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    // Frames are read in order: aggressive read-ahead, pages behind are freed first.
+    madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+#endif
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(info.st_size);
+#endif
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data == nullptr)
+    {
+        return;
+    }
+
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+
+
+bool RawVideoReader::open(const std::string& path, int width, int height)
+{
+    if (!m_file.open(path))
+    {
+        return false;
+    }
+
+    m_y4m = m_file.size() >= 10 && memcmp(m_file.data(), "YUV4MPEG2 ", 10) == 0;
+    if (m_y4m)
+    {
+        if (!parseY4mHeader())
+        {
+            m_file.close();
+            return false;
+        }
+    }
+    else
+    {
+        m_width = width;
+        m_height = height;
+        m_fps = 0.0;
+        m_begin = 0;
+    }
+    if (m_width <= 0 || m_height <= 0 || m_width % 2 != 0 || m_height % 2 != 0)
+    {
+        std::cout << "Invalid frame size " << m_width << "x" << m_height << std::endl;
+        m_file.close();
+        return false;
+    }
+
+    m_pos = m_begin;
+    return true;
+}
+
+bool RawVideoReader::parseY4mHeader()
+{
+    const char* header = reinterpret_cast<const char*>(m_file.data());
+    size_t length = m_file.size() < g_maxY4mHeader ? m_file.size() : g_maxY4mHeader;
+    const char* end = static_cast<const char*>(memchr(header, '\n', length));
+    if (end == nullptr)
+    {
+        std::cout << "Invalid Y4M header" << std::endl;
+        return false;
+    }
+
+    // Parameters are separated by spaces, first letter is parameter type.
+    std::string params(header + 10, end);
+    m_width = 0;
+    m_height = 0;
+    m_fps = 0.0;
+    size_t pos = 0;
+    while (pos < params.size())
+    {
+        size_t next = params.find(' ', pos);
+        if (next == std::string::npos)
+        {
+            next = params.size();
+        }
+        std::string param = params.substr(pos, next - pos);
+        pos = next + 1;
+        if (param.empty())
+        {
+            continue;
+        }
+
+        switch (param[0])
+        {
+        case 'W':
+            m_width = atoi(param.c_str() + 1);
+            break;
+        case 'H':
+            m_height = atoi(param.c_str() + 1);
+            break;
+        case 'F':
+        {
+            int numerator = 0;
+            int denominator = 0;
+            if (sscanf(param.c_str() + 1, "%d:%d", &numerator, &denominator) == 2 && denominator > 0)
+            {
+                m_fps = static_cast<double>(numerator) / denominator;
+            }
+            break;
+        }
+        case 'C':
+            // Only 8-bit 4:2:0, chroma siting doesn't change data layout.
+            if (param != "C420" && param != "C420jpeg" && param != "C420paldv" && param != "C420mpeg2")
+            {
+                std::cout << "Unsupported Y4M color space " << param.substr(1) << ", only 420 is supported" << std::endl;
+                return false;
+            }
+            break;
+        case 'I':
+            if (param != "Ip" && param != "I?")
+            {
+                std::cout << "Interlaced Y4M is not supported" << std::endl;
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    m_begin = static_cast<size_t>(end - header) + 1;
+    return true;
+}
+
+const uint8_t* RawVideoReader::next()
+{
+    const uint8_t* data = m_file.data();
+    size_t size = m_file.size();
+
+    if (m_y4m)
+    {
+        // Each frame starts with "FRAME" and optional parameters line.
+        if (size - m_pos < 6 || memcmp(data + m_pos, "FRAME", 5) != 0)
+        {
+            return nullptr;
+        }
+        size_t length = size - m_pos < g_maxY4mHeader ? size - m_pos : g_maxY4mHeader;
+        const uint8_t* end = static_cast<const uint8_t*>(memchr(data + m_pos, '\n', length));
+        if (end == nullptr)
+        {
+            return nullptr;
+        }
+        m_pos = static_cast<size_t>(end - data) + 1;
+    }
+
+    // Incomplete frame at the end of file is ignored.
+    if (size - m_pos < static_cast<size_t>(frameSize()))
+    {
+        m_pos = size;
+        return nullptr;
+    }
+
+    const uint8_t* frame = data + m_pos;
+    m_pos += static_cast<size_t>(frameSize());
+    return frame;
+}
+
+void RawVideoReader::rewind()
+{
+    m_pos = m_begin;
+}
+
+
+
+/**
+ * @brief Find Annex-B start code (00 00 01).
+ * @return Pointer to the first byte of start code or end.
+ */
+static const uint8_t* findStartCode(const uint8_t* data, const uint8_t* end)
+{
+    while (end - data >= 3)
+    {
+        // Search for 01 byte, then check two zeros before it.
+        const uint8_t* one = static_cast<const uint8_t*>(memchr(data + 2, 1, static_cast<size_t>(end - data - 2)));
+        if (one == nullptr)
+        {
+            break;
+        }
+        if (one[-1] == 0 && one[-2] == 0)
+        {
+            return one - 2;
+        }
+        data = one - 1;
+    }
+
+    return end;
+}
+
+
+
+/**
+ * @brief Bit reader of NAL unit payload. Emulation prevention bytes (00 00 03)
+ * are skipped, reading beyond the end returns zero bits.
+ */
+struct NalBitReader
+{
+    /// NAL unit data.
+    const uint8_t* data;
+    /// End of NAL unit.
+    const uint8_t* end;
+    /// Bit position in current byte.
+    int bit{0};
+    /// Number of zero bytes before current byte.
+    int zeros{0};
+    /// Read beyond the end of NAL unit.
+    bool overrun{false};
+
+    NalBitReader(const uint8_t* begin, const uint8_t* end_) : data(begin), end(end_) {}
+
+    /// Read one bit.
+    uint32_t readBit()
+    {
+        if (data >= end)
+        {
+            overrun = true;
+            return 0;
+        }
+        uint32_t value = (*data >> (7 - bit)) & 1;
+        if (++bit == 8)
+        {
+            bit = 0;
+            zeros = *data == 0 ? zeros + 1 : 0;
+            ++data;
+            if (zeros >= 2 && data < end && *data == 3)
+            {
+                zeros = 0;
+                ++data;
+            }
+        }
+        return value;
+    }
+
+    /// Read unsigned value of n bits.
+    uint32_t readBits(int n)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            value = (value << 1) | readBit();
+        }
+        return value;
+    }
+
+    /// Read unsigned Exp-Golomb code ue(v).
+    uint32_t readUe()
+    {
+        int leadingZeros = 0;
+        while (readBit() == 0)
+        {
+            if (overrun || ++leadingZeros > 31)
+            {
+                overrun = true;
+                return 0;
+            }
+        }
+        return (1u << leadingZeros) - 1 + readBits(leadingZeros);
+    }
+
+    /// Read signed Exp-Golomb code se(v).
+    int32_t readSe()
+    {
+        uint32_t code = readUe();
+        return (code & 1) != 0 ? static_cast<int32_t>((code + 1) / 2) : -static_cast<int32_t>(code / 2);
+    }
+};
+
+
+
+/**
+ * @brief Parse picture size of H264 sequence parameter set.
+ * @param bits Reader of SPS payload after NAL unit header.
+ * @param width Picture width.
+ * @param height Picture height.
+ * @return TRUE if the size was parsed or FALSE.
+ */
+static bool parseH264Sps(NalBitReader& bits, int& width, int& height)
+{
+    uint32_t profile = bits.readBits(8);
+    bits.readBits(16); // constraint flags, level_idc
+    bits.readUe(); // seq_parameter_set_id
+    uint32_t chromaFormat = 1;
+    bool separateColourPlane = false;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+        profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+        profile == 139 || profile == 134 || profile == 135)
+    {
+        chromaFormat = bits.readUe();
+        if (chromaFormat == 3)
+        {
+            separateColourPlane = bits.readBit() != 0;
+        }
+        bits.readUe(); // bit_depth_luma_minus8
+        bits.readUe(); // bit_depth_chroma_minus8
+        bits.readBit(); // qpprime_y_zero_transform_bypass_flag
+        if (bits.readBit() != 0) // seq_scaling_matrix_present_flag
+        {
+            int lists = chromaFormat == 3 ? 12 : 8;
+            for (int i = 0; i < lists; ++i)
+            {
+                if (bits.readBit() == 0)
+                {
+                    continue;
+                }
+                int listSize = i < 6 ? 16 : 64;
+                int last = 8;
+                int next = 8;
+                for (int j = 0; j < listSize && next != 0; ++j)
+                {
+                    next = (last + bits.readSe() + 256) % 256;
+                    last = next == 0 ? last : next;
+                }
+            }
+        }
+    }
+    bits.readUe(); // log2_max_frame_num_minus4
+    uint32_t pocType = bits.readUe();
+    if (pocType == 0)
+    {
+        bits.readUe(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (pocType == 1)
+    {
+        bits.readBit(); // delta_pic_order_always_zero_flag
+        bits.readSe(); // offset_for_non_ref_pic
+        bits.readSe(); // offset_for_top_to_bottom_field
+        uint32_t cycle = bits.readUe();
+        for (uint32_t i = 0; i < cycle && !bits.overrun; ++i)
+        {
+            bits.readSe();
+        }
+    }
+    bits.readUe(); // max_num_ref_frames
+    bits.readBit(); // gaps_in_frame_num_value_allowed_flag
+    uint32_t widthMbs = bits.readUe() + 1;
+    uint32_t heightMapUnits = bits.readUe() + 1;
+    uint32_t frameMbsOnly = bits.readBit();
+    if (frameMbsOnly == 0)
+    {
+        bits.readBit(); // mb_adaptive_frame_field_flag
+    }
+    bits.readBit(); // direct_8x8_inference_flag
+    uint32_t cropLeft = 0;
+    uint32_t cropRight = 0;
+    uint32_t cropTop = 0;
+    uint32_t cropBottom = 0;
+    if (bits.readBit() != 0) // frame_cropping_flag
+    {
+        cropLeft = bits.readUe();
+        cropRight = bits.readUe();
+        cropTop = bits.readUe();
+        cropBottom = bits.readUe();
+    }
+    if (bits.overrun)
+    {
+        return false;
+    }
+
+    // Crop units depend on chroma subsampling and field coding.
+    bool monochrome = chromaFormat == 0 || separateColourPlane;
+    uint32_t cropUnitX = monochrome || chromaFormat == 3 ? 1 : 2;
+    uint32_t cropUnitY = (monochrome || chromaFormat != 1 ? 1 : 2) * (2 - frameMbsOnly);
+    width = static_cast<int>(widthMbs * 16 - cropUnitX * (cropLeft + cropRight));
+    height = static_cast<int>((2 - frameMbsOnly) * heightMapUnits * 16 - cropUnitY * (cropTop + cropBottom));
+    return true;
+}
+
+
+
+/**
+ * @brief Parse picture size of HEVC sequence parameter set.
+ * @param bits Reader of SPS payload after NAL unit header.
+ * @param width Picture width.
+ * @param height Picture height.
+ * @return TRUE if the size was parsed or FALSE.
+ */
+static bool parseHevcSps(NalBitReader& bits, int& width, int& height)
+{
+    bits.readBits(4); // sps_video_parameter_set_id
+    uint32_t maxSubLayers = bits.readBits(3);
+    bits.readBit(); // sps_temporal_id_nesting_flag
+
+    // profile_tier_level(): general profile (88 bits) and level (8 bits),
+    // then profile and level of sub-layers if present.
+    bits.readBits(32);
+    bits.readBits(32);
+    bits.readBits(32);
+    uint32_t subLayerFlags = 0;
+    for (uint32_t i = 0; i < maxSubLayers; ++i)
+    {
+        subLayerFlags = (subLayerFlags << 2) | bits.readBits(2);
+    }
+    if (maxSubLayers > 0)
+    {
+        bits.readBits(2 * (8 - static_cast<int>(maxSubLayers)));
+    }
+    for (uint32_t i = 0; i < maxSubLayers; ++i)
+    {
+        uint32_t flags = (subLayerFlags >> (2 * (maxSubLayers - 1 - i))) & 3;
+        if ((flags & 2) != 0)
+        {
+            bits.readBits(32);
+            bits.readBits(32);
+            bits.readBits(24);
+        }
+        if ((flags & 1) != 0)
+        {
+            bits.readBits(8);
+        }
+    }
+
+    bits.readUe(); // sps_seq_parameter_set_id
+    uint32_t chromaFormat = bits.readUe();
+    bool separateColourPlane = false;
+    if (chromaFormat == 3)
+    {
+        separateColourPlane = bits.readBit() != 0;
+    }
+    uint32_t picWidth = bits.readUe();
+    uint32_t picHeight = bits.readUe();
+    uint32_t cropLeft = 0;
+    uint32_t cropRight = 0;
+    uint32_t cropTop = 0;
+    uint32_t cropBottom = 0;
+    if (bits.readBit() != 0) // conformance_window_flag
+    {
+        cropLeft = bits.readUe();
+        cropRight = bits.readUe();
+        cropTop = bits.readUe();
+        cropBottom = bits.readUe();
+    }
+    if (bits.overrun)
+    {
+        return false;
+    }
+
+    bool monochrome = chromaFormat == 0 || separateColourPlane;
+    uint32_t cropUnitX = monochrome || chromaFormat == 3 ? 1 : 2;
+    uint32_t cropUnitY = monochrome || chromaFormat != 1 ? 1 : 2;
+    width = static_cast<int>(picWidth - cropUnitX * (cropLeft + cropRight));
+    height = static_cast<int>(picHeight - cropUnitY * (cropTop + cropBottom));
+    return true;
+}
+
+
+
+bool AnnexBReader::open(const std::string& path, bool hevc)
+{
+    if (!m_file.open(path))
+    {
+        return false;
+    }
+
+    const uint8_t* end = m_file.data() + m_file.size();
+    const uint8_t* start = findStartCode(m_file.data(), end);
+    if (start == end)
+    {
+        std::cout << "No Annex-B start code in " << path << std::endl;
+        m_file.close();
+        return false;
+    }
+
+    m_hevc = hevc;
+    if (!parseSize(start))
+    {
+        std::cout << "No valid sequence parameter set in " << path << std::endl;
+        m_file.close();
+        return false;
+    }
+
+    m_begin = static_cast<size_t>(start - m_file.data());
+    m_pos = m_begin;
+    return true;
+}
+
+bool AnnexBReader::parseSize(const uint8_t* start)
+{
+    const uint8_t* end = m_file.data() + m_file.size();
+    const uint8_t* nal = start;
+    while (nal != end)
+    {
+        const uint8_t* header = nal + 3;
+        const uint8_t* next = findStartCode(header, end);
+        int headerSize = m_hevc ? 2 : 1;
+        if (end - header > headerSize)
+        {
+            // The first SPS defines picture size of stream.
+            int type = m_hevc ? (header[0] >> 1) & 0x3f : header[0] & 0x1f;
+            if ((m_hevc && type == 33) || (!m_hevc && type == 7))
+            {
+                NalBitReader bits(header + headerSize, next);
+                int width = 0;
+                int height = 0;
+                bool parsed = m_hevc ? parseHevcSps(bits, width, height) : parseH264Sps(bits, width, height);
+                if (!parsed || width <= 0 || height <= 0)
+                {
+                    return false;
+                }
+                m_width = width;
+                m_height = height;
+                return true;
+            }
+        }
+        nal = next;
+    }
+
+    return false;
+}
+
+const uint8_t* AnnexBReader::next(int& size)
+{
+    const uint8_t* data = m_file.data();
+    const uint8_t* end = data + m_file.size();
+    const uint8_t* begin = data + m_pos;
+    if (begin >= end)
+    {
+        return nullptr;
+    }
+
+    // Access unit ends before the first non-VCL NAL unit which starts new
+    // access unit (AUD, parameter sets, SEI) or before the first slice of
+    // next picture.
+    bool hasSlice = false;
+    const uint8_t* auEnd = end;
+    const uint8_t* nal = findStartCode(begin, end);
+    while (nal != end)
+    {
+        const uint8_t* header = nal + 3;
+        if (end - header < 3)
+        {
+            break;
+        }
+
+        bool slice = false;
+        bool firstSlice = false;
+        bool prefix = false;
+        if (m_hevc)
+        {
+            int type = (header[0] >> 1) & 0x3f;
+            slice = type <= 31;
+            // first_slice_segment_in_pic_flag.
+            firstSlice = slice && (header[2] & 0x80) != 0;
+            prefix = (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) ||
+                     (type >= 48 && type <= 55);
+        }
+        else
+        {
+            int type = header[0] & 0x1f;
+            slice = type >= 1 && type <= 5;
+            // first_mb_in_slice is 0: ue(v) code is single bit 1.
+            firstSlice = slice && (header[1] & 0x80) != 0;
+            prefix = (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+        }
+
+        if (hasSlice && (prefix || firstSlice))
+        {
+            // Zero byte of 4-byte start code belongs to next access unit.
+            auEnd = nal > begin && nal[-1] == 0 ? nal - 1 : nal;
+            break;
+        }
+        hasSlice |= slice;
+        nal = findStartCode(header, end);
+    }
+
+    size = static_cast<int>(auEnd - begin);
+    m_pos = static_cast<size_t>(auEnd - data);
+    return begin;
+}
+
+void AnnexBReader::rewind()
+{
+    m_pos = m_begin;
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+
+
+/**
+ * @brief Read-only memory mapping of whole file. Pages are read by OS on first
+ * access, so reading a frame doesn't copy it to user buffer.
+ */
+class MappedFile
+{
+public:
+
+    /**
+     * @brief Class constructor.
+     */
+    MappedFile() = default;
+
+    /**
+     * @brief Class destructor. Unmaps file.
+     */
+    ~MappedFile();
+
+    /**
+     * @brief Mapped file is not copyable.
+     */
+    MappedFile(MappedFile&) = delete;
+    void operator=(MappedFile&) = delete;
+
+    /**
+     * @brief Map file. Previous file is unmapped.
+     * @param path File path.
+     * @return TRUE if the file was mapped or FALSE.
+     */
+    bool open(const std::string& path);
+
+    /**
+     * @brief Unmap file.
+     */
+    void close();
+
+    /**
+     * @brief Get mapped data.
+     * @return Pointer to the first byte of file or nullptr.
+     */
+    const uint8_t* data() const { return m_data; }
+
+    /**
+     * @brief Get file size.
+     * @return File size in bytes.
+     */
+    size_t size() const { return m_size; }
+
+private:
+
+    /// Mapped data.
+    const uint8_t* m_data{nullptr};
+    /// File size.
+    size_t m_size{0};
+#if defined(_WIN32)
+    /// File handle.
+    void* m_file{nullptr};
+    /// File mapping handle.
+    void* m_mapping{nullptr};
+#endif
+};
+
+
+
+/**
+ * @brief Reader of uncompressed I420 video: YUV4MPEG2 (Y4M) file or raw file
+ * of packed frames. Frames are returned as pointers to the mapping.
+ */
+class RawVideoReader
+{
+public:
+
+    /**
+     * @brief Open file. Y4M is detected by file signature.
+     * @param path File path.
+     * @param width Frame width of raw file. Ignored for Y4M.
+     * @param height Frame height of raw file. Ignored for Y4M.
+     * @return TRUE if the file was opened or FALSE.
+     */
+    bool open(const std::string& path, int width, int height);
+
+    /**
+     * @brief Get next frame.
+     * @return Pointer to I420 frame data (frameSize() bytes) or nullptr at
+     * the end of file.
+     */
+    const uint8_t* next();
+
+    /**
+     * @brief Restart reading from the first frame.
+     */
+    void rewind();
+
+    /// Frame width.
+    int width() const { return m_width; }
+    /// Frame height.
+    int height() const { return m_height; }
+    /// Frame size in bytes.
+    int frameSize() const { return m_width * m_height * 3 / 2; }
+    /// Frame rate of Y4M file or 0.
+    double fps() const { return m_fps; }
+    /// Input is Y4M file.
+    bool isY4m() const { return m_y4m; }
+    /// Mapped file.
+    const MappedFile& file() const { return m_file; }
+
+private:
+
+    /// Mapped file.
+    MappedFile m_file;
+    /// Offset of the first frame.
+    size_t m_begin{0};
+    /// Offset of next frame.
+    size_t m_pos{0};
+    /// Frame size.
+    int m_width{0};
+    int m_height{0};
+    /// Frame rate.
+    double m_fps{0.0};
+    /// Input is Y4M file.
+    bool m_y4m{false};
+
+    /**
+     * @brief Parse Y4M stream header.
+     * @return TRUE if the header is valid or FALSE.
+     */
+    bool parseY4mHeader();
+};
+
+
+
+/**
+ * @brief Reader of H264 / HEVC Annex-B elementary stream. Stream is split
+ * to access units (frames) by NAL unit headers, access units are returned as
+ * pointers to the mapping.
+ */
+class AnnexBReader
+{
+public:
+
+    /**
+     * @brief Open file.
+     * @param path File path.
+     * @param hevc TRUE - HEVC stream, FALSE - H264 stream.
+     * @return TRUE if the file was opened and has start code or FALSE.
+     */
+    bool open(const std::string& path, bool hevc);
+
+    /**
+     * @brief Get next access unit.
+     * @param size Size of access unit in bytes.
+     * @return Pointer to access unit data (starts with start code) or nullptr
+     * at the end of file.
+     */
+    const uint8_t* next(int& size);
+
+    /**
+     * @brief Restart reading from the first access unit.
+     */
+    void rewind();
+
+    /// Picture width of the first sequence parameter set.
+    int width() const { return m_width; }
+    /// Picture height of the first sequence parameter set.
+    int height() const { return m_height; }
+    /// Mapped file.
+    const MappedFile& file() const { return m_file; }
+
+private:
+
+    /// Mapped file.
+    MappedFile m_file;
+    /// Offset of the first start code.
+    size_t m_begin{0};
+    /// Offset of next access unit.
+    size_t m_pos{0};
+    /// Picture size (cropped).
+    int m_width{0};
+    int m_height{0};
+    /// Stream is HEVC.
+    bool m_hevc{false};
+
+    /**
+     * @brief Find the first sequence parameter set and read picture size.
+     * @param start The first start code of stream.
+     * @return TRUE if the picture size was read or FALSE.
+     */
+    bool parseSize(const uint8_t* start);
+};
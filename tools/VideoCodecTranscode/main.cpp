@@ -0,0 +1,784 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "VideoCodec.h"
+#include "VideoCodecBatchEncoder.h"
+#include "InputStream.h"
+
+
+
+/// Buffer size of output file.
+static const size_t g_outputBufferSize = 4 * 1024 * 1024;
+
+
+
+/// Command line options.
+struct Options
+{
+    /// Input file.
+    std::string input;
+    /// Output file. Empty - output is not written.
+    std::string output;
+    /// Input format: y4m, yuv, h264 or hevc.
+    std::string inputFormat;
+    /// Output format: h264, hevc, mjpeg, y4m or yuv.
+    std::string outputFormat;
+    /// Frame size of raw input.
+    int width{0};
+    int height{0};
+    /// Frame rate of Y4M output.
+    double fps{0.0};
+    /// Max number of frames per pass. 0 - all frames.
+    int maxFrames{0};
+    /// Number of passes over input.
+    int loops{1};
+    /// Batch encoding of raw input by closed GOP segments in parallel.
+    bool batch{false};
+    /// Number of batch encoder threads. 0 - number of CPU cores.
+    int batchThreads{0};
+    /// Codec params.
+    std::vector<std::pair<VideoCodecParam, float>> params;
+};
+
+
+
+/// Codec param names for -P option.
+static const std::pair<const char*, VideoCodecParam> g_paramNames[] =
+{
+    {"THREAD_MODE", VideoCodecParam::THREAD_MODE},
+    {"NUM_THREADS", VideoCodecParam::NUM_THREADS},
+    {"PRESET", VideoCodecParam::PRESET},
+    {"ZERO_LATENCY", VideoCodecParam::ZERO_LATENCY},
+    {"B_FRAMES", VideoCodecParam::B_FRAMES},
+    {"LOOKAHEAD", VideoCodecParam::LOOKAHEAD},
+    {"MB_TREE", VideoCodecParam::MB_TREE},
+    {"DECODER_THREADS", VideoCodecParam::DECODER_THREADS},
+    {"DECODER_THREAD_TYPE", VideoCodecParam::DECODER_THREAD_TYPE},
+    {"JPEG_QUALITY", VideoCodecParam::JPEG_QUALITY},
+    {"JPEG_FAST_DCT", VideoCodecParam::JPEG_FAST_DCT},
+    {"JPEG_OPTIMIZE_CODING", VideoCodecParam::JPEG_OPTIMIZE_CODING},
+    {"JPEG_SUBSAMPLING", VideoCodecParam::JPEG_SUBSAMPLING},
+    {"JPEG_THREADS", VideoCodecParam::JPEG_THREADS},
+    {"RATE_CONTROL", VideoCodecParam::RATE_CONTROL},
+    {"BITRATE", VideoCodecParam::BITRATE},
+    {"MAX_BITRATE", VideoCodecParam::MAX_BITRATE},
+    {"VBV_BUFFER_SIZE", VideoCodecParam::VBV_BUFFER_SIZE},
+    {"CRF", VideoCodecParam::CRF},
+    {"GOP_SIZE", VideoCodecParam::GOP_SIZE},
+    {"ADAPTIVE_PRESET", VideoCodecParam::ADAPTIVE_PRESET},
+    {"ADAPTIVE_MAX_PRESET", VideoCodecParam::ADAPTIVE_MAX_PRESET},
+    {"FRAME_BUDGET_MS", VideoCodecParam::FRAME_BUDGET_MS},
+    {"SLICES", VideoCodecParam::SLICES},
+    {"INTRA_REFRESH", VideoCodecParam::INTRA_REFRESH},
+    {"DECODER_SKIP_FRAME", VideoCodecParam::DECODER_SKIP_FRAME},
+    {"DECODER_SKIP_LOOP_FILTER", VideoCodecParam::DECODER_SKIP_LOOP_FILTER},
+    {"DECODER_SKIP_IDCT", VideoCodecParam::DECODER_SKIP_IDCT},
+    {"DECODER_FAST", VideoCodecParam::DECODER_FAST},
+    {"DECODER_KEY_FRAMES_ONLY", VideoCodecParam::DECODER_KEY_FRAMES_ONLY},
+};
+
+
+
+/// Buffered output file. Without path data is only counted.
+class OutputFile
+{
+public:
+
+    ~OutputFile()
+    {
+        close();
+    }
+
+    bool open(const std::string& path)
+    {
+        if (path.empty())
+        {
+            return true;
+        }
+        m_file = fopen(path.c_str(), "wb");
+        if (m_file == nullptr)
+        {
+            std::cout << "Can't create file " << path << std::endl;
+            return false;
+        }
+        setvbuf(m_file, nullptr, _IOFBF, g_outputBufferSize);
+        return true;
+    }
+
+    bool write(const void* data, size_t size)
+    {
+        bytes += size;
+        return m_file == nullptr || fwrite(data, 1, size, m_file) == size;
+    }
+
+    bool close()
+    {
+        bool result = m_file == nullptr || fclose(m_file) == 0;
+        m_file = nullptr;
+        return result;
+    }
+
+    /// Number of written bytes.
+    uint64_t bytes{0};
+
+private:
+
+    /// File.
+    FILE* m_file{nullptr};
+};
+
+
+
+/// Processing counters.
+struct Counters
+{
+    /// Number of input frames or access units.
+    uint64_t inputFrames{0};
+    /// Number of input bytes.
+    uint64_t inputBytes{0};
+    /// Number of decoded frames.
+    uint64_t decodedFrames{0};
+    /// Number of encoded packets.
+    uint64_t encodedFrames{0};
+    /// Decoding time, seconds.
+    double decodeTime{0.0};
+    /// Encoding time, seconds.
+    double encodeTime{0.0};
+    /// Number of failed encode / decode calls and write errors.
+    int errors{0};
+};
+
+
+
+/// Seconds since time point.
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/// Lower case extension of file name without dot.
+static std::string extension(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find_first_of("/\\", dot) != std::string::npos)
+    {
+        return "";
+    }
+    std::string result = path.substr(dot + 1);
+    std::transform(result.begin(), result.end(), result.begin(),
+                   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return result;
+}
+
+
+
+/// Normalized format name of file extension or format option.
+static std::string formatName(const std::string& name)
+{
+    if (name == "264" || name == "h264" || name == "avc")
+    {
+        return "h264";
+    }
+    if (name == "265" || name == "h265" || name == "hevc")
+    {
+        return "hevc";
+    }
+    if (name == "mjpeg" || name == "mjpg" || name == "jpeg" || name == "jpg")
+    {
+        return "mjpeg";
+    }
+    if (name == "y4m" || name == "yuv")
+    {
+        return name;
+    }
+    return "";
+}
+
+
+
+/// Codec type of compressed format.
+static cr::video::Fourcc formatFourcc(const std::string& format)
+{
+    if (format == "h264")
+    {
+        return cr::video::Fourcc::H264;
+    }
+    if (format == "hevc")
+    {
+        return cr::video::Fourcc::HEVC;
+    }
+    return cr::video::Fourcc::JPEG;
+}
+
+
+
+/// Write encoded NAL units of packet.
+static void writeNals(const std::vector<VideoCodecNal>& nals, OutputFile& output, Counters& counters)
+{
+    if (nals.empty())
+    {
+        return;
+    }
+    for (const VideoCodecNal& nal : nals)
+    {
+        if (!output.write(nal.data, static_cast<size_t>(nal.size)))
+        {
+            ++counters.errors;
+        }
+    }
+    ++counters.encodedFrames;
+}
+
+
+
+/// Write Y4M stream header before the first frame.
+static void writeY4mHeader(OutputFile& output, int width, int height, double fps)
+{
+    int numerator = static_cast<int>(fps * 1000.0 + 0.5);
+    int denominator = 1000;
+    if (numerator % 1000 == 0)
+    {
+        numerator /= 1000;
+        denominator = 1;
+    }
+    std::ostringstream header;
+    header << "YUV4MPEG2 W" << width << " H" << height << " F" << numerator << ":" << denominator
+           << " Ip A1:1 C420jpeg\n";
+    output.write(header.str().data(), header.str().size());
+}
+
+
+
+/// Write decoded picture planes row by row without intermediate frame.
+static bool writePicture(const VideoCodecPicture& picture, const Options& options,
+                         OutputFile& output, bool& headerWritten)
+{
+    if (picture.pixelFormat() != AV_PIX_FMT_YUV420P && picture.pixelFormat() != AV_PIX_FMT_YUVJ420P)
+    {
+        std::cout << "Unsupported decoded pixel format " << picture.pixelFormat() << std::endl;
+        return false;
+    }
+
+    bool y4m = options.outputFormat == "y4m";
+    if (y4m && !headerWritten)
+    {
+        writeY4mHeader(output, picture.width(), picture.height(), options.fps);
+        headerWritten = true;
+    }
+    if (y4m && !output.write("FRAME\n", 6))
+    {
+        return false;
+    }
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        int width = plane == 0 ? picture.width() : (picture.width() + 1) / 2;
+        int height = plane == 0 ? picture.height() : (picture.height() + 1) / 2;
+        for (int row = 0; row < height; ++row)
+        {
+            if (!output.write(picture.data(plane) + row * picture.stride(plane), static_cast<size_t>(width)))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+/**
+ * @brief Encode Y4M or raw I420 input. Frames of input mapping are copied to
+ * single source frame allocated once.
+ */
+static void encodeRaw(RawVideoReader& reader, const Options& options, VideoCodec& encoder,
+                      OutputFile& output, Counters& counters)
+{
+    cr::video::Fourcc fourcc = formatFourcc(options.outputFormat);
+    std::vector<VideoCodecNal> nals;
+    cr::video::Frame frame(reader.width(), reader.height(), cr::video::Fourcc::YU12, reader.frameSize());
+    uint32_t frameId = 0;
+    for (int loop = 0; loop < options.loops; ++loop)
+    {
+        reader.rewind();
+        for (int i = 0; options.maxFrames == 0 || i < options.maxFrames; ++i)
+        {
+            const uint8_t* data = reader.next();
+            if (data == nullptr)
+            {
+                break;
+            }
+
+            // Frame owns its data, so frame of mapping is copied once.
+            memcpy(frame.data, data, static_cast<size_t>(reader.frameSize()));
+            frame.frameId = frameId++;
+            ++counters.inputFrames;
+            counters.inputBytes += static_cast<uint64_t>(reader.frameSize());
+
+            auto start = std::chrono::steady_clock::now();
+            bool result = encoder.encode(frame, fourcc, nals);
+            counters.encodeTime += elapsed(start);
+            if (!result)
+            {
+                ++counters.errors;
+                continue;
+            }
+            writeNals(nals, output, counters);
+        }
+    }
+
+    // Drain delayed frames of encoder.
+    auto start = std::chrono::steady_clock::now();
+    cr::video::Frame packet;
+    encoder.flush();
+    while (encoder.receivePacket(packet))
+    {
+        if (!output.write(packet.data, static_cast<size_t>(packet.size)))
+        {
+            ++counters.errors;
+        }
+        ++counters.encodedFrames;
+    }
+    counters.encodeTime += elapsed(start);
+}
+
+
+
+/**
+ * @brief Encode Y4M or raw I420 input by batch encoder. Segments are encoded
+ * in parallel, packets are written by separate thread in stream order.
+ */
+static void encodeRawBatch(RawVideoReader& reader, const Options& options, OutputFile& output, Counters& counters)
+{
+    VideoCodecBatchEncoder encoder(options.batchThreads);
+    for (const auto& param : options.params)
+    {
+        encoder.setParam(param.first, param.second);
+    }
+
+    // Batch encoder waits for free segments, so packets are received while
+    // frames are submitted.
+    std::thread writer([&encoder, &output, &counters]
+    {
+        cr::video::Frame packet;
+        while (encoder.receivePacket(packet))
+        {
+            if (!output.write(packet.data, static_cast<size_t>(packet.size)))
+            {
+                ++counters.errors;
+            }
+            ++counters.encodedFrames;
+        }
+    });
+
+    cr::video::Fourcc fourcc = formatFourcc(options.outputFormat);
+    cr::video::Frame frame(reader.width(), reader.height(), cr::video::Fourcc::YU12, reader.frameSize());
+    uint32_t frameId = 0;
+    int errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int loop = 0; loop < options.loops; ++loop)
+    {
+        reader.rewind();
+        for (int i = 0; options.maxFrames == 0 || i < options.maxFrames; ++i)
+        {
+            const uint8_t* data = reader.next();
+            if (data == nullptr)
+            {
+                break;
+            }
+
+            // Frame is copied to segment by batch encoder, so source frame
+            // is reused.
+            memcpy(frame.data, data, static_cast<size_t>(reader.frameSize()));
+            frame.frameId = frameId++;
+            ++counters.inputFrames;
+            counters.inputBytes += static_cast<uint64_t>(reader.frameSize());
+            if (!encoder.submitFrame(frame, fourcc))
+            {
+                ++errors;
+            }
+        }
+    }
+    encoder.flush();
+    writer.join();
+    counters.encodeTime += elapsed(start);
+    // Frames failed to encode by segment encoders have no packets.
+    counters.errors += errors + static_cast<int>(encoder.getNumErrors());
+
+    std::cout << "Batch: " << encoder.getNumSegments() << " segments" << std::endl;
+}
+
+
+
+/**
+ * @brief Decode Annex-B input and write raw video or encode again. Access
+ * units of input mapping are copied to one frame which is re-allocated only
+ * for larger access unit.
+ */
+static void decodeAnnexB(AnnexBReader& reader, cr::video::Fourcc fourcc, const Options& options,
+                         VideoCodec& decoder, VideoCodec& encoder, OutputFile& output, Counters& counters)
+{
+    bool transcode = options.outputFormat != "y4m" && options.outputFormat != "yuv";
+    cr::video::Fourcc encoderFourcc = formatFourcc(options.outputFormat);
+    cr::video::Frame decoded(reader.width(), reader.height(), cr::video::Fourcc::YU12);
+    cr::video::Frame accessUnit;
+    int accessUnitCapacity = 0;
+    VideoCodecPicture picture;
+    std::vector<VideoCodecNal> nals;
+    bool headerWritten = false;
+
+    // Writes or encodes frame after successful decode() / receiveFrame().
+    auto process = [&]()
+    {
+        ++counters.decodedFrames;
+        if (!transcode)
+        {
+            if (!writePicture(picture, options, output, headerWritten))
+            {
+                ++counters.errors;
+            }
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bool result = encoder.encode(decoded, encoderFourcc, nals);
+        counters.encodeTime += elapsed(start);
+        if (!result)
+        {
+            ++counters.errors;
+            return;
+        }
+        writeNals(nals, output, counters);
+    };
+    auto decode = [&](cr::video::Frame* packet)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool result = false;
+        if (packet != nullptr)
+        {
+            result = transcode ? decoder.decode(*packet, decoded) : decoder.decode(*packet, picture);
+        }
+        else
+        {
+            result = transcode ? decoder.receiveFrame(decoded) : decoder.receiveFrame(picture);
+        }
+        counters.decodeTime += elapsed(start);
+        return result;
+    };
+
+    for (int loop = 0; loop < options.loops; ++loop)
+    {
+        reader.rewind();
+        for (int i = 0; options.maxFrames == 0 || i < options.maxFrames; ++i)
+        {
+            int size = 0;
+            const uint8_t* data = reader.next(size);
+            if (data == nullptr)
+            {
+                break;
+            }
+
+            // Frame size field is overwritten by size of access unit, so
+            // allocated size is kept.
+            if (size > accessUnitCapacity)
+            {
+                accessUnit.release();
+                accessUnit = cr::video::Frame(reader.width(), reader.height(), fourcc, size);
+                accessUnitCapacity = size;
+            }
+            memcpy(accessUnit.data, data, static_cast<size_t>(size));
+            accessUnit.size = size;
+            accessUnit.frameId = static_cast<uint32_t>(counters.inputFrames);
+            ++counters.inputFrames;
+            counters.inputBytes += static_cast<uint64_t>(size);
+
+            if (decode(&accessUnit))
+            {
+                process();
+            }
+            while (decode(nullptr))
+            {
+                process();
+            }
+        }
+
+        // Next pass starts new stream.
+        if (decoder.flushDecoder())
+        {
+            while (decode(nullptr))
+            {
+                process();
+            }
+        }
+    }
+
+    if (!transcode)
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    cr::video::Frame packet;
+    encoder.flush();
+    while (encoder.receivePacket(packet))
+    {
+        if (!output.write(packet.data, static_cast<size_t>(packet.size)))
+        {
+            ++counters.errors;
+        }
+        ++counters.encodedFrames;
+    }
+    counters.encodeTime += elapsed(start);
+}
+
+
+
+/// Print throughput line of processing stage.
+static void printStage(const char* name, uint64_t frames, double time)
+{
+    std::cout << std::setw(8) << name << ": " << frames << " frames, " << std::fixed
+              << std::setprecision(3) << time << " s, " << std::setprecision(1)
+              << (time > 0.0 ? frames / time : 0.0) << " fps, " << std::setprecision(3)
+              << (frames > 0 ? time * 1000.0 / frames : 0.0) << " ms/frame" << std::endl;
+}
+
+
+
+/// Print command line usage.
+static void printUsage()
+{
+    std::cout << "Usage: videocodec-transcode -i INPUT [-o OUTPUT] [options]" << std::endl
+              << "  -i FILE        input: Y4M, raw I420 (.yuv) or Annex-B H264 / HEVC" << std::endl
+              << "  -o FILE        output: H264, HEVC, MJPEG (concatenated JPEG), Y4M or raw I420" << std::endl
+              << "  -f FORMAT      input format: y4m, yuv, h264, hevc (default: file extension)" << std::endl
+              << "  -c FORMAT      output format: h264, hevc, mjpeg, y4m, yuv (default: file extension)" << std::endl
+              << "  -s WxH         frame size of raw input" << std::endl
+              << "  -r FPS         frame rate of Y4M output (default: 30)" << std::endl
+              << "  -n FRAMES      max number of frames per pass" << std::endl
+              << "  -l LOOPS       number of passes over input (input stays in page cache)" << std::endl
+              << "  -b BITRATE     encoder bitrate, bps" << std::endl
+              << "  -g GOP         encoder GOP size" << std::endl
+              << "  -j THREADS     batch encoding of raw input by closed GOP segments in parallel" << std::endl
+              << "                 (0 - number of CPU cores)" << std::endl
+              << "  -P NAME=VALUE  codec param, e.g. -P PRESET=0 -P JPEG_QUALITY=90" << std::endl;
+}
+
+
+
+/// Parse command line. Returns FALSE on invalid options.
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option.size() != 2 || option[0] != '-' || i + 1 >= argc)
+        {
+            std::cout << "Invalid option " << option << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        switch (option[1])
+        {
+        case 'i':
+            options.input = value;
+            break;
+        case 'o':
+            options.output = value;
+            break;
+        case 'f':
+            options.inputFormat = formatName(value);
+            break;
+        case 'c':
+            options.outputFormat = formatName(value);
+            break;
+        case 's':
+        {
+            char separator = 0;
+            std::istringstream size(value);
+            if (!(size >> options.width >> separator >> options.height) || separator != 'x')
+            {
+                std::cout << "Invalid frame size " << value << ", expected WIDTHxHEIGHT" << std::endl;
+                return false;
+            }
+            break;
+        }
+        case 'r':
+            options.fps = atof(value.c_str());
+            break;
+        case 'n':
+            options.maxFrames = std::max(0, atoi(value.c_str()));
+            break;
+        case 'l':
+            options.loops = std::max(1, atoi(value.c_str()));
+            break;
+        case 'b':
+            options.params.push_back({VideoCodecParam::BITRATE, static_cast<float>(atof(value.c_str()))});
+            break;
+        case 'g':
+            options.params.push_back({VideoCodecParam::GOP_SIZE, static_cast<float>(atof(value.c_str()))});
+            break;
+        case 'j':
+            options.batch = true;
+            options.batchThreads = std::max(0, atoi(value.c_str()));
+            break;
+        case 'P':
+        {
+            size_t separator = value.find('=');
+            std::string name = value.substr(0, separator);
+            auto param = std::find_if(std::begin(g_paramNames), std::end(g_paramNames),
+                                      [&name](const std::pair<const char*, VideoCodecParam>& item)
+                                      { return name == item.first; });
+            if (separator == std::string::npos || param == std::end(g_paramNames))
+            {
+                std::cout << "Invalid codec param " << value << std::endl;
+                return false;
+            }
+            options.params.push_back({param->second, static_cast<float>(atof(value.c_str() + separator + 1))});
+            break;
+        }
+        default:
+            std::cout << "Invalid option " << option << std::endl;
+            return false;
+        }
+    }
+
+    if (options.input.empty())
+    {
+        return false;
+    }
+    if (options.inputFormat.empty())
+    {
+        options.inputFormat = formatName(extension(options.input));
+    }
+    if (options.outputFormat.empty() && !options.output.empty())
+    {
+        options.outputFormat = formatName(extension(options.output));
+    }
+    if (options.inputFormat.empty() || options.inputFormat == "mjpeg")
+    {
+        std::cout << "Unknown input format, use -f y4m|yuv|h264|hevc" << std::endl;
+        return false;
+    }
+    bool rawInput = options.inputFormat == "y4m" || options.inputFormat == "yuv";
+    if (rawInput && (options.outputFormat.empty() || options.outputFormat == "y4m" || options.outputFormat == "yuv"))
+    {
+        std::cout << "Output codec is not set for raw input, use -c h264|hevc|mjpeg" << std::endl;
+        return false;
+    }
+    if (!rawInput && options.outputFormat.empty())
+    {
+        options.outputFormat = "yuv";
+    }
+
+    return true;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::cout << "VideoCodec transcode v" << VideoCodec::getVersion() << std::endl;
+
+    VideoCodec decoder;
+    VideoCodec encoder;
+    for (const auto& param : options.params)
+    {
+        // Encoder params don't change decoder and vice versa.
+        if (!encoder.setParam(param.first, param.second) || !decoder.setParam(param.first, param.second))
+        {
+            std::cout << "Invalid value " << param.second << " of codec param "
+                      << static_cast<int>(param.first) << std::endl;
+            return 1;
+        }
+    }
+
+    OutputFile output;
+    if (!output.open(options.output))
+    {
+        return 1;
+    }
+
+    Counters counters;
+    uint64_t inputSize = 0;
+    auto start = std::chrono::steady_clock::now();
+    if (options.inputFormat == "y4m" || options.inputFormat == "yuv")
+    {
+        RawVideoReader reader;
+        if (!reader.open(options.input, options.width, options.height))
+        {
+            return 1;
+        }
+        inputSize = reader.file().size();
+        std::cout << "Input: " << options.input << " " << (reader.isY4m() ? "Y4M" : "raw I420") << " "
+                  << reader.width() << "x" << reader.height() << std::endl;
+        if (options.batch)
+        {
+            encodeRawBatch(reader, options, output, counters);
+        }
+        else
+        {
+            encodeRaw(reader, options, encoder, output, counters);
+        }
+    }
+    else
+    {
+        AnnexBReader reader;
+        if (!reader.open(options.input, options.inputFormat == "hevc"))
+        {
+            return 1;
+        }
+        inputSize = reader.file().size();
+        if (options.fps <= 0.0)
+        {
+            options.fps = 30.0;
+        }
+        std::cout << "Input: " << options.input << " " << (options.inputFormat == "hevc" ? "HEVC" : "H264")
+                  << " Annex-B" << std::endl;
+        decodeAnnexB(reader, formatFourcc(options.inputFormat), options, decoder, encoder, output, counters);
+    }
+    if (!output.close())
+    {
+        std::cout << "Can't write output file" << std::endl;
+        ++counters.errors;
+    }
+    double total = elapsed(start);
+
+    std::cout << "Output: " << (options.output.empty() ? "not written" : options.output) << " "
+              << options.outputFormat << std::endl;
+    if (counters.decodeTime > 0.0 || counters.decodedFrames > 0)
+    {
+        printStage("decode", counters.decodedFrames, counters.decodeTime);
+    }
+    if (counters.encodeTime > 0.0 || counters.encodedFrames > 0)
+    {
+        printStage("encode", counters.encodedFrames, counters.encodeTime);
+    }
+    printStage("total", counters.inputFrames, total);
+    std::cout << std::setprecision(1) << "   input: " << counters.inputBytes / 1e6 << " MB (file "
+              << inputSize / 1e6 << " MB), " << (total > 0.0 ? counters.inputBytes / 1e6 / total : 0.0)
+              << " MB/s" << std::endl
+              << "  output: " << output.bytes / 1e6 << " MB, " << (total > 0.0 ? output.bytes / 1e6 / total : 0.0)
+              << " MB/s" << std::endl;
+    if (counters.errors > 0)
+    {
+        std::cout << "  ERRORS: " << counters.errors << std::endl;
+    }
+
+    return counters.errors > 0 ? 1 : 0;
+}